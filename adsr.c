@@ -180,6 +180,91 @@ ADSR_OBJ *adsr_alloc(
   return pa;
 }
 
+/*
+ * adsr_raw function.
+ */
+ADSR_OBJ *adsr_raw(
+    int32_t attack,
+    int32_t decay,
+    int32_t sustain,
+    int32_t release) {
+  
+  ADSR_OBJ *pa = NULL;
+  
+  /* Check parameters */
+  if (!adsr_check(attack, decay, sustain, release)) {
+    abort();
+  }
+  
+  /* Allocate object */
+  pa = (ADSR_OBJ *) malloc(sizeof(ADSR_OBJ));
+  if (pa == NULL) {
+    abort();
+  }
+  memset(pa, 0, sizeof(ADSR_OBJ));
+  
+  /* Set variables */
+  pa->refcount = 1;
+  pa->attack = attack;
+  pa->decay = decay;
+  pa->sustain = sustain;
+  pa->release = release;
+  
+  /* Return object */
+  return pa;
+}
+
+/*
+ * adsr_check function.
+ */
+int adsr_check(
+    int32_t attack,
+    int32_t decay,
+    int32_t sustain,
+    int32_t release) {
+  
+  int result = 1;
+  
+  if ((attack < 0) || (attack > ADSR_MAXTIME) ||
+      (decay < 0) || (decay > ADSR_MAXTIME) ||
+      (sustain < 0) || (sustain > MAX_FRAC) ||
+      (release < 0) || (release > ADSR_MAXTIME)) {
+    result = 0;
+  }
+  
+  return result;
+}
+
+/*
+ * adsr_samples function.
+ */
+void adsr_samples(
+    ADSR_OBJ * pa,
+    int32_t  * pAttack,
+    int32_t  * pDecay,
+    int32_t  * pSustain,
+    int32_t  * pRelease) {
+  
+  /* Check parameters */
+  if (pa == NULL) {
+    abort();
+  }
+  
+  /* Write requested values */
+  if (pAttack != NULL) {
+    *pAttack = pa->attack;
+  }
+  if (pDecay != NULL) {
+    *pDecay = pa->decay;
+  }
+  if (pSustain != NULL) {
+    *pSustain = pa->sustain;
+  }
+  if (pRelease != NULL) {
+    *pRelease = pa->release;
+  }
+}
+
 /*
  * adsr_addref function.
  */
@@ -208,35 +293,26 @@ void adsr_release(ADSR_OBJ *pa) {
 /*
  * adsr_length function.
  */
-int32_t adsr_length(ADSR_OBJ *pa, int32_t dur) {
-  
-  int64_t d = 0;
+int64_t adsr_length(ADSR_OBJ *pa, int64_t dur) {
   
   /* Check parameters */
-  if ((pa == NULL) || (dur < 1)) {
+  if ((pa == NULL) || (dur < 1) || (dur > MAX_TIME)) {
     abort();
   }
   
-  /* The duration is dur plus any release samples */
-  d = ((int64_t) dur) + ((int64_t) pa->release);
-  
-  /* Truncate to signed 32-bit integer length if necessary */
-  if (d > INT32_MAX) {
-    d = INT32_MAX;
-  }
-  
-  /* Return the computed duration */
-  return (int32_t) d;
+  /* The duration is dur plus any release samples, which can't overflow
+   * since dur is limited to MAX_TIME */
+  return dur + ((int64_t) pa->release);
 }
 
 /*
  * adsr_compute function.
  */
-int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur) {
+int32_t adsr_compute(ADSR_OBJ *pa, int64_t t, int64_t dur) {
   
   int32_t mv = 0;
-  int32_t offset = 0;
   int32_t scale = 0;
+  int64_t offset = 0;
   
   /* Check parameters */
   if (pa == NULL) {
@@ -265,7 +341,7 @@ int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur) {
     
       /* Compute the envelope multiplier */
       mv = (int32_t)
-            ((((int64_t) (pa->release - offset)) * ((int64_t) scale)) /
+            (((((int64_t) pa->release) - offset) * ((int64_t) scale)) /
               ((int64_t) pa->release));
     }
   
@@ -274,7 +350,7 @@ int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur) {
     offset = t;
     
     /* Compute the envelope multiplier */
-    mv = (int32_t) ((((int64_t) offset) * ((int64_t) MAX_FRAC)) /
+    mv = (int32_t) ((offset * ((int64_t) MAX_FRAC)) /
                       ((int64_t) pa->attack));
     
   } else if (t < pa->attack + pa->decay) {
@@ -282,7 +358,7 @@ int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur) {
     offset = t - pa->attack;
     
     /* Compute the envelope multiplier */
-    mv = (int32_t) (((((int64_t) (pa->decay - offset)) *
+    mv = (int32_t) ((((((int64_t) pa->decay) - offset) *
                       ((int64_t) (MAX_FRAC - pa->sustain))) /
                     ((int64_t) pa->decay)) + pa->sustain);
     
@@ -295,13 +371,101 @@ int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur) {
   return mv;
 }
 
+/*
+ * adsr_ctlreset function.
+ */
+void adsr_ctlreset(ADSR_CTL *pc, int32_t period) {
+  
+  /* Check parameters */
+  if ((pc == NULL) || (period < 1) || (period > CONTROL_MAX)) {
+    abort();
+  }
+  
+  /* Reset the state */
+  memset(pc, 0, sizeof(ADSR_CTL));
+  pc->t0 = -1;
+  pc->period = period;
+}
+
+/*
+ * adsr_ctl function.
+ */
+int32_t adsr_ctl(ADSR_OBJ *pa, int64_t t, int64_t dur, ADSR_CTL *pc) {
+  
+  int32_t mv = 0;
+  
+  /* Check parameters */
+  if ((pa == NULL) || (pc == NULL)) {
+    abort();
+  }
+  if ((t < 0) || (dur < 1)) {
+    abort();
+  }
+  
+  /* Compute exactly if there is no control period, or if the end of the
+   * control period would overflow */
+  if ((pc->period <= 1) || (t > INT64_MAX - pc->period)) {
+    mv = adsr_compute(pa, t, dur);
+    
+  } else {
+    /* Compute the envelope at both ends of the control period that
+     * contains t, if not already done */
+    if ((pc->t0 < 0) || (t < pc->t0) ||
+        (t - pc->t0 >= pc->period)) {
+      pc->t0 = t - (t % pc->period);
+      pc->a0 = adsr_compute(pa, pc->t0, dur);
+      pc->a1 = adsr_compute(pa, pc->t0 + pc->period, dur);
+    }
+    
+    /* Interpolate */
+    mv = pc->a0 + (((pc->a1 - pc->a0) * ((int32_t) (t - pc->t0))) /
+                    pc->period);
+  }
+  
+  /* Return the multiplier value */
+  return mv;
+}
+
+/*
+ * adsr_peak function.
+ */
+int32_t adsr_peak(ADSR_OBJ *pa, int64_t t, int64_t dur) {
+  
+  int32_t mv = 0;
+  
+  /* Check parameters */
+  if (pa == NULL) {
+    abort();
+  }
+  if ((t < 0) || (dur < 1)) {
+    abort();
+  }
+  
+  /* Determine the bound depending on where in the envelope we are */
+  if (t >= dur) {
+    /* Releasing, and the release only falls from here */
+    mv = adsr_compute(pa, t, dur);
+    
+  } else if (t < pa->attack + pa->decay) {
+    /* Attack or decay still to come, so the peak may still be ahead */
+    mv = MAX_FRAC;
+    
+  } else {
+    /* Sustaining, and the release never rises above the sustain */
+    mv = pa->sustain;
+  }
+  
+  /* Return the bound */
+  return mv;
+}
+
 /*
  * adsr_mul function.
  */
 int16_t adsr_mul(
     ADSR_OBJ * pa,
-    int32_t    t,
-    int32_t    dur,
+    int64_t    t,
+    int64_t    dur,
     int16_t    s) {
   
   int32_t mv = 0;
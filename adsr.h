@@ -25,6 +25,34 @@
 struct ADSR_OBJ_TAG;
 typedef struct ADSR_OBJ_TAG ADSR_OBJ;
 
+/*
+ * Control-rate state for computing an envelope with adsr_ctl().
+ * 
+ * Use adsr_ctlreset() to initialize.  Clients should not directly
+ * access the internals of this structure.
+ */
+typedef struct {
+  
+  /*
+   * The t offset at the start of the current control period, or -1 if
+   * there is no current control period.
+   */
+  int64_t t0;
+  
+  /*
+   * The envelope multipliers at the start and end of the current
+   * control period.
+   */
+  int32_t a0;
+  int32_t a1;
+  
+  /*
+   * The control period in samples.
+   */
+  int32_t period;
+  
+} ADSR_CTL;
+
 /*
  * Create an ADSR envelope object.
  * 
@@ -65,6 +93,87 @@ ADSR_OBJ *adsr_alloc(
     double       t_release,
     int32_t      rate);
 
+/*
+ * Create an ADSR envelope object directly from sample counts.
+ * 
+ * This is the inverse of adsr_samples(), and is intended for restoring
+ * envelopes that were saved in a binary form.  attack, decay, and
+ * release are durations in samples, which must be in range
+ * [0, ADSR_MAXTIME].  sustain is the sustain level, which must be in
+ * range [0, MAX_FRAC].  A fault occurs if any value is out of range.
+ * Use adsr_check() first to validate untrusted values.
+ * 
+ * The returned object starts out with a reference count of one.
+ * 
+ * Parameters:
+ * 
+ *   attack - the attack duration, in samples
+ * 
+ *   decay - the decay duration, in samples
+ * 
+ *   sustain - the sustain level
+ * 
+ *   release - the release duration, in samples
+ * 
+ * Return:
+ * 
+ *   the new ADSR envelope object
+ */
+ADSR_OBJ *adsr_raw(
+    int32_t attack,
+    int32_t decay,
+    int32_t sustain,
+    int32_t release);
+
+/*
+ * Check whether the given sample counts are valid for adsr_raw().
+ * 
+ * Parameters:
+ * 
+ *   attack - the attack duration, in samples
+ * 
+ *   decay - the decay duration, in samples
+ * 
+ *   sustain - the sustain level
+ * 
+ *   release - the release duration, in samples
+ * 
+ * Return:
+ * 
+ *   non-zero if valid, zero if not
+ */
+int adsr_check(
+    int32_t attack,
+    int32_t decay,
+    int32_t sustain,
+    int32_t release);
+
+/*
+ * Get the sample counts of an ADSR envelope object.
+ * 
+ * The values returned here can be passed to adsr_raw() to create an
+ * identical envelope.  Any of the pointers may be NULL if that value is
+ * not needed.
+ * 
+ * Parameters:
+ * 
+ *   pa - the ADSR envelope object
+ * 
+ *   pAttack - variable to receive the attack duration, in samples
+ * 
+ *   pDecay - variable to receive the decay duration, in samples
+ * 
+ *   pSustain - variable to receive the sustain level
+ * 
+ *   pRelease - variable to receive the release duration, in samples
+ */
+void adsr_samples(
+    ADSR_OBJ * pa,
+    int32_t  * pAttack,
+    int32_t  * pDecay,
+    int32_t  * pSustain,
+    int32_t  * pRelease);
+
 /*
  * Add a reference to the given ADSR envelope object.
  * 
@@ -99,8 +208,9 @@ void adsr_release(ADSR_OBJ *pa);
  * Given an event duration in samples, get the ADSR envelope length in
  * samples.
  * 
- * The given duration must be greater than zero.  The return value will
- * also be greater than zero.
+ * The given duration must be in range [1, MAX_TIME].  The return value
+ * will also be greater than zero.  Since the release of an envelope is
+ * limited to ADSR_MAXTIME, the return value can't overflow.
  * 
  * The return value might be less than, equal to, or greater than dur,
  * depending on the particular envelope.
@@ -115,7 +225,7 @@ void adsr_release(ADSR_OBJ *pa);
  * 
  *   the duration of the envelope in samples for the event
  */
-int32_t adsr_length(ADSR_OBJ *pa, int32_t dur);
+int64_t adsr_length(ADSR_OBJ *pa, int64_t dur);
 
 /*
  * Compute the ADSR envelope multiplier for a given t and duration.
@@ -143,7 +253,91 @@ int32_t adsr_length(ADSR_OBJ *pa, int32_t dur);
  * 
  *   the ADSR multiplier
  */
-int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur);
+int32_t adsr_compute(ADSR_OBJ *pa, int64_t t, int64_t dur);
+
+/*
+ * Initialize control-rate state for a new event.
+ * 
+ * period is the number of samples in each control period.  It must be
+ * in range [1, CONTROL_MAX].  A period of one means that adsr_ctl()
+ * always returns exactly what adsr_compute() returns.
+ * 
+ * Otherwise, adsr_ctl() only computes the envelope at t offsets that
+ * are multiples of the period, and linearly interpolates in between.
+ * Since the envelope is made of straight segments, the result is exact
+ * except within the control periods that contain one of the corners
+ * of the envelope.  Within such a period, the result always lies
+ * between the exact values at the start and end of the period, so it
+ * never differs from the exact value by more than the difference
+ * between the greatest and least exact values within that period.
+ * 
+ * The period is kept in the control-rate state rather than in the
+ * module, so that renders running at the same time may use different
+ * control periods.
+ * 
+ * Parameters:
+ * 
+ *   pc - the control-rate state to initialize
+ * 
+ *   period - the control period in samples
+ */
+void adsr_ctlreset(ADSR_CTL *pc, int32_t period);
+
+/*
+ * Compute the ADSR envelope multiplier for a given t and duration at
+ * the control rate.
+ * 
+ * This is the same as adsr_compute(), except that the control period
+ * given to adsr_ctlreset() is used, which makes the computation cheaper
+ * but may be inexact.  See adsr_ctlreset() for the bound on the error.
+ * 
+ * pc is the control-rate state, which must have been initialized with
+ * adsr_ctlreset().  The same state should be used for all the t offsets
+ * of one event, which are fastest when they are increasing.
+ * 
+ * Parameters:
+ * 
+ *   pa - the ADSR envelope
+ * 
+ *   t - the t offset
+ * 
+ *   dur - the duration
+ * 
+ *   pc - the control-rate state
+ * 
+ * Return:
+ * 
+ *   the ADSR multiplier
+ */
+int32_t adsr_ctl(ADSR_OBJ *pa, int64_t t, int64_t dur, ADSR_CTL *pc);
+
+/*
+ * Compute an upper bound on the ADSR envelope multiplier for all t
+ * offsets from a given t onwards.
+ * 
+ * pa is the ADSR envelope.  t is the offset from the start of the
+ * envelope in samples, which must be zero or greater.  dur is the
+ * duration of the event in samples, which must be at least one.
+ * 
+ * The return value is in range [0, MAX_FRAC] and is never less than
+ * what adsr_compute() would return for any offset greater than or
+ * equal to t.  Once the release has started, the envelope only falls,
+ * so the bound is exact.  During the sustain, the bound is the sustain
+ * level.  During the attack and decay, MAX_FRAC is returned.
+ * 
+ * Parameters:
+ * 
+ *   pa - the ADSR envelope
+ * 
+ *   t - the t offset
+ * 
+ *   dur - the duration
+ * 
+ * Return:
+ * 
+ *   the upper bound on the ADSR multiplier from t onwards
+ */
+int32_t adsr_peak(ADSR_OBJ *pa, int64_t t, int64_t dur);
 
 /*
  * Transform a given sample according to an ADSR envelope.
@@ -178,8 +372,8 @@ int32_t adsr_compute(ADSR_OBJ *pa, int32_t t, int32_t dur);
  */
 int16_t adsr_mul(
     ADSR_OBJ * pa,
-    int32_t    t,
-    int32_t    dur,
+    int64_t    t,
+    int64_t    dur,
     int16_t    s);
 
 #endif
@@ -8,6 +8,7 @@
  */
 
 #include "generator.h"
+#include "os.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,26 @@
  */
 #define SINE_TABLE_AMP (16384) 
 
+/*
+ * Binary format constants for generator_save() and generator_restore().
+ * 
+ * BIN_SIGNATURE begins the binary format, followed by BIN_CHECK as a
+ * floating-point value to verify that the floating-point format is
+ * compatible.  Then come the node records, each beginning with one of
+ * the BIN_NODE_ types, and ending with a BIN_NODE_END record.
+ * 
+ * BIN_MAXNODE is the maximum number of node records.
+ */
+#define BIN_SIGNATURE (INT32_C(0x52474d31))
+#define BIN_CHECK     (0.1)
+#define BIN_MAXNODE   (65536)
+
+#define BIN_NODE_END      (0)
+#define BIN_NODE_ADDITIVE (1)
+#define BIN_NODE_SCALE    (2)
+#define BIN_NODE_CLIP     (3)
+#define BIN_NODE_OP       (4)
+
 /*
  * Type declarations
  * -----------------
@@ -40,21 +61,21 @@
  * The void pointer is a custom parameter that is passed through to the
  * function.  This represents the class data for the generator object.
  * 
- * The first int32_t parameter is the sample offset from the start of
- * the sound.
+ * The int64_t parameter is the sample offset from the start of the
+ * sound.
  * 
  * The GENERATOR_OPDATA parameter is a pointer to the array of instance
  * data structures for operators.
  * 
- * The second int32_t parameter is the number of structures in the
- * instance data array.
+ * The int32_t parameter is the number of structures in the instance
+ * data array.
  * 
  * The return value is the generated floating-point value at this
  * location.
  */
 typedef double (*fp_gen)(
     void *,
-    int32_t,
+    int64_t,
     GENERATOR_OPDATA *,
     int32_t);
 
@@ -75,8 +96,35 @@ typedef double (*fp_gen)(
  * 
  * The return value is the full length in samples.
  */
-typedef int32_t (*fp_len)(
+typedef int64_t (*fp_len)(
+    void *,
+    GENERATOR_OPDATA *,
+    int32_t);
+
+/*
+ * Function pointer to the peak function.
+ * 
+ * This function determines an upper bound on the absolute value of all
+ * samples that the generator can still produce for a particular
+ * rendering instance, from a given sample offset onwards.
+ * 
+ * The void pointer is a custom parameter that is passed through to the
+ * function.  This represents the class data for the generator object.
+ * 
+ * The int64_t parameter is the sample offset from the start of the
+ * sound.
+ * 
+ * The GENERATOR_OPDATA parameter is a pointer to the array of instance
+ * data structures for operators.
+ * 
+ * The int32_t parameter is the number of structures in the instance
+ * data array.
+ * 
+ * The return value is the upper bound, which is zero or greater.
+ */
+typedef double (*fp_peak)(
     void *,
+    int64_t,
     GENERATOR_OPDATA *,
     int32_t);
 
@@ -129,6 +177,11 @@ struct GENERATOR_TAG {
    */
   fp_len fLen;
   
+  /*
+   * Pointer to the peak function for this generator object.
+   */
+  fp_peak fPeak;
+  
   /*
    * Pointer to the bind function for this generator object.
    */
@@ -203,6 +256,14 @@ typedef struct {
   GENERATOR *pFM;
   GENERATOR *pAM;
   
+  /*
+   * The wave table for wave table operator functions, or NULL for the
+   * other operator functions.
+   * 
+   * Class data structure owns a reference to this object.
+   */
+  WAVETBL *pTable;
+  
   /*
    * Floating-point parameters.
    */
@@ -218,6 +279,59 @@ typedef struct {
   
 } OP_CLASS;
 
+/*
+ * Memo of generators that have already been compiled during a call to
+ * generator_compile().
+ * 
+ * This makes sure that a generator that is shared by more than one
+ * parent in the original graph is also shared in the compiled graph.
+ */
+typedef struct {
+  
+  /*
+   * The number of entries in the memo and the capacity of the arrays.
+   */
+  int32_t count;
+  int32_t cap;
+  
+  /*
+   * The original generators.
+   * 
+   * The memo does not own references to these generators.
+   */
+  GENERATOR **ppOld;
+  
+  /*
+   * The compiled generator corresponding to each original generator.
+   * 
+   * The memo owns a reference to each of these generators.
+   */
+  GENERATOR **ppNew;
+  
+} COMPILE_MEMO;
+
+/*
+ * List of generators that have already been written during a call to
+ * generator_save().
+ * 
+ * The index of each generator in the list is its node index in the
+ * binary format.  The list does not own references to the generators.
+ */
+typedef struct {
+  
+  /*
+   * The number of generators in the list and the capacity of the array.
+   */
+  int32_t count;
+  int32_t cap;
+  
+  /*
+   * The array of generators.
+   */
+  GENERATOR **ppg;
+  
+} SAVE_LIST;
+
 /*
  * Local data
  * ----------
@@ -226,8 +340,10 @@ typedef struct {
 /*
  * The sine wave table.
  * 
- * Use f_sine() to compute sine wave according to this table.  This will
- * also initialize the table if not already initialized.
+ * Use f_sine() to compute sine wave according to this table.  The
+ * table is built by generator_tables(), which generator_op() calls for
+ * each sine operator.  The flag is only accessed while holding
+ * os_global_lock(), and the table never changes after it is built.
  */
 static int m_sine_table_init = 0;
 static int16_t m_sine_table[SINE_TABLE_COUNT];
@@ -239,49 +355,73 @@ static int16_t m_sine_table[SINE_TABLE_COUNT];
 
 /* Prototypes */
 static double f_sine(double w);
-static double f_noise(void);
+static double f_noise(uint32_t *pState);
 
 static double gen_additive(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
 static double gen_scale(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
 static double gen_clip(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
 static double gen_op(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count);
+
+static int64_t len_additive(
+    void             * pClass,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count);
+
+static int64_t len_scale(
+    void             * pClass,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count);
+
+static int64_t len_clip(
+    void             * pClass,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count);
+
+static int64_t len_op(
+    void             * pClass,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
-static int32_t len_additive(
+static double peak_additive(
     void             * pClass,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
-static int32_t len_scale(
+static double peak_scale(
     void             * pClass,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
-static int32_t len_clip(
+static double peak_clip(
     void             * pClass,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
-static int32_t len_op(
+static double peak_op(
     void             * pClass,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
@@ -295,6 +435,14 @@ static void free_scale(void *pCustom);
 static void free_clip(void *pCustom);
 static void free_op(void *pCustom);
 
+static GENERATOR *compile_node(GENERATOR *pg, COMPILE_MEMO *pm);
+
+static int bin_write32(FILE *pOut, int32_t v);
+static int bin_writef(FILE *pOut, double v);
+static int bin_read32(FILE *pIn, int32_t *pv);
+static int bin_readf(FILE *pIn, double *pv);
+static int32_t save_node(GENERATOR *pg, SAVE_LIST *pl, FILE *pOut);
+
 /*
  * The sine wave function.
  * 
@@ -305,12 +453,17 @@ static void free_op(void *pCustom);
  * value of zero.
  * 
  * This function always computes the sine function at the given w
- * location on the wave, using a wave table that is automatically
- * generated on the first call to this function.  Sine waves do not have
- * complications involving harmonics and the Nyquist limit, unlike the
- * other wave forms.  It is assumed that the client has already checked
- * that the frequency of the sine wave is below the Nyquist limit before
- * calling this function.
+ * location on the wave, using the sine wave table.  The table must
+ * already have been built with generator_tables(), which generator_op()
+ * does for every sine operator.  Since that call takes and releases
+ * os_global_lock(), the finished table is visible to the thread that
+ * created the operator, and to any thread it hands the operator to
+ * with proper synchronization, so no lock is needed here.
+ * 
+ * Sine waves do not have complications involving harmonics and the
+ * Nyquist limit, unlike the other wave forms.  It is assumed that the
+ * client has already checked that the frequency of the sine wave is
+ * below the Nyquist limit before calling this function.
  * 
  * Parameters:
  * 
@@ -326,46 +479,6 @@ static double f_sine(double w) {
   double base = 0.0;
   double r = 0.0;
   double sv = 0.0;
-  int32_t iv = 0;
-  
-  /* Generate sine wave table if not already initialized */
-  if (!m_sine_table_init) {
-    /* Clear everything to zero first */
-    memset(
-      m_sine_table,
-      0,
-      ((size_t) SINE_TABLE_COUNT) * sizeof(int16_t));
-    
-    /* Generate each entry */
-    for(x = 0; x < SINE_TABLE_COUNT; x++) {
-      
-      /* Compute floating-point value of sine */
-      sv = sin(
-            (((double) x) / ((double) SINE_TABLE_COUNT)) * 2.0 * M_PI);
-      
-      /* Adjust amplitude for integer range */
-      sv *= ((double) SINE_TABLE_AMP);
-      
-      /* Check that finite */
-      if (!isfinite(sv)) {
-        abort();
-      }
-      
-      /* Get integer value */
-      iv = (int32_t) floor(sv);
-      
-      /* Check range */
-      if ((iv < -(SINE_TABLE_AMP)) || (iv > SINE_TABLE_AMP)) {
-        abort();
-      }
-      
-      /* Store in table */
-      m_sine_table[x] = (int16_t) iv;
-    }
-    
-    /* Set table flag */
-    m_sine_table_init = 1;
-  }
   
   /* Fix input parameter */
   if (!isfinite(w)) {
@@ -407,16 +520,29 @@ static double f_sine(double w) {
 /*
  * The noise function.
  * 
+ * pState is the state of the pseudo-random generator, which is advanced
+ * by this call.  The generator is a linear congruential generator, of
+ * which only the upper 24 bits are used since the lower bits have short
+ * periods.
+ * 
+ * Parameters:
+ * 
+ *   pState - the pseudo-random generator state
+ * 
  * Return:
  * 
  *   a random value in range [-1.0, 1.0]
  */
-static double f_noise(void) {
+static double f_noise(uint32_t *pState) {
   
   double result = 0.0;
 
+  /* Advance the generator */
+  *pState = (uint32_t) ((*pState * UINT32_C(1664525)) +
+                          UINT32_C(1013904223));
+
   /* Generate random value in range [0.0, 2.0] */
-  result = 2.0 * (((double) rand()) / ((double) RAND_MAX));
+  result = 2.0 * (((double) (*pState >> 8)) / ((double) 0xffffffL));
 
   /* Move result to range [-1.0, 1.0] */
   return (result - 1.0);
@@ -429,7 +555,7 @@ static double f_noise(void) {
  */
 static double gen_additive(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
   
@@ -478,7 +604,7 @@ static double gen_additive(
  */
 static double gen_scale(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
   
@@ -511,7 +637,7 @@ static double gen_scale(
  */
 static double gen_clip(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
   
@@ -553,7 +679,7 @@ static double gen_clip(
  */
 static double gen_op(
     void             * pClass,
-    int32_t            t,
+    int64_t            t,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
   
@@ -662,7 +788,13 @@ static double gen_op(
         nval = f_sine(pod->w);
         
       } else if (pc->fop == GENERATOR_F_NOISE) {
-        nval = f_noise();
+        nval = f_noise(&(pod->noise));
+        
+      } else if (pc->pTable != NULL) {
+        /* Wave table function -- the harmonic limit is determined from
+         * the instantaneous frequency, including any modulation, so
+         * that modulation can't push harmonics beyond Nyquist */
+        nval = wavetbl_get(pc->pTable, pod->w, 0.5 / fabs(w_adv));
         
       } else {
         /* Unrecognized function */
@@ -670,8 +802,8 @@ static double gen_op(
       }
       
       /* Next task is to compute amplitude; begin with the ADSR
-       * envelope */
-      amp = (((double) adsr_compute(pc->pAmp, t, pod->dur)) /
+       * envelope at the control rate */
+      amp = (((double) adsr_ctl(pc->pAmp, t, pod->dur, &(pod->ctl))) /
                 ((double) MAX_FRAC));
       
       /* If there is amplitude modulation, add it in */
@@ -717,14 +849,14 @@ static double gen_op(
  * 
  * This matches the interface of fp_gen.
  */
-static int32_t len_additive(
+static int64_t len_additive(
     void             * pClass,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
   
   GENERATOR **ppg = NULL;
-  int32_t result = 0;
-  int32_t retval = 0;
+  int64_t result = 0;
+  int64_t retval = 0;
   
   /* Check parameters */
   if ((pClass == NULL) ||
@@ -758,7 +890,7 @@ static int32_t len_additive(
  * 
  * This matches the interface of fp_gen.
  */
-static int32_t len_scale(
+static int64_t len_scale(
     void             * pClass,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
@@ -783,7 +915,7 @@ static int32_t len_scale(
  * 
  * This matches the interface of fp_gen.
  */
-static int32_t len_clip(
+static int64_t len_clip(
     void             * pClass,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
@@ -808,7 +940,7 @@ static int32_t len_clip(
  * 
  * This matches the interface of fp_gen.
  */
-static int32_t len_op(
+static int64_t len_op(
     void             * pClass,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
@@ -836,6 +968,151 @@ static int32_t len_op(
   return adsr_length(pc->pAmp, pod->dur);
 }
 
+/*
+ * Peak routine for additive generators.
+ * 
+ * This matches the interface of fp_peak.
+ */
+static double peak_additive(
+    void             * pClass,
+    int64_t            t,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count) {
+  
+  GENERATOR **ppg = NULL;
+  double result = 0.0;
+  
+  /* Check parameters */
+  if ((pClass == NULL) || (t < 0) ||
+      (pods == NULL) || (pod_count < 1)) {
+    abort();
+  }
+  
+  /* Cast the class data to a NULL-terminated array of generator
+   * pointers */
+  ppg = (GENERATOR **) pClass;
+  
+  /* The sum can be no greater than the sum of the component bounds */
+  for( ; *ppg != NULL; ppg++) {
+    result = result + generator_peak(*ppg, pods, pod_count, t);
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Peak routine for scaling generators.
+ * 
+ * This matches the interface of fp_peak.
+ */
+static double peak_scale(
+    void             * pClass,
+    int64_t            t,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count) {
+  
+  SCALE_CLASS *pc = NULL;
+  
+  /* Check parameters */
+  if ((pClass == NULL) || (t < 0) ||
+      (pods == NULL) || (pod_count < 1)) {
+    abort();
+  }
+  
+  /* Cast the class data to the appropriate structure pointer */
+  pc = (SCALE_CLASS *) pClass;
+  
+  /* Scale the bound of the underlying generator */
+  return (fabs(pc->scale) *
+            generator_peak(pc->pBase, pods, pod_count, t));
+}
+
+/*
+ * Peak routine for clip generators.
+ * 
+ * This matches the interface of fp_peak.
+ */
+static double peak_clip(
+    void             * pClass,
+    int64_t            t,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count) {
+  
+  CLIP_CLASS *pc = NULL;
+  double result = 0.0;
+  
+  /* Check parameters */
+  if ((pClass == NULL) || (t < 0) ||
+      (pods == NULL) || (pod_count < 1)) {
+    abort();
+  }
+  
+  /* Cast the class data to the appropriate structure pointer */
+  pc = (CLIP_CLASS *) pClass;
+  
+  /* Get the bound of the underlying generator, and clip it */
+  result = generator_peak(pc->pBase, pods, pod_count, t);
+  if (result > pc->level) {
+    result = pc->level;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Peak routine for operator generators.
+ * 
+ * This matches the interface of fp_peak.
+ */
+static double peak_op(
+    void             * pClass,
+    int64_t            t,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count) {
+  
+  OP_CLASS *pc = NULL;
+  GENERATOR_OPDATA *pod = NULL;
+  double result = 0.0;
+  
+  /* Check parameters */
+  if ((pClass == NULL) || (t < 0) ||
+      (pods == NULL) || (pod_count < 1)) {
+    abort();
+  }
+  
+  /* Cast the class data to the appropriate structure pointer */
+  pc = (OP_CLASS *) pClass;
+  
+  /* Make sure the instance data index is bound and in range, then get a
+   * pointer to the instance data for this operator */
+  if ((pc->pod_i < 0) || (pc->pod_i >= pod_count)) {
+    abort();
+  }
+  pod = &(pods[pc->pod_i]);
+  
+  /* Disabled operators never come back, so they are silent for good;
+   * otherwise, the operator functions are all in range [-1.0, 1.0], so
+   * the bound is the bound on the amplitude */
+  if (pod->t < -1) {
+    result = 0.0;
+    
+  } else {
+    /* Begin with the bound on the ADSR envelope */
+    result = ((double) adsr_peak(pc->pAmp, t, pod->dur)) /
+                ((double) MAX_FRAC);
+    
+    /* If there is amplitude modulation, add its bound */
+    if (pc->pAM != NULL) {
+      result = result + generator_peak(pc->pAM, pods, pod_count, t);
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
 /*
  * Bind routine for additive generators.
  * 
@@ -1050,24 +1327,591 @@ static void free_op(void *pCustom) {
   generator_release(pc->pAM);
   pc->pAM = NULL;
   
+  wavetbl_release(pc->pTable);
+  pc->pTable = NULL;
+  
   /* Now we can free the structure */
   free(pc);
 }
 
 /*
- * Public function implementations
- * -------------------------------
+ * Recursively compile a generator.
  * 
- * See the header for specifications.
- */
-
-/*
- * generator_opdata_init function.
+ * See generator_compile() for the transformations that are performed.
+ * The memo is checked first, and the compiled result of each generator
+ * is added to the memo.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator to compile
+ * 
+ *   pm - the compilation memo
+ * 
+ * Return:
+ * 
+ *   a new reference to the compiled generator
  */
-void generator_opdata_init(
-    GENERATOR_OPDATA * pod,
+static GENERATOR *compile_node(GENERATOR *pg, COMPILE_MEMO *pm) {
+  
+  GENERATOR *result = NULL;
+  GENERATOR *pBase = NULL;
+  GENERATOR *pFM = NULL;
+  GENERATOR *pAM = NULL;
+  GENERATOR **ppg = NULL;
+  GENERATOR **ppc = NULL;
+  SCALE_CLASS *psc = NULL;
+  CLIP_CLASS *pcc = NULL;
+  OP_CLASS *poc = NULL;
+  int found = 0;
+  int changed = 0;
+  int32_t i = 0;
+  int32_t count = 0;
+  double v = 0.0;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pm == NULL)) {
+    abort();
+  }
+  
+  /* Check whether this generator has already been compiled */
+  for(i = 0; i < pm->count; i++) {
+    if ((pm->ppOld)[i] == pg) {
+      found = 1;
+      result = (pm->ppNew)[i];
+      generator_addref(result);
+      break;
+    }
+  }
+  
+  /* Compile the generator if not found in the memo */
+  if ((result == NULL) && (pg->fGen == &gen_scale)) {
+    /* Scaling generator -- compile the base first */
+    psc = (SCALE_CLASS *) pg->pClass;
+    pBase = compile_node(psc->pBase, pm);
+    
+    /* Scaling by one is the identity, so it can be dropped */
+    if (psc->scale == 1.0) {
+      result = pBase;
+      generator_addref(result);
+      
+    } else if (pBase == psc->pBase) {
+      result = pg;
+      generator_addref(result);
+      
+    } else {
+      result = generator_scale(pBase, psc->scale);
+    }
+    
+    generator_release(pBase);
+    pBase = NULL;
+    
+  } else if ((result == NULL) && (pg->fGen == &gen_clip)) {
+    /* Clip generator -- compile the base first */
+    pcc = (CLIP_CLASS *) pg->pClass;
+    pBase = compile_node(pcc->pBase, pm);
+    v = pcc->level;
+    
+    /* If base is also a clip generator, only the lower level has any
+     * effect */
+    if (pBase->fGen == &gen_clip) {
+      if (((CLIP_CLASS *) pBase->pClass)->level < v) {
+        v = ((CLIP_CLASS *) pBase->pClass)->level;
+      }
+      result = ((CLIP_CLASS *) pBase->pClass)->pBase;
+      generator_addref(result);
+      generator_release(pBase);
+      pBase = result;
+      result = NULL;
+    }
+    
+    if ((v == pcc->level) && (pBase == pcc->pBase)) {
+      result = pg;
+      generator_addref(result);
+    } else {
+      result = generator_clip(pBase, v);
+    }
+    
+    generator_release(pBase);
+    pBase = NULL;
+    
+  } else if ((result == NULL) && (pg->fGen == &gen_additive)) {
+    /* Additive generator -- count the components */
+    for(ppg = (GENERATOR **) pg->pClass; *ppg != NULL; ppg++) {
+      count++;
+    }
+    
+    /* Compile each component, checking whether any changed */
+    ppc = (GENERATOR **) calloc((size_t) count, sizeof(GENERATOR *));
+    if (ppc == NULL) {
+      abort();
+    }
+    
+    ppg = (GENERATOR **) pg->pClass;
+    for(i = 0; i < count; i++) {
+      ppc[i] = compile_node(ppg[i], pm);
+      if (ppc[i] != ppg[i]) {
+        changed = 1;
+      }
+    }
+    
+    /* The components are kept as they are, since removing or
+     * flattening sums would change how non-finite values and rounding
+     * are handled; only construct a new generator if a component
+     * changed */
+    if (changed) {
+      result = generator_additive(ppc, count);
+    } else {
+      result = pg;
+      generator_addref(result);
+    }
+    
+    /* Release the compiled components */
+    for(i = 0; i < count; i++) {
+      generator_release(ppc[i]);
+      ppc[i] = NULL;
+    }
+    free(ppc);
+    ppc = NULL;
+    
+  } else if ((result == NULL) && (pg->fGen == &gen_op)) {
+    /* Operator -- operators are never removed, but the modulators are
+     * compiled */
+    poc = (OP_CLASS *) pg->pClass;
+    if (poc->pod_i != -1) {
+      abort();
+    }
+    
+    if (poc->pFM != NULL) {
+      pFM = compile_node(poc->pFM, pm);
+    }
+    if (poc->pAM != NULL) {
+      pAM = compile_node(poc->pAM, pm);
+    }
+    
+    if ((pFM == poc->pFM) && (pAM == poc->pAM)) {
+      result = pg;
+      generator_addref(result);
+    } else {
+      result = generator_op(
+                  poc->fop,
+                  poc->freq_mul,
+                  poc->freq_boost,
+                  poc->pAmp,
+                  pFM,
+                  pAM,
+                  (poc->fop == GENERATOR_F_TABLE) ? poc->pTable : NULL,
+                  poc->samp_rate);
+    }
+    
+    generator_release(pFM);
+    pFM = NULL;
+    
+    generator_release(pAM);
+    pAM = NULL;
+    
+  } else if (result == NULL) {
+    /* Unrecognized generator type */
+    abort();
+  }
+  
+  /* Add the result to the memo, if it was not already there */
+  if (!found) {
+    if (pm->count >= pm->cap) {
+      if (pm->cap < 1) {
+        pm->cap = 16;
+      } else if (pm->cap <= INT32_MAX / 2) {
+        pm->cap *= 2;
+      } else {
+        abort();
+      }
+      pm->ppOld = (GENERATOR **) realloc(
+                    pm->ppOld,
+                    ((size_t) pm->cap) * sizeof(GENERATOR *));
+      pm->ppNew = (GENERATOR **) realloc(
+                    pm->ppNew,
+                    ((size_t) pm->cap) * sizeof(GENERATOR *));
+      if ((pm->ppOld == NULL) || (pm->ppNew == NULL)) {
+        abort();
+      }
+    }
+    
+    (pm->ppOld)[pm->count] = pg;
+    (pm->ppNew)[pm->count] = result;
+    generator_addref(result);
+    (pm->count)++;
+  }
+  
+  /* Return the compiled generator */
+  return result;
+}
+
+/*
+ * Write a signed 32-bit integer in little-endian order.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file to write to
+ * 
+ *   v - the value to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if I/O error
+ */
+static int bin_write32(FILE *pOut, int32_t v) {
+  
+  int status = 1;
+  uint32_t uv = 0;
+  int i = 0;
+  
+  /* Check parameters */
+  if (pOut == NULL) {
+    abort();
+  }
+  
+  /* Write each byte */
+  uv = (uint32_t) v;
+  for(i = 0; i < 4; i++) {
+    if (putc((int) (uv & 0xff), pOut) == EOF) {
+      status = 0;
+      break;
+    }
+    uv >>= 8;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write a floating-point value as its 64-bit pattern in little-endian
+ * order.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file to write to
+ * 
+ *   v - the value to write
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if I/O error
+ */
+static int bin_writef(FILE *pOut, double v) {
+  
+  uint64_t uv = 0;
+  
+  /* Check parameters */
+  if (pOut == NULL) {
+    abort();
+  }
+  
+  /* Get the bit pattern and write as two 32-bit halves */
+  memcpy(&uv, &v, sizeof(uint64_t));
+  
+  return (bin_write32(pOut, (int32_t) (uv & UINT32_C(0xffffffff))) &&
+          bin_write32(pOut, (int32_t) (uv >> 32)));
+}
+
+/*
+ * Read a signed 32-bit integer in little-endian order.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file to read from
+ * 
+ *   pv - variable to receive the value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if I/O error or end of file
+ */
+static int bin_read32(FILE *pIn, int32_t *pv) {
+  
+  int status = 1;
+  uint32_t uv = 0;
+  int c = 0;
+  int i = 0;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pv == NULL)) {
+    abort();
+  }
+  
+  /* Read each byte */
+  for(i = 0; i < 4; i++) {
+    c = getc(pIn);
+    if (c == EOF) {
+      status = 0;
+      break;
+    }
+    uv |= ((uint32_t) c) << (8 * i);
+  }
+  
+  /* Write the value */
+  if (status) {
+    if (uv > INT32_MAX) {
+      *pv = -((int32_t) (~uv)) - 1;
+    } else {
+      *pv = (int32_t) uv;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read a floating-point value stored by bin_writef().
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file to read from
+ * 
+ *   pv - variable to receive the value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if I/O error or end of file
+ */
+static int bin_readf(FILE *pIn, double *pv) {
+  
+  int status = 1;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  uint64_t uv = 0;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pv == NULL)) {
+    abort();
+  }
+  
+  /* Read the two halves */
+  if (!bin_read32(pIn, &lo)) {
+    status = 0;
+  }
+  if (status && (!bin_read32(pIn, &hi))) {
+    status = 0;
+  }
+  
+  /* Reassemble the bit pattern */
+  if (status) {
+    uv = (((uint64_t) ((uint32_t) hi)) << 32) |
+            ((uint64_t) ((uint32_t) lo));
+    memcpy(pv, &uv, sizeof(double));
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Recursively write a generator and all the generators it references
+ * in the binary format.
+ * 
+ * Generators that are already in the save list are not written again,
+ * so shared generators remain shared when restored.  Each generator is
+ * written after all the generators it references, and then appended to
+ * the save list.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator to write
+ * 
+ *   pl - the save list
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   the node index of the generator, or -1 if the generator can't be
+ *   saved or there was an I/O error
+ */
+static int32_t save_node(GENERATOR *pg, SAVE_LIST *pl, FILE *pOut) {
+  
+  int status = 1;
+  int32_t result = -1;
+  int32_t i = 0;
+  int32_t count = 0;
+  int32_t i_fm = -1;
+  int32_t i_am = -1;
+  int32_t *pIdx = NULL;
+  int32_t env[4];
+  GENERATOR **ppg = NULL;
+  SCALE_CLASS *psc = NULL;
+  CLIP_CLASS *pcc = NULL;
+  OP_CLASS *poc = NULL;
+  
+  /* Initialize buffers */
+  memset(env, 0, sizeof(env));
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pl == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  
+  /* Check whether already written */
+  for(i = 0; i < pl->count; i++) {
+    if ((pl->ppg)[i] == pg) {
+      result = i;
+      break;
+    }
+  }
+  
+  /* Write the generator if not already written */
+  if ((result < 0) && (pg->fGen == &gen_scale)) {
+    psc = (SCALE_CLASS *) pg->pClass;
+    i = save_node(psc->pBase, pl, pOut);
+    if ((i < 0) ||
+        (!bin_write32(pOut, BIN_NODE_SCALE)) ||
+        (!bin_write32(pOut, i)) ||
+        (!bin_writef(pOut, psc->scale))) {
+      status = 0;
+    }
+    
+  } else if ((result < 0) && (pg->fGen == &gen_clip)) {
+    pcc = (CLIP_CLASS *) pg->pClass;
+    i = save_node(pcc->pBase, pl, pOut);
+    if ((i < 0) ||
+        (!bin_write32(pOut, BIN_NODE_CLIP)) ||
+        (!bin_write32(pOut, i)) ||
+        (!bin_writef(pOut, pcc->level))) {
+      status = 0;
+    }
+    
+  } else if ((result < 0) && (pg->fGen == &gen_additive)) {
+    /* Write all the components first */
+    for(ppg = (GENERATOR **) pg->pClass; *ppg != NULL; ppg++) {
+      count++;
+    }
+    pIdx = (int32_t *) calloc((size_t) count, sizeof(int32_t));
+    if (pIdx == NULL) {
+      abort();
+    }
+    
+    ppg = (GENERATOR **) pg->pClass;
+    for(i = 0; i < count; i++) {
+      pIdx[i] = save_node(ppg[i], pl, pOut);
+      if (pIdx[i] < 0) {
+        status = 0;
+        break;
+      }
+    }
+    
+    /* Write the additive record */
+    if (status) {
+      if ((!bin_write32(pOut, BIN_NODE_ADDITIVE)) ||
+          (!bin_write32(pOut, count))) {
+        status = 0;
+      }
+    }
+    if (status) {
+      for(i = 0; i < count; i++) {
+        if (!bin_write32(pOut, pIdx[i])) {
+          status = 0;
+          break;
+        }
+      }
+    }
+    
+    free(pIdx);
+    pIdx = NULL;
+    
+  } else if ((result < 0) && (pg->fGen == &gen_op)) {
+    poc = (OP_CLASS *) pg->pClass;
+    
+    /* Wave tables given by the client can't be saved, because they
+     * aren't part of the generator map */
+    if (poc->fop == GENERATOR_F_TABLE) {
+      status = 0;
+    }
+    
+    /* Write the modulators first */
+    if (status && (poc->pFM != NULL)) {
+      i_fm = save_node(poc->pFM, pl, pOut);
+      if (i_fm < 0) {
+        status = 0;
+      }
+    }
+    if (status && (poc->pAM != NULL)) {
+      i_am = save_node(poc->pAM, pl, pOut);
+      if (i_am < 0) {
+        status = 0;
+      }
+    }
+    
+    /* Write the operator record */
+    if (status) {
+      adsr_samples(
+        poc->pAmp, &(env[0]), &(env[1]), &(env[2]), &(env[3]));
+      if ((!bin_write32(pOut, BIN_NODE_OP)) ||
+          (!bin_write32(pOut, (int32_t) poc->fop)) ||
+          (!bin_writef(pOut, poc->freq_mul)) ||
+          (!bin_writef(pOut, poc->freq_boost)) ||
+          (!bin_write32(pOut, env[0])) ||
+          (!bin_write32(pOut, env[1])) ||
+          (!bin_write32(pOut, env[2])) ||
+          (!bin_write32(pOut, env[3])) ||
+          (!bin_write32(pOut, i_fm)) ||
+          (!bin_write32(pOut, i_am))) {
+        status = 0;
+      }
+    }
+    
+  } else if (result < 0) {
+    /* Unrecognized generator type */
+    abort();
+  }
+  
+  /* If a new record was written, append to the save list */
+  if (status && (result < 0)) {
+    if (pl->count >= BIN_MAXNODE) {
+      status = 0;
+    }
+    
+    if (status && (pl->count >= pl->cap)) {
+      if (pl->cap < 1) {
+        pl->cap = 16;
+      } else {
+        pl->cap *= 2;
+      }
+      pl->ppg = (GENERATOR **) realloc(
+                  pl->ppg, ((size_t) pl->cap) * sizeof(GENERATOR *));
+      if (pl->ppg == NULL) {
+        abort();
+      }
+    }
+    
+    if (status) {
+      (pl->ppg)[pl->count] = pg;
+      result = pl->count;
+      (pl->count)++;
+    }
+  }
+  
+  /* Return result */
+  if (!status) {
+    result = -1;
+  }
+  return result;
+}
+
+/*
+ * Public function implementations
+ * -------------------------------
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * generator_opdata_init function.
+ */
+void generator_opdata_init(
+    GENERATOR_OPDATA * pod,
     double             freq,
-    int32_t            dur) {
+    int64_t            dur,
+    int32_t            period,
+    uint32_t           seed) {
   
   /* Check parameters */
   if (pod == NULL) {
@@ -1079,7 +1923,7 @@ void generator_opdata_init(
   if (!(freq > 0.0)) {
     abort();
   }
-  if (dur < 1) {
+  if ((dur < 1) || (dur > MAX_TIME)) {
     abort();
   }
   
@@ -1092,6 +1936,8 @@ void generator_opdata_init(
   pod->current = 0.0;
   pod->t = -1;
   pod->dur = dur;
+  adsr_ctlreset(&(pod->ctl), period);
+  pod->noise = seed;
 }
 
 /*
@@ -1139,6 +1985,7 @@ GENERATOR *generator_additive(GENERATOR **ppg, int32_t count) {
   png->pClass = (void *) ppnew;
   png->fGen = &gen_additive;
   png->fLen = &len_additive;
+  png->fPeak = &peak_additive;
   png->fBind = &bind_additive;
   png->fFree = &free_additive;
   png->refcount = 1;
@@ -1185,6 +2032,7 @@ GENERATOR *generator_scale(GENERATOR *pBase, double scale) {
   png->pClass = (void *) pc;
   png->fGen = &gen_scale;
   png->fLen = &len_scale;
+  png->fPeak = &peak_scale;
   png->fBind = &bind_scale;
   png->fFree = &free_scale;
   png->refcount = 1;
@@ -1231,6 +2079,7 @@ GENERATOR *generator_clip(GENERATOR *pBase, double level) {
   png->pClass = (void *) pc;
   png->fGen = &gen_clip;
   png->fLen = &len_clip;
+  png->fPeak = &peak_clip;
   png->fBind = &bind_clip;
   png->fFree = &free_clip;
   png->refcount = 1;
@@ -1249,6 +2098,7 @@ GENERATOR *generator_op(
     ADSR_OBJ  * pAmp,
     GENERATOR * pFM,
     GENERATOR * pAM,
+    WAVETBL   * pTable,
     int32_t     samp_rate) {
   
   OP_CLASS *pc = NULL;
@@ -1267,6 +2117,9 @@ GENERATOR *generator_op(
   if (pAmp == NULL) {
     abort();
   }
+  if ((fop == GENERATOR_F_TABLE) != (pTable != NULL)) {
+    abort();
+  }
   if ((samp_rate != RATE_CD) && (samp_rate != RATE_DVD)) {
     abort();
   }
@@ -1301,6 +2154,34 @@ GENERATOR *generator_op(
     generator_addref(pc->pAM);
   }
   
+  /* If a wave table function was selected, get a reference to the wave
+   * table */
+  if (fop == GENERATOR_F_TABLE) {
+    wavetbl_addref(pTable);
+    pc->pTable = pTable;
+    
+  } else if (fop == GENERATOR_F_SQUARE) {
+    pc->pTable = wavetbl_shape(WAVETBL_SHAPE_SQUARE);
+    
+  } else if (fop == GENERATOR_F_TRIANGLE) {
+    pc->pTable = wavetbl_shape(WAVETBL_SHAPE_TRIANGLE);
+    
+  } else if (fop == GENERATOR_F_SAWTOOTH) {
+    pc->pTable = wavetbl_shape(WAVETBL_SHAPE_SAWTOOTH);
+    
+  } else if (fop == GENERATOR_F_PULSE) {
+    pc->pTable = wavetbl_shape(WAVETBL_SHAPE_PULSE);
+    
+  } else {
+    pc->pTable = NULL;
+  }
+  
+  /* If the sine function was selected, make sure the sine table has
+   * been built before the operator can be invoked */
+  if (fop == GENERATOR_F_SINE) {
+    generator_tables();
+  }
+  
   /* Allocate a generator structure */
   png = (GENERATOR *) malloc(sizeof(GENERATOR));
   if (png == NULL) {
@@ -1312,6 +2193,7 @@ GENERATOR *generator_op(
   png->pClass = (void *) pc;
   png->fGen = &gen_op;
   png->fLen = &len_op;
+  png->fPeak = &peak_op;
   png->fBind = &bind_op;
   png->fFree = &free_op;
   png->refcount = 1;
@@ -1379,7 +2261,7 @@ double generator_invoke(
     GENERATOR        * pg,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count,
-    int32_t            t) {
+    int64_t            t) {
   
   /* Check parameters */
   if ((pg == NULL) || (pods == NULL) ||
@@ -1399,7 +2281,7 @@ double generator_invoke(
 /*
  * generator_length function.
  */
-int32_t generator_length(
+int64_t generator_length(
     GENERATOR        * pg,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count) {
@@ -1419,6 +2301,91 @@ int32_t generator_length(
   return (*(pg->fLen))(pg->pClass, pods, pod_count);
 }
 
+/*
+ * generator_peak function.
+ */
+double generator_peak(
+    GENERATOR        * pg,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count,
+    int64_t            t) {
+  
+  double result = 0.0;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pods == NULL) ||
+      (pod_count < 1) || (t < 0)) {
+    abort();
+  }
+  
+  /* Check that class data and peak function are defined */
+  if ((pg->pClass == NULL) || (pg->fPeak == NULL)) {
+    abort();
+  }
+  
+  /* Call through to the peak function */
+  result = (*(pg->fPeak))(pg->pClass, t, pods, pod_count);
+  
+  /* If the bound is not finite, nothing can be proven, so leave it as
+   * an infinite bound */
+  if (!isfinite(result)) {
+    result = HUGE_VAL;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * generator_fixed function.
+ */
+int generator_fixed(GENERATOR *pg) {
+  
+  int result = 1;
+  GENERATOR **ppg = NULL;
+  OP_CLASS *poc = NULL;
+  
+  /* Check parameters */
+  if (pg == NULL) {
+    abort();
+  }
+  
+  /* Check the generator and everything it depends on */
+  if (pg->fGen == &gen_scale) {
+    result = generator_fixed(((SCALE_CLASS *) pg->pClass)->pBase);
+    
+  } else if (pg->fGen == &gen_clip) {
+    result = generator_fixed(((CLIP_CLASS *) pg->pClass)->pBase);
+    
+  } else if (pg->fGen == &gen_additive) {
+    for(ppg = (GENERATOR **) pg->pClass; *ppg != NULL; ppg++) {
+      if (!generator_fixed(*ppg)) {
+        result = 0;
+        break;
+      }
+    }
+    
+  } else if (pg->fGen == &gen_op) {
+    poc = (OP_CLASS *) pg->pClass;
+    if (poc->fop == GENERATOR_F_NOISE) {
+      result = 0;
+    }
+    if (result && (poc->pFM != NULL)) {
+      result = generator_fixed(poc->pFM);
+    }
+    if (result && (poc->pAM != NULL)) {
+      result = generator_fixed(poc->pAM);
+    }
+    
+  } else {
+    /* Unrecognized generator type */
+    abort();
+  }
+  
+  /* Return result */
+  return result;
+}
+
 /*
  * generator_bind function.
  */
@@ -1437,3 +2404,365 @@ int32_t generator_bind(GENERATOR *pg, int32_t start) {
   /* Call through to bind function implementation */
   return (*(pg->fBind))(pg->pClass, start);
 }
+
+/*
+ * generator_tables function.
+ */
+void generator_tables(void) {
+  
+  int32_t x = 0;
+  double sv = 0.0;
+  int32_t iv = 0;
+  
+  os_global_lock();
+  
+  /* Generate sine wave table if not already initialized */
+  if (!m_sine_table_init) {
+    /* Clear everything to zero first */
+    memset(
+      m_sine_table,
+      0,
+      ((size_t) SINE_TABLE_COUNT) * sizeof(int16_t));
+    
+    /* Generate each entry */
+    for(x = 0; x < SINE_TABLE_COUNT; x++) {
+      
+      /* Compute floating-point value of sine */
+      sv = sin(
+            (((double) x) / ((double) SINE_TABLE_COUNT)) * 2.0 * M_PI);
+      
+      /* Adjust amplitude for integer range */
+      sv *= ((double) SINE_TABLE_AMP);
+      
+      /* Check that finite */
+      if (!isfinite(sv)) {
+        abort();
+      }
+      
+      /* Get integer value */
+      iv = (int32_t) floor(sv);
+      
+      /* Check range */
+      if ((iv < -(SINE_TABLE_AMP)) || (iv > SINE_TABLE_AMP)) {
+        abort();
+      }
+      
+      /* Store in table */
+      m_sine_table[x] = (int16_t) iv;
+    }
+    
+    /* Set table flag */
+    m_sine_table_init = 1;
+  }
+  
+  os_global_unlock();
+}
+
+/*
+ * generator_save function.
+ */
+int generator_save(GENERATOR *pg, FILE *pOut) {
+  
+  int status = 1;
+  int32_t root = 0;
+  SAVE_LIST sl;
+  
+  /* Initialize structures */
+  memset(&sl, 0, sizeof(SAVE_LIST));
+  sl.count = 0;
+  sl.cap = 0;
+  sl.ppg = NULL;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  
+  /* Write the header */
+  if ((!bin_write32(pOut, BIN_SIGNATURE)) ||
+      (!bin_writef(pOut, BIN_CHECK))) {
+    status = 0;
+  }
+  
+  /* Write all the nodes */
+  if (status) {
+    root = save_node(pg, &sl, pOut);
+    if (root < 0) {
+      status = 0;
+    }
+  }
+  
+  /* Write the end record, which is followed by the root index */
+  if (status) {
+    if ((!bin_write32(pOut, BIN_NODE_END)) ||
+        (!bin_write32(pOut, root))) {
+      status = 0;
+    }
+  }
+  
+  /* Release the save list */
+  if (sl.ppg != NULL) {
+    free(sl.ppg);
+    sl.ppg = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * generator_restore function.
+ */
+GENERATOR *generator_restore(FILE *pIn, int32_t samp_rate) {
+  
+  int status = 1;
+  int done = 0;
+  int32_t cap = 0;
+  int32_t count = 0;
+  int32_t ntype = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t n = 0;
+  int32_t fop = 0;
+  int32_t i_fm = 0;
+  int32_t i_am = 0;
+  int32_t env[4];
+  double fv = 0.0;
+  double fv2 = 0.0;
+  GENERATOR **ppNode = NULL;
+  GENERATOR **ppa = NULL;
+  GENERATOR *pNew = NULL;
+  GENERATOR *result = NULL;
+  ADSR_OBJ *pa = NULL;
+  
+  /* Initialize buffers */
+  memset(env, 0, sizeof(env));
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    abort();
+  }
+  if ((samp_rate != RATE_CD) && (samp_rate != RATE_DVD)) {
+    abort();
+  }
+  
+  /* Read and check the header */
+  if (!bin_read32(pIn, &i)) {
+    status = 0;
+  }
+  if (status && (i != BIN_SIGNATURE)) {
+    status = 0;
+  }
+  if (status && (!bin_readf(pIn, &fv))) {
+    status = 0;
+  }
+  if (status && (fv != BIN_CHECK)) {
+    status = 0;
+  }
+  
+  /* Read node records until the end record */
+  while (status && (!done)) {
+    
+    /* Read the node type */
+    if (!bin_read32(pIn, &ntype)) {
+      status = 0;
+    }
+    
+    /* Handle the different node types, constructing the new node */
+    if (status && (ntype == BIN_NODE_END)) {
+      /* Root index follows */
+      if (!bin_read32(pIn, &i)) {
+        status = 0;
+      }
+      if (status && ((i < 0) || (i >= count))) {
+        status = 0;
+      }
+      if (status) {
+        result = ppNode[i];
+        generator_addref(result);
+        done = 1;
+      }
+      
+    } else if (status && ((ntype == BIN_NODE_SCALE) ||
+                          (ntype == BIN_NODE_CLIP))) {
+      if ((!bin_read32(pIn, &i)) || (!bin_readf(pIn, &fv))) {
+        status = 0;
+      }
+      if (status && ((i < 0) || (i >= count) || (!isfinite(fv)))) {
+        status = 0;
+      }
+      if (status && (ntype == BIN_NODE_SCALE)) {
+        pNew = generator_scale(ppNode[i], fv);
+      } else if (status) {
+        if (!(fv >= 0.0)) {
+          status = 0;
+        } else {
+          pNew = generator_clip(ppNode[i], fv);
+        }
+      }
+      
+    } else if (status && (ntype == BIN_NODE_ADDITIVE)) {
+      if (!bin_read32(pIn, &n)) {
+        status = 0;
+      }
+      if (status && ((n < 1) || (n > BIN_MAXNODE))) {
+        status = 0;
+      }
+      if (status) {
+        ppa = (GENERATOR **) calloc((size_t) n, sizeof(GENERATOR *));
+        if (ppa == NULL) {
+          abort();
+        }
+        for(j = 0; j < n; j++) {
+          if (!bin_read32(pIn, &i)) {
+            status = 0;
+          }
+          if (status && ((i < 0) || (i >= count))) {
+            status = 0;
+          }
+          if (!status) {
+            break;
+          }
+          ppa[j] = ppNode[i];
+        }
+        if (status) {
+          pNew = generator_additive(ppa, n);
+        }
+        free(ppa);
+        ppa = NULL;
+      }
+      
+    } else if (status && (ntype == BIN_NODE_OP)) {
+      if ((!bin_read32(pIn, &fop)) ||
+          (!bin_readf(pIn, &fv)) ||
+          (!bin_readf(pIn, &fv2)) ||
+          (!bin_read32(pIn, &(env[0]))) ||
+          (!bin_read32(pIn, &(env[1]))) ||
+          (!bin_read32(pIn, &(env[2]))) ||
+          (!bin_read32(pIn, &(env[3]))) ||
+          (!bin_read32(pIn, &i_fm)) ||
+          (!bin_read32(pIn, &i_am))) {
+        status = 0;
+      }
+      if (status) {
+        if ((fop < GENERATOR_F_MINVAL) || (fop > GENERATOR_F_MAXVAL) ||
+            (fop == GENERATOR_F_TABLE) ||
+            (!isfinite(fv)) || (!(fv >= 0.0)) || (!isfinite(fv2)) ||
+            (!adsr_check(env[0], env[1], env[2], env[3])) ||
+            (i_fm < -1) || (i_fm >= count) ||
+            (i_am < -1) || (i_am >= count)) {
+          status = 0;
+        }
+      }
+      if (status) {
+        pa = adsr_raw(env[0], env[1], env[2], env[3]);
+        pNew = generator_op(
+                (int) fop,
+                fv,
+                fv2,
+                pa,
+                (i_fm >= 0) ? ppNode[i_fm] : NULL,
+                (i_am >= 0) ? ppNode[i_am] : NULL,
+                NULL,
+                samp_rate);
+        adsr_release(pa);
+        pa = NULL;
+      }
+      
+    } else if (status) {
+      /* Unrecognized node type */
+      status = 0;
+    }
+    
+    /* Append any new node to the node array */
+    if (status && (pNew != NULL)) {
+      if (count >= BIN_MAXNODE) {
+        status = 0;
+      }
+      
+      if (status && (count >= cap)) {
+        if (cap < 1) {
+          cap = 16;
+        } else {
+          cap *= 2;
+        }
+        ppNode = (GENERATOR **) realloc(
+                    ppNode, ((size_t) cap) * sizeof(GENERATOR *));
+        if (ppNode == NULL) {
+          abort();
+        }
+      }
+      
+      if (status) {
+        ppNode[count] = pNew;
+        count++;
+        pNew = NULL;
+      }
+    }
+    
+    /* Release new node if it wasn't transferred */
+    generator_release(pNew);
+    pNew = NULL;
+  }
+  
+  /* Release the node array */
+  for(i = 0; i < count; i++) {
+    generator_release(ppNode[i]);
+    ppNode[i] = NULL;
+  }
+  if (ppNode != NULL) {
+    free(ppNode);
+    ppNode = NULL;
+  }
+  
+  /* If failed, release any result */
+  if (!status) {
+    generator_release(result);
+    result = NULL;
+  }
+  
+  /* Return result or NULL */
+  return result;
+}
+
+/*
+ * generator_compile function.
+ */
+GENERATOR *generator_compile(GENERATOR *pg) {
+  
+  GENERATOR *result = NULL;
+  COMPILE_MEMO memo;
+  int32_t i = 0;
+  
+  /* Initialize structures */
+  memset(&memo, 0, sizeof(COMPILE_MEMO));
+  memo.count = 0;
+  memo.cap = 0;
+  memo.ppOld = NULL;
+  memo.ppNew = NULL;
+  
+  /* Check parameter */
+  if (pg == NULL) {
+    abort();
+  }
+  
+  /* Compile the graph */
+  result = compile_node(pg, &memo);
+  
+  /* Release the memo */
+  for(i = 0; i < memo.count; i++) {
+    generator_release((memo.ppNew)[i]);
+    (memo.ppNew)[i] = NULL;
+  }
+  if (memo.ppOld != NULL) {
+    free(memo.ppOld);
+    memo.ppOld = NULL;
+  }
+  if (memo.ppNew != NULL) {
+    free(memo.ppNew);
+    memo.ppNew = NULL;
+  }
+  
+  /* Return the compiled generator */
+  return result;
+}
@@ -7,13 +7,15 @@
  * 
  * Definition of the generator object class.
  * 
- * Compile with adsr module.
+ * Compile with adsr and wavetbl modules.
  * 
  * The math library may also be required, with -lm
  */
 
 #include "retrodef.h"
 #include "adsr.h"
+#include "wavetbl.h"
+#include <stdio.h>
 
 /*
  * Constants
@@ -25,12 +27,23 @@
  * 
  * GENERATOR_F_MINVAL and GENERATOR_F_MAXVAL are the minimum and maximum
  * valid values.  They should be kept updated appropriately.
+ * 
+ * The square, triangle, sawtooth, and pulse functions are band-limited
+ * wave tables from the wavetbl module, which automatically drop the
+ * harmonics that would exceed the Nyquist limit.  The pulse function
+ * has a duty cycle of 25%.  The table function uses a wave table that
+ * is passed to generator_op(), such as a table loaded from a file.
  */
 #define GENERATOR_F_SINE      (1)   /* Sine wave function     */
 #define GENERATOR_F_NOISE     (2)   /* White noise function   */
+#define GENERATOR_F_SQUARE    (3)   /* Square wave function   */
+#define GENERATOR_F_TRIANGLE  (4)   /* Triangle wave function */
+#define GENERATOR_F_SAWTOOTH  (5)   /* Sawtooth wave function */
+#define GENERATOR_F_PULSE     (6)   /* Pulse wave function    */
+#define GENERATOR_F_TABLE     (7)   /* User wave table        */
 
 #define GENERATOR_F_MINVAL (1)
-#define GENERATOR_F_MAXVAL (2)
+#define GENERATOR_F_MAXVAL (7)
 
 /*
  * Type declarations
@@ -90,7 +103,7 @@ typedef struct {
    * This is -2 if the operator frequency has exceeded the limit and the
    * operator is now disabled.
    */
-  int32_t t;
+  int64_t t;
   
   /*
    * The duration in samples of the event being rendered by this
@@ -98,7 +111,20 @@ typedef struct {
    * 
    * This does NOT include release samples added by the ADSR envelope.
    */
-  int32_t dur;
+  int64_t dur;
+  
+  /*
+   * The control-rate state for the ADSR envelope.
+   */
+  ADSR_CTL ctl;
+  
+  /*
+   * The state of the pseudo-random generator used by NOISE functions.
+   * 
+   * Each instance has its own state, so that renders running at the
+   * same time do not disturb each other's noise.
+   */
+  uint32_t noise;
   
 } GENERATOR_OPDATA;
 
@@ -122,8 +148,16 @@ typedef struct {
  * greater than zero.
  * 
  * dur is the duration in samples of the event being rendered.  This is
- * necessary to use the ADSR envelope.  It must be greater than zero.
- * This does NOT include any release samples added by the ADSR envelope.
+ * necessary to use the ADSR envelope.  It must be in range [1,
+ * MAX_TIME].  This does NOT include any release samples added by the
+ * ADSR envelope.
+ * 
+ * period is the control period for the ADSR envelope, which is passed
+ * through to adsr_ctlreset().  It must be in range [1, CONTROL_MAX].
+ * 
+ * seed is the starting state of the pseudo-random generator for NOISE
+ * functions.  Any value is acceptable.  Callers should vary the seed
+ * between instances so that every event does not get the same noise.
  * 
  * Parameters:
  * 
@@ -132,11 +166,17 @@ typedef struct {
  *   freq - the frequency that is being rendered, in Hz
  * 
  *   dur - the duration in samples of the event being rendered
+ * 
+ *   period - the ADSR control period
+ * 
+ *   seed - the noise seed
  */
 void generator_opdata_init(
     GENERATOR_OPDATA * pod,
     double             freq,
-    int32_t            dur);
+    int64_t            dur,
+    int32_t            period,
+    uint32_t           seed);
 
 /*
  * Construct an additive generator, which mixes together the output of
@@ -257,6 +297,11 @@ GENERATOR *generator_clip(GENERATOR *pBase, double level);
  * released.  If provided, the output of the AM generator will be added
  * to the amplitude generated by the ADSR envelope at each time unit.
  * 
+ * pTable is the wave table object to use for TABLE type operators.  It
+ * must be non-NULL for TABLE operators, and it must be NULL for all
+ * other operator functions.  If provided, a reference to the wave table
+ * is added, which will be released when this operator is released.
+ * 
  * samp_rate is the sampling rate of the audio that is being generated.
  * It must be either RATE_CD or RATE_DVD.  It is ignored for NOISE type
  * operators.
@@ -275,6 +320,8 @@ GENERATOR *generator_clip(GENERATOR *pBase, double level);
  * 
  *   pAM - the amplitude modulation generator, or NULL
  * 
+ *   pTable - the wave table for TABLE operators, or NULL
+ * 
  *   samp_rate - the sampling rate, in Hz
  *
  * Return:
@@ -288,6 +335,7 @@ GENERATOR *generator_op(
     ADSR_OBJ  * pAmp,
     GENERATOR * pFM,
     GENERATOR * pAM,
+    WAVETBL   * pTable,
     int32_t     samp_rate);
 
 /*
@@ -356,7 +404,7 @@ double generator_invoke(
     GENERATOR        * pg,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count,
-    int32_t            t);
+    int64_t            t);
 
 /*
  * Determine the total length in samples of the sound that is being
@@ -403,11 +451,57 @@ double generator_invoke(
  * 
  *   the total length in samples
  */
-int32_t generator_length(
+int64_t generator_length(
     GENERATOR        * pg,
     GENERATOR_OPDATA * pods,
     int32_t            pod_count);
 
+/*
+ * Determine an upper bound on the absolute value of every sample that a
+ * specific generator instance can still produce.
+ * 
+ * Before using this function, you must bind all generators by using
+ * generator_bind() on the generator object or a fault occurs.
+ * 
+ * pg, pods, and pod_count have the same meaning as for the function
+ * generator_invoke().
+ * 
+ * t is the sample offset, which must be zero or greater.  The bound
+ * covers all samples at t and after t.  This function does not change
+ * the instance data, so it may be called at any time without
+ * disturbing the sequence of generator_invoke() calls.
+ * 
+ * Operators are bounded by their ADSR envelope from t onwards plus the
+ * bound of any amplitude modulator.  Operators that have been disabled
+ * because their frequency exceeded the limit have a bound of zero.
+ * Additive generators add the bounds of their components, scaling
+ * generators scale the bound of the underlying generator, and clip
+ * generators clip it.
+ * 
+ * The bound is conservative: the actual samples may be much smaller.
+ * If the bound can't be computed as a finite value, HUGE_VAL is
+ * returned.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator object to query
+ * 
+ *   pods - the instance data structures
+ * 
+ *   pod_count - the number of instance data structures
+ * 
+ *   t - the sample time offset
+ * 
+ * Return:
+ * 
+ *   the upper bound, zero or greater
+ */
+double generator_peak(
+    GENERATOR        * pg,
+    GENERATOR_OPDATA * pods,
+    int32_t            pod_count,
+    int64_t            t);
+
 /*
  * Recursively bind a generator object and all generator objects that
  * can be reached from the generator object.
@@ -440,4 +534,137 @@ int32_t generator_length(
  */
 int32_t generator_bind(GENERATOR *pg, int32_t start);
 
+/*
+ * Determine whether the output of a generator object is fixed.
+ * 
+ * A generator is fixed if every sample it produces is determined only
+ * by the frequency and duration passed to generator_opdata_init() and
+ * by the time offset.  This is the case unless a NOISE operator can be
+ * reached from the generator object, since noise is drawn from the
+ * random number generator.
+ * 
+ * The samples of a fixed generator can be rendered once and reused for
+ * every event with the same frequency and duration.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator to check
+ * 
+ * Return:
+ * 
+ *   non-zero if the generator is fixed, zero if not
+ */
+int generator_fixed(GENERATOR *pg);
+
+/*
+ * Compile a generator graph into a simpler graph that produces the same
+ * output.
+ * 
+ * This is a specialization pass that can be run once when a generator
+ * map is loaded, before generator_bind().  genmap_run() runs it when
+ * asked to, see instr_simplify().  The following transformations are
+ * performed throughout the graph:
+ * 
+ *   (1) Scaling generators that scale by exactly one are removed.
+ * 
+ *   (2) Nested clip generators are merged into a single clip generator
+ *       at the lower level.
+ * 
+ * Only transformations that give bit-for-bit the same samples are
+ * performed.  Multiplying by one never changes a value, and clipping
+ * only ever touches finite values, so clipping twice is the same as
+ * clipping once at the lower level.  Nested scales are not merged and
+ * additive generators are not flattened, since the product of two
+ * scales and a regrouped sum can round differently, and additive
+ * generators replace non-finite values with zero.
+ * 
+ * Operators are never removed, and any operator or other generator that
+ * was shared within the original graph remains shared within the
+ * compiled graph.  The order in which operators are invoked is also
+ * preserved, so the compiled graph binds to the same instance data
+ * layout.
+ * 
+ * None of the operators reachable from pg may be bound yet, or a fault
+ * occurs.  The original graph is not modified.  The returned generator
+ * has a new reference, which the caller should eventually release.  It
+ * may be pg itself if nothing could be simplified.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator graph to compile
+ * 
+ * Return:
+ * 
+ *   a new reference to the compiled generator graph
+ */
+GENERATOR *generator_compile(GENERATOR *pg);
+
+/*
+ * Write a generator graph to a file in a binary format.
+ * 
+ * The graph can later be restored with generator_restore(), which
+ * avoids having to interpret the generator map script again.  Shared
+ * generators within the graph remain shared in the restored graph, and
+ * the order of operators is preserved, so the restored graph binds to
+ * the same instance data layout.
+ * 
+ * Graphs that contain TABLE operators can't be saved, because the wave
+ * table is supplied by the client rather than being part of the graph.
+ * The binary format is only intended for caching on the same machine,
+ * since floating-point values are stored as their raw bit patterns.
+ * 
+ * The graph may be bound or unbound; the binding is not saved.
+ * 
+ * Parameters:
+ * 
+ *   pg - the generator graph to write
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the graph can't be saved or there
+ *   was an I/O error
+ */
+int generator_save(GENERATOR *pg, FILE *pOut);
+
+/*
+ * Build the lookup tables that are shared by all generators.
+ * 
+ * generator_op() calls this function whenever it creates a sine
+ * operator, so the tables are always built before any generator reads
+ * them.  Calling this function moves the work to an earlier time, for
+ * example into a parent process before it forks jobs that would
+ * otherwise each build their own copy.
+ * 
+ * The tables are built while holding os_global_lock(), and never change
+ * afterwards.  render_alloc() calls this function, so that renders
+ * running in different threads only ever read the tables.
+ */
+void generator_tables(void);
+
+/*
+ * Read a generator graph written by generator_save().
+ * 
+ * samp_rate is the sampling rate to construct the operators for, which
+ * must be RATE_CD or RATE_DVD.  Since ADSR envelopes are stored in
+ * samples, this should be the same sampling rate that was in effect
+ * when the graph was constructed.
+ * 
+ * All values in the binary data are checked, so corrupt data results
+ * in NULL rather than a fault.  The returned graph is unbound and has a
+ * reference count of one.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file to read from
+ * 
+ *   samp_rate - the sampling rate
+ * 
+ * Return:
+ * 
+ *   the restored generator graph, or NULL if the data is not valid
+ */
+GENERATOR *generator_restore(FILE *pIn, int32_t samp_rate);
+
 #endif
@@ -30,6 +30,7 @@
 #define GENVAR_ATOM   (3)
 #define GENVAR_ADSR   (4)
 #define GENVAR_GENOBJ (5)
+#define GENVAR_TABLE  (6)
 
 /*
  * VARCELL status values.
@@ -70,6 +71,10 @@
 #define ATOM_AM           (6)
 #define ATOM_SINE         (7)
 #define ATOM_NOISE        (8)
+#define ATOM_SQUARE       (9)
+#define ATOM_TRIANGLE     (10)
+#define ATOM_SAWTOOTH     (11)
+#define ATOM_PULSE        (12)
 
 /*
  * Arithmetic operations.
@@ -185,6 +190,11 @@ typedef struct {
      */
     GENERATOR *pGen;
     
+    /*
+     * Wave table object reference for GENVAR_TABLE.
+     */
+    WAVETBL *pTable;
+    
   } val;
   
 } GENVAR;
@@ -312,12 +322,14 @@ static double genvar_getFloat(const GENVAR *pgv);
 static int genvar_getAtom(const GENVAR *pgv);
 static ADSR_OBJ *genvar_getADSR(const GENVAR *pgv);
 static GENERATOR *genvar_getGen(const GENVAR *pgv);
+static WAVETBL *genvar_getTable(const GENVAR *pgv);
 
 static void genvar_setInt(GENVAR *pgv, int32_t v);
 static void genvar_setFloat(GENVAR *pgv, double v);
 static void genvar_setAtom(GENVAR *pgv, int atom);
 static void genvar_setADSR(GENVAR *pgv, ADSR_OBJ *pADSR);
 static void genvar_setGen(GENVAR *pgv, GENERATOR *pGen);
+static void genvar_setTable(GENVAR *pgv, WAVETBL *pTable);
 
 static ISTATE *istate_new(NAME_DICT *pNames);
 static void istate_free(ISTATE *ps);
@@ -395,11 +407,13 @@ static int op_arith(
     int       op);
 
 static int interpret(
-    ISTATE   * ps,
-    SNSOURCE * pIn,
-    int      * perr,
-    long     * pline,
-    int32_t    samp_rate);
+    ISTATE          * ps,
+    SNSOURCE        * pIn,
+    int             * perr,
+    long            * pline,
+    int32_t           samp_rate,
+    genmap_fp_table   fTable,
+    void            * pCustom);
 
 /*
  * Initialize a GENVAR structure and set it to undefined.
@@ -453,6 +467,10 @@ static void genvar_clear(GENVAR *pgv) {
   } else if (pgv->vtype == GENVAR_GENOBJ) {
     generator_release((pgv->val).pGen);
     (pgv->val).pGen = NULL;
+    
+  } else if (pgv->vtype == GENVAR_TABLE) {
+    wavetbl_release((pgv->val).pTable);
+    (pgv->val).pTable = NULL;
   }
   
   /* Clear the structure back to undefined */
@@ -503,6 +521,9 @@ static void genvar_copy(GENVAR *pDest, const GENVAR *pSrc) {
       
     } else if (pDest->vtype == GENVAR_GENOBJ) {
       generator_addref((pDest->val).pGen);
+      
+    } else if (pDest->vtype == GENVAR_TABLE) {
+      wavetbl_addref((pDest->val).pTable);
     }
   }
 }
@@ -753,6 +774,40 @@ static GENERATOR *genvar_getGen(const GENVAR *pgv) {
   return (pgv->val).pGen;
 }
 
+/*
+ * Return the wave table object stored in a GENVAR structure.
+ * 
+ * The given structure must already be initialized.  The type held in
+ * the structure must be a wave table object reference or a fault
+ * occurs.  Use the function genvar_type() to check the type.
+ * 
+ * The reference count of the returned wave table object is not
+ * modified by this function.
+ * 
+ * Parameters:
+ * 
+ *   pgv - the initialized structure
+ * 
+ * Return:
+ * 
+ *   the wave table object reference contained within
+ */
+static WAVETBL *genvar_getTable(const GENVAR *pgv) {
+  
+  /* Check parameters */
+  if (pgv == NULL) {
+    abort();
+  }
+  
+  /* Check type */
+  if (pgv->vtype != GENVAR_TABLE) {
+    abort();
+  }
+  
+  /* Return the object reference */
+  return (pgv->val).pTable;
+}
+
 /*
  * Set an integer value in the given GENVAR structure.
  * 
@@ -924,6 +979,43 @@ static void genvar_setGen(GENVAR *pgv, GENERATOR *pGen) {
   generator_addref(pGen);
 }
 
+/*
+ * Set a wave table object reference in the given GENVAR structure.
+ * 
+ * The given structure must already be initialized.  It will first be
+ * cleared using genvar_clear() and then the given wave table object
+ * reference will be written into it.
+ * 
+ * The reference count of the wave table object will be incremented by
+ * this function.
+ * 
+ * CAUTION:  The same caution applies as for genvar_setGen().  Use
+ * genvar_copy() to copy references safely between GENVAR structures.
+ * 
+ * Parameters:
+ * 
+ *   pgv - the initialized structure
+ * 
+ *   pTable - the wave table object reference to store
+ */
+static void genvar_setTable(GENVAR *pgv, WAVETBL *pTable) {
+  
+  /* Check parameters */
+  if ((pgv == NULL) || (pTable == NULL)) {
+    abort();
+  }
+  
+  /* Clear to undefined */
+  genvar_clear(pgv);
+  
+  /* Write the object reference */
+  pgv->vtype = GENVAR_TABLE;
+  (pgv->val).pTable = pTable;
+  
+  /* Increment reference count */
+  wavetbl_addref(pTable);
+}
+
 /*
  * Allocate a new interpreter state object.
  * 
@@ -2148,6 +2240,18 @@ static int atom_map(const char *pName) {
   } else if (strcmp(pName, "noise") == 0) {
     result = ATOM_NOISE;
   
+  } else if (strcmp(pName, "square") == 0) {
+    result = ATOM_SQUARE;
+  
+  } else if (strcmp(pName, "triangle") == 0) {
+    result = ATOM_TRIANGLE;
+  
+  } else if (strcmp(pName, "sawtooth") == 0) {
+    result = ATOM_SAWTOOTH;
+  
+  } else if (strcmp(pName, "pulse") == 0) {
+    result = ATOM_PULSE;
+  
   } else {
     /* Unrecognized atom */
     result = -1;
@@ -2542,6 +2646,7 @@ static int op_operator(
   double val_freq_boost = 0.0;
   GENERATOR *val_fm = NULL;
   GENERATOR *val_am = NULL;
+  WAVETBL *val_table = NULL;
   
   /* Initialize structures */
   genvar_init(&gv);
@@ -2634,14 +2739,23 @@ static int op_operator(
               def_fop = 1;
             }
             
-            /* Check type of value */
-            if (status && (genvar_type(&gv) != GENVAR_ATOM)) {
+            /* Check type of value, which is either an atom or a wave
+             * table reference */
+            if (status && (genvar_type(&gv) != GENVAR_ATOM) &&
+                  (genvar_type(&gv) != GENVAR_TABLE)) {
               status = 0;
               *perr = GENMAP_ERR_PARAMTYP;
             }
             
+            /* If a wave table was given, use the table function */
+            if (status && (genvar_type(&gv) == GENVAR_TABLE)) {
+              val_fop = GENERATOR_F_TABLE;
+              val_table = genvar_getTable(&gv);
+              wavetbl_addref(val_table);
+            }
+            
             /* Write appropriate value */
-            if (status) {
+            if (status && (genvar_type(&gv) == GENVAR_ATOM)) {
               switch (genvar_getAtom(&gv)) {
                 
                 case ATOM_SINE:
@@ -2652,6 +2766,22 @@ static int op_operator(
                   val_fop = GENERATOR_F_NOISE;
                   break;
                 
+                case ATOM_SQUARE:
+                  val_fop = GENERATOR_F_SQUARE;
+                  break;
+                
+                case ATOM_TRIANGLE:
+                  val_fop = GENERATOR_F_TRIANGLE;
+                  break;
+                
+                case ATOM_SAWTOOTH:
+                  val_fop = GENERATOR_F_SAWTOOTH;
+                  break;
+                
+                case ATOM_PULSE:
+                  val_fop = GENERATOR_F_PULSE;
+                  break;
+                
                 default:
                   /* Unrecognized atom for wave function */
                   status = 0;
@@ -2822,6 +2952,7 @@ static int op_operator(
                 val_adsr,
                 val_fm,
                 val_am,
+                val_table,
                 samp_rate);
   }
   
@@ -2846,6 +2977,9 @@ static int op_operator(
   generator_release(val_am);
   val_am = NULL;
   
+  wavetbl_release(val_table);
+  val_table = NULL;
+  
   /* Clear structures */
   genvar_clear(&gv);
   
@@ -3335,6 +3469,11 @@ static int op_arith(
  * samp_rate is the sampling rate, which must be either RATE_CD or
  * RATE_DVD.
  * 
+ * fTable is the wave table resolver, or NULL if wave tables are not
+ * supported.  See genmap_run() for further information.
+ * 
+ * pCustom is passed through to fTable.
+ * 
  * Upon successful return, the interpreter state object will hold the
  * state of the interpreter at the end of the script.
  * 
@@ -3350,22 +3489,29 @@ static int op_arith(
  * 
  *   samp_rate - the sampling rate
  * 
+ *   fTable - the wave table resolver, or NULL
+ * 
+ *   pCustom - custom data passed to the resolver
+ * 
  * Return:
  * 
  *   non-zero if successful, zero if script interpretation failed
  */
 static int interpret(
-    ISTATE   * ps,
-    SNSOURCE * pIn,
-    int      * perr,
-    long     * pline,
-    int32_t    samp_rate) {
+    ISTATE          * ps,
+    SNSOURCE        * pIn,
+    int             * perr,
+    long            * pline,
+    int32_t           samp_rate,
+    genmap_fp_table   fTable,
+    void            * pCustom) {
   
   int status = 1;
   int ival = 0;
   int32_t i32val = 0;
   double dval = 0.0;
   char *endptr = NULL;
+  WAVETBL *pTable = NULL;
   SNPARSER *pp = NULL;
   SNENTITY ent;
   GENVAR gv;
@@ -3443,35 +3589,59 @@ static int interpret(
       /* We read a non-EOF token, so handle the different token types */
       if (ent.status == SNENTITY_STRING) {
         /* String literal -- we only supported double-quoted strings
-         * with no prefix */
+         * with no prefix or a "table" prefix */
         if ((ent.str_type != SNSTRING_QUOTED) ||
-            ((ent.pKey)[0] != 0)) {
+            (((ent.pKey)[0] != 0) &&
+              (strcmp(ent.pKey, "table") != 0))) {
           status = 0;
           *perr = GENMAP_ERR_ENTTYPE;
           *pline = snparser_count(pp);
         }
         
-        /* Convert string value to atom */
-        if (status) {
-          ival = atom_map(ent.pValue);
-          if (ival < 0) {
+        /* If there is a "table" prefix, resolve the wave table and
+         * push a reference to it; otherwise, convert to an atom */
+        if (status && ((ent.pKey)[0] != 0)) {
+          if (fTable != NULL) {
+            pTable = fTable(pCustom, ent.pValue);
+          }
+          if (pTable == NULL) {
             status = 0;
-            *perr = GENMAP_ERR_ATOM;
+            *perr = GENMAP_ERR_TABLE;
             *pline = snparser_count(pp);
           }
-        }
-        
-        /* Write atom integer value into local structure */
-        if (status) {
-          genvar_setAtom(&gv, ival);
-        }
+          
+          if (status) {
+            genvar_setTable(&gv, pTable);
+            if (!istate_push(ps, &gv, perr)) {
+              status = 0;
+              *pline = snparser_count(pp);
+            }
+          }
+          
+          wavetbl_release(pTable);
+          pTable = NULL;
         
-        /* Push atom onto stack */
-        if (status) {
-          if (!istate_push(ps, &gv, perr)) {
+        } else if (status) {
+          /* Convert string value to atom */
+          ival = atom_map(ent.pValue);
+          if (ival < 0) {
             status = 0;
+            *perr = GENMAP_ERR_ATOM;
             *pline = snparser_count(pp);
           }
+          
+          /* Write atom integer value into local structure */
+          if (status) {
+            genvar_setAtom(&gv, ival);
+          }
+          
+          /* Push atom onto stack */
+          if (status) {
+            if (!istate_push(ps, &gv, perr)) {
+              status = 0;
+              *pline = snparser_count(pp);
+            }
+          }
         }
       
       } else if (ent.status == SNENTITY_NUMERIC) {
@@ -3775,9 +3945,12 @@ static int interpret(
  * genmap_run function.
  */
 void genmap_run(
-    SNSOURCE      * pIn,
-    GENMAP_RESULT * pResult,
-    int32_t         samp_rate) {
+    SNSOURCE        * pIn,
+    GENMAP_RESULT   * pResult,
+    int32_t           samp_rate,
+    int               compile,
+    genmap_fp_table   fTable,
+    void            * pCustom) {
   
   int status = 1;
   NAME_LINK *pNames = NULL;
@@ -3851,7 +4024,9 @@ void genmap_run(
           pIn,
           &(pResult->errcode),
           &(pResult->linenum),
-          samp_rate)) {
+          samp_rate,
+          fTable,
+          pCustom)) {
       status = 0;
     }
   }
@@ -3893,12 +4068,17 @@ void genmap_run(
     pResult->linenum = 0;
   }
   
-  /* Fill in result object and bind generators */
+  /* Fill in result object, simplifying the generator map if requested,
+   * and bind generators */
   if (status) {
     pResult->errcode = GENMAP_OK;
     pResult->linenum = 0;
-    pResult->pRoot = genvar_getGen(&gv);
-    generator_addref(pResult->pRoot);
+    if (compile) {
+      pResult->pRoot = generator_compile(genvar_getGen(&gv));
+    } else {
+      pResult->pRoot = genvar_getGen(&gv);
+      generator_addref(pResult->pRoot);
+    }
     pResult->icount = generator_bind(pResult->pRoot, 0);
   }
   
@@ -4035,6 +4215,10 @@ const char *genmap_errstr(int code) {
         pResult = "Arithmetic error during interpretation";
         break;
       
+      case GENMAP_ERR_TABLE:
+        pResult = "Can't load wave table";
+        break;
+      
       default:
         pResult = "Unknown error";
     }
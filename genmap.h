@@ -11,7 +11,7 @@
  * See "genmap.txt" in the doc directory for an example generator map
  * Shastina script.
  * 
- * Compile with adsr and generator modules of Retro.
+ * Compile with adsr, generator, and wavetbl modules of Retro.
  * 
  * Also requires libshastina, beta version 0.9.3 or compatible.
  * 
@@ -60,12 +60,36 @@
 #define GENMAP_ERR_OPREDEF  (21)  /* op parameter redefined */
 #define GENMAP_ERR_OPMISS   (22)  /* Missing required op parameter */
 #define GENMAP_ERR_ARITH    (23)  /* Arithmetic error */
+#define GENMAP_ERR_TABLE    (24)  /* Can't load wave table */
 
 /*
  * Type declarations
  * -----------------
  */
 
+/*
+ * Function pointer type for a wave table resolver.
+ * 
+ * pCustom is the custom data pointer that was passed to genmap_run().
+ * 
+ * pName is the name of a wave table given in the generator map script.
+ * The resolver returns a new reference to the named wave table, or
+ * NULL if the name can't be resolved or the wave table can't be loaded.
+ * The interpreter will release the returned reference when it is done
+ * with it.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the custom data pointer
+ * 
+ *   pName - the name of the wave table
+ * 
+ * Return:
+ * 
+ *   a new reference to the wave table, or NULL
+ */
+typedef WAVETBL *(*genmap_fp_table)(void *pCustom, const char *pName);
+
 /*
  * Structure storing the result of interpreting a generator map Shastina
  * script.
@@ -136,6 +160,16 @@ typedef struct {
  * 
  * samp_rate is the sampling rate.  It must be RATE_CD or RATE_DVD.
  * 
+ * If compile is non-zero, the generator graph is simplified with
+ * generator_compile() before it is bound.  The output is exactly the
+ * same either way.
+ * 
+ * fTable is the wave table resolver, which is called for each
+ * table"name" string literal in the script.  If NULL, wave tables are
+ * not supported and any table"name" literal is an error.
+ * 
+ * pCustom is passed through to each call of fTable.  It may be NULL.
+ * 
  * CAUTION:  Do not use a result structure more than once unless you
  * free any generator within it.  Otherwise, a memory leak will occur.
  * 
@@ -149,11 +183,22 @@ typedef struct {
  *   pPass - the result of the first pass
  * 
  *   pResult - the structure to receive the interpretation result
+ * 
+ *   samp_rate - the sampling rate
+ * 
+ *   compile - non-zero to simplify the generator graph
+ * 
+ *   fTable - the wave table resolver, or NULL
+ * 
+ *   pCustom - custom data passed to the resolver
  */
 void genmap_run(
-    SNSOURCE      * pIn,
-    GENMAP_RESULT * pResult,
-    int32_t         samp_rate);
+    SNSOURCE        * pIn,
+    GENMAP_RESULT   * pResult,
+    int32_t           samp_rate,
+    int               compile,
+    genmap_fp_table   fTable,
+    void            * pCustom);
 
 /*
  * Convert an error code in the GENMAP_RESULT structure to a string.
@@ -25,9 +25,9 @@ typedef struct {
    * 
    * If this is -1, then the element is currently undefined.
    * 
-   * Otherwise, the range is zero or greater.
+   * Otherwise, the range is [0, MAX_TIME].
    */
-  int32_t t;
+  int64_t t;
   
   /*
    * The starting intensity of this node.
@@ -76,6 +76,131 @@ struct GRAPH_OBJ_TAG {
   GRAPH_NODE n[1];
 };
 
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t graph_find(GRAPH_OBJ *pg, int64_t t);
+static int32_t graph_seek(GRAPH_OBJ *pg, int32_t cur, int64_t t);
+
+/*
+ * Find the index of the element that a given t offset is within.
+ * 
+ * This is the element with the greatest t value that is less than or
+ * equal to t.  Since the first element always has a t value of zero,
+ * there is always such an element.
+ * 
+ * pg is the graph object.  The caller must have already checked that
+ * all elements are defined.  t must be zero or greater.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph object
+ * 
+ *   t - the time offset
+ * 
+ * Return:
+ * 
+ *   the index of the element containing t
+ */
+static int32_t graph_find(GRAPH_OBJ *pg, int64_t t) {
+  
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  int64_t midt = 0;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (t < 0)) {
+    abort();
+  }
+  
+  /* We're looking for the element with the greatest t value that is
+   * less than or equal to t */
+  lo = 0;
+  hi = pg->ecount - 1;
+  while (lo < hi) {
+    
+    /* Figure out a midpoint that is greater than lo */
+    mid = lo + ((hi - lo) / 2);
+    if (mid <= lo) {
+      mid = lo + 1;
+    }
+    
+    /* Get midpoint t value */
+    midt = ((pg->n)[mid]).t;
+    
+    /* Compare t to midpoint t */
+    if (t > midt) {
+      /* t greater than midpoint, so set low bound to midpoint */
+      lo = mid;
+      
+    } else if (t < midt) {
+      /* t less than midpoint, so set high bound to one less than
+       * midpoint */
+      hi = mid - 1;
+      
+    } else if (t == midt) {
+      /* t equals midpoint, so zoom in on it */
+      lo = mid;
+      hi = mid;
+      
+    } else {
+      /* Shouldn't happen */
+      abort();
+    }
+  }
+  
+  /* Return the index we zoomed in on */
+  return lo;
+}
+
+/*
+ * Find the index of the element that a given t offset is within, given
+ * a cursor that may already be at or before that element.
+ * 
+ * If the element at the cursor begins at or before t, the cursor just
+ * advances through the following elements.  Otherwise, graph_find() is
+ * used.  The result is the same as graph_find() in either case.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph object
+ * 
+ *   cur - the cursor
+ * 
+ *   t - the time offset
+ * 
+ * Return:
+ * 
+ *   the index of the element containing t
+ */
+static int32_t graph_seek(GRAPH_OBJ *pg, int32_t cur, int64_t t) {
+  
+  /* Check parameters */
+  if ((pg == NULL) || (t < 0)) {
+    abort();
+  }
+  
+  /* Use the cursor if it is valid and not after t; else, search */
+  if ((cur >= 0) && (cur < pg->ecount) && (((pg->n)[cur]).t <= t)) {
+    while (cur < pg->ecount - 1) {
+      if (((pg->n)[cur + 1]).t > t) {
+        break;
+      }
+      cur++;
+    }
+    
+  } else {
+    cur = graph_find(pg, t);
+  }
+  
+  /* Return the element */
+  return cur;
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -160,7 +285,7 @@ void graph_release(GRAPH_OBJ *pg) {
 void graph_set(
     GRAPH_OBJ * pg,
     int32_t     i,
-    int32_t     t,
+    int64_t     t,
     int32_t     ra,
     int32_t     rb) {
   
@@ -173,7 +298,7 @@ void graph_set(
   if ((i < 0) || (i >= pg->ecount)) {
     abort();
   }
-  if (t < 0) {
+  if ((t < 0) || (t > MAX_TIME)) {
     abort();
   }
   if ((ra < 0) || (ra > MAX_FRAC)) {
@@ -225,15 +350,12 @@ void graph_set(
 /*
  * graph_get function.
  */
-int16_t graph_get(GRAPH_OBJ *pg, int32_t t) {
+int16_t graph_get(GRAPH_OBJ *pg, int64_t t) {
   
   int32_t lo = 0;
-  int32_t hi = 0;
-  int32_t mid = 0;
-  int32_t midt = 0;
-  int32_t e_len = 0;
   int32_t result = 0;
-  int32_t offset = 0;
+  int64_t e_len = 0;
+  int64_t offset = 0;
   GRAPH_NODE *pe = NULL;
   
   /* Check parameters */
@@ -246,41 +368,8 @@ int16_t graph_get(GRAPH_OBJ *pg, int32_t t) {
     abort();
   }
   
-  /* We're looking for the element with the greatest t value that is
-   * less than or equal to t */
-  lo = 0;
-  hi = pg->ecount - 1;
-  while (lo < hi) {
-    
-    /* Figure out a midpoint that is greater than lo */
-    mid = lo + ((hi - lo) / 2);
-    if (mid <= lo) {
-      mid = lo + 1;
-    }
-    
-    /* Get midpoint t value */
-    midt = ((pg->n)[mid]).t;
-    
-    /* Compare t to midpoint t */
-    if (t > midt) {
-      /* t greater than midpoint, so set low bound to midpoint */
-      lo = mid;
-      
-    } else if (t < midt) {
-      /* t less than midpoint, so set high bound to one less than
-       * midpoint */
-      hi = mid - 1;
-      
-    } else if (t == midt) {
-      /* t equals midpoint, so zoom in on it */
-      lo = mid;
-      hi = mid;
-      
-    } else {
-      /* Shouldn't happen */
-      abort();
-    }
-  }
+  /* Find the element that t is within */
+  lo = graph_find(pg, t);
   
   /* Get a pointer to the element t is within */
   pe = &((pg->n)[lo]);
@@ -297,10 +386,11 @@ int16_t graph_get(GRAPH_OBJ *pg, int32_t t) {
     /* We have a ramp, so determine offset within it */
     offset = t - pe->t;
     
-    /* Interpolate result */
-    result = (int32_t) (((((int64_t) offset) *
+    /* Interpolate result (the offset is less than MAX_TIME, so the
+     * product can't overflow) */
+    result = (int32_t) (((offset *
                           (((int64_t) pe->rb) - ((int64_t) pe->ra))) /
-                          ((int64_t) e_len)) +
+                          e_len) +
                             ((int64_t) pe->ra));
     
     /* Clamp result */
@@ -318,3 +408,276 @@ int16_t graph_get(GRAPH_OBJ *pg, int32_t t) {
   /* Return result */
   return (int16_t) result;
 }
+
+/*
+ * graph_run function.
+ */
+void graph_run(
+    GRAPH_OBJ * pg,
+    int32_t   * pcur,
+    int64_t     t,
+    int32_t     count,
+    int16_t   * pv) {
+  
+  int32_t e = 0;
+  int32_t k = 0;
+  int32_t n = 0;
+  int32_t result = 0;
+  int64_t e_len = 0;
+  int64_t offset = 0;
+  int64_t delta = 0;
+  GRAPH_NODE *pe = NULL;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pcur == NULL) || (t < 0) || (count < 0)) {
+    abort();
+  }
+  if ((count > 0) && (pv == NULL)) {
+    abort();
+  }
+  if (t > INT64_MAX - count) {
+    abort();
+  }
+  
+  /* Make sure all elements are defined */
+  if (((pg->n)[pg->ecount - 1]).t < 0) {
+    abort();
+  }
+  
+  /* Find the element of the first value */
+  e = graph_seek(pg, *pcur, t);
+  
+  /* Fill in the values one element at a time */
+  while (count > 0) {
+    
+    /* Move to the next element if this one has ended */
+    if (e < pg->ecount - 1) {
+      if (((pg->n)[e + 1]).t <= t) {
+        e++;
+      }
+    }
+    pe = &((pg->n)[e]);
+    
+    /* Determine how many values are in this element */
+    n = count;
+    if (e < pg->ecount - 1) {
+      if (((pg->n)[e + 1]).t - t < (int64_t) n) {
+        n = (int32_t) (((pg->n)[e + 1]).t - t);
+      }
+    }
+    
+    /* Compute the values */
+    if (pe->rb >= 0) {
+      /* We have a ramp, so interpolate each value the same way as
+       * graph_get() (the last element is never a ramp, so there is a
+       * next element here) */
+      e_len = ((pg->n)[e + 1]).t - pe->t;
+      offset = t - pe->t;
+      delta = ((int64_t) pe->rb) - ((int64_t) pe->ra);
+      for(k = 0; k < n; k++) {
+        result = (int32_t) ((((offset + k) * delta) / e_len) +
+                              ((int64_t) pe->ra));
+        if (result < 0) {
+          result = 0;
+        } else if (result > MAX_FRAC) {
+          result = MAX_FRAC;
+        }
+        pv[k] = (int16_t) result;
+      }
+      
+    } else {
+      /* We have a constant element, so just fill in the value */
+      for(k = 0; k < n; k++) {
+        pv[k] = pe->ra;
+      }
+    }
+    
+    /* Advance past these values */
+    pv += n;
+    t += n;
+    count -= n;
+  }
+  
+  /* Update the cursor */
+  *pcur = e;
+}
+
+/*
+ * graph_peak function.
+ */
+int16_t graph_peak(GRAPH_OBJ *pg, int64_t t0, int64_t t1) {
+  
+  int32_t x = 0;
+  int32_t v = 0;
+  int64_t te = 0;
+  int32_t result = 0;
+  GRAPH_NODE *pe = NULL;
+  
+  /* Check parameters */
+  if ((pg == NULL) || (t0 < 0) || (t1 < t0)) {
+    abort();
+  }
+  
+  /* Make sure all elements are defined */
+  if (((pg->n)[pg->ecount - 1]).t < 0) {
+    abort();
+  }
+  
+  /* Start with the value at the beginning of the range */
+  result = (int32_t) graph_get(pg, t0);
+  
+  /* Go through every element that overlaps the range -- since ramps
+   * are linear, the maximum within each element is at one of its
+   * boundaries */
+  for(x = graph_find(pg, t0); x < pg->ecount; x++) {
+    
+    /* Get the element and stop if it begins after the range */
+    pe = &((pg->n)[x]);
+    if (pe->t > t1) {
+      break;
+    }
+    
+    /* If the element begins within the range, check its start value */
+    if (pe->t > t0) {
+      if (pe->ra > result) {
+        result = pe->ra;
+      }
+    }
+    
+    /* If the element is a ramp, check its value at the last t within
+     * both the ramp and the range (the last element is never a ramp,
+     * so there is always a next element here) */
+    if (pe->rb >= 0) {
+      te = ((pg->n)[x + 1]).t - 1;
+      if (te > t1) {
+        te = t1;
+      }
+      v = (int32_t) graph_get(pg, te);
+      if (v > result) {
+        result = v;
+      }
+    }
+  }
+  
+  /* Return result */
+  return (int16_t) result;
+}
+
+/*
+ * graph_save function.
+ */
+int graph_save(GRAPH_OBJ *pg, FILE *pOut) {
+  
+  int status = 1;
+  int32_t x = 0;
+  int64_t t = 0;
+  int32_t rec[2];
+  
+  /* Initialize buffers */
+  memset(rec, 0, sizeof(rec));
+  
+  /* Check parameters */
+  if ((pg == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  
+  /* Make sure all elements are defined */
+  if (((pg->n)[pg->ecount - 1]).t < 0) {
+    abort();
+  }
+  
+  /* Write the element count */
+  if (fwrite(&(pg->ecount), sizeof(int32_t), 1, pOut) != 1) {
+    status = 0;
+  }
+  
+  /* Write each element */
+  for(x = 0; status && (x < pg->ecount); x++) {
+    t = ((pg->n)[x]).t;
+    rec[0] = ((pg->n)[x]).ra;
+    rec[1] = ((pg->n)[x]).rb;
+    if (fwrite(&t, sizeof(int64_t), 1, pOut) != 1) {
+      status = 0;
+    }
+    if (status) {
+      if (fwrite(rec, sizeof(int32_t), 2, pOut) != 2) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * graph_restore function.
+ */
+GRAPH_OBJ *graph_restore(FILE *pIn) {
+  
+  int status = 1;
+  int32_t count = 0;
+  int32_t x = 0;
+  int64_t prev = -1;
+  int64_t t = 0;
+  int32_t rec[2];
+  GRAPH_OBJ *pg = NULL;
+  
+  /* Initialize buffers */
+  memset(rec, 0, sizeof(rec));
+  
+  /* Check parameter */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Read and check the element count */
+  if (fread(&count, sizeof(int32_t), 1, pIn) != 1) {
+    status = 0;
+  }
+  if (status && ((count < 1) || (count > GRAPH_MAXCOUNT))) {
+    status = 0;
+  }
+  
+  /* Allocate the graph */
+  if (status) {
+    pg = graph_alloc(count);
+  }
+  
+  /* Read each element, checking it before it is set */
+  for(x = 0; status && (x < count); x++) {
+    if (fread(&t, sizeof(int64_t), 1, pIn) != 1) {
+      status = 0;
+    }
+    if (status) {
+      if (fread(rec, sizeof(int32_t), 2, pIn) != 2) {
+        status = 0;
+      }
+    }
+    if (status && ((t <= prev) || (t > MAX_TIME) ||
+          ((x == 0) && (t != 0)))) {
+      status = 0;
+    }
+    if (status && ((rec[0] < 0) || (rec[0] > MAX_FRAC) ||
+          (rec[1] < -1) || (rec[1] > MAX_FRAC))) {
+      status = 0;
+    }
+    if (status && (x >= count - 1) && (rec[1] >= 0) &&
+          (rec[1] != rec[0])) {
+      status = 0;
+    }
+    if (status) {
+      graph_set(pg, x, t, rec[0], rec[1]);
+      prev = t;
+    }
+  }
+  
+  /* Release the graph if there was an error */
+  if ((!status) && (pg != NULL)) {
+    graph_release(pg);
+    pg = NULL;
+  }
+  
+  /* Return the graph or NULL */
+  return pg;
+}
@@ -7,6 +7,8 @@
  * The graph module of the Retro synthesizer.
  */
 
+#include <stdio.h>
+
 #include "retrodef.h"
 
 /*
@@ -87,9 +89,10 @@ void graph_release(GRAPH_OBJ *pg);
  * 
  * pg is the graph object and i is the zero-based index of the element.
  * 
- * t is the time offset for the element.  The time offset of the first
- * element must be zero.  The time offset of any element elements after
- * the first must be greater than that of the previous element.
+ * t is the time offset for the element, which must not exceed
+ * MAX_TIME.  The time offset of the first element must be zero.  The
+ * time offset of any element elements after the first must be greater
+ * than that of the previous element.
  * 
  * ra is the intensity value of constant graph elements, and the
  * starting intensity of ramp graph elements.  rb is -1 for constant
@@ -116,7 +119,7 @@ void graph_release(GRAPH_OBJ *pg);
 void graph_set(
     GRAPH_OBJ * pg,
     int32_t     i,
-    int32_t     t,
+    int64_t     t,
     int32_t     ra,
     int32_t     rb);
 
@@ -141,6 +144,117 @@ void graph_set(
  * 
  *   the computed intensity according to the graph
  */
-int16_t graph_get(GRAPH_OBJ *pg, int32_t t);
+int16_t graph_get(GRAPH_OBJ *pg, int64_t t);
+
+/*
+ * Get the graph values for a run of consecutive t offsets.
+ * 
+ * pg is the graph object.  All elements must have been defined already
+ * using graph_set().
+ * 
+ * pcur points to a cursor, which is the index of the element that the
+ * previous run ended in.  A new cursor should be set to zero.  When
+ * each run starts at or after the place the previous run with the same
+ * cursor started, as happens when a note is rendered from start to
+ * finish, the cursor only ever needs to advance to the following
+ * elements, so no searching is needed.  If a run starts earlier, the
+ * element is found with a search instead, so the cursor never produces
+ * a wrong result.
+ * 
+ * t is the time offset of the first value, which must be zero or
+ * greater.  count is the number of values to compute, which must be
+ * zero or greater, and t + count must not exceed INT64_MAX.  pv points
+ * to an array that receives the values.
+ * 
+ * Each value is exactly what graph_get() would return for the same t
+ * offset.  Constant elements are filled in without any computation.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph object
+ * 
+ *   pcur - the cursor
+ * 
+ *   t - the time offset of the first value
+ * 
+ *   count - the number of values
+ * 
+ *   pv - the array that receives the values
+ */
+void graph_run(
+    GRAPH_OBJ * pg,
+    int32_t   * pcur,
+    int64_t     t,
+    int32_t     count,
+    int16_t   * pv);
+
+/*
+ * Get the greatest graph value within a given range of t offsets.
+ * 
+ * pg is the graph object.  All elements must have been defined already
+ * using graph_set().
+ * 
+ * t0 and t1 are the first and last time offsets of the range,
+ * inclusive.  t0 must be zero or greater, and t1 must be greater than
+ * or equal to t0.
+ * 
+ * The return value is the maximum value that graph_get() would return
+ * for any t in the range [t0, t1].  Since ramps are linear, only the
+ * boundaries of each element within the range need to be examined, so
+ * this is much faster than calling graph_get() on each t.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph object
+ * 
+ *   t0 - the first time offset in the range
+ * 
+ *   t1 - the last time offset in the range
+ * 
+ * Return:
+ * 
+ *   the maximum intensity within the range
+ */
+int16_t graph_peak(GRAPH_OBJ *pg, int64_t t0, int64_t t1);
+
+/*
+ * Write a graph object to a file in a binary format.
+ * 
+ * The element count is written first as a 32-bit integer, followed by
+ * the time offset of each element as a 64-bit integer and its two
+ * intensities as 32-bit integers, all in the native byte order.  The
+ * graph can later be read back with graph_restore() on the same
+ * machine.
+ * 
+ * All elements must have been defined already using graph_set().
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph object
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an I/O error
+ */
+int graph_save(GRAPH_OBJ *pg, FILE *pOut);
+
+/*
+ * Read a graph object written by graph_save().
+ * 
+ * All values in the binary data are checked against the rules of
+ * graph_set(), so corrupt data results in NULL rather than a fault.
+ * The returned graph object has a reference count of one.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file to read from
+ * 
+ * Return:
+ * 
+ *   the restored graph object, or NULL if the data is not valid
+ */
+GRAPH_OBJ *graph_restore(FILE *pIn);
 
 #endif
@@ -25,11 +25,13 @@
  * Instrument type constants.
  * 
  * The "NULL" instrument is used for instrument registers that are
- * cleared.
+ * cleared.  The "PENDING" instrument is used for external instruments
+ * that have been defined but not loaded yet; see instr_flush().
  */
 #define ITYPE_NULL      (0)
 #define ITYPE_SQUARE    (1)
 #define ITYPE_FM        (2)
+#define ITYPE_PENDING   (3)
 
 /*
  * The maximum number of entries that can be added to the search chain.
@@ -44,6 +46,55 @@
  */
 #define MAX_SEARCH_BUF  (4096)
 
+/*
+ * The number of hash buckets in the search path index.
+ */
+#define INDEX_BUCKETS (1024)
+
+/*
+ * The maximum subdirectory depth that is scanned within each search
+ * path directory when building the search path index.
+ */
+#define INDEX_MAXDEPTH (32)
+
+/*
+ * The maximum number of loader threads that instr_flush() uses to load
+ * pending external instruments at the same time.
+ */
+#define LOADER_COUNT (4)
+
+/*
+ * The version of the compiled instrument cache format.
+ * 
+ * Increment this whenever the format or the generator binary format
+ * changes, so that old cache entries are ignored.
+ */
+#define CACHE_VERSION (1)
+
+/*
+ * The file extension of compiled instrument cache entries.
+ */
+#define CACHE_EXT ".gretro"
+
+/*
+ * The number of hash buckets in the frozen event bank.
+ */
+#define FREEZE_BUCKETS (4096)
+
+/*
+ * The maximum total number of samples held in the frozen event bank.
+ * 
+ * Each sample is stored as a double, so this limits the bank to 128
+ * megabytes.  Events that don't fit are rendered normally.
+ */
+#define FREEZE_MAXSAMP (INT32_C(16777216))
+
+/*
+ * FNV-1a 64-bit hash parameters.
+ */
+#define FNV_BASIS (UINT64_C(0xcbf29ce484222325))
+#define FNV_PRIME (UINT64_C(0x100000001b3))
+
 /*
  * Type declarations
  * =================
@@ -73,6 +124,171 @@ struct SEARCH_LINK_TAG {
   char path[1];
 };
 
+/*
+ * INDEX_ENTRY structure for entries in the search path index.
+ * 
+ * Preceded by a structure prototype so the structure can
+ * self-reference.
+ */
+struct INDEX_ENTRY_TAG;
+typedef struct INDEX_ENTRY_TAG INDEX_ENTRY;
+struct INDEX_ENTRY_TAG {
+  
+  /*
+   * Pointer to next entry in the same hash bucket, or NULL if last
+   * entry.
+   */
+  INDEX_ENTRY *pNext;
+  
+  /*
+   * The search link of the directory that contains this file.
+   */
+  SEARCH_LINK *pl;
+  
+  /*
+   * The path of the file relative to the search link directory,
+   * including the file extension.
+   * 
+   * The string is nul-terminated and extends beyond the end of the
+   * structure.
+   */
+  char name[1];
+};
+
+/*
+ * INDEX_SCAN structure used while scanning a directory to build the
+ * search path index.
+ */
+typedef struct {
+  
+  /*
+   * The instrument context whose index is being built.
+   */
+  INSTR_CTX *pi;
+  
+  /*
+   * The search link being scanned.
+   */
+  SEARCH_LINK *pl;
+  
+  /*
+   * The relative path of the directory being scanned within the search
+   * link directory, which is either empty or ends with a separator.
+   */
+  const char *pRel;
+  
+  /*
+   * The subdirectory depth of the directory being scanned.
+   */
+  int depth;
+  
+} INDEX_SCAN;
+
+/*
+ * LOAD_MEMO structure for entries on the chain of external instruments
+ * that have already been loaded.
+ * 
+ * Preceded by a structure prototype so the structure can
+ * self-reference.
+ */
+struct LOAD_MEMO_TAG;
+typedef struct LOAD_MEMO_TAG LOAD_MEMO;
+struct LOAD_MEMO_TAG {
+  
+  /*
+   * Pointer to next entry on the chain, or NULL if last entry.
+   */
+  LOAD_MEMO *pNext;
+  
+  /*
+   * The bound generator map that was loaded for this call number.
+   * 
+   * The entry holds a reference to this generator.
+   */
+  GENERATOR *pRoot;
+  
+  /*
+   * The number of instance data structures required.
+   */
+  int32_t icount;
+  
+  /*
+   * The sampling rate that the generator map was loaded at.
+   */
+  int32_t rate;
+  
+  /*
+   * The call number of the external instrument.
+   * 
+   * The string is nul-terminated and extends beyond the end of the
+   * structure.
+   */
+  char call[1];
+};
+
+/*
+ * LOAD_JOB structure for an external instrument that is loaded on one
+ * of the loaders of instr_loadjobs().
+ */
+typedef struct {
+  
+  /*
+   * The call number to load.
+   * 
+   * Points into a call number list owned by the caller of
+   * instr_loadjobs().
+   */
+  const char *pCall;
+  
+  /*
+   * The result of the load, filled in by the loader.
+   * 
+   * status is non-zero if the load succeeded.  Otherwise, err, err_src,
+   * and line hold the error information, in the same way as for
+   * instr_external().
+   */
+  int status;
+  int err;
+  int err_src;
+  long line;
+  
+} LOAD_JOB;
+
+/*
+ * LOADER structure for one of the loaders of instr_loadjobs().
+ * 
+ * Each loader has an instrument context of its own to load into, so
+ * loaders never touch the same context at the same time.
+ */
+typedef struct {
+  
+  /*
+   * The loader's own instrument context.
+   * 
+   * Files are found through the main context, see the pLookup field of
+   * INSTR_CTX.
+   */
+  INSTR_CTX *pi;
+  
+  /*
+   * The worker thread running the loader, or NULL if the loader runs on
+   * the calling thread.
+   */
+  OS_WORKER *pw;
+  
+  /*
+   * The job array, shared between all loaders.
+   * 
+   * The loader takes the jobs starting at index first and going up by
+   * step, up to but excluding count, and only writes to those jobs.
+   */
+  LOAD_JOB *pJobs;
+  int32_t first;
+  int32_t step;
+  int32_t count;
+  
+} LOADER;
+
 /*
  * Structure storing instrument settings for FM instrument types.
  */
@@ -93,8 +309,83 @@ typedef struct {
    */
   int32_t icount;
   
+  /*
+   * Non-zero if the generator map is fixed, as determined by
+   * generator_fixed(), so that its events can be frozen.
+   */
+  int fixed;
+  
 } FM_PARAM;
 
+/*
+ * FROZEN structure for entries in the frozen event bank.
+ * 
+ * Each entry holds the rendered generator map output of an FM
+ * instrument event for a specific generator map, pitch, and duration.
+ * 
+ * Preceded by a structure prototype so the structure can
+ * self-reference.
+ */
+struct FROZEN_TAG;
+typedef struct FROZEN_TAG FROZEN;
+struct FROZEN_TAG {
+  
+  /*
+   * Pointer to next entry in the same hash bucket, or NULL if last
+   * entry.
+   */
+  FROZEN *pNext;
+  
+  /*
+   * The generator map that was rendered.
+   * 
+   * The entry holds a reference to this generator.
+   */
+  GENERATOR *pRoot;
+  
+  /*
+   * The pitch and duration of the event that was rendered.
+   */
+  int32_t pitch;
+  int64_t dur;
+  
+  /*
+   * The number of rendered samples, which is the generator map length
+   * for this event.
+   */
+  int32_t len;
+  
+  /*
+   * The rendered samples, exactly as returned by generator_invoke().
+   */
+  double *ps;
+};
+
+/*
+ * Instance data for FM instrument events.
+ * 
+ * instr_prepare() allocates this structure with room for all of the
+ * generator instance data at the end, so that the whole block can be
+ * released with a single free().
+ */
+typedef struct {
+  
+  /*
+   * The frozen event to play back, or NULL if the event is rendered by
+   * invoking the generator map.
+   */
+  const FROZEN *pf;
+  
+  /*
+   * The generator instance data.
+   * 
+   * The array extends beyond the end of the structure so that it has
+   * the number of elements required by the generator map.
+   */
+  GENERATOR_OPDATA od[1];
+  
+} FM_VOICE;
+
 /*
  * The instrument register structure.
  */
@@ -148,44 +439,162 @@ typedef struct {
      * FM instrument parameters.
      */
     FM_PARAM fmp;
+    
+    /*
+     * Call number of the external instrument, used for PENDING
+     * instruments.
+     * 
+     * Dynamically allocated copy owned by the register.
+     */
+    char *pCall;
   
   } val;
   
 } INSTR_REG;
 
 /*
- * Static data
- * ===========
- */
-
-/*
- * The search link chain.
- * 
- * Use instr_chaininit() to initialize this chain with default values if
- * it is empty.
- */
-static SEARCH_LINK *m_instr_search = NULL;
-
-/*
- * The sampling rate, or 0 if not set yet.
- */
-static int32_t m_instr_rate = 0;
-
-/*
- * Flag indicating whether the instrument register table has been
- * initialized yet.
+ * INSTR_CTX structure.
  * 
- * Use instr_t_init() to initialize the table.
+ * Prototype given in the header.
  */
-static int m_instr_init = 0;
-
-/*
- * The instrument register table.
- * 
- * Only valid if m_instr_init flag indicates the table has been
- * initialized.
- */
-static INSTR_REG m_instr_t[INSTR_MAXCOUNT];
+struct INSTR_CTX_TAG {
+  
+  /*
+   * The search link chain.
+   * 
+   * Use instr_chaininit() to initialize this chain with default values
+   * if it is empty.
+   */
+  SEARCH_LINK *pSearch;
+  
+  /*
+   * The number of entries that have been added to the search chain
+   * with instr_addsearch().
+   */
+  int32_t search_count;
+  
+  /*
+   * The sampling rate, or 0 if not set yet.
+   */
+  int32_t rate;
+  
+  /*
+   * Flag indicating whether the search path index has been built yet.
+   * 
+   * Use instr_indexbuild() to build the index.
+   */
+  int indexed;
+  
+  /*
+   * The search path index.
+   * 
+   * Maps paths relative to a search directory to the first search
+   * directory that contains them.  Only valid if the indexed flag
+   * indicates the index has been built.
+   */
+  INDEX_ENTRY *index[INDEX_BUCKETS];
+  
+  /*
+   * The chain of external instruments that have already been loaded.
+   * 
+   * Each entry is only used at the sampling rate it was loaded at.  The
+   * chain may have entries at a rate other than the rate of this
+   * context, which were loaded with instr_preload().
+   * 
+   * Use instr_memoclear() to release the whole chain.
+   */
+  LOAD_MEMO *pMemo;
+  
+  /*
+   * The call numbers of external instruments that were deferred by
+   * instr_external() since the last instr_flush(), in the order they
+   * were first defined, along with the count and capacity of the
+   * array.
+   * 
+   * Each string is dynamically allocated.  Call numbers stay on this
+   * list even if the register they were defined in is overwritten, so
+   * that errors in them are still reported.  Use instr_deferclear() to
+   * release the list.
+   */
+  char **ppDefer;
+  int32_t defer_count;
+  int32_t defer_cap;
+  
+  /*
+   * The context through which files are found, or NULL to find them
+   * through this context.
+   * 
+   * Used for the contexts of the loaders of instr_flush(), which share
+   * the search path and index of the main context rather than each
+   * building their own.  The main context is not changed while the
+   * loaders run, so they can all read it at the same time.
+   */
+  INSTR_CTX *pLookup;
+  
+  /*
+   * Flag indicating whether events of fixed FM instruments are frozen.
+   * 
+   * Set with instr_freeze().
+   */
+  int freeze;
+  
+  /*
+   * The frozen event bank.
+   */
+  FROZEN *frozen[FREEZE_BUCKETS];
+  
+  /*
+   * The number of samples that may still be added to the frozen event
+   * bank.
+   */
+  int32_t freeze_left;
+  
+  /*
+   * Flag indicating whether generator maps are simplified as they are
+   * loaded.
+   * 
+   * Set with instr_simplify().
+   */
+  int simplify;
+  
+  /*
+   * The compiled instrument cache directory, or NULL if there is no
+   * cache.
+   * 
+   * Dynamically allocated.
+   */
+  char *pCache;
+  
+  /*
+   * Flag indicating whether single-channel output has been requested
+   * with instr_flatten().
+   */
+  int flat;
+  
+  /*
+   * The ADSR control period, set with instr_control().
+   */
+  int32_t period;
+  
+  /*
+   * The number of noise seeds handed out so far.
+   * 
+   * See instr_seed().
+   */
+  uint32_t seed;
+  
+  /*
+   * The square wave context used by square wave instruments.
+   * 
+   * Not owned by the instrument context.
+   */
+  SQWAVE_CTX *psw;
+  
+  /*
+   * The instrument register table.
+   */
+  INSTR_REG t[INSTR_MAXCOUNT];
+};
 
 /*
  * Local functions
@@ -193,23 +602,112 @@ static INSTR_REG m_instr_t[INSTR_MAXCOUNT];
  */
 
 /* Prototypes */
-static void instr_chaininit(void);
+static void instr_chaininit(INSTR_CTX *pi);
 
-static void instr_t_init(void);
-static INSTR_REG *instr_ptr(int32_t i);
+static INSTR_REG *instr_ptr(INSTR_CTX *pi, int32_t i);
 static int instr_isclear(const INSTR_REG *pr);
+static uint32_t instr_seed(INSTR_CTX *pi);
+static void instr_image(
+          INSTR_CTX   * pi,
+          int16_t       s,
+          int32_t       pitch,
+    const STEREO_POS  * psp,
+          STEREO_SAMP * pss);
+
+static int instr_joinpath(
+          char * pbuf,
+    const char * pDir,
+    const char * prel);
+static int instr_find(
+          INSTR_CTX * pi,
+    const char      * pCall,
+    const char      * pExt,
+          char      * pbuf,
+          int       * per);
+static WAVETBL *instr_table(void *pCustom, const char *pName);
+static GENERATOR *instr_restored(INSTR_CTX *pi, GENERATOR *pRoot);
+
+static int instr_iscomp(const char *pName, int isdir);
+static INDEX_ENTRY **instr_indexslot(INSTR_CTX *pi, const char *pName);
+static void instr_indexscan(
+          void * pCustom,
+    const char * pName,
+          int    isdir);
+static void instr_indexbuild(INSTR_CTX *pi);
+static void instr_indexclear(INSTR_CTX *pi);
+
+static LOAD_MEMO *instr_memofind(
+          INSTR_CTX * pi,
+    const char      * pCall,
+          int32_t     rate);
+static void instr_memoadd(
+          INSTR_CTX * pi,
+    const char      * pCall,
+          int32_t     rate,
+          GENERATOR * pRoot,
+          int32_t     icount);
+static void instr_memoclear(INSTR_CTX *pi);
+
+static void instr_defer(INSTR_CTX *pi, const char *pCall);
+static void instr_deferclear(INSTR_CTX *pi);
+static void instr_loader(OS_WORKER *pw, void *pCustom);
+static void instr_loadjobs(
+    INSTR_CTX * pi,
+    int32_t     rate,
+    LOAD_JOB  * pJobs,
+    int32_t     jcount);
+
+static uint64_t instr_fnv(
+    uint64_t h,
+    const unsigned char *pb,
+    size_t n);
+static int instr_hashfile(const char *pPath, uint64_t *ph);
+static char *instr_cachekey(
+          INSTR_CTX * pi,
+    const char      * pPath,
+          uint64_t    h);
+static char *instr_cachepath(INSTR_CTX *pi, const char *pPath);
+static GENERATOR *instr_cacheload(
+          INSTR_CTX * pi,
+    const char      * pCache,
+    const char      * pKey);
+static void instr_cachesave(
+    const char      * pCache,
+    const char      * pKey,
+          GENERATOR * pRoot);
+
+static void instr_setfm(
+    INSTR_CTX * pi,
+    int32_t     i,
+    GENERATOR * pRoot,
+    int32_t     icount);
+static const FROZEN *instr_frozen(
+          INSTR_CTX * pi,
+    const FM_PARAM  * pfm,
+          int32_t     pitch,
+          int64_t     dur,
+          double      f,
+          FM_VOICE  * pv);
 
 static int instr_load(
-    int32_t    i,
-    SNSOURCE * pIn,
-    int      * per,
-    int      * per_src,
-    long     * pline);
+    INSTR_CTX * pi,
+    int32_t     i,
+    SNSOURCE  * pIn,
+    int       * per,
+    int       * per_src,
+    long      * pline);
+static int instr_extload(
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pCall,
+          int       * per,
+          int       * per_src,
+          long      * pline);
 
 /*
  * Initialize the search chain with default values if it is empty.
  * 
- * If m_instr_search has at least one element, this function does
+ * If the search chain has at least one element, this function does
  * nothing.  If the chain is empty, this function will initialize the
  * chain with the following, with (2) being at the end of the chain:
  * 
@@ -220,8 +718,12 @@ static int instr_load(
  * added to the chain.
  * 
  * This function does NOT check whether the directories actually exist.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
  */
-static void instr_chaininit(void) {
+static void instr_chaininit(INSTR_CTX *pi) {
   
   static const char *pSubdir = "retro_lib";
   char *pHome = NULL;
@@ -234,7 +736,7 @@ static void instr_chaininit(void) {
   memset(&(cb[0]), 0, 2);
   
   /* Only proceed if chain not initialized */
-  if (m_instr_search == NULL) {
+  if (pi->pSearch == NULL) {
     
     /* Get the home directory, if possible */
     pHome = os_gethome();
@@ -281,7 +783,7 @@ static void instr_chaininit(void) {
         strcat(&((pl->path)[0]), pSubdir);
         
         /* Add the link to the start of the chain */
-        m_instr_search = pl;
+        pi->pSearch = pl;
         pl = NULL;
       }
     }
@@ -301,7 +803,7 @@ static void instr_chaininit(void) {
     memset(pl, 0, (size_t) new_len);
     
     /* Set next pointer to current value of search chain */
-    pl->pNext = m_instr_search;
+    pl->pNext = pi->pSearch;
     
     /* Begin with the period character followed by separator */
     (pl->path)[0] = (char) '.';
@@ -311,7 +813,7 @@ static void instr_chaininit(void) {
     strcat(&((pl->path)[0]), pSubdir);
     
     /* Add the link to the start of the chain */
-    m_instr_search = pl;
+    pi->pSearch = pl;
     pl= NULL;
     
     /* Free home path copy, if allocated */
@@ -322,63 +824,30 @@ static void instr_chaininit(void) {
   }
 }
 
-/*
- * Initialize the instrument register table if not already initialized.
- * 
- * If the table has already been initialized, this function has no
- * effect.
- */ 
-static void instr_t_init(void) {
-  
-  int32_t x = 0;
-  
-  /* Only proceed if not initialized */
-  if (!m_instr_init) {
-    
-    /* Clear table */
-    memset(m_instr_t, 0, INSTR_MAXCOUNT * sizeof(INSTR_REG));
-    
-    /* Set all records to clear */
-    for(x = 0; x < INSTR_MAXCOUNT; x++) {
-      (m_instr_t[x]).i_max = 0;
-      (m_instr_t[x]).i_min = 0;
-      (m_instr_t[x]).itype = ITYPE_NULL;
-      (m_instr_t[x]).val.dummy = 0;
-    }
-    
-    /* Set initialized flag */
-    m_instr_init = 1;
-  }
-}
-
 /*
  * Get a pointer to the given instrument register.
  * 
- * The instrument register table is initialized if necessary by this
- * function.
- * 
  * This function range-checks i, faulting if out of range.
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register to retrieve
  * 
  * Return:
  * 
  *   a pointer to the instrument register
  */
-static INSTR_REG *instr_ptr(int32_t i) {
-  
-  /* Initialize instrument register table if necessary */
-  instr_t_init();
+static INSTR_REG *instr_ptr(INSTR_CTX *pi, int32_t i) {
   
-  /* Range-check parameter */
-  if ((i < 0) || (i >= INSTR_MAXCOUNT)) {
+  /* Range-check parameters */
+  if ((pi == NULL) || (i < 0) || (i >= INSTR_MAXCOUNT)) {
     abort();
   }
   
   /* Return register */
-  return &((m_instr_t)[i]);
+  return &((pi->t)[i]);
 }
 
 /*
@@ -413,735 +882,3276 @@ static int instr_isclear(const INSTR_REG *pr) {
 }
 
 /*
- * Load an instrument from a given Shastina source.
+ * Hand out a new noise seed for generator instance data.
  * 
- * i must be in range [0, INSTR_MAXCOUNT - 1].  instr_clear() is run
- * automatically on the indicated register before the new instrument is
- * defined.
+ * Each call returns a different seed, so that every event gets its own
+ * noise.  The seeds only depend on the number of seeds that the
+ * instrument context has handed out before, so a render always gets
+ * the same noise no matter what other renders are running.
  * 
- * pIn is a Shastina source that contains the whole script for defining
- * the instrument.  It must support multipass.
+ * Parameters:
  * 
- * The minimum intensity will be set to half and the maximum intensity
- * will be set to maximum possible value.  The stereo position will be
- * set to center.
+ *   pi - the instrument context
  * 
- * per and pline are pointers to variables to receive an error code and
- * a line number if there is an error.  per_src points to an integer
- * to receive one of the INSTR_ERRMOD_ constants that indicates what
- * Retro module the error code comes from, which determines the meaning
- * of the error code.
+ * Return:
+ * 
+ *   the new seed
+ */
+static uint32_t instr_seed(INSTR_CTX *pi) {
+  
+  uint32_t h = 0;
+  
+  /* Check parameter */
+  if (pi == NULL) {
+    abort();
+  }
+  
+  /* Advance the seed count, wrapping around if necessary */
+  (pi->seed)++;
+  
+  /* Scramble the count so that consecutive seeds are not related */
+  h = pi->seed * UINT32_C(0x9e3779b9);
+  h ^= h >> 16;
+  h *= UINT32_C(0x85ebca6b);
+  h ^= h >> 13;
+  
+  /* Return the seed */
+  return h;
+}
+
+/*
+ * Compute the stereo image of a sample.
+ * 
+ * This is the same as stereo_image(), except that if single-channel
+ * output has been requested with instr_flatten(), the stereo position
+ * is ignored and the sample is duplicated to both channels.
  * 
  * Parameters:
  * 
- *   i - the instrument register
+ *   pi - the instrument context
  * 
- *   pIn - the source for the instrument script
+ *   s - the sample
  * 
- *   per - pointer to variable to receive genmap error code
+ *   pitch - the pitch of the sample
  * 
- *   per_src - the module from which the error number comes
+ *   psp - the stereo position
  * 
- *   pline - pointer to variable to receive line number within script
+ *   pss - the structure to receive the result
+ */
+static void instr_image(
+          INSTR_CTX   * pi,
+          int16_t       s,
+          int32_t       pitch,
+    const STEREO_POS  * psp,
+          STEREO_SAMP * pss) {
+  
+  /* Check parameters */
+  if ((pi == NULL) || (psp == NULL) || (pss == NULL)) {
+    abort();
+  }
+  
+  /* Duplicate the sample if flat, else compute the stereo image */
+  if (pi->flat) {
+    pss->left = s;
+    pss->right = s;
+  } else {
+    stereo_image(s, pitch, psp, pss);
+  }
+}
+
+/*
+ * Build the full path of a file within a search directory.
+ * 
+ * pbuf is the buffer to receive the path.  It must have room for
+ * MAX_SEARCH_BUF characters, including the terminating nul.  pDir is
+ * the directory path, and prel is the relative path of the file within
+ * it.  The platform-specific separator is put between them.
+ * 
+ * Parameters:
+ * 
+ *   pbuf - the buffer to receive the path
+ * 
+ *   pDir - the directory path
+ * 
+ *   prel - the relative path of the file
  * 
  * Return:
  * 
- *   non-zero if successful, zero if error
+ *   non-zero if successful, zero if the path does not fit in the buffer
  */
-static int instr_load(
-    int32_t    i,
-    SNSOURCE * pIn,
-    int      * per,
-    int      * per_src,
-    long     * pline) {
+static int instr_joinpath(
+          char * pbuf,
+    const char * pDir,
+    const char * prel) {
   
   int status = 1;
-  INSTR_REG *pr = NULL;
-  GENMAP_RESULT gmr;
+  size_t full_len = 0;
+  char cb[2];
   
-  /* Initialize structures */
-  memset(&gmr, 0, sizeof(GENMAP_RESULT));
-  gmr.pRoot = NULL;
+  /* Initialize buffers */
+  memset(cb, 0, 2);
   
   /* Check parameters */
-  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
-      (pIn == NULL) || (per == NULL) ||
-      (per_src == NULL) || (pline == NULL)) {
-    abort();
-  }
-  if (!snsource_ismulti(pIn)) {
-    abort();
-  }
-  
-  /* Check state */
-  if (m_instr_rate == 0) {
+  if ((pbuf == NULL) || (pDir == NULL) || (prel == NULL)) {
     abort();
   }
   
-  /* We currently only support genmap instruments, so call through */
-  genmap_run(pIn, &gmr, m_instr_rate);
-  
-  /* Handle errors */
-  if (gmr.errcode != GENMAP_OK) {
+  /* Check that the full path fits in the buffer */
+  full_len = strlen(pDir) + strlen(prel) + 2;
+  if (full_len > (size_t) MAX_SEARCH_BUF) {
     status = 0;
-    if (gmr.errcode < 0) {
-      *per_src = INSTR_ERRMOD_SHASTINA;
-    } else {
-      *per_src = INSTR_ERRMOD_GENMAP;
-    }
-    *per = gmr.errcode;
-    *pline = gmr.linenum;
   }
   
-  /* If successful, set up the instrument */
+  /* Build the full path in the buffer */
+  memset(pbuf, 0, (size_t) MAX_SEARCH_BUF);
   if (status) {
-    /* Clear instrument register */
-    instr_clear(i);
+    strcpy(pbuf, pDir);
     
-    /* Get instrument register */
-    pr = instr_ptr(i);
-   
-    /* Setup default intensity and stereo position */
-    pr->i_min = (MAX_FRAC / 2);
-    pr->i_max = MAX_FRAC;
-    stereo_setPos(&(pr->sp), 0);
+    cb[0] = (char) os_getsep();
+    strcat(pbuf, cb);
     
-    /* Store FM instrument definition */
-    pr->itype = ITYPE_FM;
-    (pr->val).fmp.pRoot = gmr.pRoot;
-    generator_addref(gmr.pRoot);
-    (pr->val).fmp.icount = gmr.icount;
+    strcat(pbuf, prel);
   }
   
-  /* Release object references */
-  generator_release(gmr.pRoot);
-  gmr.pRoot = NULL;
-  
   /* Return status */
   return status;
 }
 
 /*
- * Public function implementations
- * ===============================
+ * Find a file on the search path by its call number.
  * 
- * See the header for specifications.
- */
-
-/*
- * instr_addsearch function.
+ * pCall is the call number.  It must be a sequence of one or more
+ * lowercase ASCII letters, decimal digits, underscores, and periods,
+ * where the first and last characters are not periods and no period
+ * immediately follows another.  Each period is replaced with the
+ * platform-specific separator to get a relative path.
+ * 
+ * pExt is the file extension to append to the relative path, including
+ * the opening dot.
+ * 
+ * pbuf is the buffer to receive the full path of the file that was
+ * found.  It must have room for MAX_SEARCH_BUF characters, including
+ * the terminating nul.
+ * 
+ * Each directory on the search chain is tried in order, and the first
+ * one that contains the file is used.  The search path index answers
+ * this without touching the file system.  Files that the index doesn't
+ * cover, because they are nested deeper than INDEX_MAXDEPTH or were
+ * added after the index was built, are checked for directly in each
+ * directory instead.
+ * 
+ * If the context has a lookup context, the search chain and index of
+ * the lookup context are used instead of its own.  The lookup context
+ * must then already have its search chain and index built, so that it
+ * is only read here.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pCall - the call number
+ * 
+ *   pExt - the file extension
+ * 
+ *   pbuf - the buffer to receive the path
+ * 
+ *   per - pointer to variable to receive an INSTR_ERR_ code on error
+ * 
+ * Return:
+ * 
+ *   non-zero if file found, zero if error
  */
-int instr_addsearch(const char *pDir) {
-  
-  static int32_t el_count = 0;
+static int instr_find(
+          INSTR_CTX * pi,
+    const char      * pCall,
+    const char      * pExt,
+          char      * pbuf,
+          int       * per) {
   
   int status = 1;
+  int found = 0;
+  int32_t depth = 0;
+  char *pc = NULL;
+  char *pt = NULL;
+  char *prel = NULL;
+  INDEX_ENTRY *pe = NULL;
   SEARCH_LINK *pl = NULL;
-  int32_t full_len = 0;
   
-  /* Initialize search chain with default values if needed */
-  instr_chaininit();
+  /* Check parameters */
+  if ((pCall == NULL) || (pExt == NULL) ||
+      (pbuf == NULL) || (per == NULL)) {
+    abort();
+  }
   
-  /* Only proceed if not too many elements */
-  if (el_count < MAX_SEARCH_LINK) {
-    /* Not too many search links, so increment count */
-    el_count++;
-    
-    /* Compute full length of new link */
-    full_len = (int32_t) strlen(pDir);
-    if (full_len <= INT32_MAX - ((int32_t) sizeof(SEARCH_LINK))) {
-      full_len = full_len + ((int32_t) sizeof(SEARCH_LINK));
-    } else {
-      abort();  /* overflow */
+  /* Use the lookup context if there is one */
+  if (pi->pLookup != NULL) {
+    pi = pi->pLookup;
+  }
+  
+  /* Initialize search chain if necessary */
+  instr_chaininit(pi);
+  
+  /* Clear the path buffer */
+  memset(pbuf, 0, (size_t) MAX_SEARCH_BUF);
+  
+  /* Make a copy of the call number string */
+  pc = (char *) malloc(strlen(pCall) + 1);
+  if (pc == NULL) {
+    abort();
+  }
+  strcpy(pc, pCall);
+  
+  /* Make sure call number string has at least one character and that
+   * the first character is not a dot */
+  if ((*pc == 0) || (*pc == '.')) {
+    status = 0;
+    *per = INSTR_ERR_BADCALL;
+  }
+  
+  /* Make sure only lowercase ASCII letters, decimal digits,
+   * underscores, and periods are used, that no period appears
+   * immediately before another period, and that the period is not the
+   * last character */
+  if (status) {
+    for(pt = pc; *pt != 0; pt++) {
+      if (((*pt < 'a') || (*pt > 'z')) &&
+          ((*pt < '0') || (*pt > '9')) &&
+          (*pt != '_') && (*pt != '.')) {
+        status = 0;
+      }
+      if (*pt == '.') {
+        if ((pt[1] == '.') || (pt[1] == 0)) {
+          status = 0;
+        }
+      }
+      if (!status) {
+        break;
+      }
     }
-    
-    /* Allocate new link structure */
-    pl = (SEARCH_LINK *) malloc((size_t) full_len);
-    if (pl == NULL) {
+    if (!status) {
+      *per = INSTR_ERR_BADCALL;
+    }
+  }
+  
+  /* Change all periods to platform-specific separator, counting how
+   * many subdirectories deep the file is */
+  if (status) {
+    for(pt = pc; *pt != 0; pt++) {
+      if (*pt == '.') {
+        *pt = (char) os_getsep();
+        depth++;
+      }
+    }
+  }
+  
+  /* Build the relative path of the file, including extension */
+  if (status) {
+    prel = (char *) malloc(strlen(pc) + strlen(pExt) + 1);
+    if (prel == NULL) {
       abort();
     }
-    memset(pl, 0, (size_t) full_len);
-    
-    /* Set next pointer to current chain */
-    pl->pNext = m_instr_search;
-    
-    /* Copy in directory */
-    strcpy(&((pl->path)[0]), pDir);
-    
-    /* Prefix to chain */
-    m_instr_search = pl;
-    pl = NULL;
+    strcpy(prel, pc);
+    strcat(prel, pExt);
+  }
+  
+  /* Look up the relative path in the search path index, unless it is
+   * deeper than the index goes */
+  if (status && (depth <= INDEX_MAXDEPTH)) {
+    instr_indexbuild(pi);
+    pe = *(instr_indexslot(pi, prel));
+  }
+  
+  /* If the index has the file, build the full path in the buffer */
+  if (status && (pe != NULL)) {
+    if (!instr_joinpath(pbuf, (pe->pl)->path, prel)) {
+      status = 0;
+      *per = INSTR_ERR_HUGEPATH;
+    }
+  
+  } else if (status) {
+    /* The index doesn't have files nested deeper than INDEX_MAXDEPTH
+     * or files added after it was built, so go through all base
+     * directories in the search path looking for the file */
+    for(pl = pi->pSearch; pl != NULL; pl = pl->pNext) {
+      if (!instr_joinpath(pbuf, pl->path, prel)) {
+        status = 0;
+        *per = INSTR_ERR_HUGEPATH;
+        break;
+      }
+      if (os_isfile(pbuf)) {
+        found = 1;
+        break;
+      }
+    }
     
-  } else {
-    /* Too many search links */
-    status = 0;
+    /* Fail if no file found */
+    if (status && (!found)) {
+      status = 0;
+      *per = INSTR_ERR_NOTFOUND;
+    }
+  }
+  
+  /* Release relative path */
+  if (prel != NULL) {
+    free(prel);
+    prel = NULL;
   }
   
+  /* Release copy of call number */
+  free(pc);
+  pc = NULL;
+  
   /* Return status */
   return status;
 }
 
 /*
- * instr_setsamp function.
+ * Wave table resolver for generator map scripts.
+ * 
+ * Wave table names are call numbers that are resolved against the
+ * instrument search path in the same way as external instruments,
+ * except that the file extension is ".wretro" instead of ".iretro".
+ * Wave table files can therefore sit next to the instruments that use
+ * them.
+ * 
+ * The wavetbl module caches loaded files by path, so each wave table
+ * file is only loaded once, no matter how many instruments use it.
+ * 
+ * Interface matches genmap_fp_table.  pCustom is the instrument
+ * context whose search path is used.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the instrument context
+ * 
+ *   pName - the call number of the wave table
+ * 
+ * Return:
+ * 
+ *   a new reference to the wave table, or NULL if it could not be
+ *   found or loaded
  */
-void instr_setsamp(int32_t rate) {
+static WAVETBL *instr_table(void *pCustom, const char *pName) {
   
-  /* Check parameter */
-  if ((rate != RATE_CD) && (rate != RATE_DVD)) {
+  const char *pExt = ".wretro";
+  
+  int err = 0;
+  char *pbuf = NULL;
+  WAVETBL *pw = NULL;
+  INSTR_CTX *pi = NULL;
+  
+  /* Check parameters */
+  if ((pCustom == NULL) || (pName == NULL)) {
     abort();
   }
+  pi = (INSTR_CTX *) pCustom;
   
-  /* Check state */
-  if (m_instr_rate != 0) {
+  /* Allocate path buffer */
+  pbuf = (char *) malloc((size_t) MAX_SEARCH_BUF);
+  if (pbuf == NULL) {
     abort();
   }
   
-  /* Store rate */
-  m_instr_rate = rate;
-}
-
+  /* Find and load the wave table file */
+  if (instr_find(pi, pName, pExt, pbuf, &err)) {
+    pw = wavetbl_file(pbuf);
+  }
+  
+  /* Release path buffer */
+  free(pbuf);
+  pbuf = NULL;
+  
+  /* Return the wave table or NULL */
+  return pw;
+}
+
 /*
- * instr_clear function.
+ * Prepare a generator map that was restored from a file for use.
+ * 
+ * Generator maps that are interpreted are simplified by genmap_run()
+ * when instr_simplify() is enabled.  Generator maps restored from the
+ * compiled instrument cache or from a compiled score get the same
+ * treatment here, so they don't depend on whether simplifying was
+ * enabled when the file was written.
+ * 
+ * The passed reference is taken over by this function.  pRoot may be
+ * NULL, in which case NULL is returned.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pRoot - the restored generator map, or NULL
+ * 
+ * Return:
+ * 
+ *   a new reference to the generator map to use, or NULL
  */
-void instr_clear(int32_t i) {
+static GENERATOR *instr_restored(INSTR_CTX *pi, GENERATOR *pRoot) {
   
-  INSTR_REG *pr = NULL;
+  GENERATOR *result = NULL;
   
-  /* Get instrument register */
-  pr = instr_ptr(i);
+  /* Check parameters */
+  if (pi == NULL) {
+    abort();
+  }
   
-  /* Only proceed if instrument register not clear */
-  if (!instr_isclear(pr)) {
-    /* Release the instrument data */
-    if (pr->itype == ITYPE_SQUARE) {
-      /* Release square wave instrument */
-      adsr_release((pr->val).pa);
-      (pr->val).pa = NULL;
-    
-    } else if (pr->itype == ITYPE_FM) {
-      /* Release FM instrument */
-      generator_release((pr->val).fmp.pRoot);
-      (pr->val).fmp.pRoot = NULL;
-    
-    } else {
-      /* Shouldn't happen */
-      abort();
-    }
-    
-    /* Clear the record */
-    memset(pr, 0, sizeof(INSTR_REG));
-    
-    /* Set the clear */
-    pr->i_max = 0;
-    pr->i_min = 0;
-    pr->itype = ITYPE_NULL;
-    (pr->val).dummy = 0;
+  /* Simplify if requested, else just pass the reference through */
+  if ((pRoot != NULL) && pi->simplify) {
+    result = generator_compile(pRoot);
+    generator_release(pRoot);
+    pRoot = NULL;
+  } else {
+    result = pRoot;
+    pRoot = NULL;
   }
+  
+  /* Return the generator map */
+  return result;
 }
 
 /*
- * instr_define function.
+ * Update an FNV-1a 64-bit hash with a sequence of bytes.
+ * 
+ * Start with FNV_BASIS as the hash value.
+ * 
+ * Parameters:
+ * 
+ *   h - the current hash value
+ * 
+ *   pb - the bytes to hash
+ * 
+ *   n - the number of bytes
+ * 
+ * Return:
+ * 
+ *   the updated hash value
  */
-void instr_define(
-          int32_t      i,
-          int32_t      i_max,
-          int32_t      i_min,
-          ADSR_OBJ   * pa,
-    const STEREO_POS * psp) {
-  
-  INSTR_REG *pr = NULL;
+static uint64_t instr_fnv(
+    uint64_t h,
+    const unsigned char *pb,
+    size_t n) {
   
-  /* Get instrument register */
-  pr = instr_ptr(i);
+  size_t i = 0;
   
   /* Check parameters */
-  if ((i_max < 0) || (i_min < 0) ||
-      (i_max > MAX_FRAC) || (i_min > MAX_FRAC) ||
-      (i_max < i_min)) {
-    abort();
-  }
-  if ((pa == NULL) || (psp == NULL)) {
+  if ((pb == NULL) && (n > 0)) {
     abort();
   }
   
-  /* Check for special case of both intensities zero */
-  if ((i_max == 0) && (i_min == 0)) {
-    /* Both intensities zero, so just clear the register */
-    instr_clear(i);
-    
-  } else {
-    /* At least one intensity non-zero, so begin by clearing the
-     * register */
-    instr_clear(i);
-    
-    /* Copy values in */
-    pr->i_max = (uint16_t) i_max;
-    pr->i_min = (uint16_t) i_min;
-    pr->itype = ITYPE_SQUARE;
-    (pr->val).pa = pa;
-    adsr_addref(pa);
-    memcpy(&(pr->sp), psp, sizeof(STEREO_POS));
+  /* Hash each byte */
+  for(i = 0; i < n; i++) {
+    h ^= (uint64_t) pb[i];
+    h *= FNV_PRIME;
   }
+  
+  /* Return updated hash */
+  return h;
 }
 
 /*
- * instr_embedded function.
+ * Check whether a directory entry name could be part of a call number.
+ * 
+ * Directory names must consist only of lowercase ASCII letters, decimal
+ * digits, and underscores.  File names must begin with such a sequence,
+ * followed by a period and the file extension.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name of the directory entry
+ * 
+ *   isdir - non-zero if the entry is a directory
+ * 
+ * Return:
+ * 
+ *   non-zero if the name could be part of a call number, zero if not
  */
-int instr_embedded(
-          int32_t   i,
-    const char    * pText,
-          int     * per,
-          int     * per_src,
-          long    * pline) {
+static int instr_iscomp(const char *pName, int isdir) {
   
-  int status = 1;
-  SNSOURCE *pIn = NULL;
+  int result = 0;
+  int32_t i = 0;
   
   /* Check parameters */
-  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
-      (pText == NULL) || (per == NULL) ||
-      (per_src == NULL) || (pline == NULL)) {
+  if (pName == NULL) {
     abort();
   }
   
-  /* Wrap string in source */
-  pIn = snsource_string(pText);
-  
-  /* Load the instrument */
-  if (!instr_load(i, pIn, per, per_src, pline)) {
-    status = 0;
+  /* Count the call number characters at the start of the name */
+  for(i = 0; pName[i] != 0; i++) {
+    if (((pName[i] < 'a') || (pName[i] > 'z')) &&
+        ((pName[i] < '0') || (pName[i] > '9')) &&
+        (pName[i] != '_')) {
+      break;
+    }
   }
   
-  /* Release source if allocated */
-  snsource_free(pIn);
-  pIn = NULL;
+  /* Check that there was at least one and that the rest of the name is
+   * appropriate for the entry type */
+  if (i > 0) {
+    if (isdir) {
+      result = (pName[i] == 0);
+    } else {
+      result = (pName[i] == '.');
+    }
+  }
   
-  /* Return status */
-  return status;
+  /* Return result */
+  return result;
 }
 
 /*
- * instr_external function.
+ * Get the hash bucket in the search path index for a relative path.
+ * 
+ * The return value points to the bucket head if no entry for the path
+ * exists, or else to the pNext field that points to the entry for the
+ * path.  Either way, the pointed-to value is the entry for the path or
+ * NULL if there is no such entry.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pName - the relative path
+ * 
+ * Return:
+ * 
+ *   pointer to the link that does or would point to the entry
  */
-int instr_external(
-          int32_t   i,
-    const char    * pCall,
-          int     * per,
-          int     * per_src,
-          long    * pline) {
-  
-  const char *pExt = ".iretro";
-  
-  int status = 1;
-  int file_found = 0;
-  int32_t full_len = 0;
-  int32_t x = 0;
-  char *pc = NULL;
-  char *pbuf = NULL;
-  char *pt = NULL;
-  SEARCH_LINK *pl = NULL;
-  FILE *pHIn = NULL;
-  SNSOURCE *pIn = NULL;
-  char cb[2];
+static INDEX_ENTRY **instr_indexslot(INSTR_CTX *pi, const char *pName) {
   
-  /* Initialize buffers */
-  memset(cb, 0, 2);
+  uint64_t h = 0;
+  INDEX_ENTRY **ppe = NULL;
   
   /* Check parameters */
-  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
-      (pCall == NULL) || (per == NULL) ||
-      (per_src == NULL) || (pline == NULL)) {
+  if (pName == NULL) {
     abort();
   }
   
-  /* Reset error information */
-  *per = INSTR_ERR_OK;
-  *per_src = INSTR_ERRMOD_INSTR;
-  *pline = 0;
-  
-  /* Initialize search chain if necessary */
-  instr_chaininit();
+  /* Hash the name to select the bucket */
+  h = instr_fnv(
+        FNV_BASIS, (const unsigned char *) pName, strlen(pName));
+  ppe = &(pi->index[(size_t) (h % INDEX_BUCKETS)]);
   
-  /* Allocate path buffer */
-  pbuf = (char *) malloc((size_t) MAX_SEARCH_BUF);
-  if (pbuf == NULL) {
-    abort();
+  /* Walk the bucket until the entry or the end of the bucket */
+  while (*ppe != NULL) {
+    if (strcmp(&(((*ppe)->name)[0]), pName) == 0) {
+      break;
+    }
+    ppe = &((*ppe)->pNext);
   }
-  memset(pbuf, 0, (size_t) MAX_SEARCH_BUF);
   
-  /* Make a copy of the call number string */
-  pc = (char *) malloc(strlen(pCall) + 1);
-  if (pc == NULL) {
-    abort();
-  }
-  strcpy(pc, pCall);
+  /* Return the link */
+  return ppe;
+}
+
+/*
+ * Directory listing callback used to build the search path index.
+ * 
+ * pCustom points to the INDEX_SCAN structure for the directory being
+ * scanned.  Files are added to the index unless an earlier search
+ * directory already provided the same relative path.  Subdirectories
+ * are scanned recursively, up to INDEX_MAXDEPTH.  Entries that can't
+ * be reached by any call number are ignored, as are paths that would
+ * not fit in the search path buffer.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the INDEX_SCAN structure
+ * 
+ *   pName - the name of the entry
+ * 
+ *   isdir - non-zero for a directory, zero for a regular file
+ */
+static void instr_indexscan(
+          void * pCustom,
+    const char * pName,
+          int    isdir) {
   
-  /* Make sure call number string has at least one character and that
-   * the first character is not a dot */
-  if ((*pc == 0) || (*pc == '.')) {
-    status = 0;
-    *per = INSTR_ERR_BADCALL;
-    *per_src = INSTR_ERRMOD_INSTR;
-    *pline = 0;
+  INDEX_SCAN *ps = NULL;
+  INDEX_SCAN sub;
+  INDEX_ENTRY **ppe = NULL;
+  char *prel = NULL;
+  char *pdir = NULL;
+  size_t plen = 0;
+  size_t rlen = 0;
+  char cb[2];
+  
+  /* Initialize structures */
+  memset(&sub, 0, sizeof(INDEX_SCAN));
+  memset(cb, 0, 2);
+  
+  /* Check parameters */
+  if ((pCustom == NULL) || (pName == NULL)) {
+    abort();
   }
+  ps = (INDEX_SCAN *) pCustom;
   
-  /* Make sure only lowercase ASCII letters, decimal digits,
-   * underscores, and periods are used, that no period appears
-   * immediately before another period, and that the period is not the
-   * last character */
-  if (status) {
-    for(pt = pc; *pt != 0; pt++) {
-      if (((*pt < 'a') || (*pt > 'z')) &&
-          ((*pt < '0') || (*pt > '9')) &&
-          (*pt != '_') && (*pt != '.')) {
-        status = 0;
+  /* Only proceed if name could be part of a call number and the path
+   * would fit in the search path buffer */
+  plen = strlen((ps->pl)->path);
+  rlen = strlen(ps->pRel) + strlen(pName);
+  if (instr_iscomp(pName, isdir) &&
+      (plen + rlen + 3 <= MAX_SEARCH_BUF)) {
+    
+    /* Build the new relative path, with a trailing separator if this
+     * is a directory */
+    prel = (char *) malloc(rlen + 2);
+    if (prel == NULL) {
+      abort();
+    }
+    strcpy(prel, ps->pRel);
+    strcat(prel, pName);
+    if (isdir) {
+      cb[0] = (char) os_getsep();
+      strcat(prel, cb);
+    }
+    
+    if (isdir && (ps->depth < INDEX_MAXDEPTH)) {
+      /* Directory, so build its full path without trailing separator
+       * and scan it */
+      pdir = (char *) malloc(plen + rlen + 2);
+      if (pdir == NULL) {
+        abort();
       }
-      if (*pt == '.') {
-        if ((pt[1] == '.') || (pt[1] == 0)) {
-          status = 0;
+      cb[0] = (char) os_getsep();
+      strcpy(pdir, (ps->pl)->path);
+      strcat(pdir, cb);
+      strcat(pdir, ps->pRel);
+      strcat(pdir, pName);
+      
+      sub.pi = ps->pi;
+      sub.pl = ps->pl;
+      sub.pRel = prel;
+      sub.depth = ps->depth + 1;
+      os_listdir(pdir, &instr_indexscan, &sub);
+      
+      free(pdir);
+      pdir = NULL;
+      
+    } else if (!isdir) {
+      /* File, so add it to the index unless already present */
+      ppe = instr_indexslot(ps->pi, prel);
+      if (*ppe == NULL) {
+        *ppe = (INDEX_ENTRY *) malloc(sizeof(INDEX_ENTRY) + rlen);
+        if (*ppe == NULL) {
+          abort();
         }
+        memset(*ppe, 0, sizeof(INDEX_ENTRY));
+        (*ppe)->pNext = NULL;
+        (*ppe)->pl = ps->pl;
+        strcpy(&(((*ppe)->name)[0]), prel);
       }
-      if (!status) {
-        break;
-      }
-    }
-    if (!status) {
-      *per = INSTR_ERR_BADCALL;
-      *per_src = INSTR_ERRMOD_INSTR;
-      *pline = 0;
     }
+    
+    free(prel);
+    prel = NULL;
   }
+}
+
+/*
+ * Build the search path index if it has not been built yet.
+ * 
+ * The search directories are scanned in search chain order, so the
+ * first directory that contains a given relative path wins, just as if
+ * each directory were checked in turn.  Search directories that don't
+ * exist are skipped.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ */
+static void instr_indexbuild(INSTR_CTX *pi) {
   
-  /* Change all periods to platform-specific separator */
-  if (status) {
-    for(pt = pc; *pt != 0; pt++) {
-      if (*pt == '.') {
-        *pt = (char) os_getsep();
-      }
-    }
-  }
+  SEARCH_LINK *pl = NULL;
+  INDEX_SCAN scan;
+  char *pdir = NULL;
+  int32_t i = 0;
   
-  /* Go through all base directories in the search path looking for the
-   * instrument file */
-  if (status) {
-    for(pl = m_instr_search; pl != NULL; pl = pl->pNext) {
+  /* Initialize structures */
+  memset(&scan, 0, sizeof(INDEX_SCAN));
+  
+  /* Only proceed if index not built */
+  if (!pi->indexed) {
+    
+    /* Clear the buckets */
+    for(i = 0; i < INDEX_BUCKETS; i++) {
+      pi->index[i] = NULL;
+    }
+    
+    /* Scan each search directory */
+    instr_chaininit(pi);
+    for(pl = pi->pSearch; pl != NULL; pl = pl->pNext) {
       
-      /* Compute the full length of the path that will be constructed */
-      full_len = (int32_t) strlen(pl->path);
-      if (full_len <= INT32_MAX - 2) {
-        full_len += 2;
-      } else {
-        abort();  /* overflow */
+      /* Copy the directory path without any trailing separators */
+      pdir = (char *) malloc(strlen(pl->path) + 1);
+      if (pdir == NULL) {
+        abort();
       }
-      
-      x = (int32_t) strlen(pc);
-      if (x <= INT32_MAX - full_len) {
-        full_len += x;
+      strcpy(pdir, pl->path);
+      for(i = ((int32_t) strlen(pdir)) - 1; i >= 0; i--) {
+        if (os_issep(pdir[i])) {
+          pdir[i] = (char) 0;
+        } else {
+          break;
+        }
       }
       
-      x = (int32_t) strlen(pExt);
-      if (x <= INT32_MAX - full_len) {
-        full_len += x;
+      /* Scan the directory */
+      scan.pi = pi;
+      scan.pl = pl;
+      scan.pRel = "";
+      scan.depth = 0;
+      if (*pdir != 0) {
+        os_listdir(pdir, &instr_indexscan, &scan);
       }
       
-      /* Check that full length fits in path buffer */
-      if (full_len >= MAX_SEARCH_BUF) {
-        status = 0;
-        *per = INSTR_ERR_HUGEPATH;
-        *per_src = INSTR_ERRMOD_INSTR;
-        *pline = 0;
-      }
-      
-      /* Clear the path buffer */
-      if (status) {
-        memset(pbuf, 0, MAX_SEARCH_BUF);
+      free(pdir);
+      pdir = NULL;
+    }
+    
+    /* Set indexed flag */
+    pi->indexed = 1;
+  }
+}
+
+/*
+ * Release the search path index, so that it will be rebuilt on the
+ * next lookup.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ */
+static void instr_indexclear(INSTR_CTX *pi) {
+  
+  INDEX_ENTRY *pe = NULL;
+  int32_t i = 0;
+  
+  /* Only proceed if index built */
+  if (pi->indexed) {
+    
+    /* Free each bucket */
+    for(i = 0; i < INDEX_BUCKETS; i++) {
+      while (pi->index[i] != NULL) {
+        pe = pi->index[i];
+        pi->index[i] = pe->pNext;
+        free(pe);
       }
-      
-      /* Build the full path in the buffer */
-      if (status) {
-        strcpy(pbuf, pl->path);
-        
-        cb[0] = (char) os_getsep();
-        strcat(pbuf, cb);
-        
-        strcat(pbuf, pc);
-        strcat(pbuf, pExt);
+    }
+    
+    /* Clear indexed flag */
+    pi->indexed = 0;
+  }
+}
+
+/*
+ * Find a call number on the chain of loaded external instruments.
+ * 
+ * Only entries that were loaded at the given sampling rate match.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pCall - the call number
+ * 
+ *   rate - the sampling rate
+ * 
+ * Return:
+ * 
+ *   the chain entry, or NULL if the call number has not been loaded at
+ *   that rate
+ */
+static LOAD_MEMO *instr_memofind(
+          INSTR_CTX * pi,
+    const char      * pCall,
+          int32_t     rate) {
+  
+  LOAD_MEMO *pm = NULL;
+  
+  /* Check parameters */
+  if (pCall == NULL) {
+    abort();
+  }
+  
+  /* Search the chain */
+  for(pm = pi->pMemo; pm != NULL; pm = pm->pNext) {
+    if ((pm->rate == rate) &&
+        (strcmp(&((pm->call)[0]), pCall) == 0)) {
+      break;
+    }
+  }
+  
+  /* Return entry or NULL */
+  return pm;
+}
+
+/*
+ * Add a loaded external instrument to the chain of loaded external
+ * instruments.
+ * 
+ * pRoot is the bound generator map that was loaded for the call
+ * number at sampling rate rate, and icount is its number of instance
+ * data structures.  A reference to the generator map is added for the
+ * chain entry.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pCall - the call number
+ * 
+ *   rate - the sampling rate the generator map was loaded at
+ * 
+ *   pRoot - the loaded generator map
+ * 
+ *   icount - the number of instance data structures
+ */
+static void instr_memoadd(
+          INSTR_CTX * pi,
+    const char      * pCall,
+          int32_t     rate,
+          GENERATOR * pRoot,
+          int32_t     icount) {
+  
+  LOAD_MEMO *pm = NULL;
+  
+  /* Check parameters */
+  if ((pCall == NULL) || (pRoot == NULL) || (icount < 1)) {
+    abort();
+  }
+  
+  /* Allocate new entry with room for the call number */
+  pm = (LOAD_MEMO *) malloc(sizeof(LOAD_MEMO) + strlen(pCall));
+  if (pm == NULL) {
+    abort();
+  }
+  memset(pm, 0, sizeof(LOAD_MEMO));
+  
+  /* Fill in the entry */
+  pm->pRoot = pRoot;
+  generator_addref(pm->pRoot);
+  pm->icount = icount;
+  pm->rate = rate;
+  strcpy(&((pm->call)[0]), pCall);
+  
+  /* Prefix to chain */
+  pm->pNext = pi->pMemo;
+  pi->pMemo = pm;
+}
+
+/*
+ * Release the whole chain of loaded external instruments.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ */
+static void instr_memoclear(INSTR_CTX *pi) {
+  
+  LOAD_MEMO *pm = NULL;
+  
+  while (pi->pMemo != NULL) {
+    pm = pi->pMemo;
+    pi->pMemo = pm->pNext;
+    
+    generator_release(pm->pRoot);
+    pm->pRoot = NULL;
+    free(pm);
+  }
+}
+
+/*
+ * Add a call number to the list of deferred external instruments.
+ * 
+ * Nothing happens if the call number is already on the list.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pCall - the call number
+ */
+static void instr_defer(INSTR_CTX *pi, const char *pCall) {
+  
+  int found = 0;
+  int32_t i = 0;
+  
+  /* Check parameters */
+  if (pCall == NULL) {
+    abort();
+  }
+  
+  /* Check whether the call number is already on the list */
+  for(i = 0; i < pi->defer_count; i++) {
+    if (strcmp((pi->ppDefer)[i], pCall) == 0) {
+      found = 1;
+      break;
+    }
+  }
+  
+  /* Append the call number if it isn't, growing the list if needed */
+  if (!found) {
+    if (pi->defer_count >= pi->defer_cap) {
+      if (pi->defer_cap < 1) {
+        pi->defer_cap = 16;
+      } else if (pi->defer_cap <= INT32_MAX / 2) {
+        pi->defer_cap *= 2;
+      } else {
+        abort();
       }
-      
-      /* Check if file exists; leave loop if it does and set
-       * file_found flag */
-      if (status) {
-        if (os_isfile(pbuf)) {
-          file_found = 1;
-          break;
-        }
+      pi->ppDefer = (char **) realloc(
+                      pi->ppDefer,
+                      ((size_t) pi->defer_cap) * sizeof(char *));
+      if (pi->ppDefer == NULL) {
+        abort();
       }
-      
-      /* Leave loop if error */
-      if (!status) {
-        break;
+    }
+    
+    (pi->ppDefer)[pi->defer_count] = (char *) malloc(strlen(pCall) + 1);
+    if ((pi->ppDefer)[pi->defer_count] == NULL) {
+      abort();
+    }
+    strcpy((pi->ppDefer)[pi->defer_count], pCall);
+    (pi->defer_count)++;
+  }
+}
+
+/*
+ * Release the list of deferred external instruments.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ */
+static void instr_deferclear(INSTR_CTX *pi) {
+  
+  int32_t i = 0;
+  
+  for(i = 0; i < pi->defer_count; i++) {
+    free((pi->ppDefer)[i]);
+    (pi->ppDefer)[i] = NULL;
+  }
+  if (pi->ppDefer != NULL) {
+    free(pi->ppDefer);
+    pi->ppDefer = NULL;
+  }
+  pi->defer_count = 0;
+  pi->defer_cap = 0;
+}
+
+/*
+ * Run one of the loaders of instr_loadjobs().
+ * 
+ * Each job of the loader is loaded into register zero of the loader's
+ * own context with instr_extload(), which also remembers the loaded
+ * generator map on the chain of loaded call numbers of that context.
+ * The result of each load is written into its job.
+ * 
+ * Interface matches os_fp_worker.  pw is NULL if the loader runs on
+ * the calling thread instead of a worker.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker, or NULL
+ * 
+ *   pCustom - the LOADER structure
+ */
+static void instr_loader(OS_WORKER *pw, void *pCustom) {
+  
+  int32_t j = 0;
+  LOADER *pl = NULL;
+  LOAD_JOB *pj = NULL;
+  
+  /* No coordination with the starting thread is needed besides the
+   * join */
+  (void) pw;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  pl = (LOADER *) pCustom;
+  
+  /* Load each job of this loader */
+  for(j = pl->first; j < pl->count; j += pl->step) {
+    pj = &((pl->pJobs)[j]);
+    pj->status = instr_extload(
+                    pl->pi, 0, pj->pCall,
+                    &(pj->err), &(pj->err_src), &(pj->line));
+  }
+}
+
+/*
+ * Load external instruments on worker threads.
+ * 
+ * pJobs is an array of jcount jobs, each with the call number to load
+ * filled in.  The call numbers must be distinct and must not already be
+ * loaded at sampling rate rate.  The search chain and index of the
+ * context must already be built, since the loaders only read them.
+ * 
+ * The platform is first asked to start reading all of the instrument
+ * files.  The jobs are then split between up to LOADER_COUNT loaders,
+ * each running on a worker thread with a context of its own at
+ * sampling rate rate.  A loader whose thread can't be started runs on
+ * the calling thread.  Once all loaders are done, each instrument that
+ * loaded is added to the chain of loaded call numbers of this context
+ * at sampling rate rate, and the result of each job is filled in.
+ * 
+ * The rate of the context itself is neither used nor required to be
+ * set.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   rate - the sampling rate to load at
+ * 
+ *   pJobs - the jobs
+ * 
+ *   jcount - the number of jobs
+ */
+static void instr_loadjobs(
+    INSTR_CTX * pi,
+    int32_t     rate,
+    LOAD_JOB  * pJobs,
+    int32_t     jcount) {
+  
+  int err = 0;
+  int32_t j = 0;
+  int32_t lcount = 0;
+  char *pbuf = NULL;
+  char *pCache = NULL;
+  LOADER *pLoaders = NULL;
+  LOAD_MEMO *pm = NULL;
+  
+  /* Check parameters */
+  if ((jcount < 0) || ((jcount > 0) && (pJobs == NULL))) {
+    abort();
+  }
+  if ((rate != RATE_CD) && (rate != RATE_DVD)) {
+    abort();
+  }
+  
+  /* Allocate path buffer */
+  pbuf = (char *) malloc((size_t) MAX_SEARCH_BUF);
+  if (pbuf == NULL) {
+    abort();
+  }
+  
+  /* Let the platform start reading every instrument file to load, and
+   * any compiled cache entries, before any of them is interpreted */
+  for(j = 0; j < jcount; j++) {
+    if (instr_find(pi, pJobs[j].pCall, ".iretro", pbuf, &err)) {
+      os_prefetch(pbuf);
+      if (pi->pCache != NULL) {
+        pCache = instr_cachepath(pi, pbuf);
+        os_prefetch(pCache);
+        free(pCache);
+        pCache = NULL;
       }
     }
+  }
+  
+  /* Set up the loaders, each with a context of its own that has the
+   * same settings as this one and finds files through this one */
+  lcount = jcount;
+  if (lcount > LOADER_COUNT) {
+    lcount = LOADER_COUNT;
+  }
+  if (lcount > 0) {
+    pLoaders = (LOADER *) calloc((size_t) lcount, sizeof(LOADER));
+    if (pLoaders == NULL) {
+      abort();
+    }
+  }
+  for(j = 0; j < lcount; j++) {
+    pLoaders[j].pi = instr_alloc(pi->psw);
+    instr_setsamp(pLoaders[j].pi, rate);
+    instr_simplify(pLoaders[j].pi, pi->simplify);
+    if (pi->pCache != NULL) {
+      instr_cachedir(pLoaders[j].pi, pi->pCache);
+    }
+    (pLoaders[j].pi)->pLookup = pi;
     
-    /* Fail if no instrument file found */
-    if (status && (!file_found)) {
-      status = 0;
-      *per = INSTR_ERR_NOTFOUND;
-      *per_src = INSTR_ERRMOD_INSTR;
-      *pline = 0;
+    pLoaders[j].pJobs = pJobs;
+    pLoaders[j].first = j;
+    pLoaders[j].step = lcount;
+    pLoaders[j].count = jcount;
+  }
+  
+  /* Start each loader on a worker thread, running it here instead if
+   * no thread could be started, and then wait for all of them */
+  for(j = 0; j < lcount; j++) {
+    pLoaders[j].pw = os_worker(&instr_loader, &(pLoaders[j]));
+    if (pLoaders[j].pw == NULL) {
+      instr_loader(NULL, &(pLoaders[j]));
+    }
+  }
+  for(j = 0; j < lcount; j++) {
+    if (pLoaders[j].pw != NULL) {
+      os_join(pLoaders[j].pw);
+      pLoaders[j].pw = NULL;
     }
   }
   
-  /* If we got here, then we found an instrument file and its path is in
-   * the pbuf buffer -- open a file handle to read it */
-  if (status) {
-    pHIn = fopen(pbuf, "rb");
-    if (pHIn == NULL) {
-      status = 0;
-      *per = INSTR_ERR_OPEN;
-      *per_src = INSTR_ERRMOD_INSTR;
-      *pline = 0;
+  /* Remember each generator map that was loaded in this context */
+  for(j = 0; j < jcount; j++) {
+    if (pJobs[j].status) {
+      pm = instr_memofind(
+              pLoaders[j % lcount].pi, pJobs[j].pCall, rate);
+      if (pm == NULL) {
+        abort();
+      }
+      instr_memoadd(pi, pJobs[j].pCall, rate, pm->pRoot, pm->icount);
     }
   }
   
-  /* Transfer the file handle into a Shastina source */
-  if (status) {
-    pIn = snsource_stream(pHIn, SNSTREAM_OWNER | SNSTREAM_RANDOM);
-    pHIn = NULL;
+  /* Release the loaders */
+  for(j = 0; j < lcount; j++) {
+    instr_free(pLoaders[j].pi);
+    pLoaders[j].pi = NULL;
+  }
+  if (pLoaders != NULL) {
+    free(pLoaders);
+    pLoaders = NULL;
   }
   
-  /* Load instrument */
+  /* Release path buffer */
+  free(pbuf);
+  pbuf = NULL;
+}
+
+/*
+ * Compute the FNV-1a 64-bit hash of the contents of a file.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ *   ph - variable to receive the hash
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file could not be read
+ */
+static int instr_hashfile(const char *pPath, uint64_t *ph) {
+  
+  int status = 1;
+  size_t n = 0;
+  uint64_t h = FNV_BASIS;
+  FILE *pf = NULL;
+  unsigned char buf[4096];
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (ph == NULL)) {
+    abort();
+  }
+  
+  /* Open the file */
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Hash the whole file */
   if (status) {
-    if (!instr_load(i, pIn, per, per_src, pline)) {
+    for(n = fread(buf, 1, sizeof(buf), pf);
+        n > 0;
+        n = fread(buf, 1, sizeof(buf), pf)) {
+      h = instr_fnv(h, buf, n);
+    }
+    if (ferror(pf)) {
       status = 0;
     }
   }
   
-  /* Close Shastina source if open */
-  snsource_free(pIn);
-  pIn = NULL;
+  /* Close the file */
+  if (pf != NULL) {
+    fclose(pf);
+    pf = NULL;
+  }
   
-  /* Close file if open */
-  if (pHIn != NULL) {
-    fclose(pHIn);
-    pHIn = NULL;
+  /* Write the hash */
+  if (status) {
+    *ph = h;
   }
   
-  /* Release path buffer if allocated */
-  if (pbuf != NULL) {
-    free(pbuf);
-    pbuf = NULL;
+  /* Return status */
+  return status;
+}
+
+/*
+ * Build the cache key for an instrument file.
+ * 
+ * The key is a line of text that identifies the cache format version,
+ * the sampling rate, the hash of the instrument file contents, and the
+ * path of the instrument file.  It is stored at the start of the cache
+ * entry, and the entry is only used if its key matches exactly.
+ * 
+ * The returned string is dynamically allocated.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pPath - the path to the instrument file
+ * 
+ *   h - the hash of the instrument file contents
+ * 
+ * Return:
+ * 
+ *   the cache key
+ */
+static char *instr_cachekey(
+          INSTR_CTX * pi,
+    const char      * pPath,
+          uint64_t    h) {
+  
+  char *pKey = NULL;
+  
+  /* Check parameters */
+  if (pPath == NULL) {
+    abort();
   }
   
-  /* Release copy of call number if allocated */
-  if (pc != NULL) {
-    free(pc);
-    pc = NULL;
-  }
+  /* Allocate key with room for the fixed fields */
+  pKey = (char *) malloc(strlen(pPath) + 64);
+  if (pKey == NULL) {
+    abort();
+  }
+  
+  /* Format the key */
+  sprintf(pKey, "retro-cache %d %ld %08lx%08lx %s\n",
+          CACHE_VERSION,
+          (long) pi->rate,
+          (unsigned long) (h >> 32),
+          (unsigned long) (h & UINT64_C(0xffffffff)),
+          pPath);
+  
+  /* Return key */
+  return pKey;
+}
+
+/*
+ * Get the path to the cache entry for an instrument file.
+ * 
+ * The cache entry name is the hash of the instrument file path, so each
+ * instrument file has a single cache entry that is replaced whenever
+ * the instrument file changes.
+ * 
+ * The cache directory must be set.  The returned string is dynamically
+ * allocated.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pPath - the path to the instrument file
+ * 
+ * Return:
+ * 
+ *   the path to the cache entry
+ */
+static char *instr_cachepath(INSTR_CTX *pi, const char *pPath) {
+  
+  char *pc = NULL;
+  uint64_t h = 0;
+  
+  /* Check parameters and state */
+  if ((pPath == NULL) || (pi->pCache == NULL)) {
+    abort();
+  }
+  
+  /* Hash the path */
+  h = instr_fnv(
+        FNV_BASIS, (const unsigned char *) pPath, strlen(pPath));
+  
+  /* Allocate the path with room for separator, hash, and extension */
+  pc = (char *) malloc(strlen(pi->pCache) + strlen(CACHE_EXT) + 18);
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Format the path */
+  sprintf(pc, "%s%c%08lx%08lx%s",
+          pi->pCache,
+          (char) os_getsep(),
+          (unsigned long) (h >> 32),
+          (unsigned long) (h & UINT64_C(0xffffffff)),
+          CACHE_EXT);
+  
+  /* Return path */
+  return pc;
+}
+
+/*
+ * Load a compiled instrument from a cache entry.
+ * 
+ * The cache entry is only used if it begins with exactly the given key.
+ * The returned generator is unbound.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pCache - the path to the cache entry
+ * 
+ *   pKey - the expected cache key
+ * 
+ * Return:
+ * 
+ *   the restored generator, or NULL if the cache entry is missing, out
+ *   of date, or invalid
+ */
+static GENERATOR *instr_cacheload(
+          INSTR_CTX * pi,
+    const char      * pCache,
+    const char      * pKey) {
+  
+  int status = 1;
+  size_t klen = 0;
+  char *pBuf = NULL;
+  FILE *pf = NULL;
+  GENERATOR *pRoot = NULL;
+  
+  /* Check parameters */
+  if ((pCache == NULL) || (pKey == NULL)) {
+    abort();
+  }
+  
+  /* Open the cache entry, if it exists */
+  pf = fopen(pCache, "rb");
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Read and compare the key */
+  if (status) {
+    klen = strlen(pKey);
+    pBuf = (char *) malloc(klen + 1);
+    if (pBuf == NULL) {
+      abort();
+    }
+    if (fread(pBuf, 1, klen, pf) != klen) {
+      status = 0;
+    }
+    if (status && (memcmp(pBuf, pKey, klen) != 0)) {
+      status = 0;
+    }
+  }
+  
+  /* Restore the generator */
+  if (status) {
+    pRoot = generator_restore(pf, pi->rate);
+  }
+  
+  /* Release resources */
+  if (pBuf != NULL) {
+    free(pBuf);
+    pBuf = NULL;
+  }
+  if (pf != NULL) {
+    fclose(pf);
+    pf = NULL;
+  }
+  
+  /* Return restored generator or NULL */
+  return pRoot;
+}
+
+/*
+ * Save a compiled instrument to a cache entry.
+ * 
+ * The entry is first written to a temporary file and then renamed, so
+ * that an interrupted write never leaves a partial entry behind.  The
+ * temporary file has a unique name, so that parallel jobs saving the
+ * same entry don't write into each other's files.  Any failure just
+ * leaves the cache without the entry.
+ * 
+ * Parameters:
+ * 
+ *   pCache - the path to the cache entry
+ * 
+ *   pKey - the cache key
+ * 
+ *   pRoot - the generator to save
+ */
+static void instr_cachesave(
+    const char      * pCache,
+    const char      * pKey,
+          GENERATOR * pRoot) {
+  
+  int status = 1;
+  char *pTemp = NULL;
+  FILE *pf = NULL;
+  
+  /* Check parameters */
+  if ((pCache == NULL) || (pKey == NULL) || (pRoot == NULL)) {
+    abort();
+  }
+  
+  /* Create the temporary file */
+  pf = os_tempfile(pCache, &pTemp);
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Write the temporary file */
+  if (status) {
+    if (fputs(pKey, pf) == EOF) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    if (!generator_save(pRoot, pf)) {
+      status = 0;
+    }
+  }
+  
+  if (pf != NULL) {
+    if (fclose(pf) != 0) {
+      status = 0;
+    }
+    pf = NULL;
+  }
+  
+  /* Move the temporary file into place, or remove it on failure */
+  if (status) {
+    remove(pCache);
+    if (rename(pTemp, pCache) != 0) {
+      status = 0;
+    }
+  }
+  if ((!status) && (pTemp != NULL)) {
+    remove(pTemp);
+  }
+  
+  /* Release temporary path */
+  free(pTemp);
+  pTemp = NULL;
+}
+
+/*
+ * Set up an instrument register with an FM instrument.
+ * 
+ * instr_clear() is run automatically on the indicated register first.
+ * The minimum intensity will be set to half and the maximum intensity
+ * will be set to maximum possible value.  The stereo position will be
+ * set to center.
+ * 
+ * pRoot is the bound generator map.  A reference is added for the
+ * register.  icount is the number of instance data structures it
+ * requires.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   pRoot - the bound generator map
+ * 
+ *   icount - the number of instance data structures
+ */
+static void instr_setfm(
+    INSTR_CTX * pi,
+    int32_t     i,
+    GENERATOR * pRoot,
+    int32_t     icount) {
+  
+  INSTR_REG *pr = NULL;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
+      (pRoot == NULL) || (icount < 1)) {
+    abort();
+  }
+  
+  /* Clear instrument register */
+  instr_clear(pi, i);
+  
+  /* Get instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Setup default intensity and stereo position */
+  pr->i_min = (MAX_FRAC / 2);
+  pr->i_max = MAX_FRAC;
+  stereo_setPos(&(pr->sp), 0);
+  
+  /* Store FM instrument definition */
+  pr->itype = ITYPE_FM;
+  (pr->val).fmp.pRoot = pRoot;
+  generator_addref(pRoot);
+  (pr->val).fmp.icount = icount;
+  (pr->val).fmp.fixed = generator_fixed(pRoot);
+}
+
+/*
+ * Get the frozen event for an FM instrument event.
+ * 
+ * pfm is the FM instrument, which must be fixed.  pitch and dur are the
+ * pitch and duration of the event, and f is the frequency of the pitch.
+ * 
+ * pv is the instance data that was just initialized for the event.  If
+ * the event is not in the frozen event bank yet, it is rendered into
+ * the bank using this instance data, which is then initialized again.
+ * 
+ * NULL is returned if the event does not fit in what remains of the
+ * frozen event bank.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pfm - the FM instrument
+ * 
+ *   pitch - the pitch of the event
+ * 
+ *   dur - the duration of the event
+ * 
+ *   f - the frequency of the pitch
+ * 
+ *   pv - the instance data for the event
+ * 
+ * Return:
+ * 
+ *   the frozen event, or NULL
+ */
+static const FROZEN *instr_frozen(
+          INSTR_CTX * pi,
+    const FM_PARAM  * pfm,
+          int32_t     pitch,
+          int64_t     dur,
+          double      f,
+          FM_VOICE  * pv) {
+  
+  FROZEN *pe = NULL;
+  FROZEN **ppb = NULL;
+  uint64_t h = FNV_BASIS;
+  int64_t len = 0;
+  int32_t t = 0;
+  
+  /* Check parameters */
+  if ((pfm == NULL) || (pv == NULL) || (dur < 1)) {
+    abort();
+  }
+  if (!(pfm->fixed)) {
+    abort();
+  }
+  
+  /* Find the hash bucket for this generator map, pitch, and duration */
+  h = instr_fnv(
+        h, (const unsigned char *) &(pfm->pRoot), sizeof(GENERATOR *));
+  h = instr_fnv(h, (const unsigned char *) &pitch, sizeof(int32_t));
+  h = instr_fnv(h, (const unsigned char *) &dur, sizeof(int64_t));
+  ppb = &(pi->frozen[(size_t) (h % FREEZE_BUCKETS)]);
+  
+  /* Look for the event in the bucket */
+  for(pe = *ppb; pe != NULL; pe = pe->pNext) {
+    if ((pe->pRoot == pfm->pRoot) &&
+        (pe->pitch == pitch) && (pe->dur == dur)) {
+      break;
+    }
+  }
+  
+  /* If not found, render the event into the bank if it fits */
+  if (pe == NULL) {
+    len = generator_length(pfm->pRoot, pv->od, pfm->icount);
+    if (len <= ((int64_t) pi->freeze_left)) {
+      
+      /* Allocate the new entry */
+      pe = (FROZEN *) malloc(sizeof(FROZEN));
+      if (pe == NULL) {
+        abort();
+      }
+      memset(pe, 0, sizeof(FROZEN));
+      pe->len = (int32_t) len;
+      
+      pe->ps = (double *) calloc((size_t) pe->len, sizeof(double));
+      if (pe->ps == NULL) {
+        abort();
+      }
+      
+      /* Render the event */
+      for(t = 0; t < pe->len; t++) {
+        (pe->ps)[t] = generator_invoke(
+                        pfm->pRoot, pv->od, pfm->icount, t);
+      }
+      
+      /* Fill in the entry and link it into the bucket */
+      pe->pRoot = pfm->pRoot;
+      generator_addref(pe->pRoot);
+      pe->pitch = pitch;
+      pe->dur = dur;
+
+      pe->pNext = *ppb;
+      *ppb = pe;
+      pi->freeze_left -= pe->len;
+      
+      /* Initialize the instance data again; fixed generator maps
+       * have no noise, so the seed does not matter */
+      for(t = 0; t < pfm->icount; t++) {
+        generator_opdata_init(&((pv->od)[t]), f, dur, pi->period, 0);
+      }
+    }
+  }
+  
+  /* Return the frozen event or NULL */
+  return pe;
+}
+
+/*
+ * Load an instrument from a given Shastina source.
+ * 
+ * i must be in range [0, INSTR_MAXCOUNT - 1].  instr_clear() is run
+ * automatically on the indicated register before the new instrument is
+ * defined.
+ * 
+ * pIn is a Shastina source that contains the whole script for defining
+ * the instrument.  It must support multipass.
+ * 
+ * The minimum intensity will be set to half and the maximum intensity
+ * will be set to maximum possible value.  The stereo position will be
+ * set to center.
+ * 
+ * per and pline are pointers to variables to receive an error code and
+ * a line number if there is an error.  per_src points to an integer
+ * to receive one of the INSTR_ERRMOD_ constants that indicates what
+ * Retro module the error code comes from, which determines the meaning
+ * of the error code.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   pIn - the source for the instrument script
+ * 
+ *   per - pointer to variable to receive genmap error code
+ * 
+ *   per_src - the module from which the error number comes
+ * 
+ *   pline - pointer to variable to receive line number within script
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int instr_load(
+    INSTR_CTX * pi,
+    int32_t     i,
+    SNSOURCE  * pIn,
+    int       * per,
+    int       * per_src,
+    long      * pline) {
+  
+  int status = 1;
+  GENMAP_RESULT gmr;
+  
+  /* Initialize structures */
+  memset(&gmr, 0, sizeof(GENMAP_RESULT));
+  gmr.pRoot = NULL;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
+      (pIn == NULL) || (per == NULL) ||
+      (per_src == NULL) || (pline == NULL)) {
+    abort();
+  }
+  if (!snsource_ismulti(pIn)) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pi->rate == 0) {
+    abort();
+  }
+  
+  /* We currently only support genmap instruments, so call through */
+  genmap_run(pIn, &gmr, pi->rate, pi->simplify, &instr_table, pi);
+  
+  /* Handle errors */
+  if (gmr.errcode != GENMAP_OK) {
+    status = 0;
+    if (gmr.errcode < 0) {
+      *per_src = INSTR_ERRMOD_SHASTINA;
+    } else {
+      *per_src = INSTR_ERRMOD_GENMAP;
+    }
+    *per = gmr.errcode;
+    *pline = gmr.linenum;
+  }
+  
+  /* If successful, set up the instrument */
+  if (status) {
+    instr_setfm(pi, i, gmr.pRoot, gmr.icount);
+  }
+  
+  /* Release object references */
+  generator_release(gmr.pRoot);
+  gmr.pRoot = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Load an external instrument into a register right away.
+ * 
+ * This is the loader behind instr_external() and instr_flush().  The
+ * parameters and return value are the same as for instr_external(),
+ * except that the instrument is loaded before returning instead of
+ * being left pending.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   pCall - the "call number" of the external instrument script
+ * 
+ *   per - pointer to variable to receive genmap error code
+ * 
+ *   per_src - the module from which the error number comes
+ * 
+ *   pline - pointer to variable to receive line number within script
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int instr_extload(
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pCall,
+          int       * per,
+          int       * per_src,
+          long      * pline) {
+  
+  const char *pExt = ".iretro";
+  
+  int status = 1;
+  int cached = 0;
+  uint64_t h = 0;
+  char *pbuf = NULL;
+  char *pCache = NULL;
+  char *pKey = NULL;
+  FILE *pHIn = NULL;
+  SNSOURCE *pIn = NULL;
+  GENERATOR *pRoot = NULL;
+  LOAD_MEMO *pm = NULL;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
+      (pCall == NULL) || (per == NULL) ||
+      (per_src == NULL) || (pline == NULL)) {
+    abort();
+  }
+  
+  /* Reset error information */
+  *per = INSTR_ERR_OK;
+  *per_src = INSTR_ERRMOD_INSTR;
+  *pline = 0;
+  
+  /* If this call number was already loaded, share its generator map
+   * and skip everything else */
+  pm = instr_memofind(pi, pCall, pi->rate);
+  if (pm != NULL) {
+    instr_setfm(pi, i, pm->pRoot, pm->icount);
+    cached = 1;
+  }
+  
+  /* Allocate path buffer */
+  pbuf = (char *) malloc((size_t) MAX_SEARCH_BUF);
+  if (pbuf == NULL) {
+    abort();
+  }
+  
+  /* Find the instrument file */
+  if ((!cached) && (!instr_find(pi, pCall, pExt, pbuf, per))) {
+    status = 0;
+    *per_src = INSTR_ERRMOD_INSTR;
+    *pline = 0;
+  }
+  
+  /* If there is a compiled instrument cache, check for an up-to-date
+   * entry for this instrument file */
+  if (status && (!cached) && (pi->pCache != NULL)) {
+    if (instr_hashfile(pbuf, &h)) {
+      pCache = instr_cachepath(pi, pbuf);
+      pKey = instr_cachekey(pi, pbuf, h);
+      
+      pRoot = instr_restored(pi, instr_cacheload(pi, pCache, pKey));
+      if (pRoot != NULL) {
+        instr_setfm(pi, i, pRoot, generator_bind(pRoot, 0));
+        cached = 1;
+      }
+      
+      generator_release(pRoot);
+      pRoot = NULL;
+    }
+  }
+  
+  /* If we got here without a cached instrument, then we found an
+   * instrument file and its path is in the pbuf buffer -- open a file
+   * handle to read it */
+  if (status && (!cached)) {
+    pHIn = fopen(pbuf, "rb");
+    if (pHIn == NULL) {
+      status = 0;
+      *per = INSTR_ERR_OPEN;
+      *per_src = INSTR_ERRMOD_INSTR;
+      *pline = 0;
+    }
+  }
+  
+  /* Transfer the file handle into a Shastina source */
+  if (status && (!cached)) {
+    pIn = snsource_stream(pHIn, SNSTREAM_OWNER | SNSTREAM_RANDOM);
+    pHIn = NULL;
+  }
+  
+  /* Load instrument */
+  if (status && (!cached)) {
+    if (!instr_load(pi, i, pIn, per, per_src, pline)) {
+      status = 0;
+    }
+  }
+  
+  /* If the instrument was interpreted and there is a cache entry path,
+   * save the compiled instrument in the cache */
+  if (status && (!cached) && (pCache != NULL)) {
+    instr_cachesave(pCache, pKey, (instr_ptr(pi, i)->val).fmp.pRoot);
+  }
+  
+  /* Remember the loaded call number unless it was already remembered */
+  if (status && (pm == NULL)) {
+    instr_memoadd(
+      pi, pCall, pi->rate,
+      (instr_ptr(pi, i)->val).fmp.pRoot,
+      (instr_ptr(pi, i)->val).fmp.icount);
+  }
+  
+  /* Close Shastina source if open */
+  snsource_free(pIn);
+  pIn = NULL;
+  
+  /* Close file if open */
+  if (pHIn != NULL) {
+    fclose(pHIn);
+    pHIn = NULL;
+  }
+  
+  /* Release path buffers if allocated */
+  if (pbuf != NULL) {
+    free(pbuf);
+    pbuf = NULL;
+  }
+  if (pCache != NULL) {
+    free(pCache);
+    pCache = NULL;
+  }
+  if (pKey != NULL) {
+    free(pKey);
+    pKey = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * instr_alloc function.
+ */
+INSTR_CTX *instr_alloc(SQWAVE_CTX *psw) {
+  
+  INSTR_CTX *pi = NULL;
+  int32_t x = 0;
+  
+  /* Check parameter */
+  if (psw == NULL) {
+    abort();
+  }
+  
+  /* Allocate context */
+  pi = (INSTR_CTX *) malloc(sizeof(INSTR_CTX));
+  if (pi == NULL) {
+    abort();
+  }
+  memset(pi, 0, sizeof(INSTR_CTX));
+  
+  /* Initialize fields */
+  pi->pSearch = NULL;
+  pi->search_count = 0;
+  pi->rate = 0;
+  pi->indexed = 0;
+  pi->pMemo = NULL;
+  pi->ppDefer = NULL;
+  pi->defer_count = 0;
+  pi->defer_cap = 0;
+  pi->pLookup = NULL;
+  pi->freeze = 0;
+  pi->freeze_left = FREEZE_MAXSAMP;
+  pi->simplify = 0;
+  pi->pCache = NULL;
+  pi->flat = 0;
+  pi->period = 1;
+  pi->seed = 0;
+  pi->psw = psw;
+  
+  for(x = 0; x < INDEX_BUCKETS; x++) {
+    (pi->index)[x] = NULL;
+  }
+  for(x = 0; x < FREEZE_BUCKETS; x++) {
+    (pi->frozen)[x] = NULL;
+  }
+  
+  /* Set all registers to clear */
+  for(x = 0; x < INSTR_MAXCOUNT; x++) {
+    ((pi->t)[x]).i_max = 0;
+    ((pi->t)[x]).i_min = 0;
+    ((pi->t)[x]).itype = ITYPE_NULL;
+    ((pi->t)[x]).val.dummy = 0;
+  }
+  
+  /* Return context */
+  return pi;
+}
+
+/*
+ * instr_free function.
+ */
+void instr_free(INSTR_CTX *pi) {
+  
+  int32_t x = 0;
+  SEARCH_LINK *pl = NULL;
+  FROZEN *pe = NULL;
+  
+  /* Only proceed if non-NULL */
+  if (pi != NULL) {
+    
+    /* Clear all registers, releasing their objects */
+    for(x = 0; x < INSTR_MAXCOUNT; x++) {
+      instr_clear(pi, x);
+    }
+    
+    /* Release the loaded and deferred call numbers and the search path
+     * index */
+    instr_memoclear(pi);
+    instr_deferclear(pi);
+    instr_indexclear(pi);
+    
+    /* Release the search chain */
+    while (pi->pSearch != NULL) {
+      pl = pi->pSearch;
+      pi->pSearch = pl->pNext;
+      free(pl);
+    }
+    
+    /* Release the frozen event bank */
+    for(x = 0; x < FREEZE_BUCKETS; x++) {
+      while ((pi->frozen)[x] != NULL) {
+        pe = (pi->frozen)[x];
+        (pi->frozen)[x] = pe->pNext;
+        
+        generator_release(pe->pRoot);
+        pe->pRoot = NULL;
+        free(pe->ps);
+        pe->ps = NULL;
+        free(pe);
+      }
+    }
+    
+    /* Release the cache directory */
+    if (pi->pCache != NULL) {
+      free(pi->pCache);
+      pi->pCache = NULL;
+    }
+    
+    /* Release the context */
+    free(pi);
+  }
+}
+
+/*
+ * instr_addsearch function.
+ */
+int instr_addsearch(INSTR_CTX *pi, const char *pDir) {
+  
+  int status = 1;
+  SEARCH_LINK *pl = NULL;
+  int32_t full_len = 0;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (pDir == NULL)) {
+    abort();
+  }
+  
+  /* Initialize search chain with default values if needed */
+  instr_chaininit(pi);
+  
+  /* Previously loaded call numbers might now resolve differently */
+  instr_memoclear(pi);
+  instr_indexclear(pi);
+  
+  /* Only proceed if not too many elements */
+  if (pi->search_count < MAX_SEARCH_LINK) {
+    /* Not too many search links, so increment count */
+    (pi->search_count)++;
+    
+    /* Compute full length of new link */
+    full_len = (int32_t) strlen(pDir);
+    if (full_len <= INT32_MAX - ((int32_t) sizeof(SEARCH_LINK))) {
+      full_len = full_len + ((int32_t) sizeof(SEARCH_LINK));
+    } else {
+      abort();  /* overflow */
+    }
+    
+    /* Allocate new link structure */
+    pl = (SEARCH_LINK *) malloc((size_t) full_len);
+    if (pl == NULL) {
+      abort();
+    }
+    memset(pl, 0, (size_t) full_len);
+    
+    /* Set next pointer to current chain */
+    pl->pNext = pi->pSearch;
+    
+    /* Copy in directory */
+    strcpy(&((pl->path)[0]), pDir);
+    
+    /* Prefix to chain */
+    pi->pSearch = pl;
+    pl = NULL;
+    
+  } else {
+    /* Too many search links */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * instr_freeze function.
+ */
+void instr_freeze(INSTR_CTX *pi, int enable) {
+  if (pi == NULL) {
+    abort();
+  }
+  if (enable) {
+    pi->freeze = 1;
+  } else {
+    pi->freeze = 0;
+  }
+}
+
+/*
+ * instr_simplify function.
+ */
+void instr_simplify(INSTR_CTX *pi, int enable) {
+  if (pi == NULL) {
+    abort();
+  }
+  if (enable) {
+    pi->simplify = 1;
+  } else {
+    pi->simplify = 0;
+  }
+}
+
+/*
+ * instr_cachedir function.
+ */
+void instr_cachedir(INSTR_CTX *pi, const char *pDir) {
+  
+  /* Check parameter */
+  if (pi == NULL) {
+    abort();
+  }
+  
+  /* Release any current cache directory */
+  if (pi->pCache != NULL) {
+    free(pi->pCache);
+    pi->pCache = NULL;
+  }
+  
+  /* Copy the new cache directory if given */
+  if (pDir != NULL) {
+    pi->pCache = (char *) malloc(strlen(pDir) + 1);
+    if (pi->pCache == NULL) {
+      abort();
+    }
+    strcpy(pi->pCache, pDir);
+  }
+}
+
+/*
+ * instr_setsamp function.
+ */
+void instr_setsamp(INSTR_CTX *pi, int32_t rate) {
+  
+  /* Check parameters */
+  if (pi == NULL) {
+    abort();
+  }
+  if ((rate != RATE_CD) && (rate != RATE_DVD)) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pi->rate != 0) {
+    abort();
+  }
+  
+  /* Store rate */
+  pi->rate = rate;
+}
+
+/*
+ * instr_flatten function.
+ */
+void instr_flatten(INSTR_CTX *pi) {
+  if (pi == NULL) {
+    abort();
+  }
+  pi->flat = 1;
+}
+
+/*
+ * instr_control function.
+ */
+void instr_control(INSTR_CTX *pi, int32_t period) {
+  if (pi == NULL) {
+    abort();
+  }
+  if ((period < 1) || (period > CONTROL_MAX)) {
+    abort();
+  }
+  pi->period = period;
+}
+
+/*
+ * instr_clear function.
+ */
+void instr_clear(INSTR_CTX *pi, int32_t i) {
+  
+  INSTR_REG *pr = NULL;
+  
+  /* Get instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Only proceed if instrument register not clear */
+  if (!instr_isclear(pr)) {
+    /* Release the instrument data */
+    if (pr->itype == ITYPE_SQUARE) {
+      /* Release square wave instrument */
+      adsr_release((pr->val).pa);
+      (pr->val).pa = NULL;
+    
+    } else if (pr->itype == ITYPE_FM) {
+      /* Release FM instrument */
+      generator_release((pr->val).fmp.pRoot);
+      (pr->val).fmp.pRoot = NULL;
+    
+    } else if (pr->itype == ITYPE_PENDING) {
+      /* Release pending external instrument */
+      free((pr->val).pCall);
+      (pr->val).pCall = NULL;
+    
+    } else {
+      /* Shouldn't happen */
+      abort();
+    }
+    
+    /* Clear the record */
+    memset(pr, 0, sizeof(INSTR_REG));
+    
+    /* Set the clear */
+    pr->i_max = 0;
+    pr->i_min = 0;
+    pr->itype = ITYPE_NULL;
+    (pr->val).dummy = 0;
+  }
+}
+
+/*
+ * instr_define function.
+ */
+void instr_define(
+          INSTR_CTX  * pi,
+          int32_t      i,
+          int32_t      i_max,
+          int32_t      i_min,
+          ADSR_OBJ   * pa,
+    const STEREO_POS * psp) {
+  
+  INSTR_REG *pr = NULL;
+  
+  /* Get instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Check parameters */
+  if ((i_max < 0) || (i_min < 0) ||
+      (i_max > MAX_FRAC) || (i_min > MAX_FRAC) ||
+      (i_max < i_min)) {
+    abort();
+  }
+  if ((pa == NULL) || (psp == NULL)) {
+    abort();
+  }
+  
+  /* Check for special case of both intensities zero */
+  if ((i_max == 0) && (i_min == 0)) {
+    /* Both intensities zero, so just clear the register */
+    instr_clear(pi, i);
+    
+  } else {
+    /* At least one intensity non-zero, so begin by clearing the
+     * register */
+    instr_clear(pi, i);
+    
+    /* Copy values in */
+    pr->i_max = (uint16_t) i_max;
+    pr->i_min = (uint16_t) i_min;
+    pr->itype = ITYPE_SQUARE;
+    (pr->val).pa = pa;
+    adsr_addref(pa);
+    memcpy(&(pr->sp), psp, sizeof(STEREO_POS));
+  }
+}
+
+/*
+ * instr_embedded function.
+ */
+int instr_embedded(
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pText,
+          int       * per,
+          int       * per_src,
+          long      * pline) {
+  
+  int status = 1;
+  SNSOURCE *pIn = NULL;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
+      (pText == NULL) || (per == NULL) ||
+      (per_src == NULL) || (pline == NULL)) {
+    abort();
+  }
+  
+  /* Wrap string in source */
+  pIn = snsource_string(pText);
+  
+  /* Load the instrument */
+  if (!instr_load(pi, i, pIn, per, per_src, pline)) {
+    status = 0;
+  }
+  
+  /* Release source if allocated */
+  snsource_free(pIn);
+  pIn = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * instr_external function.
+ */
+int instr_external(
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pCall,
+          int       * per,
+          int       * per_src,
+          long      * pline) {
+  
+  int status = 1;
+  char *pbuf = NULL;
+  INSTR_REG *pr = NULL;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= INSTR_MAXCOUNT) ||
+      (pCall == NULL) || (per == NULL) ||
+      (per_src == NULL) || (pline == NULL)) {
+    abort();
+  }
+  
+  /* If this call number was already loaded, there is nothing to wait
+   * for, so just load it right away */
+  if (instr_memofind(pi, pCall, pi->rate) != NULL) {
+    status = instr_extload(pi, i, pCall, per, per_src, pline);
+    
+  } else {
+    /* Reset error information */
+    *per = INSTR_ERR_OK;
+    *per_src = INSTR_ERRMOD_INSTR;
+    *pline = 0;
+    
+    /* Allocate path buffer */
+    pbuf = (char *) malloc((size_t) MAX_SEARCH_BUF);
+    if (pbuf == NULL) {
+      abort();
+    }
+    
+    /* Make sure the instrument file can be found, so that these errors
+     * are still reported where the instrument is defined */
+    if (!instr_find(pi, pCall, ".iretro", pbuf, per)) {
+      status = 0;
+    }
+    
+    /* Define a pending instrument with the same defaults that loading
+     * the instrument would give */
+    if (status) {
+      instr_clear(pi, i);
+      pr = instr_ptr(pi, i);
+      
+      pr->i_min = (MAX_FRAC / 2);
+      pr->i_max = MAX_FRAC;
+      stereo_setPos(&(pr->sp), 0);
+      
+      pr->itype = ITYPE_PENDING;
+      (pr->val).pCall = (char *) malloc(strlen(pCall) + 1);
+      if ((pr->val).pCall == NULL) {
+        abort();
+      }
+      strcpy((pr->val).pCall, pCall);
+      
+      instr_defer(pi, pCall);
+    }
+    
+    /* Release path buffer */
+    free(pbuf);
+    pbuf = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * instr_flush function.
+ */
+int instr_flush(
+    INSTR_CTX *  pi,
+    int       *  per,
+    int       *  per_src,
+    long      *  pline,
+    char      ** ppCall) {
+  
+  int status = 1;
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t jcount = 0;
+  LOAD_JOB *pJobs = NULL;
+  LOAD_MEMO *pm = NULL;
+  INSTR_REG *pr = NULL;
+  INSTR_REG saved;
+  
+  /* Initialize structures */
+  memset(&saved, 0, sizeof(INSTR_REG));
+  
+  /* Check parameters */
+  if ((per == NULL) || (per_src == NULL) || (pline == NULL)) {
+    abort();
+  }
+  
+  /* Reset error information */
+  *per = INSTR_ERR_OK;
+  *per_src = INSTR_ERRMOD_INSTR;
+  *pline = 0;
+  if (ppCall != NULL) {
+    *ppCall = NULL;
+  }
+  
+  /* Build the search chain and index now, since the loaders only read
+   * them */
+  instr_chaininit(pi);
+  instr_indexbuild(pi);
+  
+  /* Make a job for each deferred call number that hasn't been loaded
+   * yet, in definition order */
+  if (pi->defer_count > 0) {
+    pJobs = (LOAD_JOB *) calloc(
+                (size_t) pi->defer_count, sizeof(LOAD_JOB));
+    if (pJobs == NULL) {
+      abort();
+    }
+  }
+  for(i = 0; i < pi->defer_count; i++) {
+    if (instr_memofind(pi, (pi->ppDefer)[i], pi->rate) == NULL) {
+      pJobs[jcount].pCall = (pi->ppDefer)[i];
+      jcount++;
+    }
+  }
+  
+  /* Load them all */
+  if (jcount > 0) {
+    instr_loadjobs(pi, pi->rate, pJobs, jcount);
+  }
+  
+  /* Report the first job in definition order that failed */
+  for(j = 0; j < jcount; j++) {
+    if (!(pJobs[j].status)) {
+      status = 0;
+      *per = pJobs[j].err;
+      *per_src = pJobs[j].err_src;
+      *pline = pJobs[j].line;
+      if (ppCall != NULL) {
+        *ppCall = (char *) malloc(strlen(pJobs[j].pCall) + 1);
+        if (*ppCall == NULL) {
+          abort();
+        }
+        strcpy(*ppCall, pJobs[j].pCall);
+      }
+      break;
+    }
+  }
+  
+  /* Set up each pending instrument that was loaded, keeping any
+   * intensity and stereo settings made while it was pending; pending
+   * instruments whose load failed are left pending */
+  for(i = 0; i < INSTR_MAXCOUNT; i++) {
+    pr = instr_ptr(pi, i);
+    if ((!instr_isclear(pr)) && (pr->itype == ITYPE_PENDING)) {
+      pm = instr_memofind(pi, (pr->val).pCall, pi->rate);
+      if (pm != NULL) {
+        memcpy(&saved, pr, sizeof(INSTR_REG));
+        
+        instr_setfm(pi, i, pm->pRoot, pm->icount);
+        
+        pr = instr_ptr(pi, i);
+        pr->i_max = saved.i_max;
+        pr->i_min = saved.i_min;
+        memcpy(&(pr->sp), &(saved.sp), sizeof(STEREO_POS));
+      }
+    }
+  }
+  
+  /* Every deferred call number has now been dealt with, unless there
+   * was an error, in which case they are kept so that a later call
+   * tries the failed ones again */
+  if (status) {
+    instr_deferclear(pi);
+  }
+  
+  /* Release job array */
+  if (pJobs != NULL) {
+    free(pJobs);
+    pJobs = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * instr_preload function.
+ */
+void instr_preload(INSTR_CTX *pi, int32_t rate) {
+  
+  const char *pExt = ".iretro";
+  
+  int32_t x = 0;
+  int32_t j = 0;
+  int32_t jcount = 0;
+  size_t elen = 0;
+  size_t nlen = 0;
+  char *pt = NULL;
+  char **ppCalls = NULL;
+  LOAD_JOB *pJobs = NULL;
+  INDEX_ENTRY *pe = NULL;
+  
+  /* Check parameters */
+  if (pi == NULL) {
+    abort();
+  }
+  if ((rate != RATE_CD) && (rate != RATE_DVD)) {
+    abort();
+  }
+  
+  /* Build the search chain and index, since the loaders only read
+   * them */
+  instr_chaininit(pi);
+  instr_indexbuild(pi);
+  
+  /* Count the instrument files in the index */
+  elen = strlen(pExt);
+  for(x = 0; x < INDEX_BUCKETS; x++) {
+    for(pe = pi->index[x]; pe != NULL; pe = pe->pNext) {
+      nlen = strlen(&((pe->name)[0]));
+      if ((nlen > elen) &&
+          (strcmp(&((pe->name)[nlen - elen]), pExt) == 0)) {
+        jcount++;
+      }
+    }
+  }
+  
+  /* Turn each instrument file path into a call number by dropping the
+   * extension and changing separators back to periods, and make a job
+   * for it unless it is already loaded at this rate */
+  if (jcount > 0) {
+    ppCalls = (char **) calloc((size_t) jcount, sizeof(char *));
+    pJobs = (LOAD_JOB *) calloc((size_t) jcount, sizeof(LOAD_JOB));
+    if ((ppCalls == NULL) || (pJobs == NULL)) {
+      abort();
+    }
+  }
+  j = 0;
+  for(x = 0; x < INDEX_BUCKETS; x++) {
+    for(pe = pi->index[x]; pe != NULL; pe = pe->pNext) {
+      nlen = strlen(&((pe->name)[0]));
+      if ((nlen > elen) &&
+          (strcmp(&((pe->name)[nlen - elen]), pExt) == 0)) {
+        ppCalls[j] = (char *) malloc(nlen - elen + 1);
+        if (ppCalls[j] == NULL) {
+          abort();
+        }
+        memcpy(ppCalls[j], &((pe->name)[0]), nlen - elen);
+        (ppCalls[j])[nlen - elen] = (char) 0;
+        for(pt = ppCalls[j]; *pt != 0; pt++) {
+          if (*pt == (char) os_getsep()) {
+            *pt = '.';
+          }
+        }
+        
+        if (instr_memofind(pi, ppCalls[j], rate) == NULL) {
+          pJobs[j].pCall = ppCalls[j];
+          j++;
+        } else {
+          free(ppCalls[j]);
+          ppCalls[j] = NULL;
+        }
+      }
+    }
+  }
+  jcount = j;
+  
+  /* Load them all, ignoring failures, which are reported when the
+   * instruments are defined */
+  if (jcount > 0) {
+    instr_loadjobs(pi, rate, pJobs, jcount);
+  }
+  
+  /* Release the jobs and call numbers */
+  for(j = 0; j < jcount; j++) {
+    free(ppCalls[j]);
+    ppCalls[j] = NULL;
+  }
+  if (ppCalls != NULL) {
+    free(ppCalls);
+    ppCalls = NULL;
+  }
+  if (pJobs != NULL) {
+    free(pJobs);
+    pJobs = NULL;
+  }
+}
+
+/*
+ * instr_dup function.
+ */
+void instr_dup(INSTR_CTX *pi, int32_t i_target, int32_t i_src) {
+  
+  INSTR_REG *ps = NULL;
+  INSTR_REG *pt = NULL;
+
+  /* Check parameters */
+  if ((i_target < 0) || (i_src < 0) ||
+      (i_target >= INSTR_MAXCOUNT) || (i_src >= INSTR_MAXCOUNT)) {
+    abort();
+  }
+  
+  /* Only proceed if source and target are different */
+  if (i_target != i_src) {
+    
+    /* Get pointers to source and target */
+    ps = instr_ptr(pi, i_src);
+    pt = instr_ptr(pi, i_target);
+
+    /* Check if source is cleared */
+    if (instr_isclear(ps)) {
+      /* Source is cleared, so just clear target */
+      instr_clear(pi, i_target);
+    
+    } else {
+      /* Source not cleared, so clear target and copy to it */
+      instr_clear(pi, i_target);
+      memcpy(pt, ps, sizeof(INSTR_REG));
+      
+      /* Add any references */
+      if (pt->itype == ITYPE_SQUARE) {
+        /* Add references for square wave instrument */
+        adsr_addref((pt->val).pa);      
+      
+      } else if (pt->itype == ITYPE_FM) {
+        /* Add references for FM instrument */
+        generator_addref((pt->val).fmp.pRoot);
+      
+      } else if (pt->itype == ITYPE_PENDING) {
+        /* Make a separate copy of the pending call number */
+        (pt->val).pCall = (char *) malloc(strlen((ps->val).pCall) + 1);
+        if ((pt->val).pCall == NULL) {
+          abort();
+        }
+        strcpy((pt->val).pCall, (ps->val).pCall);
+      
+      } else {
+        /* Shouldn't happen */
+        abort();
+      }
+    }
+  }
+}
+
+/*
+ * instr_setMaxMin function.
+ */
+void instr_setMaxMin(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int32_t     i_max,
+    int32_t     i_min) {
+  
+  INSTR_REG *pr = NULL;
+  
+  /* Get pointer to instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Check parameters */
+  if ((i_max < 0) || (i_min < 0) ||
+      (i_max > MAX_FRAC) || (i_min > MAX_FRAC) ||
+      (i_max < i_min)) {
+    abort();
+  }
+  
+  /* Check whether both intensities are zero */
+  if ((i_max == 0) && (i_min == 0)) {
+    /* Both intensities zero, so just clear register */
+    instr_clear(pi, i);
+  
+  } else {
+    /* At least one intensity non-zero -- proceed only if register is
+     * not clear */
+    if (!instr_isclear(pr)) {
+      /* Set the new intensity values */
+      pr->i_max = (uint16_t) i_max;
+      pr->i_min = (uint16_t) i_min;
+    }
+  }
+  
+}
+
+/*
+ * instr_setStereo function.
+ */
+void instr_setStereo(INSTR_CTX *pi, int32_t i, const STEREO_POS *psp) {
+  
+  INSTR_REG *pr = NULL;
+  
+  /* Get pointer to instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Check parameter */
+  if (psp == NULL) {
+    abort();
+  }
+  
+  /* Only proceed if register not cleared */
+  if (!instr_isclear(pr)) {
+    /* Copy in the new stereo position */
+    memcpy(&(pr->sp), psp, sizeof(STEREO_POS));
+  }
+}
+
+/*
+ * instr_prepare function.
+ */
+void *instr_prepare(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int64_t     dur,
+    int32_t     pitch) {
+  
+  INSTR_REG *pr = NULL;
+  FM_VOICE *pv = NULL;
+  int32_t x = 0;
+  int32_t icount = 0;
+  double f = 0.0;
+  
+  /* Get pointer to instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Check parameters */
+  if ((dur < 1) || (dur > MAX_TIME) ||
+      (pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  
+  /* Only proceed if register not cleared */
+  if (!instr_isclear(pr)) {
+    /* Only proceed if FM instrument */
+    if (pr->itype == ITYPE_FM) {
+      
+      /* Look up the frequency for this pitch */
+      f = pitchfreq(pitch);
+      
+      /* Get the count of instance data structures */
+      icount = (pr->val).fmp.icount;
+      
+      /* Allocate the instance data with the necessary set of generator
+       * instance data */
+      pv = (FM_VOICE *) malloc(sizeof(FM_VOICE) +
+              (((size_t) (icount - 1)) * sizeof(GENERATOR_OPDATA)));
+      if (pv == NULL) {
+        abort();
+      }
+      memset(pv, 0, sizeof(FM_VOICE));
+      pv->pf = NULL;
+      
+      /* Initialize all the generator instance data */
+      for(x = 0; x < icount; x++) {
+        generator_opdata_init(
+          &((pv->od)[x]), f, dur, pi->period, instr_seed(pi));
+      }
+      
+      /* If freezing is enabled and the instrument is fixed, use the
+       * frozen event */
+      if (pi->freeze && (pr->val).fmp.fixed) {
+        pv->pf = instr_frozen(pi, &((pr->val).fmp), pitch, dur, f, pv);
+      }
+    }
+  }
+  
+  /* Return instance data or NULL */
+  return pv;
+}
+
+/*
+ * instr_skip function.
+ */
+void instr_skip(INSTR_CTX *pi, int32_t i) {
+  
+  INSTR_REG *pr = NULL;
+  int32_t x = 0;
+  int32_t icount = 0;
+  
+  /* Get pointer to instrument register */
+  pr = instr_ptr(pi, i);
   
-  /* Return status */
-  return status;
+  /* Hand out the same seeds instr_prepare() would, if any */
+  if (!instr_isclear(pr)) {
+    if (pr->itype == ITYPE_FM) {
+      icount = (pr->val).fmp.icount;
+      for(x = 0; x < icount; x++) {
+        instr_seed(pi);
+      }
+    }
+  }
 }
 
 /*
- * instr_dup function.
+ * instr_length function.
  */
-void instr_dup(int32_t i_target, int32_t i_src) {
+int64_t instr_length(INSTR_CTX *pi, int32_t i, int64_t dur, void *pod) {
   
-  INSTR_REG *ps = NULL;
-  INSTR_REG *pt = NULL;
-
-  /* Check parameters */
-  if ((i_target < 0) || (i_src < 0) ||
-      (i_target >= INSTR_MAXCOUNT) || (i_src >= INSTR_MAXCOUNT)) {
+  INSTR_REG *pr = NULL;
+  GENERATOR_OPDATA *pTemp = NULL;
+  int64_t result = 0;
+  int32_t x = 0;
+  
+  /* Get pointer to instrument register */
+  pr = instr_ptr(pi, i);
+  
+  /* Check parameter */
+  if ((dur < 1) || (dur > MAX_TIME)) {
     abort();
   }
   
-  /* Only proceed if source and target are different */
-  if (i_target != i_src) {
-    
-    /* Get pointers to source and target */
-    ps = instr_ptr(i_src);
-    pt = instr_ptr(i_target);
+  /* Check if register cleared */
+  if (instr_isclear(pr)) {
+    /* Register is cleared, so result is always one */
+    result = 1;
 
-    /* Check if source is cleared */
-    if (instr_isclear(ps)) {
-      /* Source is cleared, so just clear target */
-      instr_clear(i_target);
-    
-    } else {
-      /* Source not cleared, so clear target and copy to it */
-      instr_clear(i_target);
-      memcpy(pt, ps, sizeof(INSTR_REG));
-      
-      /* Add any references */
-      if (pt->itype == ITYPE_SQUARE) {
-        /* Add references for square wave instrument */
-        adsr_addref((pt->val).pa);      
-      
-      } else if (pt->itype == ITYPE_FM) {
-        /* Add references for FM instrument */
-        generator_addref((pt->val).fmp.pRoot);
+  } else {
+    /* Register is not cleared, so call through */
+    if (pr->itype == ITYPE_SQUARE) {
+      /* For square waves, call through to ADSR envelope, after making
+       * sure no instance data was provided */
+      if (pod != NULL) {
+        abort();
+      }
+      result = adsr_length((pr->val).pa, dur);
       
-      } else {
-        /* Shouldn't happen */
+    } else if ((pr->itype == ITYPE_FM) && (pod != NULL)) {
+      /* For FM instruments with instance data, query generator map */
+      result = generator_length(
+                  (pr->val).fmp.pRoot,
+                  ((FM_VOICE *) pod)->od,
+                  (pr->val).fmp.icount);
+    
+    } else if (pr->itype == ITYPE_FM) {
+      /* For FM instruments without instance data, query generator map
+       * with temporary instance data; the length only depends on the
+       * duration, so the frequency doesn't matter, and no noise seeds
+       * are needed */
+      pTemp = (GENERATOR_OPDATA *) calloc(
+                (size_t) (pr->val).fmp.icount,
+                sizeof(GENERATOR_OPDATA));
+      if (pTemp == NULL) {
         abort();
       }
+      for(x = 0; x < (pr->val).fmp.icount; x++) {
+        generator_opdata_init(
+          &(pTemp[x]), pitchfreq(0), dur, pi->period, 0);
+      }
+      result = generator_length(
+                  (pr->val).fmp.pRoot,
+                  pTemp,
+                  (pr->val).fmp.icount);
+      free(pTemp);
+      pTemp = NULL;
+    
+    } else {
+      /* Shouldn't happen */
+      abort();
     }
   }
+  
+  /* Return result */
+  return result;
 }
 
 /*
- * instr_setMaxMin function.
+ * instr_get function.
  */
-void instr_setMaxMin(int32_t i, int32_t i_max, int32_t i_min) {
+void instr_get(
+    INSTR_CTX   * pi,
+    int32_t       i,
+    int64_t       t,
+    int64_t       dur,
+    int32_t       pitch,
+    int16_t       amp,
+    STEREO_SAMP * pss,
+    void        * pod) {
   
   INSTR_REG *pr = NULL;
-  
+  FM_VOICE *pv = NULL;
+  double sf = 0.0;
+  double af = 0.0;
+  int16_t s = 0;
+  int32_t s32 = 0;
+  int32_t intensity = 0;
+
   /* Get pointer to instrument register */
-  pr = instr_ptr(i);
+  pr = instr_ptr(pi, i);
   
   /* Check parameters */
-  if ((i_max < 0) || (i_min < 0) ||
-      (i_max > MAX_FRAC) || (i_min > MAX_FRAC) ||
-      (i_max < i_min)) {
+  if (t < 0) {
+    abort();
+  }
+  if (dur < 1) {
+    abort();
+  }
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  if ((amp < 0) || (amp > MAX_FRAC)) {
+    abort();
+  }
+  if (pss == NULL) {
     abort();
   }
   
-  /* Check whether both intensities are zero */
-  if ((i_max == 0) && (i_min == 0)) {
-    /* Both intensities zero, so just clear register */
-    instr_clear(i);
+  /* Only proceed if instrument register is not clear; otherwise, just
+   * generate a zero result */
+  if (!instr_isclear(pr)) {
   
-  } else {
-    /* At least one intensity non-zero -- proceed only if register is
-     * not clear */
-    if (!instr_isclear(pr)) {
-      /* Set the new intensity values */
-      pr->i_max = (uint16_t) i_max;
-      pr->i_min = (uint16_t) i_min;
+    /* Handle instrument types */
+    if (pr->itype == ITYPE_SQUARE) {
+      /* Square wave instrument, verify that no instance data */
+      if (pod != NULL) {
+        abort();
+      }
+  
+      /* First of all, get the sample from the square wave generator */
+      s = sqwave_get(pi->psw, pitch, t);
+    
+      /* Second, compute the intensity from the amplitude and the i_max
+       * & i_min parameters */
+      intensity =
+        ((((int32_t) amp) * ((int32_t) (pr->i_max - pr->i_min))) /
+                  ((int32_t) MAX_FRAC)) + ((int32_t) pr->i_min);
+    
+      /* Next, multiply the sample by the intensity */
+      s = (int16_t) ((intensity * ((int32_t) s)) / 
+              ((int32_t) MAX_FRAC));
+    
+      /* Then comes the envelope */
+      s = adsr_mul((pr->val).pa, t, dur, s);
+    
+      /* Finally, stereo-image the sample */
+      instr_image(pi, s, pitch, &(pr->sp), pss);
+    
+    } else if (pr->itype == ITYPE_FM) {
+      /* FM instrument, verify that instance data */
+      if (pod == NULL) {
+        abort();
+      }
+    
+      /* First of all, get the generated floating-point sample, either
+       * from the frozen event or from the generator map */
+      pv = (FM_VOICE *) pod;
+      if (pv->pf != NULL) {
+        if (t < (pv->pf)->len) {
+          sf = ((pv->pf)->ps)[t];
+        } else {
+          sf = 0.0;
+        }
+      } else {
+        sf = generator_invoke(
+                  (pr->val).fmp.pRoot,
+                  pv->od,
+                  (pr->val).fmp.icount,
+                  t);
+      }
+      
+      /* Second, compute floating-point intensity from the amplitude and
+       * the i_max & i_min parameters */
+      af = 
+        ((((double) amp) * ((double) (pr->i_max - pr->i_min))) /
+                  ((double) MAX_FRAC)) + ((double) pr->i_min);
+
+      /* Next, multiply the floating-point sample by the intensity */
+      sf = (sf * af) / ((double) MAX_FRAC);
+      
+      /* If floating-point sample not finite, set to zero */
+      if (!isfinite(sf)) {
+        sf = 0.0;
+      }
+      
+      /* Clamp floating-point sample to 16-bit signed range */
+      if (sf > ((double) INT16_MAX)) {
+        sf = (double) INT16_MAX;
+      } else if (sf < (double) INT16_MIN) {
+        sf = (double) INT16_MIN;
+      }
+      
+      /* Convert to 32-bit integer and clamp to 16-bit range */
+      s32 = (int32_t) floor(sf);
+      if (s32 > INT16_MAX) {
+        s32 = INT16_MAX;
+      } else if (s32 < INT16_MIN) {
+        s32 = INT16_MIN;
+      }
+      
+      /* Finally, stereo-image the sample */
+      instr_image(pi, (int16_t) s32, pitch, &(pr->sp), pss);
+    
+    } else {
+      /* Shouldn't happen */
+      abort();
     }
-  }
   
+  } else {
+    /* Instrument register clear */
+    pss->left = 0;
+    pss->right = 0;
+  }
 }
 
 /*
- * instr_setStereo function.
+ * instr_pan function.
  */
-void instr_setStereo(int32_t i, const STEREO_POS *psp) {
+void instr_pan(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int32_t     pitch,
+    int32_t   * pl,
+    int32_t   * pr) {
   
-  INSTR_REG *pr = NULL;
+  INSTR_REG *preg = NULL;
   
   /* Get pointer to instrument register */
-  pr = instr_ptr(i);
+  preg = instr_ptr(pi, i);
   
-  /* Check parameter */
-  if (psp == NULL) {
+  /* Check parameters */
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX) ||
+      (pl == NULL) || (pr == NULL)) {
     abort();
   }
   
-  /* Only proceed if register not cleared */
-  if (!instr_isclear(pr)) {
-    /* Copy in the new stereo position */
-    memcpy(&(pr->sp), psp, sizeof(STEREO_POS));
+  /* Compute the gains, or silence for a clear register */
+  if ((!instr_isclear(preg)) && pi->flat) {
+    *pl = MAX_FRAC;
+    *pr = MAX_FRAC;
+  } else if (!instr_isclear(preg)) {
+    stereo_gain(pitch, &(preg->sp), pl, pr);
+  } else {
+    *pl = 0;
+    *pr = 0;
   }
 }
 
 /*
- * instr_prepare function.
+ * instr_render function.
  */
-void *instr_prepare(int32_t i, int32_t dur, int32_t pitch) {
+void instr_render(
+          INSTR_CTX * pi,
+          int32_t     i,
+          int64_t     t,
+          int64_t     dur,
+          int32_t     pitch,
+    const int16_t   * pAmp,
+          int32_t     count,
+          int32_t     gain_l,
+          int32_t     gain_r,
+          int64_t   * pLeft,
+          int64_t   * pRight,
+          void      * pod) {
   
   INSTR_REG *pr = NULL;
-  GENERATOR_OPDATA *pod = NULL;
-  int32_t x = 0;
-  int32_t icount = 0;
-  double f = 0.0;
+  FM_VOICE *pv = NULL;
+  const int16_t *pw = NULL;
+  int32_t wcount = 0;
+  int32_t w = 0;
+  int32_t k = 0;
+  int32_t irange = 0;
+  int32_t intensity = 0;
+  double frange = 0.0;
+  double fmin = 0.0;
+  double sf = 0.0;
+  double af = 0.0;
+  int16_t s = 0;
+  int32_t s32 = 0;
+  ADSR_CTL ctl;
+  
+  /* Initialize structures */
+  memset(&ctl, 0, sizeof(ADSR_CTL));
   
   /* Get pointer to instrument register */
-  pr = instr_ptr(i);
+  pr = instr_ptr(pi, i);
   
   /* Check parameters */
-  if ((dur < 1) || (pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+  if ((t < 0) || (dur < 1) || (count < 0)) {
+    abort();
+  }
+  if (count > 0) {
+    if (t > INT64_MAX - (count - 1)) {
+      abort();
+    }
+  }
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  if ((gain_l < 0) || (gain_l > MAX_FRAC) ||
+      (gain_r < 0) || (gain_r > MAX_FRAC)) {
+    abort();
+  }
+  if ((count > 0) && ((pAmp == NULL) || (pLeft == NULL))) {
     abort();
   }
+  for(k = 0; k < count; k++) {
+    if ((pAmp[k] < 0) || (pAmp[k] > MAX_FRAC)) {
+      abort();
+    }
+  }
   
-  /* Only proceed if register not cleared */
-  if (!instr_isclear(pr)) {
-    /* Only proceed if FM instrument */
-    if (pr->itype == ITYPE_FM) {
+  /* Only proceed if instrument register is not clear; otherwise, there
+   * is nothing to add */
+  if ((count > 0) && (!instr_isclear(pr))) {
+    
+    /* Handle instrument types */
+    if (pr->itype == ITYPE_SQUARE) {
+      /* Square wave instrument, verify that no instance data */
+      if (pod != NULL) {
+        abort();
+      }
       
-      /* Look up the frequency for this pitch */
-      f = pitchfreq(pitch);
+      /* Get the looped wave table and the starting index within it,
+       * and start computing the envelope at the control rate */
+      pw = sqwave_table(pi->psw, pitch, &wcount);
+      adsr_ctlreset(&ctl, pi->period);
+      w = (int32_t) (t % ((int64_t) wcount));
       
-      /* Get the count of instance data structures */
-      icount = (pr->val).fmp.icount;
+      /* Get the intensity range */
+      irange = ((int32_t) (pr->i_max - pr->i_min));
+      
+      /* Compute each sample the same way as instr_get() */
+      for(k = 0; k < count; k++) {
+        intensity =
+          ((((int32_t) pAmp[k]) * irange) / ((int32_t) MAX_FRAC)) +
+            ((int32_t) pr->i_min);
+        
+        s = (int16_t) ((intensity * ((int32_t) pw[w])) /
+              ((int32_t) MAX_FRAC));
+        
+        s32 = (((int32_t) s) *
+                adsr_ctl((pr->val).pa, t + k, dur, &ctl)) / MAX_FRAC;
+        if (s32 < -(INT16_MAX)) {
+          s32 = -(INT16_MAX);
+        } else if (s32 > INT16_MAX) {
+          s32 = INT16_MAX;
+        }
+        s = (int16_t) s32;
+        
+        pLeft[k] += (int64_t) ((gain_l * ((int32_t) s)) / MAX_FRAC);
+        if (pRight != NULL) {
+          pRight[k] += (int64_t) ((gain_r * ((int32_t) s)) / MAX_FRAC);
+        }
+        
+        w++;
+        if (w >= wcount) {
+          w = 0;
+        }
+      }
       
-      /* Allocate the necessary set of generator instance data */
-      pod = (GENERATOR_OPDATA *) calloc(
-                                    (size_t) icount,
-                                    sizeof(GENERATOR_OPDATA));
+    } else if (pr->itype == ITYPE_FM) {
+      /* FM instrument, verify that instance data */
       if (pod == NULL) {
         abort();
       }
       
-      /* Initialize all the instance data */
-      for(x = 0; x < icount; x++) {
-        generator_opdata_init(&(pod[x]), f, dur);
+      /* Get the intensity parameters */
+      frange = ((double) (pr->i_max - pr->i_min));
+      fmin = ((double) pr->i_min);
+      
+      /* Compute each sample the same way as instr_get() */
+      pv = (FM_VOICE *) pod;
+      for(k = 0; k < count; k++) {
+        if (pv->pf == NULL) {
+          sf = generator_invoke(
+                    (pr->val).fmp.pRoot,
+                    pv->od,
+                    (pr->val).fmp.icount,
+                    t + k);
+        } else if (t + k < (pv->pf)->len) {
+          sf = ((pv->pf)->ps)[t + k];
+        } else {
+          sf = 0.0;
+        }
+        
+        af = ((((double) pAmp[k]) * frange) / ((double) MAX_FRAC)) +
+              fmin;
+        
+        sf = (sf * af) / ((double) MAX_FRAC);
+        if (!isfinite(sf)) {
+          sf = 0.0;
+        }
+        
+        if (sf > ((double) INT16_MAX)) {
+          sf = (double) INT16_MAX;
+        } else if (sf < (double) INT16_MIN) {
+          sf = (double) INT16_MIN;
+        }
+        
+        s32 = (int32_t) floor(sf);
+        if (s32 > INT16_MAX) {
+          s32 = INT16_MAX;
+        } else if (s32 < INT16_MIN) {
+          s32 = INT16_MIN;
+        }
+        
+        pLeft[k] += (int64_t) ((gain_l * s32) / MAX_FRAC);
+        if (pRight != NULL) {
+          pRight[k] += (int64_t) ((gain_r * s32) / MAX_FRAC);
+        }
       }
+      
+    } else {
+      /* Shouldn't happen */
+      abort();
     }
   }
-  
-  /* Return instance data or NULL */
-  return pod;
 }
 
 /*
- * instr_length function.
+ * instr_peak function.
  */
-int32_t instr_length(int32_t i, int32_t dur, void *pod) {
+double instr_peak(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int64_t     t,
+    int64_t     dur,
+    int16_t     amp,
+    void      * pod) {
   
   INSTR_REG *pr = NULL;
-  int32_t result = 0;
+  double af = 0.0;
+  double result = 0.0;
   
   /* Get pointer to instrument register */
-  pr = instr_ptr(i);
+  pr = instr_ptr(pi, i);
   
-  /* Check parameter */
-  if (dur < 1) {
+  /* Check parameters */
+  if ((t < 0) || (dur < 1)) {
+    abort();
+  }
+  if ((amp < 0) || (amp > MAX_FRAC)) {
     abort();
   }
   
-  /* Check if register cleared */
-  if (instr_isclear(pr)) {
-    /* Register is cleared, so result is always one */
-    result = 1;
-
-  } else {
-    /* Register is not cleared, so call through */
+  /* Only proceed if instrument register is not clear; otherwise, the
+   * instrument is always silent */
+  if (!instr_isclear(pr)) {
+    
+    /* Compute floating-point intensity from the amplitude bound and the
+     * i_max & i_min parameters, the same way as instr_get() */
+    af = 
+      ((((double) amp) * ((double) (pr->i_max - pr->i_min))) /
+                ((double) MAX_FRAC)) + ((double) pr->i_min);
+    
+    /* Handle instrument types */
     if (pr->itype == ITYPE_SQUARE) {
-      /* For square waves, call through to ADSR envelope, after making
-       * sure no instance data was provided */
+      /* Square wave instrument, verify that no instance data */
       if (pod != NULL) {
         abort();
       }
-      result = adsr_length((pr->val).pa, dur);
+      
+      /* Square wave samples are within 16-bit range, and are then
+       * scaled by the intensity and the envelope */
+      result = (((double) INT16_MAX) * af) / ((double) MAX_FRAC);
+      result = (result * ((double) adsr_peak((pr->val).pa, t, dur))) /
+                  ((double) MAX_FRAC);
       
     } else if (pr->itype == ITYPE_FM) {
-      /* For FM instruments, query generator map, after making sure
-       * instance data was provided */
+      /* FM instrument, verify that instance data */
       if (pod == NULL) {
         abort();
       }
-      result = generator_length(
+      
+      /* Get the bound on the generator map, scaled by intensity */
+      result = generator_peak(
                   (pr->val).fmp.pRoot,
-                  pod,
-                  (pr->val).fmp.icount);
-    
+                  ((FM_VOICE *) pod)->od,
+                  (pr->val).fmp.icount,
+                  t);
+      result = (result * af) / ((double) MAX_FRAC);
+      
     } else {
       /* Shouldn't happen */
       abort();
     }
+    
+    /* Samples are clamped to 16-bit range, so the bound can be too */
+    if ((!isfinite(result)) || (result > ((double) INT16_MAX) + 1.0)) {
+      result = ((double) INT16_MAX) + 1.0;
+    }
   }
   
   /* Return result */
@@ -1149,129 +4159,57 @@ int32_t instr_length(int32_t i, int32_t dur, void *pod) {
 }
 
 /*
- * instr_get function.
+ * instr_silent function.
  */
-void instr_get(
-    int32_t       i,
-    int32_t       t,
-    int32_t       dur,
-    int32_t       pitch,
-    int16_t       amp,
-    STEREO_SAMP * pss,
-    void        * pod) {
+int instr_silent(INSTR_CTX *pi, int32_t i, int16_t amp) {
   
   INSTR_REG *pr = NULL;
-  double sf = 0.0;
-  double af = 0.0;
-  int16_t s = 0;
-  int32_t s32 = 0;
   int32_t intensity = 0;
-
+  int result = 0;
+  
   /* Get pointer to instrument register */
-  pr = instr_ptr(i);
+  pr = instr_ptr(pi, i);
   
-  /* Check parameters */
-  if (t < 0) {
-    abort();
-  }
-  if (dur < 1) {
-    abort();
-  }
-  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
-    abort();
-  }
+  /* Check parameter */
   if ((amp < 0) || (amp > MAX_FRAC)) {
     abort();
   }
-  if (pss == NULL) {
-    abort();
-  }
-  
-  /* Only proceed if instrument register is not clear; otherwise, just
-   * generate a zero result */
-  if (!instr_isclear(pr)) {
-  
-    /* Handle instrument types */
-    if (pr->itype == ITYPE_SQUARE) {
-      /* Square wave instrument, verify that no instance data */
-      if (pod != NULL) {
-        abort();
-      }
   
-      /* First of all, get the sample from the square wave generator */
-      s = sqwave_get(pitch, t);
-    
-      /* Second, compute the intensity from the amplitude and the i_max
-       * & i_min parameters */
-      intensity =
-        ((((int32_t) amp) * ((int32_t) (pr->i_max - pr->i_min))) /
-                  ((int32_t) MAX_FRAC)) + ((int32_t) pr->i_min);
-    
-      /* Next, multiply the sample by the intensity */
-      s = (int16_t) ((intensity * ((int32_t) s)) / 
-              ((int32_t) MAX_FRAC));
-    
-      /* Then comes the envelope */
-      s = adsr_mul((pr->val).pa, t, dur, s);
-    
-      /* Finally, stereo-image the sample */
-      stereo_image(s, pitch, &(pr->sp), pss);
+  /* Check whether register is clear */
+  if (instr_isclear(pr)) {
+    /* Cleared registers always produce zero samples */
+    result = 1;
     
-    } else if (pr->itype == ITYPE_FM) {
-      /* FM instrument, verify that instance data */
-      if (pod == NULL) {
-        abort();
-      }
+  } else if (pr->itype == ITYPE_SQUARE) {
+    /* Compute the intensity the same way as instr_get() -- intensity
+     * only grows with amplitude, so this is the greatest intensity */
+    intensity =
+      ((((int32_t) amp) * ((int32_t) (pr->i_max - pr->i_min))) /
+                ((int32_t) MAX_FRAC)) + ((int32_t) pr->i_min);
     
-      /* First of all, get the generated floating-point sample */
-      sf = generator_invoke(
-                (pr->val).fmp.pRoot,
-                pod,
-                (pr->val).fmp.icount,
-                t);
-      
-      /* Second, compute floating-point intensity from the amplitude and
-       * the i_max & i_min parameters */
-      af = 
-        ((((double) amp) * ((double) (pr->i_max - pr->i_min))) /
-                  ((double) MAX_FRAC)) + ((double) pr->i_min);
-
-      /* Next, multiply the floating-point sample by the intensity */
-      sf = (sf * af) / ((double) MAX_FRAC);
-      
-      /* If floating-point sample not finite, set to zero */
-      if (!isfinite(sf)) {
-        sf = 0.0;
-      }
-      
-      /* Clamp floating-point sample to 16-bit signed range */
-      if (sf > ((double) INT16_MAX)) {
-        sf = (double) INT16_MAX;
-      } else if (sf < (double) INT16_MIN) {
-        sf = (double) INT16_MIN;
-      }
-      
-      /* Convert to 32-bit integer and clamp to 16-bit range */
-      s32 = (int32_t) floor(sf);
-      if (s32 > INT16_MAX) {
-        s32 = INT16_MAX;
-      } else if (s32 < INT16_MIN) {
-        s32 = INT16_MIN;
-      }
-      
-      /* Finally, stereo-image the sample */
-      stereo_image((int16_t) s32, pitch, &(pr->sp), pss);
+    /* Zero intensity means every sample is multiplied down to zero */
+    if (intensity < 1) {
+      result = 1;
+    } else {
+      result = 0;
+    }
     
+  } else if (pr->itype == ITYPE_FM) {
+    /* FM intensity is floating-point, so it is only zero if there is no
+     * minimum intensity and the amplitude contributes nothing */
+    if ((pr->i_min == 0) && ((amp == 0) || (pr->i_max == 0))) {
+      result = 1;
     } else {
-      /* Shouldn't happen */
-      abort();
+      result = 0;
     }
-  
+    
   } else {
-    /* Instrument register clear */
-    pss->left = 0;
-    pss->right = 0;
+    /* Shouldn't happen */
+    abort();
   }
+  
+  /* Return result */
+  return result;
 }
 
 /*
@@ -1308,3 +4246,217 @@ const char *instr_errstr(int code) {
   
   return pResult;
 }
+
+/*
+ * instr_save function.
+ */
+int instr_save(INSTR_CTX *pi, FILE *pOut) {
+  
+  int status = 1;
+  int32_t x = 0;
+  int32_t y = 0;
+  int32_t rec[9];
+  int32_t env[4];
+  INSTR_REG *pr = NULL;
+  
+  /* Initialize buffers */
+  memset(rec, 0, sizeof(rec));
+  memset(env, 0, sizeof(env));
+  
+  /* Check parameter */
+  if ((pi == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  
+  /* Write a record for each register that is not clear */
+  for(x = 0; status && (x < INSTR_MAXCOUNT); x++) {
+    pr = &(pi->t[x]);
+    if (!instr_isclear(pr)) {
+      
+      /* All external instruments must have been loaded */
+      if (pr->itype == ITYPE_PENDING) {
+        abort();
+      }
+      
+      /* For FM instruments, find an earlier register with the same
+       * generator map */
+      y = x;
+      if (pr->itype == ITYPE_FM) {
+        for(y = 0; y < x; y++) {
+          if (((pi->t[y]).itype == ITYPE_FM) &&
+              ((pi->t[y]).val.fmp.pRoot == (pr->val).fmp.pRoot)) {
+            break;
+          }
+        }
+      }
+      
+      /* Write the register record */
+      rec[0] = x;
+      rec[1] = pr->i_max;
+      rec[2] = pr->i_min;
+      rec[3] = pr->itype;
+      rec[4] = (pr->sp).low_pos;
+      rec[5] = (pr->sp).low_pitch;
+      rec[6] = (pr->sp).high_pos;
+      rec[7] = (pr->sp).high_pitch;
+      if (y < x) {
+        rec[8] = y;
+      } else {
+        rec[8] = -1;
+      }
+      if (fwrite(rec, sizeof(int32_t), 9, pOut) != 9) {
+        status = 0;
+      }
+      
+      /* Write the envelope or the generator map, unless shared */
+      if (status && (pr->itype == ITYPE_SQUARE)) {
+        adsr_samples((pr->val).pa, &(env[0]), &(env[1]),
+                      &(env[2]), &(env[3]));
+        if (fwrite(env, sizeof(int32_t), 4, pOut) != 4) {
+          status = 0;
+        }
+        
+      } else if (status && (y >= x)) {
+        if (!generator_save((pr->val).fmp.pRoot, pOut)) {
+          status = 0;
+        }
+      }
+    }
+  }
+  
+  /* Write the end record */
+  if (status) {
+    memset(rec, 0, sizeof(rec));
+    rec[0] = -1;
+    if (fwrite(rec, sizeof(int32_t), 9, pOut) != 9) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * instr_restore function.
+ */
+int instr_restore(INSTR_CTX *pi, FILE *pIn) {
+  
+  int status = 1;
+  int done = 0;
+  int32_t prev = -1;
+  int32_t rec[9];
+  int32_t env[4];
+  STEREO_POS sp;
+  ADSR_OBJ *pa = NULL;
+  GENERATOR *pRoot = NULL;
+  INSTR_REG *pr = NULL;
+  
+  /* Initialize buffers and structures */
+  memset(rec, 0, sizeof(rec));
+  memset(env, 0, sizeof(env));
+  memset(&sp, 0, sizeof(STEREO_POS));
+  
+  /* Check parameter and state */
+  if ((pi == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  if (pi->rate == 0) {
+    abort();
+  }
+  
+  /* Read records until the end record */
+  while (status && (!done)) {
+    
+    /* Read the record */
+    if (fread(rec, sizeof(int32_t), 9, pIn) != 9) {
+      status = 0;
+    }
+    
+    /* Check for end record */
+    if (status && (rec[0] == -1)) {
+      done = 1;
+    }
+    
+    /* Check the register index, intensities, and type */
+    if (status && (!done)) {
+      if ((rec[0] <= prev) || (rec[0] >= INSTR_MAXCOUNT) ||
+          (rec[2] < 0) || (rec[1] < rec[2]) ||
+          (rec[1] < 1) || (rec[1] > MAX_FRAC) ||
+          ((rec[3] != ITYPE_SQUARE) && (rec[3] != ITYPE_FM))) {
+        status = 0;
+      }
+    }
+    
+    /* Check the stereo position and build it */
+    if (status && (!done)) {
+      if ((rec[4] < -MAX_FRAC) || (rec[4] > MAX_FRAC) ||
+          (rec[6] < -MAX_FRAC) || (rec[6] > MAX_FRAC) ||
+          (rec[5] < PITCH_MIN) || (rec[5] > PITCH_MAX) ||
+          (rec[7] < PITCH_MIN) || (rec[7] > PITCH_MAX) ||
+          (rec[7] < rec[5])) {
+        status = 0;
+      }
+      if (status && (rec[7] > rec[5])) {
+        stereo_setField(&sp, rec[4], rec[5], rec[6], rec[7]);
+      } else if (status) {
+        stereo_setPos(&sp, rec[4]);
+      }
+    }
+    
+    /* Restore a square wave instrument */
+    if (status && (!done) && (rec[3] == ITYPE_SQUARE)) {
+      if (fread(env, sizeof(int32_t), 4, pIn) != 4) {
+        status = 0;
+      }
+      if (status && (!adsr_check(env[0], env[1], env[2], env[3]))) {
+        status = 0;
+      }
+      if (status) {
+        pa = adsr_raw(env[0], env[1], env[2], env[3]);
+        instr_define(pi, rec[0], rec[1], rec[2], pa, &sp);
+        adsr_release(pa);
+        pa = NULL;
+      }
+    
+    /* Restore an FM instrument, sharing the generator map of an
+     * earlier register if indicated */
+    } else if (status && (!done)) {
+      if ((rec[8] < -1) || (rec[8] >= rec[0])) {
+        status = 0;
+      }
+      if (status && (rec[8] >= 0)) {
+        pr = &(pi->t[rec[8]]);
+        if (pr->itype == ITYPE_FM) {
+          instr_setfm(
+            pi, rec[0], (pr->val).fmp.pRoot, (pr->val).fmp.icount);
+        } else {
+          status = 0;
+        }
+      
+      } else if (status) {
+        pRoot = instr_restored(pi, generator_restore(pIn, pi->rate));
+        if (pRoot != NULL) {
+          instr_setfm(pi, rec[0], pRoot, generator_bind(pRoot, 0));
+          generator_release(pRoot);
+          pRoot = NULL;
+        } else {
+          status = 0;
+        }
+      }
+      
+      if (status) {
+        instr_setMaxMin(pi, rec[0], rec[1], rec[2]);
+        instr_setStereo(pi, rec[0], &sp);
+      }
+    }
+    
+    /* Update the previous register index */
+    if (status && (!done)) {
+      prev = rec[0];
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
@@ -19,8 +19,9 @@
 /*
  * The maximum number of instruments that may be defined.
  * 
- * Space for instruments is statically allocated, so be cautious about
- * setting this too high.  This must not exceed 65536.
+ * The instrument register table is allocated in full with each
+ * instrument context, so be cautious about setting this too high.
+ * This must not exceed 65536.
  */
 #define INSTR_MAXCOUNT (4096)
 
@@ -46,6 +47,50 @@
 #define INSTR_ERR_HUGEPATH    (3)   /* Instrument path too long */
 #define INSTR_ERR_OPEN        (4)   /* Can't open instrument file */
 
+/*
+ * Structure prototype for INSTR_CTX.
+ * 
+ * An instrument context holds the instrument registers, the search
+ * path, and the caches of one render context.  See render.h for
+ * further information.
+ */
+struct INSTR_CTX_TAG;
+typedef struct INSTR_CTX_TAG INSTR_CTX;
+
+/*
+ * Allocate a new instrument context.
+ * 
+ * psw is the square wave context that square wave instruments are
+ * rendered with.  It is not owned by the instrument context, so it must
+ * remain allocated until the instrument context is released.  It must
+ * be initialized with sqwave_init() before any square wave instrument
+ * is rendered.
+ * 
+ * All instrument registers start out clear.  Release the context with
+ * instr_free().
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave context
+ * 
+ * Return:
+ * 
+ *   the new instrument context
+ */
+INSTR_CTX *instr_alloc(SQWAVE_CTX *psw);
+
+/*
+ * Release an instrument context.
+ * 
+ * All instrument registers are cleared, and all the caches of the
+ * context are released.  If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context, or NULL
+ */
+void instr_free(INSTR_CTX *pi);
+
 /*
  * Prefix a directory to the search path.
  * 
@@ -57,13 +102,91 @@
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   pDir - the directory to prefix to the search path
  * 
  * Return:
  * 
  *   non-zero if successful, zero if search path too long
  */
-int instr_addsearch(const char *pDir);
+int instr_addsearch(INSTR_CTX *pi, const char *pDir);
+
+/*
+ * Set the directory used for the compiled instrument cache.
+ * 
+ * By default, there is no cache, and every external instrument is
+ * interpreted from its script each time it is loaded.  When a cache
+ * directory is set, each external instrument that is interpreted is
+ * also saved in a compiled binary form in the cache directory, and
+ * later loads of the same instrument file read the compiled form
+ * instead of interpreting the script.
+ * 
+ * Cache entries are keyed by the path of the instrument file, a hash
+ * of its contents, and the sampling rate, so editing an instrument
+ * file or changing the sampling rate automatically invalidates its
+ * cache entry.  Instruments that use wave table files are not cached.
+ * 
+ * The directory must already exist.  Problems reading or writing the
+ * cache are not errors; the instrument is simply interpreted instead.
+ * 
+ * An internal copy of the string is made.  Passing NULL disables the
+ * cache.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pDir - the cache directory, or NULL
+ */
+void instr_cachedir(INSTR_CTX *pi, const char *pDir);
+
+/*
+ * Enable or disable freezing of FM instrument events.
+ * 
+ * When freezing is enabled, the output of the generator map of each FM
+ * instrument event is rendered once into a bank of frozen events,
+ * keyed by the generator map, the pitch, and the duration.  Later
+ * events with the same generator map, pitch, and duration just walk
+ * the frozen samples, applying intensity and stereo position.  This
+ * gives exactly the same output, but pieces that repeat notes don't
+ * pay for evaluating the generator map each time.
+ * 
+ * Only instruments whose generator maps are fixed, as determined by
+ * generator_fixed(), are frozen, since other instruments produce
+ * different output each time.  The bank is limited in size, and events
+ * that don't fit are rendered normally.
+ * 
+ * Freezing is disabled by default.  Changing the setting only affects
+ * events prepared afterwards.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   enable - non-zero to enable freezing, zero to disable it
+ */
+void instr_freeze(INSTR_CTX *pi, int enable);
+
+/*
+ * Enable or disable simplifying FM instruments as they are loaded.
+ * 
+ * When enabled, each generator map is passed through
+ * generator_compile() before it is used, which removes generators that
+ * have no effect and merges nested clips.  Only transformations that
+ * give exactly the same output are performed, so this just makes
+ * rendering the instrument cheaper.
+ * 
+ * Simplifying is disabled by default.  Changing the setting only
+ * affects instruments loaded afterwards.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   enable - non-zero to enable simplifying, zero to disable it
+ */
+void instr_simplify(INSTR_CTX *pi, int enable);
 
 /*
  * Set the sampling rate to be used when building instruments.
@@ -73,9 +196,45 @@ int instr_addsearch(const char *pDir);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   rate - the sampling rate to set
  */
-void instr_setsamp(int32_t rate);
+void instr_setsamp(INSTR_CTX *pi, int32_t rate);
+
+/*
+ * Set the instrument context into single-channel mode.
+ * 
+ * If this function has already been called, further calls have no
+ * effect.
+ * 
+ * After this function has been called, stereo positions are ignored,
+ * and each instrument sample is just duplicated to both stereo output
+ * channels.  This allows for single-channel output.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ */
+void instr_flatten(INSTR_CTX *pi);
+
+/*
+ * Set the control period for ADSR envelopes.
+ * 
+ * period is the number of samples between each computation of an ADSR
+ * envelope.  It must be in range [1, CONTROL_MAX].  The default is one,
+ * which computes the envelope at every sample.  This applies to the
+ * envelopes of square wave instruments rendered with instr_render(),
+ * and to the envelopes within the generator maps of FM instruments
+ * prepared afterwards.  See adsr_ctlreset() for the error bound.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   period - the control period
+ */
+void instr_control(INSTR_CTX *pi, int32_t period);
 
 /*
  * Clear the instrument register i.
@@ -88,9 +247,11 @@ void instr_setsamp(int32_t rate);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register to clear
  */
-void instr_clear(int32_t i);
+void instr_clear(INSTR_CTX *pi, int32_t i);
 
 /*
  * Define a square wave instrument in register i.
@@ -118,6 +279,8 @@ void instr_clear(int32_t i);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   i_max - the maximum intensity of the instrument
@@ -129,6 +292,7 @@ void instr_clear(int32_t i);
  *   psp - the stereo position of the instrument
  */
 void instr_define(
+          INSTR_CTX  * pi,
           int32_t      i,
           int32_t      i_max,
           int32_t      i_min,
@@ -163,6 +327,8 @@ void instr_define(
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   pText - the full text of the instrument script
@@ -178,11 +344,12 @@ void instr_define(
  *   non-zero if successful, zero if error
  */
 int instr_embedded(
-          int32_t   i,
-    const char    * pText,
-          int     * per,
-          int     * per_src,
-          long    * pline);
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pText,
+          int       * per,
+          int       * per_src,
+          long      * pline);
 
 /*
  * Define an external instrument in register i.
@@ -203,8 +370,30 @@ int instr_embedded(
  * See Instruments.md in the doc directory for more about how external
  * instrument definition files are found.
  * 
+ * Each call number is only loaded once for the life of the instrument
+ * context.
+ * Later definitions with the same call number share the generator map
+ * that was loaded the first time, in the same way as instr_dup().
+ * Failed loads are not remembered.  Adding a directory to the search
+ * path with instr_addsearch() forgets all loaded call numbers, since
+ * they might now resolve to different files.
+ * 
+ * Unless the call number has already been loaded, the instrument file
+ * is only located by this function, and the register is left with a
+ * pending instrument that is loaded by instr_flush().  Errors locating
+ * the file are reported here, but errors within the instrument file
+ * are only reported later by instr_flush(), so a successful return
+ * does not mean that the instrument is valid.  This holds even if the
+ * register is redefined before instr_flush() is called, so an error in
+ * an instrument that is overwritten is still reported.  A pending
+ * register has the default intensity and stereo position, and can be
+ * duplicated, adjusted, and cleared like any other register, but it
+ * can't be used for synthesis until instr_flush() is called.
+ * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   pCall - the "call number" of the external instrument script
@@ -220,11 +409,99 @@ int instr_embedded(
  *   non-zero if successful, zero if error 
  */
 int instr_external(
-          int32_t   i,
-    const char    * pCall,
-          int     * per,
-          int     * per_src,
-          long    * pline);
+          INSTR_CTX * pi,
+          int32_t     i,
+    const char      * pCall,
+          int       * per,
+          int       * per_src,
+          long      * pline);
+
+/*
+ * Load all pending external instruments.
+ * 
+ * This must be called after the last instr_external() call and before
+ * any instrument register is used for synthesis, or else a fault
+ * occurs when a pending register is used.
+ * 
+ * Every call number that instr_external() left pending since the last
+ * successful call is loaded, including call numbers whose registers
+ * have since been redefined or cleared.  Before any of them is
+ * interpreted, the platform is asked to start reading all of the
+ * instrument files, so that file access latency overlaps the
+ * interpretation of the instruments.  The call numbers are then split
+ * between up to four loaders, each running on a worker thread with an
+ * instrument context of its own, so that separate instrument files are
+ * interpreted at the same time.  If a worker thread can't be started,
+ * its loader runs on the calling thread instead.
+ * 
+ * Once all the loaders are done, the results are merged in the order
+ * the call numbers were first defined, and each pending register is
+ * then set up in register order.  Intensity and stereo settings made
+ * while a register was pending are kept.
+ * 
+ * If any instrument fails to load, this function returns failure after
+ * the merge, reporting the call number that was defined first among
+ * those that failed.  per, per_src, and pline receive the error
+ * information in the same way as for instr_external().  If ppCall is
+ * not NULL, it receives a dynamically allocated copy of that call
+ * number, which the caller must free, or NULL if there was no error.
+ * Registers whose instruments did not load are left pending, and a
+ * later call tries those instruments again.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   per - pointer to variable to receive genmap error code
+ * 
+ *   per_src - the module from which the error number comes
+ * 
+ *   pline - pointer to variable to receive line number within script
+ * 
+ *   ppCall - pointer to variable to receive the failed call number, or
+ *   NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+int instr_flush(
+    INSTR_CTX *  pi,
+    int       *  per,
+    int       *  per_src,
+    long      *  pline,
+    char      ** ppCall);
+
+/*
+ * Load every external instrument on the search path ahead of time.
+ * 
+ * Each instrument file in the search path index is loaded at sampling
+ * rate rate, which must be RATE_CD or RATE_DVD, and remembered in the
+ * same way as a call number loaded by instr_external().  Later
+ * definitions of those call numbers at the same rate share the loaded
+ * generator map without touching the file again.  The loading is done
+ * on worker threads in the same way as for instr_flush().
+ * 
+ * This can be called before instr_setsamp(), and more than once with
+ * different rates.  It is meant for a process that is copied for each
+ * job it runs, so that the instruments are loaded once and every copy
+ * starts with them.  The search path, cache directory, and simplify
+ * setting should be configured before this call.
+ * 
+ * Instruments that fail to load are skipped, so that the error is
+ * reported when the instrument is defined.  Instrument files that are
+ * nested too deeply to be in the index or that are added later are not
+ * preloaded.  Since a call number is never loaded twice, changes to
+ * instrument files after this call are not seen until instr_addsearch()
+ * is called or the context is freed.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   rate - the sampling rate to load at
+ */
+void instr_preload(INSTR_CTX *pi, int32_t rate);
 
 /*
  * Copy one instrument register to another.
@@ -242,11 +519,13 @@ int instr_external(
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i_target - the target register
  * 
  *   i_src - the source register
  */
-void instr_dup(int32_t i_target, int32_t i_src);
+void instr_dup(INSTR_CTX *pi, int32_t i_target, int32_t i_src);
 
 /*
  * Set the maximum and minimum intensities of an instrument register.
@@ -263,13 +542,19 @@ void instr_dup(int32_t i_target, int32_t i_src);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   i_max - the maximum intensity for the instrument
  * 
  *   i_min - the minimum intensity for the instrument
  */
-void instr_setMaxMin(int32_t i, int32_t i_max, int32_t i_min);
+void instr_setMaxMin(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int32_t     i_max,
+    int32_t     i_min);
 
 /*
  * Set the stereo position of an instrument register.
@@ -284,11 +569,13 @@ void instr_setMaxMin(int32_t i, int32_t i_max, int32_t i_min);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   psp - the new stereo position
  */
-void instr_setStereo(int32_t i, const STEREO_POS *psp);
+void instr_setStereo(INSTR_CTX *pi, int32_t i, const STEREO_POS *psp);
 
 /*
  * Prepare instance data for a specific instrument.
@@ -310,13 +597,15 @@ void instr_setStereo(int32_t i, const STEREO_POS *psp);
  * 
  * dur is the duration of the event in samples.  This is not necessarily
  * the same as the duration of the envelope from instr_length().  It
- * must be greater than zero.
+ * must be in range [1, MAX_TIME].
  * 
  * pitch is the pitch to generate.  It must be in the range
  * [PITCH_MIN, PITCH_MAX].
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   dur - the duration of the event, in samples
@@ -328,7 +617,30 @@ void instr_setStereo(int32_t i, const STEREO_POS *psp);
  *   a dynamically allocated instance data block for rendering this
  *   note, or NULL if no instance data is required for this instrument
  */
-void *instr_prepare(int32_t i, int32_t dur, int32_t pitch);
+void *instr_prepare(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int64_t     dur,
+    int32_t     pitch);
+
+/*
+ * Skip over a note that will not be performed.
+ * 
+ * Each note that is prepared with instr_prepare() takes the next noise
+ * seeds from the instrument context.  This call takes the same seeds
+ * without preparing anything, so that leaving out a note that can only
+ * produce silence doesn't change the noise in the notes that follow.
+ * 
+ * i is the instrument register the note would have used.  It must be
+ * in range [0, INSTR_MAXCOUNT - 1].
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ */
+void instr_skip(INSTR_CTX *pi, int32_t i);
 
 /*
  * Given an event duration in samples, return the envelope duration in
@@ -338,10 +650,15 @@ void *instr_prepare(int32_t i, int32_t dur, int32_t pitch);
  * [0, INSTR_MAXCOUNT - 1].  If the given register is cleared, this call
  * always returns a value of one.
  * 
- * dur is the event duration in samples.  It must be greater than zero.
+ * dur is the event duration in samples.  It must be in range [1,
+ * MAX_TIME].
  * 
  * pod is a pointer to instance data that has been generated with a call
  * to instr_prepare() for this instrument and for the given duration.
+ * It may also be NULL, in which case the length is computed without
+ * any instance data.  Unlike instr_prepare(), that hands out no noise
+ * seeds and never freezes the event, so it can be used to find the
+ * length of a note that may never be performed.
  * 
  * The return value will always be greater than zero.  It may be less
  * than, equal to, or greater than the given dur value, depending on the
@@ -349,17 +666,19 @@ void *instr_prepare(int32_t i, int32_t dur, int32_t pitch);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   dur - the event duration in samples
  * 
- *   pod - pointer to instance data
+ *   pod - pointer to instance data, or NULL
  * 
  * Return:
  * 
  *   the envelope duration in samples
  */
-int32_t instr_length(int32_t i, int32_t dur, void *pod);
+int64_t instr_length(INSTR_CTX *pi, int32_t i, int64_t dur, void *pod);
 
 /*
  * Compute an instrument sample.
@@ -396,6 +715,8 @@ int32_t instr_length(int32_t i, int32_t dur, void *pod);
  * 
  * Parameters:
  * 
+ *   pi - the instrument context
+ * 
  *   i - the instrument register
  * 
  *   t - the time offset from the start of the event, in samples
@@ -411,14 +732,202 @@ int32_t instr_length(int32_t i, int32_t dur, void *pod);
  *   pod - pointer to instance data
  */
 void instr_get(
+    INSTR_CTX   * pi,
     int32_t       i,
-    int32_t       t,
-    int32_t       dur,
+    int64_t       t,
+    int64_t       dur,
     int32_t       pitch,
     int16_t       amp,
     STEREO_SAMP * pss,
     void        * pod);
 
+/*
+ * Get the stereo gains of an instrument at a pitch.
+ * 
+ * i is the instrument register, in range [0, INSTR_MAXCOUNT - 1].
+ * pitch is the pitch index in semitones from middle C.
+ * 
+ * The gains are what instr_render() multiplies each sample by, divided
+ * by MAX_FRAC, to get the left and right channels.  They only depend on
+ * the stereo position of the register and the pitch, so a voice can
+ * get them once when it starts.  Each is in range [0, MAX_FRAC].  If
+ * the register is clear, both gains are zero.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   pitch - the pitch index in semitones from middle C
+ * 
+ *   pl - receives the left channel gain
+ * 
+ *   pr - receives the right channel gain
+ */
+void instr_pan(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int32_t     pitch,
+    int32_t   * pl,
+    int32_t   * pr);
+
+/*
+ * Compute a block of consecutive instrument samples and add them to a
+ * stereo mix bus.
+ * 
+ * The samples are the same as calling instr_get() for each time offset
+ * in the block, but the per-call overhead of instr_get() is only paid
+ * once for the whole block.  The intensity parameters are computed
+ * once, and square wave instruments walk the looped wave table with a
+ * running index.
+ * 
+ * The one exception is that square wave instruments compute their ADSR
+ * envelope at the control rate.  This only makes a difference if a
+ * control period has been set with instr_control().
+ * 
+ * i, dur, pitch, and pod have the same meaning as for instr_get().
+ * 
+ * t is the time offset of the first sample in the block.  It must be
+ * zero or greater, and t + count - 1 must not exceed INT64_MAX.
+ * 
+ * pAmp points to count amplitudes, one for each sample in the block,
+ * each in range [0, MAX_FRAC].
+ * 
+ * count is the number of samples in the block.  It must be zero or
+ * greater.  If it is zero, nothing is computed.
+ * 
+ * gain_l and gain_r are the stereo gains, which should be what
+ * instr_pan() returns for the same register and pitch.
+ * 
+ * pLeft and pRight point to count accumulators each for the left and
+ * right channels.  Each stereo sample is added to the accumulators for
+ * its time offset, so the mix bus should be cleared before the first
+ * voice is added.  Nothing is added if the register is clear.  pRight
+ * may be NULL for a mono-aural mix bus, in which case only the left
+ * channel is computed.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   t - the time offset of the first sample in the block
+ * 
+ *   dur - the duration of the event, in samples
+ * 
+ *   pitch - the pitch index in semitones from middle C
+ * 
+ *   pAmp - the amplitudes of each sample in the block
+ * 
+ *   count - the number of samples in the block
+ * 
+ *   gain_l - the left channel gain
+ * 
+ *   gain_r - the right channel gain
+ * 
+ *   pLeft - the left channel accumulators
+ * 
+ *   pRight - the right channel accumulators, or NULL
+ * 
+ *   pod - pointer to instance data
+ */
+void instr_render(
+          INSTR_CTX * pi,
+          int32_t     i,
+          int64_t     t,
+          int64_t     dur,
+          int32_t     pitch,
+    const int16_t   * pAmp,
+          int32_t     count,
+          int32_t     gain_l,
+          int32_t     gain_r,
+          int64_t   * pLeft,
+          int64_t   * pRight,
+          void      * pod);
+
+/*
+ * Compute an upper bound on the magnitude of all instrument samples
+ * from a given time offset onwards.
+ * 
+ * i is the instrument register to use.  It must be in range
+ * [0, INSTR_MAXCOUNT - 1].  If the given register is cleared, the
+ * result is always zero.
+ * 
+ * t is the time offset in samples from the start of the event.  It
+ * must be zero or greater.  The bound covers t and all later offsets.
+ * 
+ * dur is the duration of the event in samples.  It must be greater than
+ * zero.
+ * 
+ * amp is the greatest amplitude that will be passed to instr_get() from
+ * t onwards.  It must be in range [0, MAX_FRAC].
+ * 
+ * pod is a pointer to instance data that has been generated with a call
+ * to instr_prepare() for this instrument and for the given duration.
+ * This function does not change the instance data.
+ * 
+ * The result is in output sample units, before stereo imaging (which
+ * never increases the magnitude).  It is conservative, so the actual
+ * samples may be much quieter.  It is not rounded, so a result below
+ * one means the samples are nothing more than rounding residue.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   t - the time offset from the start of the event, in samples
+ * 
+ *   dur - the duration of the event, in samples
+ * 
+ *   amp - the greatest amplitude from time t onwards
+ * 
+ *   pod - pointer to instance data
+ * 
+ * Return:
+ * 
+ *   the upper bound on the sample magnitude, zero or greater
+ */
+double instr_peak(
+    INSTR_CTX * pi,
+    int32_t     i,
+    int64_t     t,
+    int64_t     dur,
+    int16_t     amp,
+    void      * pod);
+
+/*
+ * Determine whether an instrument can only produce silence.
+ * 
+ * i is the instrument register to check.  It must be in range
+ * [0, INSTR_MAXCOUNT - 1].
+ * 
+ * amp is the greatest amplitude that will ever be passed to
+ * instr_get() for the event.  It must be in range [0, MAX_FRAC].
+ * 
+ * An instrument can only produce silence if its register is cleared,
+ * or if its intensity computed from amp and the i_max & i_min
+ * parameters is zero.  Unlike instr_peak(), this does not need
+ * instance data, so it can be used to analyze events before they are
+ * rendered.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   i - the instrument register
+ * 
+ *   amp - the greatest amplitude during the event
+ * 
+ * Return:
+ * 
+ *   non-zero if the instrument is always silent, zero otherwise
+ */
+int instr_silent(INSTR_CTX *pi, int32_t i, int16_t amp);
+
 /*
  * Translate an error code received from this module to a message.
  * 
@@ -441,4 +950,55 @@ void instr_get(
  */
 const char *instr_errstr(int code);
 
+/*
+ * Write all instrument registers that are not clear to a file in a
+ * binary format.
+ * 
+ * All external instruments must already have been loaded with
+ * instr_flush() or a fault occurs.  Registers that share an FM
+ * instrument, such as after instr_dup(), are written so that they still
+ * share it when restored.  The data is in the native byte order, so it
+ * can only be read back with instr_restore() on the same machine.
+ * 
+ * The call fails if an FM instrument uses a wave table, since wave
+ * tables can't be saved by generator_save().
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if an instrument can't be saved or
+ *   there was an I/O error
+ */
+int instr_save(INSTR_CTX *pi, FILE *pOut);
+
+/*
+ * Read instrument registers written by instr_save().
+ * 
+ * instr_setsamp() must have been called first with the same sampling
+ * rate that was in effect when the registers were saved, or a fault
+ * occurs.  This is intended to be called before any instrument has been
+ * defined.  Each register in the data is set as it was when saved,
+ * while all other registers are left alone.
+ * 
+ * All values in the binary data are checked, so corrupt data results
+ * in a zero return rather than a fault.  However, some registers may
+ * already have been set in that case.
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pIn - the file to read from
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the data is not valid
+ */
+int instr_restore(INSTR_CTX *pi, FILE *pIn);
+
 #endif
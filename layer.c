@@ -35,26 +35,89 @@ typedef struct {
    */
   int16_t m;
   
+  /*
+   * The index of the layer register where this graph was defined, from
+   * which the graph values are shared in blocks.
+   * 
+   * Only valid if pg is non-NULL.  If that register no longer holds the
+   * same graph, this register uses its own graph values.
+   */
+  int32_t src;
+  
+  /*
+   * The graph cursor used for blocks.
+   */
+  int32_t gcur;
+  
+  /*
+   * The block stamps and buffer slots of the unscaled graph values and
+   * the scaled layer values in the current block.
+   * 
+   * Each buffer is only valid if its stamp equals the stamp of the
+   * layer context.
+   */
+  int32_t gstamp;
+  int32_t gslot;
+  int32_t lstamp;
+  int32_t lslot;
+  
 } LAYER_REG;
 
 /*
- * Static data
- * ===========
+ * LAYER_CTX structure.
+ * 
+ * Prototype given in the header.
  */
+struct LAYER_CTX_TAG {
+  
+  /*
+   * The layer register bank.
+   */
+  LAYER_REG t[LAYER_MAXCOUNT];
+  
+  /*
+   * The stamp of the current block.
+   * 
+   * Zero if no block has been started.  Changed whenever a block begins
+   * or a register is changed, which invalidates all block buffers.
+   */
+  int32_t stamp;
+  
+  /*
+   * The first time offset and the number of time offsets of the current
+   * block.
+   */
+  int64_t bt;
+  int32_t bcount;
+  
+  /*
+   * The control period for blocks.
+   */
+  int32_t period;
+  
+  /*
+   * The pool of block buffers.
+   * 
+   * Each buffer holds LAYER_BLOCK_MAX values.  pcap is the number of
+   * buffers allocated, and used is the number of buffers that have been
+   * handed out in the current block.
+   */
+  int16_t **pool;
+  int32_t pcap;
+  int32_t used;
+};
 
 /*
- * The initialization flag.
- * 
- * Set to non-zero when the layer registers have been initialized.
+ * Static data
+ * ===========
  */
-static int m_layer_init = 0;
 
 /*
- * The layer register bank.
+ * The block buffer returned for layers that are not defined.
  * 
- * Only valid when m_layer_init is non-zero.
+ * This is never written, so it is shared by all layer contexts.
  */
-static LAYER_REG m_layer_t[LAYER_MAXCOUNT];
+static const int16_t m_layer_zero[LAYER_BLOCK_MAX];
 
 /*
  * Local functions
@@ -62,51 +125,35 @@ static LAYER_REG m_layer_t[LAYER_MAXCOUNT];
  */
 
 /* Prototypes */
-static void layer_init(void);
-static LAYER_REG *layer_ptr(int32_t i);
+static LAYER_REG *layer_ptr(LAYER_CTX *pl, int32_t i);
 static int16_t layer_qmul(double m);
-
-/*
- * Initialize the layer register bank, if not already initialized.
- */
-static void layer_init(void) {
-  
-  int32_t x = 0;
-  
-  if (!m_layer_init) {
-    m_layer_init = 1;
-    memset(m_layer_t, 0, sizeof(LAYER_REG) * LAYER_MAXCOUNT);
-    for(x = 0; x < LAYER_MAXCOUNT; x++) {
-      (m_layer_t[x]).pg = NULL;
-    }
-  }
-}
+static void layer_newstamp(LAYER_CTX *pl);
+static int32_t layer_slot(LAYER_CTX *pl);
+static void layer_ctlrun(LAYER_CTX *pl, LAYER_REG *pr, int16_t *pv);
+static int32_t layer_graphslot(LAYER_CTX *pl, int32_t i);
 
 /*
  * Get a pointer to the given layer register.
  * 
- * Initializes the layer register bank if necessary.
- * 
  * Parameters:
  * 
+ *   pl - the layer context
+ * 
  *   i - the layer register
  * 
  * Return:
  * 
  *   a pointer to the layer register
  */
-static LAYER_REG *layer_ptr(int32_t i) {
+static LAYER_REG *layer_ptr(LAYER_CTX *pl, int32_t i) {
   
-  /* Check parameter */
-  if ((i < 0) || (i >= LAYER_MAXCOUNT)) {
+  /* Check parameters */
+  if ((pl == NULL) || (i < 0) || (i >= LAYER_MAXCOUNT)) {
     abort();
   }
   
-  /* Initialize if necessary */
-  layer_init();
-  
   /* Return pointer */
-  return &(m_layer_t[i]);
+  return &((pl->t)[i]);
 }
 
 /*
@@ -147,6 +194,200 @@ static int16_t layer_qmul(double m) {
   return (int16_t) result;
 }
 
+/*
+ * Invalidate all block buffers by changing the block stamp.
+ * 
+ * Also releases all buffers back to the pool.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ */
+static void layer_newstamp(LAYER_CTX *pl) {
+  
+  int32_t x = 0;
+  
+  /* Increment the stamp, clearing all register stamps if it would
+   * overflow */
+  if (pl->stamp < INT32_MAX) {
+    (pl->stamp)++;
+  } else {
+    for(x = 0; x < LAYER_MAXCOUNT; x++) {
+      ((pl->t)[x]).gstamp = 0;
+      ((pl->t)[x]).lstamp = 0;
+    }
+    pl->stamp = 1;
+  }
+  
+  /* Release all buffers */
+  pl->used = 0;
+}
+
+/*
+ * Hand out a buffer from the pool for the current block, growing the
+ * pool if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ * Return:
+ * 
+ *   the index of the buffer in the pool
+ */
+static int32_t layer_slot(LAYER_CTX *pl) {
+  
+  int32_t newcap = 0;
+  int32_t x = 0;
+  
+  /* Grow the pool if all buffers are in use */
+  if (pl->used >= pl->pcap) {
+    if (pl->pcap < 1) {
+      newcap = 16;
+    } else if (pl->pcap <= LAYER_MAXCOUNT) {
+      newcap = pl->pcap * 2;
+    } else {
+      /* At most two buffers per layer */
+      abort();
+    }
+    
+    pl->pool = (int16_t **) realloc(
+                      pl->pool, newcap * sizeof(int16_t *));
+    if (pl->pool == NULL) {
+      abort();
+    }
+    for(x = pl->pcap; x < newcap; x++) {
+      (pl->pool)[x] = (int16_t *) malloc(
+                            LAYER_BLOCK_MAX * sizeof(int16_t));
+      if ((pl->pool)[x] == NULL) {
+        abort();
+      }
+    }
+    pl->pcap = newcap;
+  }
+  
+  /* Hand out the next buffer */
+  (pl->used)++;
+  return (pl->used - 1);
+}
+
+/*
+ * Compute the unscaled graph values of a layer register for the current
+ * block at the control rate.
+ * 
+ * The register must be defined and a block must be in progress.  The
+ * graph is only computed at multiples of the control period, using the
+ * graph cursor of the register, and linearly interpolated in between.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   pr - the layer register
+ * 
+ *   pv - the array that receives the block values
+ */
+static void layer_ctlrun(LAYER_CTX *pl, LAYER_REG *pr, int16_t *pv) {
+  
+  int32_t k = 0;
+  int32_t j = 0;
+  int32_t n = 0;
+  int64_t t = 0;
+  int64_t t0 = 0;
+  int16_t a0 = 0;
+  int16_t a1 = 0;
+  
+  /* Check parameters and state */
+  if ((pr == NULL) || (pv == NULL)) {
+    abort();
+  }
+  if ((pr->pg == NULL) || (pl->bcount < 1)) {
+    abort();
+  }
+  
+  /* Go through each control period that overlaps the block */
+  for(k = 0; k < pl->bcount; k += n) {
+    
+    /* Get the time offset and the control period containing it */
+    t = pl->bt + k;
+    t0 = t - (t % pl->period);
+    
+    /* Determine how many values are in this period and the block */
+    n = pl->period - ((int32_t) (t - t0));
+    if (n > pl->bcount - k) {
+      n = pl->bcount - k;
+    }
+    
+    if (t0 <= INT64_MAX - pl->period) {
+      /* Compute the graph at both ends of the period and interpolate */
+      graph_run(pr->pg, &(pr->gcur), t0, 1, &a0);
+      graph_run(pr->pg, &(pr->gcur), t0 + pl->period, 1, &a1);
+      for(j = 0; j < n; j++) {
+        pv[k + j] = (int16_t) (((int32_t) a0) +
+          ((((int32_t) a1) - ((int32_t) a0)) *
+            (((int32_t) (t - t0)) + j)) /
+            pl->period);
+      }
+      
+    } else {
+      /* End of the period would overflow, so compute exactly */
+      graph_run(pr->pg, &(pr->gcur), t, n, &(pv[k]));
+    }
+  }
+}
+
+/*
+ * Get the buffer slot of the unscaled graph values of a layer register
+ * for the current block, computing them if necessary.
+ * 
+ * The register must be defined and a block must be in progress.  The
+ * values are computed at the register where the graph was defined, so
+ * that all registers derived from it share them.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   i - the layer register
+ * 
+ * Return:
+ * 
+ *   the index of the buffer in the pool
+ */
+static int32_t layer_graphslot(LAYER_CTX *pl, int32_t i) {
+  
+  LAYER_REG *pr = NULL;
+  
+  /* Get the register, and switch to the register where the graph was
+   * defined if it still holds the graph */
+  pr = layer_ptr(pl, i);
+  if (pr->pg == NULL) {
+    abort();
+  }
+  if (((pl->t)[pr->src]).pg == pr->pg) {
+    pr = &((pl->t)[pr->src]);
+  }
+  
+  /* Compute the graph values if not computed yet in this block */
+  if (pr->gstamp != pl->stamp) {
+    pr->gslot = layer_slot(pl);
+    if (pl->period > 1) {
+      layer_ctlrun(pl, pr, (pl->pool)[pr->gslot]);
+    } else {
+      graph_run(
+        pr->pg,
+        &(pr->gcur),
+        pl->bt,
+        pl->bcount,
+        (pl->pool)[pr->gslot]);
+    }
+    pr->gstamp = pl->stamp;
+  }
+  
+  /* Return the slot */
+  return pr->gslot;
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -154,28 +395,97 @@ static int16_t layer_qmul(double m) {
  * See the header for specifications.
  */
 
+/*
+ * layer_alloc function.
+ */
+LAYER_CTX *layer_alloc(void) {
+  
+  LAYER_CTX *pl = NULL;
+  int32_t x = 0;
+  
+  /* Allocate the context */
+  pl = (LAYER_CTX *) malloc(sizeof(LAYER_CTX));
+  if (pl == NULL) {
+    abort();
+  }
+  memset(pl, 0, sizeof(LAYER_CTX));
+  
+  /* Initialize the context */
+  for(x = 0; x < LAYER_MAXCOUNT; x++) {
+    ((pl->t)[x]).pg = NULL;
+  }
+  pl->stamp = 0;
+  pl->bt = 0;
+  pl->bcount = 0;
+  pl->period = 1;
+  pl->pool = NULL;
+  pl->pcap = 0;
+  pl->used = 0;
+  
+  /* Return the new context */
+  return pl;
+}
+
+/*
+ * layer_free function.
+ */
+void layer_free(LAYER_CTX *pl) {
+  
+  int32_t x = 0;
+  
+  /* Only proceed if not NULL */
+  if (pl != NULL) {
+    
+    /* Release the graphs of all registers */
+    for(x = 0; x < LAYER_MAXCOUNT; x++) {
+      if (((pl->t)[x]).pg != NULL) {
+        graph_release(((pl->t)[x]).pg);
+        ((pl->t)[x]).pg = NULL;
+      }
+    }
+    
+    /* Release the buffer pool */
+    for(x = 0; x < pl->pcap; x++) {
+      free((pl->pool)[x]);
+      (pl->pool)[x] = NULL;
+    }
+    if (pl->pool != NULL) {
+      free(pl->pool);
+      pl->pool = NULL;
+    }
+    
+    /* Release the context */
+    free(pl);
+  }
+}
+
 /*
  * layer_clear function.
  */
-void layer_clear(int32_t layer) {
+void layer_clear(LAYER_CTX *pl, int32_t layer) {
   
   LAYER_REG *pr = NULL;
   
   /* Get pointer to register */
-  pr = layer_ptr(layer);
+  pr = layer_ptr(pl, layer);
   
   /* Only proceed if register defined */
   if (pr->pg != NULL) {
     graph_release(pr->pg);
     memset(pr, 0, sizeof(LAYER_REG));
     pr->pg = NULL;
+    layer_newstamp(pl);
   }
 }
 
 /*
  * layer_define function.
  */
-void layer_define(int32_t layer, double mul, GRAPH_OBJ *pg) {
+void layer_define(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    double      mul,
+    GRAPH_OBJ * pg) {
   
   LAYER_REG *pr = NULL;
   
@@ -191,27 +501,36 @@ void layer_define(int32_t layer, double mul, GRAPH_OBJ *pg) {
   }
   
   /* Clear register */
-  layer_clear(layer);
+  layer_clear(pl, layer);
   
   /* Only proceed if multiplier greater than zero */
   if (mul > 0.0) {
   
     /* Get pointer to register */
-    pr = layer_ptr(layer);
+    pr = layer_ptr(pl, layer);
     
     /* Copy in parameters */
     pr->pg = pg;
     graph_addref(pg);
     pr->m = layer_qmul(mul);
+    pr->src = layer;
+    layer_newstamp(pl);
   }
 }
 
 /*
  * layer_derive function.
  */
-void layer_derive(int32_t target, int32_t source, double mul) {
+void layer_derive(
+    LAYER_CTX * pl,
+    int32_t     target,
+    int32_t     source,
+    double      mul) {
   
   /* Check parameters */
+  if (pl == NULL) {
+    abort();
+  }
   if ((target < 0) || (source < 0) ||
       (target > LAYER_MAXCOUNT - 1) || (source > LAYER_MAXCOUNT - 1)) {
     abort();
@@ -223,44 +542,52 @@ void layer_derive(int32_t target, int32_t source, double mul) {
     abort();
   }
   
-  /* Initialize registers if necessary */
-  layer_init();
-  
   /* First, filter out special case of mul zero */
   if (mul > 0.0) {
     /* Non-zero multiplier, next see if source register is clear */
-    if ((m_layer_t[source]).pg == NULL) {
+    if (((pl->t)[source]).pg == NULL) {
       
       /* Source register clear, so just clear the target register */
-      layer_clear(target);
+      layer_clear(pl, target);
       
     } else {
       /* Source register not clear, now check if source and target are
        * the same */
       if (source == target) {
         /* Registers are the same, so just change the multiplier */
-        (m_layer_t[target]).m = layer_qmul(mul);
+        ((pl->t)[target]).m = layer_qmul(mul);
+        layer_newstamp(pl);
         
       } else {
         /* Registers are not the same, so copy in the graph and adjust
          * the multiplier */
-        layer_clear(target);
-        (m_layer_t[target]).m = layer_qmul(mul);
-        (m_layer_t[target]).pg = (m_layer_t[source]).pg;
-        graph_addref((m_layer_t[target]).pg);
+        layer_clear(pl, target);
+        ((pl->t)[target]).m = layer_qmul(mul);
+        ((pl->t)[target]).pg = ((pl->t)[source]).pg;
+        graph_addref(((pl->t)[target]).pg);
+        
+        /* Share graph values with the register the source graph was
+         * defined in, if it still holds the graph */
+        if (((pl->t)[((pl->t)[source]).src]).pg ==
+              ((pl->t)[source]).pg) {
+          ((pl->t)[target]).src = ((pl->t)[source]).src;
+        } else {
+          ((pl->t)[target]).src = source;
+        }
+        layer_newstamp(pl);
       }
     }
     
   } else {
     /* Zero multiplier, so just clear target register */
-    layer_clear(target);
+    layer_clear(pl, target);
   }
 }
 
 /*
  * layer_get function.
  */
-int16_t layer_get(int32_t layer, int32_t t) {
+int16_t layer_get(LAYER_CTX *pl, int32_t layer, int64_t t) {
   
   LAYER_REG *pr = NULL;
   int32_t result = 0;
@@ -271,7 +598,7 @@ int16_t layer_get(int32_t layer, int32_t t) {
   }
   
   /* Get pointer to register */
-  pr = layer_ptr(layer);
+  pr = layer_ptr(pl, layer);
   
   /* Check if register is clear */
   if (pr->pg == NULL) {
@@ -297,3 +624,350 @@ int16_t layer_get(int32_t layer, int32_t t) {
   /* Return result */
   return (int16_t) result;
 }
+
+/*
+ * layer_run function.
+ */
+void layer_run(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    int32_t   * pcur,
+    int64_t     t,
+    int32_t     count,
+    int16_t   * pv) {
+  
+  LAYER_REG *pr = NULL;
+  int32_t k = 0;
+  int32_t result = 0;
+  
+  /* Check parameters */
+  if ((pcur == NULL) || (t < 0) || (count < 0)) {
+    abort();
+  }
+  if ((count > 0) && (pv == NULL)) {
+    abort();
+  }
+  
+  /* Get pointer to register */
+  pr = layer_ptr(pl, layer);
+  
+  /* Check if register is clear */
+  if (pr->pg == NULL) {
+    
+    /* Register is clear, so results are just zero */
+    for(k = 0; k < count; k++) {
+      pv[k] = 0;
+    }
+    
+  } else {
+    /* Register not clear, so first of all get the graph values */
+    graph_run(pr->pg, pcur, t, count, pv);
+    
+    /* Next, multiply by layer scaling rate unless it is the full
+     * scale */
+    if (pr->m < MAX_FRAC) {
+      for(k = 0; k < count; k++) {
+        result = (((int32_t) pv[k]) * ((int32_t) pr->m)) / MAX_FRAC;
+        
+        /* Clamp result */
+        if (result < 0) {
+          result = 0;
+        } else if (result > MAX_FRAC) {
+          result = MAX_FRAC;
+        }
+        
+        pv[k] = (int16_t) result;
+      }
+    }
+  }
+}
+
+/*
+ * layer_peak function.
+ */
+int16_t layer_peak(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    int64_t     t0,
+    int64_t     t1) {
+  
+  LAYER_REG *pr = NULL;
+  int32_t result = 0;
+  
+  /* Check range parameters */
+  if ((t0 < 0) || (t1 < t0)) {
+    abort();
+  }
+  
+  /* Get pointer to register */
+  pr = layer_ptr(pl, layer);
+  
+  /* Check if register is clear */
+  if (pr->pg == NULL) {
+    
+    /* Register is clear, so result is just zero */
+    result = 0;
+    
+  } else {
+    /* Register not clear, so get the greatest graph value within the
+     * range */
+    result = (int32_t) graph_peak(pr->pg, t0, t1);
+    
+    /* Next, multiply by layer scaling rate -- scaling is monotonic, so
+     * the scaled peak is the peak of the scaled values */
+    result = (result * ((int32_t) pr->m)) / MAX_FRAC;
+    
+    /* Clamp result */
+    if (result < 0) {
+      result = 0;
+    } else if (result > MAX_FRAC) {
+      result = MAX_FRAC;
+    }
+  }
+  
+  /* Return result */
+  return (int16_t) result;
+}
+
+/*
+ * layer_block function.
+ */
+void layer_block(LAYER_CTX *pl, int64_t t, int32_t count) {
+  
+  /* Check parameters */
+  if (pl == NULL) {
+    abort();
+  }
+  if ((t < 0) || (count < 1) || (count > LAYER_BLOCK_MAX)) {
+    abort();
+  }
+  if (t > INT64_MAX - count) {
+    abort();
+  }
+  
+  /* Invalidate the previous block and record the new one */
+  layer_newstamp(pl);
+  pl->bt = t;
+  pl->bcount = count;
+}
+
+/*
+ * layer_control function.
+ */
+void layer_control(LAYER_CTX *pl, int32_t period) {
+  
+  /* Check parameters */
+  if ((pl == NULL) || (period < 1) || (period > CONTROL_MAX)) {
+    abort();
+  }
+  
+  /* Set the period and invalidate the current block */
+  pl->period = period;
+  layer_newstamp(pl);
+}
+
+/*
+ * layer_blockget function.
+ */
+const int16_t *layer_blockget(LAYER_CTX *pl, int32_t layer) {
+  
+  LAYER_REG *pr = NULL;
+  const int16_t *pg = NULL;
+  int16_t *pv = NULL;
+  int32_t k = 0;
+  int32_t slot = 0;
+  int32_t result = 0;
+  
+  /* Check state */
+  if (pl == NULL) {
+    abort();
+  }
+  if (pl->bcount < 1) {
+    abort();
+  }
+  
+  /* Get pointer to register */
+  pr = layer_ptr(pl, layer);
+  
+  /* Check if register is clear */
+  if (pr->pg == NULL) {
+    /* Register is clear, so results are just zero */
+    pg = m_layer_zero;
+    
+  } else if (pr->m >= MAX_FRAC) {
+    /* Full scale, so the graph values are used as-is (getting the slot
+     * first, since the pool may grow) */
+    slot = layer_graphslot(pl, layer);
+    pg = (pl->pool)[slot];
+    
+  } else {
+    /* Scale the graph values if not done yet in this block */
+    if (pr->lstamp != pl->stamp) {
+      slot = layer_graphslot(pl, layer);
+      pr->lslot = layer_slot(pl);
+      pg = (pl->pool)[slot];
+      pv = (pl->pool)[pr->lslot];
+      for(k = 0; k < pl->bcount; k++) {
+        result = (((int32_t) pg[k]) * ((int32_t) pr->m)) / MAX_FRAC;
+        
+        /* Clamp result */
+        if (result < 0) {
+          result = 0;
+        } else if (result > MAX_FRAC) {
+          result = MAX_FRAC;
+        }
+        
+        pv[k] = (int16_t) result;
+      }
+      pr->lstamp = pl->stamp;
+    }
+    pg = (pl->pool)[pr->lslot];
+  }
+  
+  /* Return the values */
+  return pg;
+}
+
+/*
+ * layer_save function.
+ */
+int layer_save(LAYER_CTX *pl, FILE *pOut) {
+  
+  int status = 1;
+  int32_t x = 0;
+  int32_t y = 0;
+  int32_t rec[4];
+  
+  /* Initialize buffers */
+  memset(rec, 0, sizeof(rec));
+  
+  /* Check parameters */
+  if ((pl == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  
+  /* Write a record for each defined register, each followed by its
+   * graph unless an earlier register has the same graph */
+  for(x = 0; status && (x < LAYER_MAXCOUNT); x++) {
+    if (((pl->t)[x]).pg != NULL) {
+      for(y = 0; y < x; y++) {
+        if (((pl->t)[y]).pg == ((pl->t)[x]).pg) {
+          break;
+        }
+      }
+      
+      rec[0] = x;
+      rec[1] = ((pl->t)[x]).m;
+      rec[2] = ((pl->t)[x]).src;
+      if (y < x) {
+        rec[3] = y;
+      } else {
+        rec[3] = -1;
+      }
+      
+      if (fwrite(rec, sizeof(int32_t), 4, pOut) != 4) {
+        status = 0;
+      }
+      if (status && (y >= x)) {
+        if (!graph_save(((pl->t)[x]).pg, pOut)) {
+          status = 0;
+        }
+      }
+    }
+  }
+  
+  /* Write the end record */
+  if (status) {
+    rec[0] = -1;
+    rec[1] = 0;
+    rec[2] = 0;
+    rec[3] = 0;
+    if (fwrite(rec, sizeof(int32_t), 4, pOut) != 4) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * layer_restore function.
+ */
+int layer_restore(LAYER_CTX *pl, FILE *pIn) {
+  
+  int status = 1;
+  int done = 0;
+  int32_t prev = -1;
+  int32_t rec[4];
+  GRAPH_OBJ *pg = NULL;
+  LAYER_REG *pr = NULL;
+  
+  /* Initialize buffers */
+  memset(rec, 0, sizeof(rec));
+  
+  /* Check parameters */
+  if ((pl == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  
+  /* Read records until the end record */
+  while (status && (!done)) {
+    
+    /* Read the record */
+    if (fread(rec, sizeof(int32_t), 4, pIn) != 4) {
+      status = 0;
+    }
+    
+    /* Check for end record */
+    if (status && (rec[0] == -1)) {
+      done = 1;
+    }
+    
+    /* Check the record, which must be for a later register than the
+     * previous record, and which can only share the graph of a
+     * register that was already restored */
+    if (status && (!done)) {
+      if ((rec[0] <= prev) || (rec[0] >= LAYER_MAXCOUNT) ||
+          (rec[1] < 1) || (rec[1] > MAX_FRAC) ||
+          (rec[2] < 0) || (rec[2] >= LAYER_MAXCOUNT) ||
+          (rec[3] < -1) || (rec[3] >= rec[0])) {
+        status = 0;
+      }
+      if (status && (rec[3] >= 0)) {
+        if (((pl->t)[rec[3]]).pg == NULL) {
+          status = 0;
+        }
+      }
+    }
+    
+    /* Get the graph */
+    if (status && (!done)) {
+      if (rec[3] >= 0) {
+        pg = ((pl->t)[rec[3]]).pg;
+        graph_addref(pg);
+      } else {
+        pg = graph_restore(pIn);
+        if (pg == NULL) {
+          status = 0;
+        }
+      }
+    }
+    
+    /* Set the register, transferring the graph reference to it */
+    if (status && (!done)) {
+      layer_clear(pl, rec[0]);
+      pr = layer_ptr(pl, rec[0]);
+      pr->pg = pg;
+      pr->m = (int16_t) rec[1];
+      pr->src = rec[2];
+      layer_newstamp(pl);
+      
+      pg = NULL;
+      prev = rec[0];
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
@@ -18,11 +18,51 @@
 /*
  * The maximum number of layers that may be defined.
  * 
- * The layer table is statically allocated, so be careful of setting
- * this too high.
+ * The layer table is allocated in full with each layer context, so be
+ * careful of setting this too high.
  */
 #define LAYER_MAXCOUNT (16384)
 
+/*
+ * The maximum number of time offsets in a block.
+ * 
+ * See layer_block().
+ */
+#define LAYER_BLOCK_MAX (1024)
+
+/*
+ * Structure prototype for LAYER_CTX.
+ * 
+ * A layer context holds the layer registers and block state of one
+ * render context.  See render.h for further information.
+ */
+struct LAYER_CTX_TAG;
+typedef struct LAYER_CTX_TAG LAYER_CTX;
+
+/*
+ * Allocate a new layer context.
+ * 
+ * All layer registers start out clear, and the control period starts
+ * out as one.  Release the context with layer_free().
+ * 
+ * Return:
+ * 
+ *   the new layer context
+ */
+LAYER_CTX *layer_alloc(void);
+
+/*
+ * Release a layer context.
+ * 
+ * The references that the layer registers hold to graph objects are
+ * released.  If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context, or NULL
+ */
+void layer_free(LAYER_CTX *pl);
+
 /*
  * Clear a layer register.
  * 
@@ -35,9 +75,11 @@
  * 
  * Parameters:
  * 
+ *   pl - the layer context
+ * 
  *   layer - the layer to clear
  */
-void layer_clear(int32_t layer);
+void layer_clear(LAYER_CTX *pl, int32_t layer);
 
 /*
  * Define a layer.
@@ -60,13 +102,19 @@ void layer_clear(int32_t layer);
  * 
  * Parameters:
  * 
+ *   pl - the layer context
+ * 
  *   layer - the layer index
  * 
  *   mul - the multiplier
  * 
  *   pg - the graph object
  */
-void layer_define(int32_t layer, double mul, GRAPH_OBJ *pg);
+void layer_define(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    double      mul,
+    GRAPH_OBJ * pg);
 
 /*
  * Derive one layer from another by a constant multiplier.
@@ -90,13 +138,19 @@ void layer_define(int32_t layer, double mul, GRAPH_OBJ *pg);
  * 
  * Parameters:
  * 
+ *   pl - the layer context
+ * 
  *   target - the target register
  * 
  *   source - the source register to copy from
  * 
  *   mul - the new multiplier
  */
-void layer_derive(int32_t target, int32_t source, double mul);
+void layer_derive(
+    LAYER_CTX * pl,
+    int32_t     target,
+    int32_t     source,
+    double      mul);
 
 /*
  * Compute an intensity value from the given layer.
@@ -114,6 +168,8 @@ void layer_derive(int32_t target, int32_t source, double mul);
  * 
  * Parameters:
  * 
+ *   pl - the layer context
+ * 
  *   layer - the layer index
  * 
  *   t - the time offset
@@ -122,6 +178,199 @@ void layer_derive(int32_t target, int32_t source, double mul);
  * 
  *   the computed intensity value
  */
-int16_t layer_get(int32_t layer, int32_t t);
+int16_t layer_get(LAYER_CTX *pl, int32_t layer, int64_t t);
+
+/*
+ * Compute the intensity values of the given layer for a run of
+ * consecutive time offsets.
+ * 
+ * layer is the layer index, in range [0, LAYER_MAXCOUNT - 1].
+ * 
+ * pcur points to a graph cursor, which should be set to zero before
+ * the first run.  Keep a separate cursor for each voice that reads the
+ * layer, so that successive runs of a voice don't need to search the
+ * graph.  See graph_run() for further information.
+ * 
+ * t is the time offset of the first value, which must be zero or
+ * greater.  count is the number of values, which must be zero or
+ * greater.  pv points to the array that receives the values.
+ * 
+ * Each value is exactly what layer_get() would return for the same
+ * time offset.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   layer - the layer index
+ * 
+ *   pcur - the graph cursor
+ * 
+ *   t - the time offset of the first value
+ * 
+ *   count - the number of values
+ * 
+ *   pv - the array that receives the values
+ */
+void layer_run(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    int32_t   * pcur,
+    int64_t     t,
+    int32_t     count,
+    int16_t   * pv);
+
+/*
+ * Compute the greatest intensity value of the given layer within a
+ * range of time offsets.
+ * 
+ * layer is the layer index, in range [0, LAYER_MAXCOUNT - 1].
+ * 
+ * t0 and t1 are the first and last time offsets of the range,
+ * inclusive.  t0 must be zero or greater, and t1 must be greater than
+ * or equal to t0.
+ * 
+ * The result is the maximum value that layer_get() would return for any
+ * t in the range.  If the given layer is undefined, this function
+ * always returns zero.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   layer - the layer index
+ * 
+ *   t0 - the first time offset in the range
+ * 
+ *   t1 - the last time offset in the range
+ * 
+ * Return:
+ * 
+ *   the maximum intensity value within the range
+ */
+int16_t layer_peak(
+    LAYER_CTX * pl,
+    int32_t     layer,
+    int64_t     t0,
+    int64_t     t1);
+
+/*
+ * Begin a block of consecutive time offsets.
+ * 
+ * After this call, layer_blockget() returns the intensity values of any
+ * layer for this block.  Each layer is only computed once per block, no
+ * matter how many times it is requested, and layers derived from the
+ * same graph with layer_derive() share a single evaluation of the graph
+ * that is then scaled for each layer.
+ * 
+ * Each layer keeps its own graph cursor for blocks, so blocks should
+ * start at increasing time offsets for best performance.  See
+ * graph_run().
+ * 
+ * t is the time offset of the first value in the block, which must be
+ * zero or greater.  count is the number of time offsets in the block,
+ * which must be in range [1, LAYER_BLOCK_MAX].
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   t - the time offset of the first value
+ * 
+ *   count - the number of time offsets in the block
+ */
+void layer_block(LAYER_CTX *pl, int64_t t, int32_t count);
+
+/*
+ * Set the control period used for blocks.
+ * 
+ * period is the number of samples in each control period.  It must be
+ * in range [1, CONTROL_MAX].  The default is one, which means that
+ * layer_blockget() returns exactly what layer_get() would.
+ * 
+ * Otherwise, the graph of each layer is only computed at time offsets
+ * that are multiples of the period, and linearly interpolated in
+ * between.  Since graphs are made of straight segments, the values are
+ * exact except within the control periods that contain the start of a
+ * graph element.  Within such a period, each value always lies between
+ * the exact values at the start and end of the period, so it never
+ * differs from the exact value by more than the difference between the
+ * greatest and least exact values within that period.
+ * 
+ * This invalidates the current block.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   period - the control period in samples
+ */
+void layer_control(LAYER_CTX *pl, int32_t period);
+
+/*
+ * Get the intensity values of a layer for the current block.
+ * 
+ * layer_block() must have been called to begin the block.  layer is
+ * the layer index, in range [0, LAYER_MAXCOUNT - 1].
+ * 
+ * The returned array has one value for each time offset in the block,
+ * which is exactly what layer_get() would return for that offset.  The
+ * array is owned by the layer context and is only valid until the next
+ * call to layer_block() or to any function that changes a layer
+ * register.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   layer - the layer index
+ * 
+ * Return:
+ * 
+ *   the intensity values of the layer for the block
+ */
+const int16_t *layer_blockget(LAYER_CTX *pl, int32_t layer);
+
+/*
+ * Write all defined layer registers to a file in a binary format.
+ * 
+ * Registers that share a graph object are written so that they still
+ * share it when restored.  The data is in the native byte order, so it
+ * can only be read back with layer_restore() on the same machine.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an I/O error
+ */
+int layer_save(LAYER_CTX *pl, FILE *pOut);
+
+/*
+ * Read layer registers written by layer_save().
+ * 
+ * This is intended to be called before any layer has been defined.
+ * Each register in the data is set as it was when saved, while all
+ * other registers are left alone.
+ * 
+ * All values in the binary data are checked, so corrupt data results
+ * in a zero return rather than a fault.  However, some registers may
+ * already have been set in that case.
+ * 
+ * Parameters:
+ * 
+ *   pl - the layer context
+ * 
+ *   pIn - the file to read from
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the data is not valid
+ */
+int layer_restore(LAYER_CTX *pl, FILE *pIn);
 
 #endif
@@ -17,6 +17,10 @@
  * See Porting.md in the doc directory for further information.
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 /*
  * Return the character code in range [0x21, 0x7e] that is used for
  * separating directories within a path string on this platform.
@@ -76,6 +80,135 @@ int os_isdir(const char *pc);
  */
 int os_isfile(const char *pc);
 
+/*
+ * Hint that a file will be read soon.
+ * 
+ * The platform may start reading the file in the background, so that
+ * later reads complete sooner.  This is only a hint.  Nothing happens
+ * if the file doesn't exist or the platform has no such facility.
+ * 
+ * Parameters:
+ * 
+ *   pc - the path to the file
+ */
+void os_prefetch(const char *pc);
+
+/*
+ * Map a whole file into memory for reading.
+ * 
+ * The file contents are mapped read-only and remain mapped until they
+ * are passed to os_unmapfile(), or until the process exits.  If the
+ * platform can't map files, the contents are read into a dynamically
+ * allocated buffer instead, which os_unmapfile() frees.
+ * 
+ * NULL is returned if the file doesn't exist, can't be read, or is
+ * empty.
+ * 
+ * Parameters:
+ * 
+ *   pc - the path to the file
+ * 
+ *   plen - receives the length of the file in bytes
+ * 
+ * Return:
+ * 
+ *   pointer to the file contents, or NULL
+ */
+const void *os_mapfile(const char *pc, size_t *plen);
+
+/*
+ * Unmap a file that was mapped with os_mapfile().
+ * 
+ * p and len must be the pointer and length returned by os_mapfile().
+ * The contents must not be accessed after this call.  If NULL is
+ * passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   p - the file contents, or NULL
+ * 
+ *   len - the length of the file in bytes
+ */
+void os_unmapfile(const void *p, size_t len);
+
+/*
+ * Create a new temporary file to be renamed over a file later.
+ * 
+ * The temporary file is created in the same directory as the file at
+ * pc, with a name that is pc followed by a suffix that is unique to
+ * this process and this call.  The file must not already exist, so
+ * separate processes and threads writing the same file never share a
+ * temporary file.  It is opened for writing in binary mode.
+ * 
+ * The path of the temporary file is written to *ppTemp as a
+ * dynamically allocated string, which the caller must free with
+ * free().  If the file can't be created, NULL is returned and *ppTemp
+ * is set to NULL.
+ * 
+ * Parameters:
+ * 
+ *   pc - the path to the file that will be replaced
+ * 
+ *   ppTemp - receives the path of the temporary file
+ * 
+ * Return:
+ * 
+ *   the temporary file opened for writing, or NULL
+ */
+FILE *os_tempfile(const char *pc, char **ppTemp);
+
+/*
+ * Callback function type for os_listdir().
+ * 
+ * pCustom is the custom parameter that was passed to os_listdir().
+ * 
+ * pName is the name of the directory entry, without any directory
+ * path.  The string is only valid during the callback.
+ * 
+ * isdir is non-zero if the entry is a directory, zero if it is a
+ * regular file.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the custom parameter
+ * 
+ *   pName - the name of the entry
+ * 
+ *   isdir - non-zero for a directory, zero for a regular file
+ */
+typedef void (*os_fp_entry)(
+          void * pCustom,
+    const char * pName,
+          int    isdir);
+
+/*
+ * List the entries of a directory.
+ * 
+ * The callback is invoked once for each entry in the directory that is
+ * a regular file or a directory, in no particular order.  Other kinds
+ * of entries are skipped, as are the "." and ".." entries.  Symbolic
+ * links are followed when determining the kind of an entry.  Where the
+ * platform reports the kind of each entry along with its name, entries
+ * are only queried individually when that is needed to follow a
+ * symbolic link or when the kind is unknown.
+ * 
+ * The given path must NOT have a trailing separator or a fault occurs.
+ * 
+ * Parameters:
+ * 
+ *   pc - the path to the directory
+ * 
+ *   fp - the callback function
+ * 
+ *   pCustom - custom parameter passed through to the callback
+ * 
+ * Return:
+ * 
+ *   non-zero if the directory was listed, zero if it could not be
+ *   opened
+ */
+int os_listdir(const char *pc, os_fp_entry fp, void *pCustom);
+
 /*
  * Return a copy of the home directory path.
  * 
@@ -97,4 +230,185 @@ int os_isfile(const char *pc);
  */
 char *os_gethome(void);
 
+/*
+ * Callback function type for os_serve().
+ * 
+ * The function is called once for each job, in a separate process
+ * whose standard input, standard output, and standard error are all
+ * connected to the client of the job.  pCustom is the custom parameter
+ * that was passed to os_serve().
+ * 
+ * Parameters:
+ * 
+ *   pCustom - the custom parameter
+ * 
+ * Return:
+ * 
+ *   non-zero if the job succeeded, zero if it failed
+ */
+typedef int (*os_fp_job)(void *pCustom);
+
+/*
+ * Serve jobs from clients that connect to a local socket.
+ * 
+ * pc is the path of the socket to create.  If a socket already exists
+ * at that path, it is replaced.  Any other kind of file at that path
+ * makes the call fail.  Only the user running the process may connect
+ * to the socket, since a job has all the permissions of the process.
+ * The socket is created with those permissions from the start, by
+ * narrowing the file mode mask of the process while it is created, so
+ * no other thread should be creating files during this call.
+ * 
+ * Each connection is one job.  The job runs the callback function in a
+ * copy of the current process, so the job starts with all the state
+ * that the caller set up before this call, and nothing a job does
+ * affects the caller or any other job.  At most jobs jobs run at the
+ * same time, which must be at least one.  The connection is closed
+ * when the callback returns.  If the copy of the process can't be
+ * started, the callback isn't run for that job.  Instead, a line with
+ * "ERROR" is written to the connection, and then it is closed, so that
+ * the client can tell the job failed.
+ * 
+ * This function only returns if the socket can't be created or stops
+ * accepting connections.  On platforms without local sockets or
+ * separate processes, it always fails.
+ * 
+ * Parameters:
+ * 
+ *   pc - the path to the socket
+ * 
+ *   jobs - the maximum number of jobs at the same time
+ * 
+ *   fp - the callback function
+ * 
+ *   pCustom - custom parameter passed through to the callback
+ * 
+ * Return:
+ * 
+ *   zero, since the function only returns on failure
+ */
+int os_serve(const char *pc, int32_t jobs, os_fp_job fp, void *pCustom);
+
+/*
+ * Structure prototype for OS_WORKER.
+ */
+struct OS_WORKER_TAG;
+typedef struct OS_WORKER_TAG OS_WORKER;
+
+/*
+ * Callback function type for os_worker().
+ * 
+ * pw is the worker object that is running the function.  It is passed
+ * here so that the function can lock and wait on its own worker before
+ * os_worker() has even returned to the starting thread.
+ * 
+ * pCustom is the custom parameter that was passed to os_worker().
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ * 
+ *   pCustom - the custom parameter
+ */
+typedef void (*os_fp_worker)(OS_WORKER *pw, void *pCustom);
+
+/*
+ * Start running a function on a background worker thread.
+ * 
+ * Each worker has its own lock and condition, so any number of workers
+ * may exist at a time.  The worker must eventually be joined with
+ * os_join(), which also releases the worker object.
+ * 
+ * If the platform can't run threads, or a thread couldn't be started,
+ * NULL is returned and nothing happens.  The caller should then do the
+ * work itself.
+ * 
+ * The worker and the calling thread must coordinate through os_lock(),
+ * os_unlock(), os_wait(), and os_wake(), passing the worker object
+ * that was returned here.
+ * 
+ * Parameters:
+ * 
+ *   fp - the function to run on the worker
+ * 
+ *   pCustom - custom parameter passed through to the function
+ * 
+ * Return:
+ * 
+ *   the new worker object, or NULL if the worker was not started
+ */
+OS_WORKER *os_worker(os_fp_worker fp, void *pCustom);
+
+/*
+ * Wait for a worker started with os_worker() to return from its
+ * function, and then release the worker object.
+ * 
+ * The lock of the worker may not be held.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ */
+void os_join(OS_WORKER *pw);
+
+/*
+ * Acquire the lock that is shared between a worker and the thread that
+ * started it.
+ * 
+ * The lock is not recursive.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ */
+void os_lock(OS_WORKER *pw);
+
+/*
+ * Release the lock acquired with os_lock().
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ */
+void os_unlock(OS_WORKER *pw);
+
+/*
+ * Release the lock of a worker, sleep until another thread calls
+ * os_wake() on the same worker, and then acquire the lock again.
+ * 
+ * The lock must be held.  The wait may also end spuriously, so the
+ * caller must check its condition again in a loop.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ */
+void os_wait(OS_WORKER *pw);
+
+/*
+ * Wake every thread that is sleeping in os_wait() on a worker.
+ * 
+ * The lock of the worker must be held.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ */
+void os_wake(OS_WORKER *pw);
+
+/*
+ * Acquire the process-wide lock that guards data shared between all
+ * the renders in the process, such as the built-in wave tables.
+ * 
+ * The lock is not recursive.  It should only be held for short periods,
+ * and no other lock should be acquired while it is held.  On platforms
+ * without threads, this call does nothing.
+ */
+void os_global_lock(void);
+
+/*
+ * Release the lock acquired with os_global_lock().
+ */
+void os_global_unlock(void);
+
 #endif
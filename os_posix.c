@@ -9,13 +9,115 @@
  * This module is appropriate for UNIX and UNIX-like operating systems.
  * Just add os_posix.c as one of the modules during compilation and you
  * should be good to go.
+ * 
+ * The worker functions use POSIX threads, which may require compiling
+ * and linking with -pthread
  */
 
 #include "os.h"
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+/*
+ * Constants
+ * ---------
+ */
+
+/*
+ * The kinds of directory entries that os_listdir() distinguishes.
+ */
+#define OS_KIND_UNKNOWN (0)
+#define OS_KIND_FILE    (1)
+#define OS_KIND_DIR     (2)
+#define OS_KIND_OTHER   (3)
+
+/*
+ * Type declarations
+ * -----------------
+ */
+
+/*
+ * OS_WORKER structure.
+ * 
+ * Prototype given in the header.
+ */
+struct OS_WORKER_TAG {
+  
+  /*
+   * The worker thread.
+   */
+  pthread_t thread;
+  
+  /*
+   * The function the worker runs and its custom parameter.
+   */
+  os_fp_worker fp;
+  void *pCustom;
+  
+  /*
+   * The lock and condition shared with the worker.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/*
+ * Static data
+ * -----------
+ */
+
+/*
+ * The process-wide lock.
+ */
+static pthread_mutex_t m_os_global = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The counter that makes temporary file names unique within the
+ * process, and the lock that protects it.
+ */
+static pthread_mutex_t m_os_temp_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long m_os_temp_count = 0;
+
+/*
+ * Local functions
+ * ---------------
+ */
+
+/* Prototypes */
+static void *os_thread(void *pArg);
+
+/*
+ * The start routine of a worker thread, which runs the function that
+ * was passed to os_worker().
+ * 
+ * Parameters:
+ * 
+ *   pArg - the OS_WORKER object
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *os_thread(void *pArg) {
+  
+  OS_WORKER *pw = NULL;
+  
+  pw = (OS_WORKER *) pArg;
+  (pw->fp)(pw, pw->pCustom);
+  return NULL;
+}
 
 /*
  * Public function implementations
@@ -119,6 +221,272 @@ int os_isfile(const char *pc) {
   return status;
 }
 
+/*
+ * os_prefetch function.
+ */
+void os_prefetch(const char *pc) {
+  
+  int fd = -1;
+  
+  /* Check parameters */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Open the file and ask the kernel to start reading it */
+  fd = open(pc, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+    fd = -1;
+  }
+}
+
+/*
+ * os_mapfile function.
+ */
+const void *os_mapfile(const char *pc, size_t *plen) {
+  
+  int fd = -1;
+  struct stat st;
+  void *pm = NULL;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pc == NULL) || (plen == NULL)) {
+    abort();
+  }
+  
+  /* Reset length */
+  *plen = 0;
+  
+  /* Open the file and get its length */
+  fd = open(pc, O_RDONLY);
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0) {
+      if (S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        *plen = (size_t) st.st_size;
+      }
+    }
+  }
+  
+  /* Map the file; the mapping remains after the descriptor closes */
+  if (*plen > 0) {
+    pm = mmap(NULL, *plen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pm == MAP_FAILED) {
+      pm = NULL;
+      *plen = 0;
+    }
+  }
+  
+  /* Close the file */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  /* Return the mapping */
+  return pm;
+}
+
+/*
+ * os_unmapfile function.
+ */
+void os_unmapfile(const void *p, size_t len) {
+  if (p != NULL) {
+    if (munmap((void *) p, len) != 0) {
+      abort();
+    }
+  }
+}
+
+/*
+ * os_tempfile function.
+ */
+FILE *os_tempfile(const char *pc, char **ppTemp) {
+  
+  int fd = -1;
+  int tries = 0;
+  unsigned long count = 0;
+  size_t blen = 0;
+  char *pbuf = NULL;
+  FILE *pf = NULL;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (ppTemp == NULL)) {
+    abort();
+  }
+  
+  /* Reset result */
+  *ppTemp = NULL;
+  
+  /* Allocate room for the path, the process ID, the counter, and the
+   * punctuation */
+  blen = strlen(pc) + 64;
+  pbuf = (char *) malloc(blen);
+  if (pbuf == NULL) {
+    abort();
+  }
+  
+  /* Try a few names, in case a file left behind by an earlier process
+   * with the same ID is in the way */
+  for(tries = 0; tries < 16; tries++) {
+    if (pthread_mutex_lock(&m_os_temp_lock)) {
+      abort();
+    }
+    count = m_os_temp_count;
+    m_os_temp_count++;
+    if (pthread_mutex_unlock(&m_os_temp_lock)) {
+      abort();
+    }
+    
+    snprintf(pbuf, blen, "%s.%ld-%lu.tmp",
+              pc, (long) getpid(), count);
+    
+    fd = open(pbuf, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if ((fd >= 0) || (errno != EEXIST)) {
+      break;
+    }
+  }
+  
+  /* Wrap the descriptor in a stream */
+  if (fd >= 0) {
+    pf = fdopen(fd, "wb");
+    if (pf == NULL) {
+      close(fd);
+      remove(pbuf);
+    }
+    fd = -1;
+  }
+  
+  /* Return the path, or release it on failure */
+  if (pf != NULL) {
+    *ppTemp = pbuf;
+  } else {
+    free(pbuf);
+  }
+  pbuf = NULL;
+  
+  /* Return the stream or NULL */
+  return pf;
+}
+
+/*
+ * os_listdir function.
+ */
+int os_listdir(const char *pc, os_fp_entry fp, void *pCustom) {
+  
+  int status = 1;
+  int kind = 0;
+  DIR *pd = NULL;
+  struct dirent *pe = NULL;
+  struct stat st;
+  char *pbuf = NULL;
+  size_t slen = 0;
+  size_t nlen = 0;
+  size_t blen = 0;
+  
+  /* Initialize structures */
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pc == NULL) || (fp == NULL)) {
+    abort();
+  }
+  
+  /* Check for trailing separator */
+  slen = strlen(pc);
+  if (slen > 0) {
+    if (os_issep(pc[slen - 1])) {
+      abort();
+    }
+  }
+  
+  /* Open the directory */
+  pd = opendir(pc);
+  if (pd == NULL) {
+    status = 0;
+  }
+  
+  /* Go through each entry */
+  if (status) {
+    for(pe = readdir(pd); pe != NULL; pe = readdir(pd)) {
+      
+      /* Skip the "." and ".." entries */
+      if ((strcmp(pe->d_name, ".") == 0) ||
+          (strcmp(pe->d_name, "..") == 0)) {
+        nlen = 0;
+      } else {
+        nlen = strlen(pe->d_name);
+      }
+      
+      /* Make sure buffer is large enough for full path of entry */
+      if ((nlen > 0) && (slen + nlen + 2 > blen)) {
+        if (pbuf != NULL) {
+          free(pbuf);
+          pbuf = NULL;
+        }
+        blen = slen + nlen + 2;
+        pbuf = (char *) malloc(blen);
+        if (pbuf == NULL) {
+          abort();
+        }
+      }
+      
+      /* Get the kind of entry from the directory entry itself where
+       * the platform provides it; only symbolic links and entries of
+       * unknown kind need to be queried */
+      kind = OS_KIND_UNKNOWN;
+#ifdef DT_UNKNOWN
+      if (pe->d_type == DT_REG) {
+        kind = OS_KIND_FILE;
+      } else if (pe->d_type == DT_DIR) {
+        kind = OS_KIND_DIR;
+      } else if ((pe->d_type != DT_UNKNOWN) && (pe->d_type != DT_LNK)) {
+        kind = OS_KIND_OTHER;
+      }
+#endif
+      
+      if ((nlen > 0) && (kind == OS_KIND_UNKNOWN)) {
+        strcpy(pbuf, pc);
+        strcat(pbuf, "/");
+        strcat(pbuf, pe->d_name);
+        
+        kind = OS_KIND_OTHER;
+        if (stat(pbuf, &st) == 0) {
+          if (S_ISREG(st.st_mode)) {
+            kind = OS_KIND_FILE;
+          } else if (S_ISDIR(st.st_mode)) {
+            kind = OS_KIND_DIR;
+          }
+        }
+      }
+      
+      /* Report the entry if it is a regular file or a directory */
+      if ((nlen > 0) && (kind == OS_KIND_FILE)) {
+        fp(pCustom, pe->d_name, 0);
+      } else if ((nlen > 0) && (kind == OS_KIND_DIR)) {
+        fp(pCustom, pe->d_name, 1);
+      }
+    }
+  }
+  
+  /* Close the directory and release buffer */
+  if (pd != NULL) {
+    closedir(pd);
+    pd = NULL;
+  }
+  if (pbuf != NULL) {
+    free(pbuf);
+    pbuf = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
 /*
  * os_gethome function.
  */
@@ -154,3 +522,289 @@ char *os_gethome(void) {
   /* Return result or NULL */
   return pcopy;
 }
+
+/*
+ * os_serve function.
+ */
+int os_serve(
+    const char    * pc,
+          int32_t   jobs,
+          os_fp_job fp,
+          void    * pCustom) {
+  
+  int status = 1;
+  int fd = -1;
+  int cd = -1;
+  int32_t running = 0;
+  pid_t pid = 0;
+  mode_t mask = 0;
+  struct sockaddr_un addr;
+  struct stat st;
+  
+  /* Initialize structures */
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check parameters */
+  if ((pc == NULL) || (jobs < 1) || (fp == NULL)) {
+    abort();
+  }
+  
+  /* Make sure the path fits in a socket address */
+  if (strlen(pc) >= sizeof(addr.sun_path)) {
+    status = 0;
+  }
+  
+  /* Remove any socket left over at the path, but nothing else */
+  if (status) {
+    if (lstat(pc, &st) == 0) {
+      if (S_ISSOCK(st.st_mode)) {
+        if (unlink(pc)) {
+          status = 0;
+        }
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Create the socket and start listening */
+  if (status) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      status = 0;
+    }
+  }
+  if (status) {
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, pc);
+    
+    /* The socket file is created by bind() with the permissions that
+     * the file mode mask allows, so mask out everything but read and
+     * write for the user while binding, so that there is never a moment
+     * when anyone else could connect */
+    mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    if (bind(
+          fd,
+          (struct sockaddr *) &addr,
+          sizeof(struct sockaddr_un))) {
+      status = 0;
+    }
+    umask(mask);
+  }
+  if (status) {
+    if (listen(fd, 16)) {
+      status = 0;
+    }
+  }
+  
+  /* Accept jobs until something goes wrong */
+  while (status) {
+    
+    /* Wait for a job to finish if too many are running */
+    while (running >= jobs) {
+      if (waitpid(-1, NULL, 0) > 0) {
+        running--;
+      } else if (errno != EINTR) {
+        running = 0;
+      }
+    }
+    
+    /* Accept the next connection */
+    cd = accept(fd, NULL, NULL);
+    if ((cd < 0) && (errno != EINTR) && (errno != ECONNABORTED)) {
+      status = 0;
+    }
+    
+    /* Collect any jobs that have finished */
+    while ((running > 0) && (waitpid(-1, NULL, WNOHANG) > 0)) {
+      running--;
+    }
+    
+    /* Run the job in a new process connected to the client */
+    if (cd >= 0) {
+      fflush(stdout);
+      fflush(stderr);
+      pid = fork();
+      if (pid == 0) {
+        close(fd);
+        if ((dup2(cd, STDIN_FILENO) < 0) ||
+            (dup2(cd, STDOUT_FILENO) < 0) ||
+            (dup2(cd, STDERR_FILENO) < 0)) {
+          _exit(1);
+        }
+        close(cd);
+        
+        if (fp(pCustom)) {
+          fflush(stdout);
+          fflush(stderr);
+          _exit(0);
+        } else {
+          fflush(stdout);
+          fflush(stderr);
+          _exit(1);
+        }
+        
+      } else if (pid > 0) {
+        running++;
+        
+      } else {
+        /* The job couldn't be started, so tell the client before
+         * closing the connection */
+        if (write(cd, "ERROR\n", 6) != 6) {
+          /* Nothing more can be done for this client */
+        }
+      }
+      
+      close(cd);
+      cd = -1;
+    }
+  }
+  
+  /* Close the socket */
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  
+  /* Only returns on failure */
+  return 0;
+}
+
+/*
+ * os_worker function.
+ */
+OS_WORKER *os_worker(os_fp_worker fp, void *pCustom) {
+  
+  int status = 1;
+  int has_lock = 0;
+  int has_cond = 0;
+  OS_WORKER *pw = NULL;
+  
+  /* Check parameters */
+  if (fp == NULL) {
+    abort();
+  }
+  
+  /* Allocate the worker */
+  pw = (OS_WORKER *) malloc(sizeof(OS_WORKER));
+  if (pw == NULL) {
+    abort();
+  }
+  memset(pw, 0, sizeof(OS_WORKER));
+  
+  pw->fp = fp;
+  pw->pCustom = pCustom;
+  
+  /* Create the lock and condition */
+  if (pthread_mutex_init(&(pw->lock), NULL)) {
+    status = 0;
+  } else {
+    has_lock = 1;
+  }
+  
+  if (status) {
+    if (pthread_cond_init(&(pw->cond), NULL)) {
+      status = 0;
+    } else {
+      has_cond = 1;
+    }
+  }
+  
+  /* Start the thread */
+  if (status) {
+    if (pthread_create(&(pw->thread), NULL, &os_thread, pw)) {
+      status = 0;
+    }
+  }
+  
+  /* Release the worker if it couldn't be started */
+  if (!status) {
+    if (has_cond) {
+      pthread_cond_destroy(&(pw->cond));
+    }
+    if (has_lock) {
+      pthread_mutex_destroy(&(pw->lock));
+    }
+    free(pw);
+    pw = NULL;
+  }
+  
+  /* Return the worker or NULL */
+  return pw;
+}
+
+/*
+ * os_join function.
+ */
+void os_join(OS_WORKER *pw) {
+  
+  /* Check parameter */
+  if (pw == NULL) {
+    abort();
+  }
+  
+  /* Wait for the thread */
+  if (pthread_join(pw->thread, NULL)) {
+    abort();
+  }
+  
+  /* Release the worker */
+  pthread_cond_destroy(&(pw->cond));
+  pthread_mutex_destroy(&(pw->lock));
+  free(pw);
+}
+
+/*
+ * os_lock function.
+ */
+void os_lock(OS_WORKER *pw) {
+  if (pthread_mutex_lock(&(pw->lock))) {
+    abort();
+  }
+}
+
+/*
+ * os_unlock function.
+ */
+void os_unlock(OS_WORKER *pw) {
+  if (pthread_mutex_unlock(&(pw->lock))) {
+    abort();
+  }
+}
+
+/*
+ * os_wait function.
+ */
+void os_wait(OS_WORKER *pw) {
+  if (pthread_cond_wait(&(pw->cond), &(pw->lock))) {
+    abort();
+  }
+}
+
+/*
+ * os_wake function.
+ */
+void os_wake(OS_WORKER *pw) {
+  if (pthread_cond_broadcast(&(pw->cond))) {
+    abort();
+  }
+}
+
+/*
+ * os_global_lock function.
+ */
+void os_global_lock(void) {
+  if (pthread_mutex_lock(&m_os_global)) {
+    abort();
+  }
+}
+
+/*
+ * os_global_unlock function.
+ */
+void os_global_unlock(void) {
+  if (pthread_mutex_unlock(&m_os_global)) {
+    abort();
+  }
+}
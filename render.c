@@ -0,0 +1,73 @@
+/*
+ * render.c
+ * 
+ * Implementation of render.h
+ */
+
+#include "render.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * render_alloc function.
+ */
+RENDER *render_alloc(void) {
+  
+  RENDER *pr = NULL;
+  
+  /* Build the shared tables before any render reads them */
+  generator_tables();
+  
+  /* Allocate the render context */
+  pr = (RENDER *) malloc(sizeof(RENDER));
+  if (pr == NULL) {
+    abort();
+  }
+  memset(pr, 0, sizeof(RENDER));
+  
+  /* Allocate the contexts and bind them together */
+  pr->pSqwave = sqwave_alloc();
+  pr->pInstr = instr_alloc(pr->pSqwave);
+  pr->pLayer = layer_alloc();
+  pr->pSeq = seq_alloc(pr->pInstr, pr->pLayer);
+  
+  /* Return the new render context */
+  return pr;
+}
+
+/*
+ * render_free function.
+ */
+void render_free(RENDER *pr) {
+  
+  /* Only proceed if not NULL */
+  if (pr != NULL) {
+    
+    /* Release the sequencer first, which stops any worker thread */
+    seq_free(pr->pSeq);
+    pr->pSeq = NULL;
+    
+    /* Release the contexts the sequencer was bound to */
+    instr_free(pr->pInstr);
+    pr->pInstr = NULL;
+    
+    layer_free(pr->pLayer);
+    pr->pLayer = NULL;
+    
+    sqwave_free(pr->pSqwave);
+    pr->pSqwave = NULL;
+    
+    /* Release the render context */
+    free(pr);
+  }
+}
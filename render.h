@@ -0,0 +1,104 @@
+#ifndef RENDER_H_INCLUDED
+#define RENDER_H_INCLUDED
+
+/*
+ * render.h
+ * 
+ * Render context module of the Retro synthesizer.
+ * 
+ * Render contexts
+ * ===============
+ * 
+ * All the mutable state of a render lives in context objects that are
+ * passed explicitly to the module functions:
+ * 
+ *   (1) SQWAVE_CTX holds the square wave tables
+ *   (2) INSTR_CTX holds the instrument registers and caches
+ *   (3) LAYER_CTX holds the layer registers and block state
+ *   (4) SEQ_CTX holds the notes and the sequencing state
+ * 
+ * The output objects SBUF and WAVWRITE are also separate objects.  A
+ * RENDER object bundles the four contexts of one render, bound
+ * together so that the sequencer performs with the instruments and
+ * layers of the same render.
+ * 
+ * A single render context must only be used by one thread at a time,
+ * except for the worker thread that the sequencer starts itself in
+ * pipelined mode.  Different render contexts share no mutable state,
+ * so they may run at the same time in different threads.
+ * 
+ * The only state shared between render contexts are the lookup tables
+ * of the generator and wave table modules.  These are built once while
+ * holding os_global_lock() and never change afterwards, so renders only
+ * ever read them.  render_alloc() builds the generator tables up front.
+ */
+
+#include "retrodef.h"
+#include "instr.h"
+#include "layer.h"
+#include "seq.h"
+#include "sqwave.h"
+
+/*
+ * The render context structure.
+ * 
+ * Use render_alloc() to create one and render_free() to release it.
+ */
+typedef struct {
+  
+  /*
+   * The square wave context.
+   * 
+   * This must be initialized with sqwave_init() before square wave
+   * instruments are rendered.
+   */
+  SQWAVE_CTX *pSqwave;
+  
+  /*
+   * The instrument context, bound to the square wave context.
+   */
+  INSTR_CTX *pInstr;
+  
+  /*
+   * The layer context.
+   */
+  LAYER_CTX *pLayer;
+  
+  /*
+   * The sequencer context, bound to the instrument and layer contexts.
+   * 
+   * A sample buffer must still be bound with seq_output().
+   */
+  SEQ_CTX *pSeq;
+  
+} RENDER;
+
+/*
+ * Allocate a new render context.
+ * 
+ * The shared generator tables are built if they haven't been built
+ * yet, and then a new square wave, instrument, layer, and sequencer
+ * context are allocated and bound together.  Release the render context
+ * with render_free().
+ * 
+ * Return:
+ * 
+ *   the new render context
+ */
+RENDER *render_alloc(void);
+
+/*
+ * Release a render context.
+ * 
+ * All four contexts are released, the sequencer context first so that
+ * any worker thread is stopped before the other contexts go away.  Any
+ * sample buffer bound to the sequencer is not released.  If NULL is
+ * passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pr - the render context, or NULL
+ */
+void render_free(RENDER *pr);
+
+#endif
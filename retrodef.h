@@ -21,4 +21,22 @@
 #define RATE_CD  (44100)  /* 44,100 Hz (Audio CDs) */
 #define RATE_DVD (48000)  /* 48,000 Hz (DVDs) */
 
+/*
+ * The greatest sample time on the timeline.
+ * 
+ * Sample times and durations are 64-bit signed integers, but they are
+ * limited to this value, which is about 370 years at 48,000 Hz.  The
+ * limit leaves enough headroom that the sum of two times, or the
+ * product of a time with a value in range [-MAX_FRAC, MAX_FRAC], never
+ * overflows.
+ */
+#define MAX_TIME (INT64_C(0x1ffffffffffff))
+
+/*
+ * The maximum control period in samples.
+ * 
+ * See instr_control() and layer_control().
+ */
+#define CONTROL_MAX (256)
+
 #endif
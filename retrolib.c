@@ -0,0 +1,4138 @@
+/*
+ * retrolib.c
+ * 
+ * Implementation of retrolib.h
+ */
+
+#include "retrolib.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adsr.h"
+#include "generator.h"
+#include "genmap.h"
+#include "graph.h"
+#include "instr.h"
+#include "layer.h"
+#include "os.h"
+#include "sbuf.h"
+#include "seq.h"
+#include "sqwave.h"
+#include "stereo.h"
+#include "ttone.h"
+#include "wavetbl.h"
+#include "wavwrite.h"
+
+/*
+ * Error codes
+ * ===========
+ * 
+ * Remember to update retrolib_errstr!
+ */
+
+#define ERR_OK      (0)   /* No error */
+#define ERR_ENTITY  (1)   /* Unsupported Shastina entity type */
+#define ERR_METAMID (2)   /* Metacommand after header */
+#define ERR_NORATE  (3)   /* Sampling rate not defined in header */
+#define ERR_NOAMP   (4)   /* Output amplitude not in header */
+#define ERR_NOSIG   (5)   /* Missing file type signature */
+#define ERR_BADMETA (6)   /* Unknown metacommand */
+#define ERR_MPARAMC (7)   /* Too many metacommand parameters */
+#define ERR_METAINT (8)   /* Can't parse metacommand integer */
+#define ERR_METAPRM (9)   /* Wrong number of metacommand parameters */
+#define ERR_EMPTYMT (10)  /* Empty metacommand */
+#define ERR_METAMUL (11)  /* Metacommand used multiple times */
+#define ERR_BADRATE (12)  /* Invalid sampling rate */
+#define ERR_BADAMP  (13)  /* Invalid output amplitude */
+#define ERR_BADFRM  (14)  /* Invalid frame definition */
+#define ERR_EMPTY   (15)  /* Nothing after header */
+#define ERR_NUM     (16)  /* Can't parse numeric entity */
+#define ERR_OVERFLW (17)  /* Stack overflow */
+#define ERR_GROUP   (18)  /* Group closed improperly */
+#define ERR_BADOP   (19)  /* Unrecognized operation */
+#define ERR_OPPARAM (20)  /* Operation doesn't have enough parameters */
+#define ERR_PARAMT  (21)  /* Wrong parameter type */
+#define ERR_LAYERC  (22)  /* Invalid layer count */
+#define ERR_BADT    (23)  /* t value is negative or too large */
+#define ERR_BADFRAC (24)  /* Invalid fraction value */
+#define ERR_REMAIN  (25)  /* Elements remain on stack at end */
+#define ERR_BADDUR  (26)  /* Duration is less than one */
+#define ERR_LONGDUR (27)  /* Duration is too long */
+#define ERR_PITCH   (28)  /* Pitch out of range */
+#define ERR_INSTR   (29)  /* Instrument index out of range */
+#define ERR_LAYER   (30)  /* Layer index out of range */
+#define ERR_NOTES   (31)  /* Too many notes */
+#define ERR_PITCHR  (32)  /* Invalid pitch range */
+#define ERR_IRANGE  (33)  /* Invalid intensity range */
+#define ERR_GRAPH   (34)  /* Invalid graph */
+#define ERR_OUTFILE (35)  /* Can't open output file */
+#define ERR_STRPFXN (36)  /* Can't parse numeric string prefix */
+#define ERR_BADCUT  (37)  /* Invalid cutoff threshold */
+#define ERR_COMPILE (38)  /* Can't write compiled score */
+#define ERR_SCORE   (39)  /* Can't read compiled score */
+#define ERR_ORDER   (40)  /* Note out of order in streaming mode */
+#define ERR_STREAMR (41)  /* Register changed in streaming mode */
+#define ERR_STREAMC (42)  /* Can't compile streaming score */
+#define ERR_BIGINT  (43)  /* Integer parameter out of range */
+
+#define ERR_SN_MIN  (500) /* Mininum error code used for Shastina */
+#define ERR_SN_MAX  (600) /* Maximum error code used for Shastina */
+
+#define ERR_GENMAP_MIN  (800)   /* Minimum error code for genmap */
+#define ERR_GENMAP_MAX  (899)   /* Maximum error code for genmap */
+
+#define ERR_INSTR_MIN   (900)   /* Minimum error code for instr */
+#define ERR_INSTR_MAX   (999)   /* Maximum error code for instr */
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The amplitude to use to initialize the square wave module.
+ */
+#define SQWAVE_AMP_INIT (20000.0)
+
+/*
+ * Maximum number of metacommand parameters.
+ */
+#define META_MAXPARAM (8)
+
+/*
+ * Metacommand codes.
+ */
+#define METACMD_NONE        (0)   /* No metacommand recorded yet */
+#define METACMD_SIGNATURE   (1)   /* File signature "retro-synth" */
+#define METACMD_RATE        (2)   /* Sampling rate "rate" */
+#define METACMD_SQAMP       (3)   /* Output amplitude "sqamp" */
+#define METACMD_NOSTEREO    (4)   /* No stereo "nostereo" */
+#define METACMD_FRAME       (5)   /* Frame definition "frame" */
+#define METACMD_CUTOFF      (6)   /* Cutoff threshold "cutoff" */
+#define METACMD_STREAM      (7)   /* Streaming mode "stream" */
+
+/*
+ * The maximum number of entries on the interpreter stack.
+ */
+#define MAX_STACK (4096)
+
+/*
+ * The maximum number of nested groups.
+ */
+#define MAX_GROUP (1024)
+
+/*
+ * Opcodes.
+ */
+#define OPCODE_NONE   (0)   /* invalid opcode */
+#define OPCODE_LC     (1)   /* lc */
+#define OPCODE_LR     (2)   /* lr */
+#define OPCODE_LAYER  (3)   /* layer */
+#define OPCODE_DERIVE (4)   /* derive_layer */
+#define OPCODE_INSTR  (5)   /* instr */
+#define OPCODE_IDUP   (6)   /* instr_dup */
+#define OPCODE_MAXMIN (7)   /* instr_maxmin */
+#define OPCODE_FIELD  (8)   /* instr_field */
+#define OPCODE_STEREO (9)   /* instr_stereo */
+#define OPCODE_NOTE   (10)  /* n */
+
+/*
+ * Parameter types.
+ */
+#define PTYPE_INT (0)   /* Integer/numeric */
+#define PTYPE_LC  (1)   /* lc constant graph node */
+#define PTYPE_LR  (2)   /* lr ramp graph node */
+
+/*
+ * The signature, format version, and byte order check value at the
+ * start of compiled score files.
+ * 
+ * The version must be changed whenever the format of the file or of
+ * any of the sections written by other modules changes.
+ */
+#define SCORE_MAGIC "RSCORE"
+#define SCORE_VERSION (2)
+#define SCORE_ORDER (UINT32_C(0x01020304))
+
+/*
+ * The alignment in bytes of the note table within a compiled score
+ * file.
+ */
+#define SCORE_ALIGN (16)
+
+/*
+ * The states of pulling samples from a library context.
+ */
+#define PULL_NONE  (0)  /* No script loaded for pulling */
+#define PULL_READY (1)  /* Script loaded, nothing pulled yet */
+#define PULL_MUSIC (2)  /* The music is not finished yet */
+#define PULL_DONE  (3)  /* The music is finished */
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The structure used on the interpreter stack.
+ */
+typedef struct {
+  
+  /*
+   * For numeric entries, this is the integer value.  Numeric entries
+   * are 64-bit so that they can hold any sample time, but only time
+   * offsets and durations may be outside of 32-bit range.
+   * 
+   * For graph nodes, this is the t offset, in range [0, MAX_TIME].
+   */
+  int64_t val;
+  
+  /*
+   * For numeric entries, this is set to -1.
+   * 
+   * For constant graph nodes, this is the value, in [0, MAX_FRAC].
+   * 
+   * For ramp graph nodes, this is the beginning value of the ramp, in
+   * range [0, MAX_FRAC].
+   */
+  int16_t ra;
+  
+  /*
+   * For numeric entries, this is set to -1.
+   * 
+   * For constant graph nodes, this is set to -1.
+   * 
+   * For ramp graph nodes, this is the end value of the ramp, in range
+   * [0, MAX_FRAC].
+   */
+  int16_t rb;
+  
+} STACK_REC;
+
+/*
+ * The header at the start of a compiled score file.
+ * 
+ * The header is followed by the instrument registers written by
+ * instr_save() and the layer registers written by layer_save().  The
+ * note table written by seq_save() begins at note_offset and runs to
+ * the end of the file, so that it can be loaded straight out of a
+ * memory-mapped file.
+ * 
+ * All values are in the native byte order of the machine that compiled
+ * the score, which is checked with the order field.
+ */
+typedef struct {
+  
+  /*
+   * SCORE_MAGIC, padded with nul bytes.
+   */
+  char magic[8];
+  
+  /*
+   * SCORE_VERSION and SCORE_ORDER.
+   */
+  int32_t version;
+  uint32_t order;
+  
+  /*
+   * The header configuration passed to header_config().
+   */
+  int32_t rate;
+  int32_t sqamp;
+  int32_t nostereo;
+  int32_t frame_before;
+  int32_t frame_after;
+  int32_t cutoff;
+  
+  /*
+   * Non-zero if the square wave module needs to be initialized.
+   */
+  int32_t use_sqwave;
+  
+  /*
+   * The offset in bytes of the note table from the start of the file,
+   * which is a multiple of SCORE_ALIGN.
+   */
+  int64_t note_offset;
+  
+} SCORE_HEAD;
+
+/*
+ * RETROLIB structure.
+ * 
+ * Prototype given in the header.
+ */
+struct RETROLIB_TAG {
+  
+  /*
+   * The render context that the script is interpreted into.
+   */
+  RENDER *pRender;
+  
+  /*
+   * The name to prefix to diagnostic reports, or NULL if diagnostics
+   * are not reported.
+   * 
+   * Set with retrolib_report().
+   */
+  const char *pModule;
+  
+  /*
+   * Non-zero once the context has been used to interpret a script or
+   * to play a compiled score, since each context may only be used for
+   * one of these, once.
+   */
+  int used;
+  
+  /*
+   * The WAV writer and sample buffer objects while synthesis to a file
+   * is open, or NULL if not open.
+   */
+  WAVWRITE *pWav;
+  SBUF *pBuf;
+  
+  /*
+   * Flag that is set on any call to the "instr" to indicate that the
+   * square wave module will need to be initialized.
+   */
+  int use_sqwave;
+  
+  /*
+   * Flag indicating whether the context has been initialized with the
+   * header_config() function.
+   */
+  int init;
+  
+  /*
+   * The sampling rate, in hertz.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t rate;
+  
+  /*
+   * The amplitude of the output.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t sqamp;
+  
+  /*
+   * Flag that is non-zero to have single-channel output.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int nostereo;
+  
+  /*
+   * The number of samples of silence before synthesis starts.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t frame_before;
+  
+  /*
+   * The number of samples of silence after synthesis ends.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t frame_after;
+  
+  /*
+   * The cutoff threshold for early voice termination.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t cutoff;
+  
+  /*
+   * Flag that is non-zero for streaming mode, in which notes are
+   * sequenced as they are read.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int stream;
+  
+  /*
+   * In streaming mode, stream_notes is set once the first note has been
+   * read, after which instruments and layers may no longer change.
+   * stream_t is the time offset of the last note that was read.
+   */
+  int stream_notes;
+  int64_t stream_t;
+  
+  /*
+   * Flag that is set when synth_begin() has opened the output in
+   * streaming mode, so synth_end() must be called.
+   */
+  int synth_open;
+  
+  /*
+   * The number of groups open on the group stack.
+   * 
+   * Only valid if init is non-zero.
+   */
+  int32_t group_count;
+  
+  /*
+   * The group stack.
+   * 
+   * Only valid if init is non-zero.
+   * 
+   * group_count indicates how many entries are on this stack.
+   * 
+   * Each entry is a count of the number of elements that were on the
+   * full stack when the group was opened.
+   */
+  int32_t group_stack[MAX_GROUP];
+  
+  /*
+   * The number of elements on the interpreter stack.
+   * 
+   * Only valid if init is non-zero.
+   * 
+   * This counts the number of elements on the full stack, regardless of
+   * what groups might be open.
+   */
+  int32_t stack_count;
+  
+  /*
+   * The interpreter stack.
+   * 
+   * Only valid if init is non-zero.
+   * 
+   * stack_count indicates how many elements are used on the stack.
+   */
+  STACK_REC stack[MAX_STACK];
+  
+  /*
+   * The state of pulling samples with retrolib_pull16() and
+   * retrolib_pullf().
+   * 
+   * pull is one of the PULL constants.  before and after are the
+   * number of silent frames still to output before and after the
+   * music.  level is the mix level that is output at the amplitude of
+   * the header, set with retrolib_level().
+   */
+  int pull;
+  int32_t before;
+  int32_t after;
+  int32_t level;
+};
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static void synth_prepare(RETROLIB *pr);
+static void synth_cull(RETROLIB *pr);
+static int synth_begin(RETROLIB *pr, const char *pOutPath);
+static void synth_end(RETROLIB *pr, int ok);
+static int synthesize(RETROLIB *pr, const char *pOutPath);
+static int compile_score(RETROLIB *pr, const char *pOutPath);
+
+static int op_lc(int64_t t, int32_t r, int *per, STACK_REC *psr);
+static int op_lr(
+    int64_t     t,
+    int32_t     ra,
+    int32_t     rb,
+    int       * per,
+    STACK_REC * psr);
+static int op_layer(
+          RETROLIB  * pr,
+          int32_t     lid,
+          int32_t     m,
+          int32_t     c,
+    const STACK_REC * psa,
+          int       * per);
+static int op_derive(
+    RETROLIB * pr,
+    int32_t    lid,
+    int32_t    src,
+    int32_t    m,
+    int      * per);
+static int op_instr(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    i_max,
+    int32_t    i_min,
+    int32_t    attack,
+    int32_t    decay,
+    int32_t    sustain,
+    int32_t    release,
+    int      * per);
+static int op_idup(RETROLIB *pr, int32_t iid, int32_t src, int *per);
+static int op_maxmin(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    i_max,
+    int32_t    i_min,
+    int      * per);
+static int op_field(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    low_pos,
+    int32_t    low_pitch,
+    int32_t    high_pos,
+    int32_t    high_pitch,
+    int      * per);
+static int op_stereo(RETROLIB *pr, int32_t iid, int32_t pos, int *per);
+static int op_note(
+    RETROLIB * pr,
+    int64_t    t,
+    int64_t    dur,
+    int32_t    pitch,
+    int32_t    iid,
+    int32_t    lid,
+    int      * per);
+
+static int32_t stack_height(RETROLIB *pr);
+static int stack_type(RETROLIB *pr, int32_t i);
+static int32_t stack_int(RETROLIB *pr, int32_t i);
+static int64_t stack_time(RETROLIB *pr, int32_t i);
+static int op(RETROLIB *pr, const char *pk, int *per);
+
+static int begin_group(RETROLIB *pr);
+static int end_group(RETROLIB *pr);
+static int push_num(RETROLIB *pr, int64_t val);
+static void header_config(
+    RETROLIB * pr,
+    int32_t    rate,
+    int32_t    sqamp,
+    int        nostereo,
+    int32_t    frame_before,
+    int32_t    frame_after,
+    int32_t    cutoff,
+    int        stream);
+static int load_pending(
+    RETROLIB *  pr,
+    int      *  per,
+    long     *  pln,
+    char     ** ppExternal);
+
+static int parseLong(const char *pstr, int64_t *pv);
+static int parseInt(const char *pstr, int32_t *pv);
+static int retro(
+          RETROLIB *  pr,
+          SNSOURCE *  pIn,
+    const char     *  pOutPath,
+          int         compile,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal);
+static int play_score(
+          RETROLIB * pr,
+    const char     * pScorePath,
+    const char     * pOutPath,
+          int      * per);
+static void pull_zero(void *pBuf, int format, int32_t i);
+static int32_t pull_frames(
+    RETROLIB * pr,
+    void     * pBuf,
+    int        format,
+    int32_t    frames);
+
+/*
+ * Prepare the render context for synthesis.
+ * 
+ * header_config() must have already been called.  This is called once
+ * before the first note is sequenced, both when synthesizing to a file
+ * and when pulling samples.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ */
+static void synth_prepare(RETROLIB *pr) {
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Initialize square wave module, but only if at least one square wave
+   * instrument was defined; in streaming mode, instruments haven't
+   * been defined yet, so always initialize it, which is cheap because
+   * the tables are only built on first use */
+  if (pr->use_sqwave || pr->stream) {
+    sqwave_init(pr->pRender->pSqwave, SQWAVE_AMP_INIT, pr->rate);
+  }
+  
+  /* Flatten stereo and only mix one channel if requested */
+  if (pr->nostereo) {
+    instr_flatten(pr->pRender->pInstr);
+    seq_mono(pr->pRender->pSeq);
+  }
+}
+
+/*
+ * Remove notes that can only produce silence before the rest of the
+ * music is sequenced.
+ * 
+ * If the context reports diagnostics, the number of notes that were
+ * removed is reported, since they usually indicate authoring mistakes.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ */
+static void synth_cull(RETROLIB *pr) {
+  
+  int32_t culled = 0;
+  
+  /* Mark the notes */
+  culled = seq_cull(pr->pRender->pSeq);
+  
+  /* Report how many there were */
+  if ((culled > 0) && (pr->pModule != NULL)) {
+    fprintf(stderr, "%s: Culled %ld silent note(s)\n",
+              pr->pModule, (long) culled);
+  }
+}
+
+/*
+ * Open the output and prepare the modules for synthesis.
+ * 
+ * header_config() must have already been called.  Outside of streaming
+ * mode, the input file should be fully interpreted before calling this
+ * function.  In streaming mode, this is called as soon as the header
+ * has been read, so that notes can be sequenced as they are read.
+ * 
+ * If successful, synth_end() must be called afterwards.  Undefined
+ * behavior occurs if this function is called more than once.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pOutPath - the output WAV file path
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if output file can't be opened
+ */
+static int synth_begin(RETROLIB *pr, const char *pOutPath) {
+  
+  int32_t scount = 0;
+  int status = 1;
+  int wavflags = 0;
+  
+  /* Check state and parameter */
+  if ((!pr->init) || (pOutPath == NULL)) {
+    abort();
+  }
+  
+  /* Set WAV initialization flags */
+  if (pr->rate == RATE_DVD) {
+    wavflags = WAVWRITE_INIT_48000;
+  
+  } else if (pr->rate == RATE_CD) {
+    wavflags = WAVWRITE_INIT_44100;
+  
+  } else {
+    /* Unrecognized rate */
+    abort();
+  }
+  if (pr->nostereo) {
+    wavflags = wavflags | WAVWRITE_INIT_MONO;
+  } else {
+    wavflags = wavflags | WAVWRITE_INIT_STEREO;
+  }
+  
+  /* Prepare the render context */
+  synth_prepare(pr);
+  
+  /* Initialize WAV writer */
+  pr->pWav = wavwrite_init(pOutPath, wavflags);
+  if (pr->pWav == NULL) {
+    status = 0;
+  }
+  
+  /* Write silence before */
+  if (status) {
+    for(scount = 0; scount < pr->frame_before; scount++) {
+      wavwrite_sample(pr->pWav, 0, 0);
+    }
+  }
+  
+  /* Initialize sample buffer, only buffering one channel if output is
+   * mono-aural, and sequence the music to it */
+  if (status) {
+    pr->pBuf = sbuf_init();
+    if (pr->nostereo) {
+      sbuf_mono(pr->pBuf);
+    }
+    seq_output(pr->pRender->pSeq, pr->pBuf);
+  }
+  
+  /* Sequence notes as they are added in streaming mode, on a worker
+   * thread so that synthesis overlaps with reading the input */
+  if (status && pr->stream) {
+    seq_stream(pr->pRender->pSeq);
+    seq_pipeline(pr->pRender->pSeq);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Finish synthesis after a successful call to synth_begin().
+ * 
+ * If ok is non-zero, the rest of the music is synthesized and the
+ * output file is completed.  If ok is zero, an error occurred while
+ * reading the input, so the output file is closed and removed.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   ok - non-zero to complete the output, zero to remove it
+ */
+static void synth_end(RETROLIB *pr, int ok) {
+  
+  int32_t scount = 0;
+  
+  /* Remove notes that can only produce silence */
+  if (ok) {
+    synth_cull(pr);
+  }
+  
+  /* Sequence the music to the sample buffer */
+  if (ok) {
+    seq_play(pr->pRender->pSeq);
+  }
+  
+  /* Stream the sample buffer to output */
+  if (ok) {
+    sbuf_stream(pr->pBuf, pr->sqamp, pr->pWav);
+  }
+  
+  /* Close down the sample buffer */
+  sbuf_close(pr->pBuf);
+  pr->pBuf = NULL;
+  
+  /* Write silence after */
+  if (ok) {
+    for(scount = 0; scount < pr->frame_after; scount++) {
+      wavwrite_sample(pr->pWav, 0, 0);
+    }
+  }
+  
+  /* Close down */
+  if (ok) {
+    wavwrite_close(pr->pWav, WAVWRITE_CLOSE_NORMAL);
+  } else {
+    wavwrite_close(pr->pWav, WAVWRITE_CLOSE_RMFILE);
+  }
+  pr->pWav = NULL;
+}
+
+/*
+ * Perform the synthesis.
+ * 
+ * header_config() must have already been called, and the input file
+ * should be fully interpreted before calling this function.  Undefined
+ * behavior occurs if this function is called more than once.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pOutPath - the output WAV file path
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if output file can't be opened
+ */
+static int synthesize(RETROLIB *pr, const char *pOutPath) {
+  
+  int status = 1;
+  
+  /* Open the output, and then synthesize everything */
+  if (synth_begin(pr, pOutPath)) {
+    synth_end(pr, 1);
+  } else {
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write the interpreted state of the synthesizer to a compiled score
+ * file instead of synthesizing it.
+ * 
+ * header_config() must have already been called, and the input file
+ * should be fully interpreted before calling this function, including
+ * loading all external instruments.  See SCORE_HEAD for the format of
+ * the file.  If the file can't be written, it is removed.
+ * 
+ * The call fails if any FM instrument uses a wave table, since those
+ * can't be saved.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pOutPath - the compiled score file path
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file couldn't be written
+ */
+static int compile_score(RETROLIB *pr, const char *pOutPath) {
+  
+  int status = 1;
+  long pos = 0;
+  FILE *pf = NULL;
+  SCORE_HEAD sh;
+  char pad[SCORE_ALIGN];
+  
+  /* Initialize structures and buffers */
+  memset(&sh, 0, sizeof(SCORE_HEAD));
+  memset(pad, 0, SCORE_ALIGN);
+  
+  /* Check state and parameter */
+  if ((!pr->init) || (pOutPath == NULL)) {
+    abort();
+  }
+  
+  /* Fill in the header, except for the note table offset */
+  strcpy(sh.magic, SCORE_MAGIC);
+  sh.version = SCORE_VERSION;
+  sh.order = SCORE_ORDER;
+  sh.rate = pr->rate;
+  sh.sqamp = pr->sqamp;
+  sh.nostereo = pr->nostereo;
+  sh.frame_before = pr->frame_before;
+  sh.frame_after = pr->frame_after;
+  sh.cutoff = pr->cutoff;
+  sh.use_sqwave = pr->use_sqwave;
+  
+  /* Open the output file */
+  pf = fopen(pOutPath, "wb");
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Reserve space for the header, then write the instrument and layer
+   * registers */
+  if (status) {
+    if (fwrite(&sh, sizeof(SCORE_HEAD), 1, pf) != 1) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!instr_save(pr->pRender->pInstr, pf)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!layer_save(pr->pRender->pLayer, pf)) {
+      status = 0;
+    }
+  }
+  
+  /* Pad to the alignment of the note table */
+  if (status) {
+    pos = ftell(pf);
+    if (pos < 0) {
+      status = 0;
+    }
+  }
+  if (status && ((pos % SCORE_ALIGN) != 0)) {
+    if (fwrite(pad, 1, (size_t) (SCORE_ALIGN - (pos % SCORE_ALIGN)), pf)
+          != (size_t) (SCORE_ALIGN - (pos % SCORE_ALIGN))) {
+      status = 0;
+    }
+    pos = pos + (SCORE_ALIGN - (pos % SCORE_ALIGN));
+  }
+  
+  /* Write the note table and then the completed header */
+  if (status) {
+    sh.note_offset = (int64_t) pos;
+    if (!seq_save(pr->pRender->pSeq, pf)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (fseek(pf, 0, SEEK_SET) != 0) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (fwrite(&sh, sizeof(SCORE_HEAD), 1, pf) != 1) {
+      status = 0;
+    }
+  }
+  
+  /* Close the file, removing it if it couldn't be written */
+  if (pf != NULL) {
+    if (fclose(pf) != 0) {
+      status = 0;
+    }
+    pf = NULL;
+    if (!status) {
+      remove(pOutPath);
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "lc" operation.
+ * 
+ * psr points to a structure to be filled in with the record to be
+ * pushed on the stack, if successful.
+ * 
+ * Parameters:
+ * 
+ *   t - the time offset
+ * 
+ *   r - the constant intensity for the graph element
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ *   psr - pointer to result variable
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_lc(int64_t t, int32_t r, int *per, STACK_REC *psr) {
+  
+  int status = 1;
+  
+  /* Check per and psr */
+  if ((per == NULL) || (psr == NULL)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((t < 0) || (t > MAX_TIME)) {
+    status = 0;
+    *per = ERR_BADT;
+  }
+  if (status) {
+    if ((r < 0) || (r > MAX_FRAC)) {
+      status = 0;
+      *per = ERR_BADFRAC;
+    }
+  }
+  
+  /* Fill in result */
+  if (status) {
+    psr->val = t;
+    psr->ra = (int16_t) r;
+    psr->rb = -1;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "lr" operation.
+ * 
+ * psr points to a structure to be filled in with the record to be
+ * pushed on the stack, if successful.
+ * 
+ * If ra and rb are equal, this has the effect of an lc operation.
+ * 
+ * Parameters:
+ * 
+ *   t - the time offset
+ * 
+ *   ra - the beginning intensity for the graph element
+ * 
+ *   rb - the ending intensity for the graph element
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ *   psr - pointer to result variable
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_lr(
+    int64_t     t,
+    int32_t     ra,
+    int32_t     rb,
+    int       * per,
+    STACK_REC * psr) {
+  
+  int status = 1;
+  
+  /* Check per and psr */
+  if ((per == NULL) || (psr == NULL)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((t < 0) || (t > MAX_TIME)) {
+    status = 0;
+    *per = ERR_BADT;
+  }
+  if (status) {
+    if ((ra < 0) || (ra > MAX_FRAC)) {
+      status = 0;
+      *per = ERR_BADFRAC;
+    }
+  }
+  if (status) {
+    if ((rb < 0) || (rb > MAX_FRAC)) {
+      status = 0;
+      *per = ERR_BADFRAC;
+    }
+  }
+  
+  /* Fill in result */
+  if (status) {
+    if (ra != rb) {
+      psr->val = t;
+      psr->ra = (int16_t) ra;
+      psr->rb = (int16_t) rb;
+    } else {
+      psr->val = t;
+      psr->ra = (int16_t) ra;
+      psr->rb = -1;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "layer" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   lid - the layer ID
+ * 
+ *   m - the multiplier
+ * 
+ *   c - the number of graph elements
+ * 
+ *   psa - pointer to the graph elements array
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_layer(
+          RETROLIB  * pr,
+          int32_t     lid,
+          int32_t     m,
+          int32_t     c,
+    const STACK_REC * psa,
+          int       * per) {
+  
+  int status = 1;
+  int32_t x = 0;
+  GRAPH_OBJ *pg = NULL;
+  
+  /* Check per and psa and state and c */
+  if ((per == NULL) || (!pr->init) || (psa == NULL) ||
+      (c < 1) || (c > GRAPH_MAXCOUNT)) {
+    abort();
+  }
+  
+  /* Range-check lid and m */
+  if ((lid < 1) || (lid > LAYER_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_LAYER;
+  }
+  if (status && ((m < 0) || (m > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  
+  /* Verify that the graph element sequence is valid */
+  if (status) {
+    for(x = 0; x < c; x++) {
+      
+      /* Check that element is a graph element */
+      if ((psa[x]).ra < 0) {
+        abort();  /* shouldn't happen -- should already be checked */
+      }
+      
+      /* If this is first element, time offset must be zero */
+      if (x < 1) {
+        if ((psa[x]).val != 0) {
+          status = 0;
+          *per = ERR_GRAPH;
+        }
+      }
+      
+      /* If this is the last element, it must be a constant */
+      if (status && (x >= c - 1)) {
+        if ((psa[x]).rb >= 0) {
+          status = 0;
+          *per = ERR_GRAPH;
+        }
+      }
+      
+      /* If this is not the first element, its time offset must be
+       * greater than the previous */
+      if (status && (x > 0)) {
+        if ((psa[x]).val <= (psa[x - 1]).val) {
+          status = 0;
+          *per = ERR_GRAPH;
+        }
+      }
+      
+      /* Range-check ra and rb */
+      if (status) {
+        if (((psa[x]).ra < 0) || ((psa[x]).ra > MAX_FRAC)) {
+          abort();
+        }
+        if (((psa[x]).rb < -1) || ((psa[x]).rb > MAX_FRAC)) {
+          abort();
+        }
+      }
+      
+      /* Leave loop if error */
+      if (!status) {
+        break;
+      }
+    }
+  }
+  
+  /* Call through */
+  if (status) {
+    pg = graph_alloc(c);
+    for(x = 0; x < c; x++) {
+      graph_set(pg, x, (psa[x]).val, (psa[x]).ra, (psa[x]).rb);
+    }
+    layer_define(
+      pr->pRender->pLayer, lid - 1, ((double) m) / 1024.0, pg);
+  }
+  
+  /* Release graph object if necessary */
+  graph_release(pg);
+  pg = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "layer_derive" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   lid - the target layer ID
+ * 
+ *   src - the source layer ID
+ * 
+ *   m - the multiplier
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_derive(
+    RETROLIB * pr,
+    int32_t    lid,
+    int32_t    src,
+    int32_t    m,
+    int      * per) {
+  
+  int status = 1;
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((lid < 1) || (lid > LAYER_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_LAYER;
+  }
+  if (status && ((src < 1) || (src > LAYER_MAXCOUNT))) {
+    status = 0;
+    *per = ERR_LAYER;
+  }
+  if (status && ((m < 0) || (m > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  
+  /* Call through */
+  if (status) {
+    layer_derive(pr->pRender->pLayer,
+                  lid - 1, src - 1, ((double) m) / 1024.0);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of "instr" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   iid - the instrument ID
+ * 
+ *   i_max - the maximum intensity
+ * 
+ *   i_min - the minimum intensity
+ * 
+ *   attack - the attack duration
+ * 
+ *   decay - the decay duration
+ * 
+ *   sustain - the sustain level
+ * 
+ *   release - the release duration
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_instr(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    i_max,
+    int32_t    i_min,
+    int32_t    attack,
+    int32_t    decay,
+    int32_t    sustain,
+    int32_t    release,
+    int      * per) {
+  
+  int status = 1;
+  STEREO_POS sp;
+  ADSR_OBJ *pa = NULL;
+  
+  /* Initialize structures */
+  memset(&sp, 0, sizeof(STEREO_POS));
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((iid < 1) || (iid > INSTR_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((i_max < 0) || (i_max > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && ((i_min < 0) || (i_min > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && (i_min > i_max)) {
+    status = 0;
+    *per = ERR_IRANGE;
+  }
+  if (status && ((sustain < 0) || (sustain > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && (attack < 0)) {
+    status = 0;
+    *per = ERR_BADDUR;
+  }
+  if (status && (decay < 0)) {
+    status = 0;
+    *per = ERR_BADDUR;
+  }
+  if (status && (release < 0)) {
+    status = 0;
+    *per = ERR_BADDUR;
+  }
+  
+  /* Set the square wave flag so that the square wave module will be
+   * initialized */
+  if (status) {
+    pr->use_sqwave = 1;
+  }
+  
+  /* Call through */
+  if (status) {
+    pa = adsr_alloc(
+            (double) attack,
+            (double) decay,
+            ((double) sustain) / 1024.0,
+            (double) release,
+            pr->rate);
+    stereo_setPos(&sp, 0);
+    instr_define(pr->pRender->pInstr, iid - 1, i_max, i_min, pa, &sp);
+  }
+  
+  /* Release object if allocated */
+  adsr_release(pa);
+  pa = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of "instr_dup" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   iid - the target instrument ID
+ * 
+ *   src - the source instrument ID
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_idup(RETROLIB *pr, int32_t iid, int32_t src, int *per) {
+  
+  int status = 1;
+
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((iid < 1) || (iid > INSTR_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((src < 1) || (src > INSTR_MAXCOUNT))) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  
+  /* Call through */
+  if (status) {
+    instr_dup(pr->pRender->pInstr, iid - 1, src - 1);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Implementation of "instr_maxmin" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   iid - the instrument ID
+ * 
+ *   i_max - the maximum intensity
+ * 
+ *   i_min - the minimum intensity
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_maxmin(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    i_max,
+    int32_t    i_min,
+    int      * per) {
+  
+  int status = 1;
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((iid < 1) || (iid > INSTR_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((i_max < 0) || (i_max > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && ((i_min < 0) || (i_min > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && (i_min > i_max)) {
+    status = 0;
+    *per = ERR_IRANGE;
+  }
+  
+  /* Call through */
+  if (status) {
+    instr_setMaxMin(pr->pRender->pInstr, iid - 1, i_max, i_min);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "instr_field" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   iid - the instrument ID
+ * 
+ *   low_pos - the stereo position of the low pitch
+ * 
+ *   low_pitch - the low pitch
+ * 
+ *   high_pos - the stereo position of the high pitch
+ * 
+ *   high_pitch - the high pitch
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_field(
+    RETROLIB * pr,
+    int32_t    iid,
+    int32_t    low_pos,
+    int32_t    low_pitch,
+    int32_t    high_pos,
+    int32_t    high_pitch,
+    int      * per) {
+  
+  int status = 1;
+  STEREO_POS sp;
+  
+  /* Initialize structures */
+  memset(&sp, 0, sizeof(STEREO_POS));
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((iid < 1) || (iid > INSTR_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((low_pos < -(MAX_FRAC)) || (low_pos > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && ((high_pos < -(MAX_FRAC)) || (high_pos > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  if (status && ((low_pitch < PITCH_MIN) ||
+                  (low_pitch > PITCH_MAX))) {
+    status = 0;
+    *per = ERR_PITCH;
+  }
+  if (status && ((high_pitch < PITCH_MIN) ||
+                  (high_pitch > PITCH_MAX))) {
+    status = 0;
+    *per = ERR_PITCH;
+  }
+  if (status && (high_pitch <= low_pitch)) {
+    status = 0;
+    *per = ERR_PITCHR;
+  }
+  
+  /* Call through */
+  if (status) {
+    stereo_setField(&sp, low_pos, low_pitch, high_pos, high_pitch);
+    instr_setStereo(pr->pRender->pInstr, iid - 1, &sp);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "instr_stereo" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   iid - the instrument ID
+ * 
+ *   pos - the stereo position
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_stereo(RETROLIB *pr, int32_t iid, int32_t pos, int *per) {
+  
+  int status = 1;
+  STEREO_POS sp;
+  
+  /* Initialize structures */
+  memset(&sp, 0, sizeof(STEREO_POS));
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((iid < 1) || (iid > INSTR_MAXCOUNT)) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((pos < -(MAX_FRAC)) || (pos > MAX_FRAC))) {
+    status = 0;
+    *per = ERR_BADFRAC;
+  }
+  
+  /* Call through */
+  if (status) {
+    stereo_setPos(&sp, pos);
+    instr_setStereo(pr->pRender->pInstr, iid - 1, &sp);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/* 
+ * Implementation of "n" operation.
+ * 
+ * header_config() must be called before using this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   t - the time offset
+ * 
+ *   dur - the duration
+ * 
+ *   pitch - the pitch number
+ * 
+ *   iid - the instrument ID
+ * 
+ *   lid - the layer ID
+ * 
+ *   per - pointer to a variable to receive an error code
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op_note(
+    RETROLIB * pr,
+    int64_t    t,
+    int64_t    dur,
+    int32_t    pitch,
+    int32_t    iid,
+    int32_t    lid,
+    int      * per) {
+  
+  int status = 1;
+  
+  /* Check per and state */
+  if ((per == NULL) || (!pr->init)) {
+    abort();
+  }
+  
+  /* Range-check parameters */
+  if ((t < 0) || (t > MAX_TIME)) {
+    status = 0;
+    *per = ERR_BADT;
+  }
+  if (status && (dur < 1)) {
+    status = 0;
+    *per = ERR_BADDUR;
+  }
+  if (status && (dur > MAX_TIME - t)) {
+    status = 0;
+    *per = ERR_LONGDUR;
+  }
+  if (status && ((pitch < PITCH_MIN) ||
+                  (pitch > PITCH_MAX))) {
+    status = 0;
+    *per = ERR_PITCH;
+  }
+  if (status && ((iid < 1) || (iid > INSTR_MAXCOUNT))) {
+    status = 0;
+    *per = ERR_INSTR;
+  }
+  if (status && ((lid < 1) || (lid > LAYER_MAXCOUNT))) {
+    status = 0;
+    *per = ERR_LAYER;
+  }
+  
+  /* In streaming mode, notes must be in time order */
+  if (status && pr->stream && pr->stream_notes && (t < pr->stream_t)) {
+    status = 0;
+    *per = ERR_ORDER;
+  }
+  
+  /* Call through to sequencer module */
+  if (status) {
+    if (!seq_note(pr->pRender->pSeq, t, dur, pitch, iid - 1, lid - 1)) {
+      status = 0;
+      *per = ERR_NOTES;
+    }
+  }
+  
+  /* In streaming mode, record the time of the latest note */
+  if (status && pr->stream) {
+    pr->stream_notes = 1;
+    pr->stream_t = t;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Get the current height of the stack, taking into account any open
+ * groups.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   the stack height, accounting for open groups
+ */
+static int32_t stack_height(RETROLIB *pr) {
+  
+  int32_t result = 0;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check if an open group */
+  if (pr->group_count > 0) {
+    /* Open groups, so use stack count minus top of group stack */
+    result = pr->stack_count - (pr->group_stack)[pr->group_count - 1];
+    
+  } else {
+    /* No open groups, so just use stack count */
+    result = pr->stack_count;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Get the type of element on the stack at index i.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * The return value is one of the PTYPE constants.
+ * 
+ * i must be in range [0, stack_count - 1].  This function ignores any
+ * open groups.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   i - the index on the stack
+ * 
+ * Return:
+ * 
+ *   the type of element on the stack
+ */
+static int stack_type(RETROLIB *pr, int32_t i) {
+  
+  STACK_REC *psr = NULL;
+  int pt = 0;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check parameter */
+  if ((i < 0) || (i > pr->stack_count - 1)) {
+    abort();
+  }
+  
+  /* Get pointer to record */
+  psr = &((pr->stack)[i]);
+  
+  /* Determine type */
+  if (psr->ra < 0) {
+    pt = PTYPE_INT;
+  
+  } else if (psr->rb < 0) {
+    pt = PTYPE_LC;
+    
+  } else {
+    pt = PTYPE_LR;
+  }
+  
+  /* Return result */
+  return pt;
+}
+
+/*
+ * Get the integer stack element value at stack index i.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * i must be in range [0, stack_count - 1].  Open groups are ignored
+ * by this function.
+ * 
+ * A fault occurs if the indicated record is not for an integer, or if
+ * the integer is outside of 32-bit range.  Use stack_time() for time
+ * offsets and durations.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   i - the index of the stack element
+ * 
+ * Return:
+ * 
+ *   the integer value of the requested stack element
+ */
+static int32_t stack_int(RETROLIB *pr, int32_t i) {
+  
+  STACK_REC *psr = NULL;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check parameter */
+  if ((i < 0) || (i > pr->stack_count - 1)) {
+    abort();
+  }
+  
+  /* Get pointer to record */
+  psr = &((pr->stack)[i]);
+  
+  /* Verify type and range */
+  if (psr->ra >= 0) {
+    abort();
+  }
+  if ((psr->val < INT32_MIN) || (psr->val > INT32_MAX)) {
+    abort();
+  }
+  
+  /* Return result */
+  return (int32_t) psr->val;
+}
+
+/*
+ * Get the integer stack element value at stack index i as a time offset
+ * or duration.
+ * 
+ * This is the same as stack_int(), except that the full 64-bit range
+ * of the integer is returned.  The caller must range-check the value.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   i - the index of the stack element
+ * 
+ * Return:
+ * 
+ *   the integer value of the requested stack element
+ */
+static int64_t stack_time(RETROLIB *pr, int32_t i) {
+  
+  STACK_REC *psr = NULL;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check parameter */
+  if ((i < 0) || (i > pr->stack_count - 1)) {
+    abort();
+  }
+  
+  /* Get pointer to record */
+  psr = &((pr->stack)[i]);
+  
+  /* Verify type */
+  if (psr->ra >= 0) {
+    abort();
+  }
+  
+  /* Return result */
+  return psr->val;
+}
+
+/*
+ * Called to interpret an operation from the Shastina file.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * per points to the variable to receive the error code in case of
+ * error.  It may not be NULL.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pk - pointer to the opname token
+ * 
+ *   per - pointer to the error code variable
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if operation failed
+ */
+static int op(RETROLIB *pr, const char *pk, int *per) {
+  
+  int status = 1;
+  int opcode = OPCODE_NONE;
+  int32_t sh = 0;
+  int32_t opcount = 0;
+  int32_t tcount = 0;
+  int32_t varcount = 0;
+  int32_t x = 0;
+  int32_t st = 0;
+  int64_t v = 0;
+  int pt = 0;
+  STACK_REC sr;
+  
+  /* Initialize structures */
+  memset(&sr, 0, sizeof(STACK_REC));
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check parameters */
+  if ((pk == NULL) || (per == NULL)) {
+    abort();
+  }
+  
+  /* First of all, translate token to opcode */
+  if (strcmp(pk, "n") == 0) {
+    opcode = OPCODE_NOTE;
+  
+  } else if (strcmp(pk, "lc") == 0) {
+    opcode = OPCODE_LC;
+    
+  } else if (strcmp(pk, "lr") == 0) {
+    opcode = OPCODE_LR;
+    
+  } else if (strcmp(pk, "layer") == 0) {
+    opcode = OPCODE_LAYER;
+    
+  } else if (strcmp(pk, "derive_layer") == 0) {
+    opcode = OPCODE_DERIVE;
+    
+  } else if (strcmp(pk, "instr") == 0) {
+    opcode = OPCODE_INSTR;
+  
+  } else if (strcmp(pk, "instr_dup") == 0) {
+    opcode = OPCODE_IDUP;
+    
+  } else if (strcmp(pk, "instr_maxmin") == 0) {
+    opcode = OPCODE_MAXMIN;
+    
+  } else if (strcmp(pk, "instr_field") == 0) {
+    opcode = OPCODE_FIELD;
+    
+  } else if (strcmp(pk, "instr_stereo") == 0) {
+    opcode = OPCODE_STEREO;
+    
+  } else {
+    /* Unrecognized opcode */
+    status = 0;
+    *per = ERR_BADOP;
+  }
+  
+  /* In streaming mode, instruments and layers are locked once the
+   * first note has been sequenced */
+  if (status && pr->stream && pr->stream_notes) {
+    if ((opcode != OPCODE_NOTE) &&
+          (opcode != OPCODE_LC) && (opcode != OPCODE_LR)) {
+      status = 0;
+      *per = ERR_STREAMR;
+    }
+  }
+
+  /* Next, make sure stack height is sufficient for operation
+   * parameters; for the layer opcode that has varying parameters, make
+   * sure height is enough for the fixed parameters; also, save the
+   * number of (fixed) parameters */
+  if (status) {
+    /* Get stack height */
+    sh = stack_height(pr);
+    
+    /* Check stack height and get parameter count */
+    if (opcode == OPCODE_NOTE) {
+      if (sh >= 5) {
+        opcount = 5;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_LC) {
+      if (sh >= 2) {
+        opcount = 2;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_LR) {
+      if (sh >= 3) {
+        opcount = 3;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_LAYER) {
+      if (sh >= 3) {
+        opcount = 3;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_DERIVE) {
+      if (sh >= 3) {
+        opcount = 3;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_INSTR) {
+      if (sh >= 7) {
+        opcount = 7;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_IDUP) {
+      if (sh >= 2) {
+        opcount = 2;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_MAXMIN) {
+      if (sh >= 3) {
+        opcount = 3;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_FIELD) {
+      if (sh >= 5) {
+        opcount = 5;
+      } else {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_STEREO) {
+      if (sh >= 2) {
+        opcount = 2;
+      } else {
+        status = 0;
+      }
+      
+    } else {
+      /* Unrecognized opcode -- shouldn't happen */
+      abort();
+    }
+    
+    /* If there was an error, set error code */
+    if (!status) {
+      *per = ERR_OPPARAM;
+    }
+  }
+
+  /* Get the number of fixed parameters that are time offsets or
+   * durations, which are always the first parameters */
+  if (status) {
+    if (opcode == OPCODE_NOTE) {
+      tcount = 2;
+    } else if ((opcode == OPCODE_LC) || (opcode == OPCODE_LR)) {
+      tcount = 1;
+    } else {
+      tcount = 0;
+    }
+  }
+  
+  /* Check that all fixed parameters are integers, and that all of them
+   * except for time offsets and durations are in 32-bit range */
+  if (status) {
+    for(x = 0; x < opcount; x++) {
+      if (stack_type(pr, pr->stack_count - x - 1) != PTYPE_INT) {
+        status = 0;
+        *per = ERR_PARAMT;
+        break;
+      }
+      if (x < opcount - tcount) {
+        v = ((pr->stack)[pr->stack_count - x - 1]).val;
+        if ((v < INT32_MIN) || (v > INT32_MAX)) {
+          status = 0;
+          *per = ERR_BIGINT;
+          break;
+        }
+      }
+    }
+  }
+
+  /* Get the number of variable parameters -- for a layer, this is given
+   * by the third-from-top parameter; for everything else, this is zero;
+   * verify for layer that this is at least one and doesn't exceed stack
+   * height */
+  if (status && (opcode == OPCODE_LAYER)) {
+    /* Layer op -- get count */
+    varcount = (int32_t) ((pr->stack)[pr->stack_count - 3]).val;
+    
+    /* Verify count is at least one and no more than GRAPH_MAXCOUNT */
+    if ((varcount < 1) || (varcount > GRAPH_MAXCOUNT)) {
+      status = 0;
+      *per = ERR_LAYERC;
+    }
+    
+    /* Verify (varcount+opcount) doesn't exceed stack height */
+    if (status) {
+      if (varcount > sh - opcount) {
+        status = 0;
+        *per = ERR_LAYERC;
+      }
+    }
+    
+  } else if (status) {
+    /* Not a layer op -- set varcount to zero */
+    varcount = 0;
+  }
+
+  /* Check that if there are variable parameters, they are all graph
+   * types */
+  if (status) {
+    st = pr->stack_count - 1 - opcount;
+    for(x = 0; x < varcount; x++) {
+      pt = stack_type(pr, st - x);
+      if ((pt != PTYPE_LC) && (pt != PTYPE_LR)) {
+        status = 0;
+        *per = ERR_PARAMT;
+        break;
+      }
+    }
+  }
+
+  /* Route to appropriate implementation function */
+  if (status) {
+    if (opcode == OPCODE_NOTE) {
+      if (!op_note(
+            pr,
+            stack_time(pr, pr->stack_count - 5),
+            stack_time(pr, pr->stack_count - 4),
+            stack_int(pr, pr->stack_count - 3),
+            stack_int(pr, pr->stack_count - 2),
+            stack_int(pr, pr->stack_count - 1),
+            per)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_LC) {
+      if (!op_lc(
+            stack_time(pr, pr->stack_count - 2),
+            stack_int(pr, pr->stack_count - 1),
+            per, &sr)) {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_LR) {
+      if (!op_lr(
+            stack_time(pr, pr->stack_count - 3),
+            stack_int(pr, pr->stack_count - 2),
+            stack_int(pr, pr->stack_count - 1),
+            per, &sr)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_LAYER) {
+      if (!op_layer(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 2),
+            varcount,
+            &((pr->stack)[pr->stack_count - opcount - varcount]),
+            per)) {
+        status = 0;
+      }
+      
+    } else if (opcode == OPCODE_DERIVE) {
+      if (!op_derive(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 2),
+            stack_int(pr, pr->stack_count - 3),
+            per)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_INSTR) {
+      if (!op_instr(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 7),
+            stack_int(pr, pr->stack_count - 6),
+            stack_int(pr, pr->stack_count - 5),
+            stack_int(pr, pr->stack_count - 4),
+            stack_int(pr, pr->stack_count - 3),
+            stack_int(pr, pr->stack_count - 2),
+            per)) {
+        status = 0;
+      }
+  
+    } else if (opcode == OPCODE_IDUP) {
+      if (!op_idup(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 2),
+            per)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_MAXMIN) {
+      if (!op_maxmin(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 3),
+            stack_int(pr, pr->stack_count - 2),
+            per)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_FIELD) {
+      if (!op_field(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 5),
+            stack_int(pr, pr->stack_count - 4),
+            stack_int(pr, pr->stack_count - 3),
+            stack_int(pr, pr->stack_count - 2),
+            per)) {
+        status = 0;
+      }
+    
+    } else if (opcode == OPCODE_STEREO) {
+      if (!op_stereo(
+            pr,
+            stack_int(pr, pr->stack_count - 1),
+            stack_int(pr, pr->stack_count - 2),
+            per)) {
+        status = 0;
+      }
+    
+    } else {
+      /* Unrecognized opcode (shouldn't happen) */
+      abort();
+    }
+  }
+  
+  /* Clear parameters from stack */
+  if (status) {
+    pr->stack_count = pr->stack_count - opcount - varcount;
+  }
+  
+  /* If opcode was lc or lr, push the result on the stack */
+  if (status && ((opcode == OPCODE_LC) || (opcode == OPCODE_LR))) {
+    memcpy(&((pr->stack)[pr->stack_count]), &sr, sizeof(STACK_REC));
+    (pr->stack_count)++;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Called when a group begins while interpreting the Shastina file.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if too much group nesting
+ */
+static int begin_group(RETROLIB *pr) {
+  
+  int status = 1;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check for group overflow */
+  if (pr->group_count < MAX_GROUP) {
+    /* No overflow, so open new group */
+    (pr->group_stack)[pr->group_count] = pr->stack_count;
+    (pr->group_count)++;
+    
+  } else {
+    /* Group stack overflow */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Called when a group ends while interpreting the Shastina file.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * In order for the group end to be successful, there must be exactly
+ * one element left in the stack group
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if improper group closing
+ */
+static int end_group(RETROLIB *pr) {
+  
+  int status = 1;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  if (pr->group_count < 1) {
+    /* Shastina should make sure this doesn't happen */
+    abort();
+  }
+  
+  /* Check if stack height is exactly one */
+  if (stack_height(pr) == 1) {
+    /* Stack height exactly one, so close the group */
+    (pr->group_count)--;
+    
+  } else {
+    /* Stack height not exactly one, so improper group closing */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Called to push a number on the stack while interpreting the Shastina
+ * file.
+ * 
+ * header_config() must be called before this function.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if stack overflow
+ */
+static int push_num(RETROLIB *pr, int64_t val) {
+  
+  int status = 1;
+  
+  /* Check state */
+  if (!pr->init) {
+    abort();
+  }
+  
+  /* Check for overflow */
+  if (pr->stack_count < MAX_STACK) {
+    /* No overflow, so push number */
+    ((pr->stack)[pr->stack_count]).val = val;
+    ((pr->stack)[pr->stack_count]).ra = -1;
+    ((pr->stack)[pr->stack_count]).rb = -1;
+    (pr->stack_count)++;
+    
+  } else {
+    /* Stack overflow */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Record basic configuration information from the header.
+ * 
+ * This must only be called once for each library context.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   rate - the sampling rate (RATE_DVD or RATE_CD)
+ * 
+ *   sqamp - the output amplitude
+ * 
+ *   nostereo - non-zero for no-stereo mode
+ * 
+ *   frame_before - the number of blank samples before
+ * 
+ *   frame_after - the number of blank samples after
+ * 
+ *   cutoff - the cutoff threshold for early voice termination
+ * 
+ *   stream - non-zero for streaming mode
+ */
+static void header_config(
+    RETROLIB * pr,
+    int32_t    rate,
+    int32_t    sqamp,
+    int        nostereo,
+    int32_t    frame_before,
+    int32_t    frame_after,
+    int32_t    cutoff,
+    int        stream) {
+  
+  /* Check state */
+  if (pr->init) {
+    abort();
+  }
+  
+  /* Check parameters */
+  if ((rate != RATE_DVD) && (rate != RATE_CD)) {
+    abort();
+  }
+  if ((sqamp < 1) || (sqamp > INT16_MAX) ||
+      (frame_before < 0) || (frame_after < 0)) {
+    abort();
+  }
+  if ((cutoff < 0) || (cutoff > SEQ_CUTOFF_MAX)) {
+    abort();
+  }
+  
+  /* Set initialization flag */
+  pr->init = 1;
+  
+  /* Set parameter values */
+  pr->rate = rate;
+  pr->sqamp = sqamp;
+  if (nostereo) {
+    pr->nostereo = 1;
+  } else {
+    pr->nostereo = 0;
+  }
+  pr->frame_before = frame_before;
+  pr->frame_after = frame_after;
+  pr->cutoff = cutoff;
+  if (stream) {
+    pr->stream = 1;
+  } else {
+    pr->stream = 0;
+  }
+  
+  /* Initialize stacks */
+  pr->group_count = 0;
+  pr->stack_count = 0;
+  
+  memset(pr->group_stack, 0, MAX_GROUP * sizeof(int32_t));
+  memset(pr->stack, 0, MAX_STACK * sizeof(STACK_REC));
+  
+  /* Notify instr module of rate */
+  instr_setsamp(pr->pRender->pInstr, rate);
+  
+  /* Notify seq module of cutoff threshold */
+  seq_cutoff(pr->pRender->pSeq, cutoff);
+}
+
+/*
+ * Load all the external instruments that are still pending.
+ * 
+ * This wraps instr_flush(), converting any error into an error code
+ * and line number in the same way as retro().
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   per - pointer to the error status variable
+ * 
+ *   pln - pointer to the line number status variable
+ * 
+ *   ppExternal - pointer to variable to receive external script name,
+ *   or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int load_pending(
+    RETROLIB *  pr,
+    int      *  per,
+    long     *  pln,
+    char     ** ppExternal) {
+  
+  int status = 1;
+  int err_num = 0;
+  int err_mod = 0;
+  long err_line = 0;
+  
+  /* Check parameters */
+  if ((per == NULL) || (pln == NULL)) {
+    abort();
+  }
+  
+  /* Load the pending instruments */
+  if (!instr_flush(pr->pRender->pInstr,
+                    &err_num, &err_mod, &err_line, ppExternal)) {
+    /* Error in external script, so only minor adjustment needed to
+     * line number */
+    if (err_line == LONG_MAX) {
+      err_line = 0;
+    }
+    
+    /* Convert error code */
+    if (err_mod == INSTR_ERRMOD_GENMAP) {
+      *per = err_num + ERR_GENMAP_MIN;
+    } else if (err_mod == INSTR_ERRMOD_SHASTINA) {
+      *per = err_num + ERR_SN_MAX;
+    } else if (err_mod == INSTR_ERRMOD_INSTR) {
+      *per = err_num + ERR_INSTR_MIN;
+    } else {
+      /* Unknown error */
+      *per = INT_MAX;
+    }
+    
+    /* Set line number and clear status */
+    *pln = err_line;
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Parse the given string as a signed 64-bit integer.
+ * 
+ * pstr is the string to parse.
+ * 
+ * pv points to the integer value to use to return the parsed numeric
+ * value if the function is successful.
+ * 
+ * In two's complement, this function will not successfully parse the
+ * least negative value.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the string to parse
+ * 
+ *   pv - pointer to the return numeric value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int parseLong(const char *pstr, int64_t *pv) {
+  
+  int negflag = 0;
+  int64_t result = 0;
+  int status = 1;
+  int64_t d = 0;
+  
+  /* Check parameters */
+  if ((pstr == NULL) || (pv == NULL)) {
+    abort();
+  }
+  
+  /* If first character is a sign character, set negflag appropriately
+   * and skip it */
+  if (*pstr == '+') {
+    negflag = 0;
+    pstr++;
+  } else if (*pstr == '-') {
+    negflag = 1;
+    pstr++;
+  } else {
+    negflag = 0;
+  }
+  
+  /* Make sure we have at least one digit */
+  if (*pstr == 0) {
+    status = 0;
+  }
+  
+  /* Parse all digits */
+  if (status) {
+    for( ; *pstr != 0; pstr++) {
+    
+      /* Make sure in range of digits */
+      if ((*pstr < '0') || (*pstr > '9')) {
+        status = 0;
+      }
+    
+      /* Get numeric value of digit */
+      if (status) {
+        d = (int64_t) (*pstr - '0');
+      }
+      
+      /* Multiply result by 10, watching for overflow */
+      if (status) {
+        if (result <= INT64_MAX / 10) {
+          result = result * 10;
+        } else {
+          status = 0; /* overflow */
+        }
+      }
+      
+      /* Add in digit value, watching for overflow */
+      if (status) {
+        if (result <= INT64_MAX - d) {
+          result = result + d;
+        } else {
+          status = 0; /* overflow */
+        }
+      }
+    
+      /* Leave loop if error */
+      if (!status) {
+        break;
+      }
+    }
+  }
+  
+  /* Invert result if negative mode */
+  if (status && negflag) {
+    result = -(result);
+  }
+  
+  /* Write result if successful */
+  if (status) {
+    *pv = result;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Parse the given string as a signed 32-bit integer.
+ * 
+ * This is the same as parseLong(), except that the function fails if
+ * the value is outside of 32-bit range.
+ * 
+ * Parameters:
+ * 
+ *   pstr - the string to parse
+ * 
+ *   pv - pointer to the return numeric value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int parseInt(const char *pstr, int32_t *pv) {
+  
+  int status = 1;
+  int64_t v = 0;
+  
+  /* Check parameters */
+  if ((pstr == NULL) || (pv == NULL)) {
+    abort();
+  }
+  
+  /* Parse as a 64-bit integer and then check the range */
+  if (!parseLong(pstr, &v)) {
+    status = 0;
+  }
+  if (status && ((v < INT32_MIN) || (v > INT32_MAX))) {
+    status = 0;
+  }
+  
+  /* Write result if successful */
+  if (status) {
+    *pv = (int32_t) v;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Run the Retro synthesizer on the given input file and generate the
+ * output file.
+ * 
+ * Undefined behavior occurs if this function is called more than once
+ * for the same library context.
+ * 
+ * pIn is the Shastina source to read to program the synthesizer.  The
+ * source does not need to support multiplass.
+ * 
+ * pOutPath is the path to the output WAV file to create.  If a WAV file
+ * already exists at that location, it will be overwritten.  If it is
+ * NULL, the script is only interpreted into the render context, and the
+ * %stream; header command is ignored.
+ * 
+ * If compile is non-zero, the interpreted state is written to a
+ * compiled score file at pOutPath with compile_score() instead of being
+ * synthesized.  pOutPath may not be NULL in that case.
+ * 
+ * per points to the variable to receive the error status.  If the
+ * status is not required, it may be NULL.  Use retrolib_errstr() to get
+ * an error string for the error code.
+ * 
+ * pln points to the variable to receive the line number, if there is a
+ * line number in the input file associated with the error.  It may be
+ * NULL if not required.  -1 or LONG_MAX is returned if there is no line
+ * number associated with the error.
+ * 
+ * ppExternal points to a string pointer that will by default be cleared
+ * to NULL.  If a parsing error occurs in an external instrument script,
+ * a dynamic copy of the instrument name will be made and a pointer to
+ * it placed in this variable.  Caller has responsibility for freeing
+ * this if it is allocated.  If this parameter is NULL, it will not be
+ * used.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pIn - the input Shastina source to program the synthesizer
+ * 
+ *   pOutPath - the output WAV file path, or NULL
+ * 
+ *   compile - non-zero to write a compiled score instead
+ * 
+ *   per - pointer to the error status variable, or NULL
+ * 
+ *   pln - pointer to line number status variable, or NULL
+ * 
+ *   ppExternal - pointer to variable to receive external script name,
+ *   or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int retro(
+          RETROLIB *  pr,
+          SNSOURCE *  pIn,
+    const char     *  pOutPath,
+          int         compile,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal) {
+  
+  int status = 1;
+  int dummy = 0;
+  long dummy_l = 0;
+  long emb_line = 0;
+  const char *pc = NULL;
+  SNPARSER *pp = NULL;
+  SNENTITY ent;
+  
+  int header_done = 0;
+  int sig_read = 0;
+  int32_t rate = -1;
+  int32_t sqamp = -1;
+  int nostereo = 0;
+  int stream = 0;
+  int32_t frame_before = -1;
+  int32_t frame_after = -1;
+  int32_t cutoff = -1;
+  
+  int32_t meta_param[META_MAXPARAM];
+  int meta_count = 0;
+  int meta_cmd = METACMD_NONE;
+  
+  int32_t v = 0;
+  int64_t lv = 0;
+  int err_num = 0;
+  int err_mod = 0;
+  long err_line = 0;
+
+  /* Initialize structures and arrays */
+  memset(&ent, 0, sizeof(SNENTITY));
+  memset(meta_param, 0, sizeof(int32_t) * META_MAXPARAM);
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (compile && (pOutPath == NULL))) {
+    abort();
+  }
+  
+  /* Redirect errors to dummy if not defined */
+  if (per == NULL) {
+    per = &dummy;
+  }
+  if (pln == NULL) {
+    pln = &dummy_l;
+  }
+  
+  /* If external given, clear to NULL */
+  if (ppExternal != NULL) {
+    *ppExternal = NULL;
+  }
+  
+  /* Reset error status */
+  *per = ERR_OK;
+  *pln = -1;
+  
+  /* Allocate a Shastina parser */
+  pp = snparser_alloc();
+  
+  /* Read Shastina entities until EOF entity or error */
+  for(snparser_read(pp, &ent, pIn);
+      (ent.status >= 0) && (ent.status != SNENTITY_EOF);
+      snparser_read(pp, &ent, pIn)) {
+
+    /* First of all, fail if an unsupported entity type */
+    if ((ent.status != SNENTITY_STRING) &&
+        (ent.status != SNENTITY_BEGIN_META) &&
+        (ent.status != SNENTITY_END_META) &&
+        (ent.status != SNENTITY_META_TOKEN) &&
+        (ent.status != SNENTITY_NUMERIC) &&
+        (ent.status != SNENTITY_BEGIN_GROUP) &&
+        (ent.status != SNENTITY_END_GROUP) &&
+        (ent.status != SNENTITY_ARRAY) &&
+        (ent.status != SNENTITY_OPERATION)) {
+      status = 0;
+      *per = ERR_ENTITY;
+      *pln = snparser_count(pp);
+    }
+    
+    /* If header is done, make sure not a meta type */
+    if (status) {
+      if (header_done) {
+        if ((ent.status == SNENTITY_BEGIN_META) ||
+            (ent.status == SNENTITY_END_META) ||
+            (ent.status == SNENTITY_META_TOKEN)) {
+          status = 0;
+          *per = ERR_METAMID;
+          *pln = snparser_count(pp);
+        }
+      }
+    }
+    
+    /* If header is not done and the entity is not a meta type, then
+     * make sure we got the required header information, fill in any
+     * necessary defaults, and set the header_done flag, and report the
+     * header information */
+    if (status && (!header_done)) {
+      if ((ent.status != SNENTITY_BEGIN_META) &&
+          (ent.status != SNENTITY_END_META) &&
+          (ent.status != SNENTITY_META_TOKEN)) {
+        /* Header finishing -- make sure we got sig, rate, and sqamp */
+        if (!sig_read) {
+          status = 0;
+          *per = ERR_NOSIG;
+          *pln = snparser_count(pp);
+        }
+        if (status && (rate < 0)) {
+          status = 0;
+          *per = ERR_NORATE;
+          *pln = snparser_count(pp);
+        }
+        if (status && (sqamp < 0)) {
+          status = 0;
+          *per = ERR_NOAMP;
+          *pln = snparser_count(pp);
+        }
+        
+        /* Set defaults that weren't set */
+        if (status && (frame_before < 0)) {
+          frame_before = rate;  /* one second */
+        }
+        if (status && (frame_after < 0)) {
+          frame_after = rate;   /* one second */
+        }
+        if (status && (cutoff < 0)) {
+          cutoff = SEQ_CUTOFF_DEFAULT;
+        }
+        
+        /* Streaming only applies when synthesizing to a file */
+        if (status && (pOutPath == NULL)) {
+          stream = 0;
+        }
+        
+        /* Set the header_done flag */
+        if (status) {
+          header_done = 1;
+        }
+        
+        /* Report header information */
+        if (status) {
+          header_config(
+            pr,
+            rate, sqamp, nostereo, frame_before, frame_after, cutoff,
+            stream);
+        }
+        
+        /* In streaming mode, start synthesis right away, which can't
+         * be combined with compiling the score */
+        if (status && stream && compile) {
+          status = 0;
+          *per = ERR_STREAMC;
+          *pln = snparser_count(pp);
+        }
+        if (status && stream) {
+          if (synth_begin(pr, pOutPath)) {
+            pr->synth_open = 1;
+          } else {
+            status = 0;
+            *per = ERR_OUTFILE;
+            *pln = snparser_count(pp);
+          }
+        }
+      }
+    }
+    
+    /* Different handling depending whether in header mode or not */
+    if (status && header_done) {
+      /* Header is complete, parsing main -- handle types */
+      if (ent.status == SNENTITY_NUMERIC) {
+        /* Numeric entity */
+        if (parseLong(ent.pKey, &lv)) {
+          if (!push_num(pr, lv)) {
+            status = 0;
+            *per = ERR_OVERFLW;
+            *pln = snparser_count(pp);
+          }
+          
+        } else {
+          status = 0;
+          *per = ERR_NUM;
+          *pln = snparser_count(pp);
+        }
+      
+      } else if (ent.status == SNENTITY_STRING) {
+        /* String literal -- make sure that string prefix begins with a
+         * decimal digit */
+        if (((ent.pKey)[0] < '0') || ((ent.pKey)[0] > '9')) {
+          status = 0;
+          *per = ERR_ENTITY;
+          *pln = snparser_count(pp);
+        }
+        
+        /* In streaming mode, instruments can't be defined once the
+         * first note has been sequenced */
+        if (status && pr->stream && pr->stream_notes) {
+          status = 0;
+          *per = ERR_STREAMR;
+          *pln = snparser_count(pp);
+        }
+        
+        /* Parse the string prefix as an integer, now that we know it is
+         * unsigned */
+        if (status) {
+          if (!parseInt(ent.pKey, &v)) {
+            status = 0;
+            *per = ERR_STRPFXN;
+            *pln = snparser_count(pp);
+          }
+        }
+        
+        /* Check range of string prefix is valid instrument index */
+        if (status) {
+          if ((v < 1) || (v > INSTR_MAXCOUNT)) {
+            status = 0;
+            *per = ERR_INSTR;
+            *pln = snparser_count(pp);
+          }
+        }
+        
+        /* Decrement instrument index */
+        if (status) {
+          v--;
+        }
+        
+        /* If this is an embedded script, figure out a number that
+         * should be added to one-based line numbers internal to the
+         * script to translate them to line numbers in input; otherwise,
+         * if external script, set offset number to zero */
+        if (status && (ent.str_type == SNSTRING_CURLY)) {
+          /* Embedded script, so begin with the current line number,
+           * which is the line the closing curly takes place on */
+          emb_line = snparser_count(pp);
+          
+          /* For every LF character found in the string literal,
+           * decrease the embedded line by one */
+          for(pc = ent.pValue; *pc != 0; pc++) {
+            if (*pc == '\n') {
+              /* We found an LF, so decrease embedded line */
+              if ((emb_line > 1) && (emb_line < LONG_MAX)) {
+                /* Embedded line in range, so decrement */
+                emb_line--;
+              } else {
+                /* Embedded line no longer in range, so set to zero and
+                 * leave loop */
+                emb_line = 0;
+                break;
+              }
+            }
+          }
+          
+          /* Since embedded line numbers are one-indexed, we need to
+           * move the line number back one more so it works correctly as
+           * an offset; set to -1 if not valid */
+          if ((emb_line >= 1) && (emb_line < LONG_MAX)) {
+            emb_line--;
+          } else {
+            emb_line = -1;
+          }
+          
+        } else if (status) {
+          /* Not an embedded script, so offset should be zero */
+          emb_line = 0;
+        }
+        
+        /* Call through to appropriate function */
+        if (status && (ent.str_type == SNSTRING_CURLY)) {
+          /* Curly string means embedded instrument */
+          if (!instr_embedded(
+                  pr->pRender->pInstr,
+                  v, ent.pValue, &err_num, &err_mod, &err_line)) {
+            /* Error in embedded script, so first of all modify line
+             * number by offset, or set to zero if not valid */
+            if (emb_line >= 0) {
+              if ((err_line >= 1) &&
+                    (err_line < LONG_MAX - emb_line)) {
+                err_line = err_line + emb_line;
+              } else {
+                err_line = 0;
+              }
+            } else {
+              err_line = 0;
+            }
+            
+            /* Convert error code */
+            if (err_mod == INSTR_ERRMOD_GENMAP) {
+              *per = err_num + ERR_GENMAP_MIN;
+            } else if (err_mod == INSTR_ERRMOD_SHASTINA) {
+              *per = err_num + ERR_SN_MAX;
+            } else if (err_mod == INSTR_ERRMOD_INSTR) {
+              *per = err_num + ERR_INSTR_MIN;
+            } else {
+              /* Unknown error */
+              *per = INT_MAX;
+            }
+            
+            /* Set corrected line number and clear status */
+            *pln = err_line;
+            status = 0;
+          }
+          
+        } else if (status && (ent.str_type == SNSTRING_QUOTED)) {
+          /* Quoted string means external instrument */
+          if (!instr_external(
+                  pr->pRender->pInstr,
+                  v, ent.pValue, &err_num, &err_mod, &err_line)) {
+            /* Error in external script, so only minor adjustment needed
+             * to line number */
+            if (err_line == LONG_MAX) {
+              err_line = 0;
+            }
+            
+            /* If external pointer given, we need to make a copy of the
+             * instrument name for error reporting */
+            if (ppExternal != NULL) {
+              *ppExternal = (char *) malloc(strlen(ent.pValue) + 1);
+              if (*ppExternal == NULL) {
+                abort();
+              }
+              strcpy(*ppExternal, ent.pValue);
+            }
+            
+            /* Convert error code */
+            if (err_mod == INSTR_ERRMOD_GENMAP) {
+              *per = err_num + ERR_GENMAP_MIN;
+            } else if (err_mod == INSTR_ERRMOD_SHASTINA) {
+              *per = err_num + ERR_SN_MAX;
+            } else if (err_mod == INSTR_ERRMOD_INSTR) {
+              *per = err_num + ERR_INSTR_MIN;
+            } else {
+              /* Unknown error */
+              *per = INT_MAX;
+            }
+            
+            /* Set line number and clear status */
+            *pln = err_line;
+            status = 0;
+          }
+          
+        } else if (status) {
+          /* Shouldn't happen */
+          abort();
+        }
+      
+      } else if (ent.status == SNENTITY_BEGIN_GROUP) {
+        /* Begin group */
+        if (!begin_group(pr)) {
+          status = 0;
+          *per = ERR_SN_MAX + SNERR_DEEPGROUP;
+          *pln = snparser_count(pp);
+        }
+      
+      } else if (ent.status == SNENTITY_END_GROUP) {
+        /* End group */
+        if (!end_group(pr)) {
+          status = 0;
+          *per = ERR_GROUP;
+          *pln = snparser_count(pp);
+        }
+        
+      } else if (ent.status == SNENTITY_ARRAY) {
+        /* Array entity */
+        if (ent.count <= INT32_MAX) {
+          if (!push_num(pr, (int32_t) ent.count)) {
+            status = 0;
+            *per = ERR_OVERFLW;
+            *pln = snparser_count(pp);
+          }
+   
+        } else {
+          status = 0;
+          *per = ERR_SN_MAX + SNERR_LONGARRAY;
+          *pln = snparser_count(pp);
+        }
+        
+      } else if (ent.status == SNENTITY_OPERATION) {
+        /* In streaming mode, load any pending external instruments
+         * before the first note is sequenced */
+        if (pr->stream && (!pr->stream_notes) &&
+              (strcmp(ent.pKey, "n") == 0)) {
+          if (!load_pending(pr, per, pln, ppExternal)) {
+            status = 0;
+          }
+        }
+        
+        /* Operation entity */
+        if (status) {
+          if (!op(pr, ent.pKey, per)) {
+            status = 0;
+            *pln = snparser_count(pp);
+          }
+        }
+        
+      } else {
+        /* Unrecognized entity type -- shouldn't happen */
+        abort();
+      }
+      
+    } else if (status) {
+      /* Parsing header -- check type */
+      if (ent.status == SNENTITY_BEGIN_META) {
+        /* Beginning a metacommand -- reset state */
+        meta_count = 0;
+        meta_cmd = METACMD_NONE;
+        
+      } else if (ent.status == SNENTITY_META_TOKEN) {
+        /* Meta token -- if we haven't recorded the command type yet,
+         * parse as the meta command; else, parse as numeric param */
+        if (meta_cmd == METACMD_NONE) {
+          /* Don't have command yet, so parse token as command */
+          if (strcmp(ent.pKey, "retro-synth") == 0) {
+            meta_cmd = METACMD_SIGNATURE;
+          
+          } else if (strcmp(ent.pKey, "rate") == 0) {
+            meta_cmd = METACMD_RATE;
+          
+          } else if (strcmp(ent.pKey, "sqamp") == 0) {
+            meta_cmd = METACMD_SQAMP;
+          
+          } else if (strcmp(ent.pKey, "nostereo") == 0) {
+            meta_cmd = METACMD_NOSTEREO;
+          
+          } else if (strcmp(ent.pKey, "frame") == 0) {
+            meta_cmd = METACMD_FRAME;
+          
+          } else if (strcmp(ent.pKey, "cutoff") == 0) {
+            meta_cmd = METACMD_CUTOFF;
+          
+          } else if (strcmp(ent.pKey, "stream") == 0) {
+            meta_cmd = METACMD_STREAM;
+          
+          } else {
+            /* Unrecognized metacommand */
+            status = 0;
+            *per = ERR_BADMETA;
+            *pln = snparser_count(pp);
+          }
+          
+        } else {
+          /* We already have the command, so we are adding a param --
+           * check that not too many parameters */
+          if (meta_count >= META_MAXPARAM) {
+            status = 0;
+            *per = ERR_MPARAMC;
+            *pln = snparser_count(pp);
+          }
+          
+          /* Parse the parameter as a signed integer */
+          if (status) {
+            if (!parseInt(ent.pKey, &(meta_param[meta_count]))) {
+              status = 0;
+              *per = ERR_METAINT;
+              *pln = snparser_count(pp);
+            }
+          }
+          
+          /* Increase the metacommand parameter count */
+          if (status) {
+            meta_count++;
+          }
+        }
+        
+      } else if (ent.status == SNENTITY_END_META) {
+        /* Ending a metacommand -- interpret it, first checking that
+         * metacommand has correct number of parameters */
+        if (meta_cmd == METACMD_SIGNATURE) {
+          if (meta_count != 0) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_RATE) {
+          if (meta_count != 1) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_SQAMP) {
+          if (meta_count != 1) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_NOSTEREO) {
+          if (meta_count != 0) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_FRAME) {
+          if (meta_count != 2) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_CUTOFF) {
+          if (meta_count != 1) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_STREAM) {
+          if (meta_count != 0) {
+            status = 0;
+            *per = ERR_METAPRM;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (meta_cmd == METACMD_NONE) {
+          /* Metacommand had no tokens */
+          status = 0;
+          *per = ERR_EMPTYMT;
+          *pln = snparser_count(pp);
+          
+        } else {
+          /* Unrecognized metacommand -- shouldn't happen */
+          abort();
+        }
+        
+        /* If we haven't read the signature yet, metacommand must be the
+         * signature */
+        if (status && (!sig_read)) {
+          if (meta_cmd != METACMD_SIGNATURE) {
+            status = 0;
+            *per = ERR_NOSIG;
+            *pln = snparser_count(pp);
+          }
+        }
+        
+        /* Interpret specific metacommand */
+        if (status && (meta_cmd == METACMD_SIGNATURE)) {
+          /* Signature -- set sig_read flag, error if already set */
+          if (!sig_read) {
+            sig_read = 1;
+          } else {
+            status = 0;
+            *per = ERR_METAMUL;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (status && (meta_cmd == METACMD_RATE)) {
+          /* Rate -- set rate, error if invalid value or already set */
+          if (rate < 0) {
+            if ((meta_param[0] == RATE_DVD) ||
+                  (meta_param[0] == RATE_CD)) {
+              rate = meta_param[0];
+            } else {
+              status = 0;
+              *per = ERR_BADRATE;
+              *pln = snparser_count(pp);
+            }
+            
+          } else {
+            status = 0;
+            *per = ERR_METAMUL;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (status && (meta_cmd == METACMD_SQAMP)) {
+          /* Output amplitude, error if invalid value or set */
+          if (sqamp < 0) {
+            if ((meta_param[0] > 0) && (meta_param[0] <= INT16_MAX)) {
+              sqamp = meta_param[0];
+            } else {
+              status = 0;
+              *per = ERR_BADAMP;
+              *pln = snparser_count(pp);
+            }
+            
+          } else {
+            status = 0;
+            *per = ERR_METAMUL;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (status && (meta_cmd == METACMD_NOSTEREO)) {
+          /* No-stereo flag, set flag */
+          nostereo = 1;
+          
+        } else if (status && (meta_cmd == METACMD_STREAM)) {
+          /* Streaming flag, set flag */
+          stream = 1;
+          
+        } else if (status && (meta_cmd == METACMD_FRAME)) {
+          /* Frame command, error if invalid value or set already */
+          if (frame_before < 0) {
+            if ((meta_param[0] >= 0) && (meta_param[1] >= 0)) {
+              frame_before = meta_param[0];
+              frame_after = meta_param[1];
+            } else {
+              status = 0;
+              *per = ERR_BADFRM;
+              *pln = snparser_count(pp);
+            }
+            
+          } else {
+            status = 0;
+            *per = ERR_METAMUL;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (status && (meta_cmd == METACMD_CUTOFF)) {
+          /* Cutoff command, error if invalid value or set already */
+          if (cutoff < 0) {
+            if ((meta_param[0] >= 0) &&
+                  (meta_param[0] <= SEQ_CUTOFF_MAX)) {
+              cutoff = meta_param[0];
+            } else {
+              status = 0;
+              *per = ERR_BADCUT;
+              *pln = snparser_count(pp);
+            }
+            
+          } else {
+            status = 0;
+            *per = ERR_METAMUL;
+            *pln = snparser_count(pp);
+          }
+          
+        } else if (status) {
+          /* Unrecognized metacommand -- shouldn't happen */
+          abort();
+        }
+        
+      } else {
+        /* Non-meta type; shouldn't happen */
+        abort();
+      }
+    }
+    
+    /* Leave loop if error */
+    if (!status) {
+      break;
+    }
+  }
+  
+  /* If we left loop on account of a Shastina error, record it */
+  if (status && (ent.status < 0)) {
+    status = 0;
+    *per = ERR_SN_MAX + ent.status;
+    *pln = snparser_count(pp);
+  }
+  
+  /* If there was nothing after the header, empty error */
+  if (status && (!header_done)) {
+    status = 0;
+    *per = ERR_EMPTY;
+    *pln = snparser_count(pp);
+  }
+  
+  /* Check that stack is empty */
+  if (status && (pr->stack_count > 0)) {
+    status = 0;
+    *per = ERR_REMAIN;
+    *pln = snparser_count(pp);
+  }
+  
+  /* In streaming mode, wait for the sequencer to catch up with all the
+   * notes, which may report that there were too many notes */
+  if (pr->synth_open) {
+    if (!seq_join(pr->pRender->pSeq)) {
+      if (status) {
+        status = 0;
+        *per = ERR_NOTES;
+        *pln = snparser_count(pp);
+      }
+    }
+  }
+  
+  /* Load all the external instruments that are still pending */
+  if (status) {
+    if (!load_pending(pr, per, pln, ppExternal)) {
+      status = 0;
+    }
+  }
+  
+  /* Compile the score if requested */
+  if (status && compile) {
+    if (!compile_score(pr, pOutPath)) {
+      status = 0;
+      *per = ERR_COMPILE;
+      *pln = snparser_count(pp);
+    }
+  }
+  
+  /* Finish synthesizing in streaming mode, which removes the output if
+   * there was an error; otherwise, synthesize */
+  if (pr->synth_open) {
+    synth_end(pr, status);
+    pr->synth_open = 0;
+    
+  } else if (status && (!compile) && (pOutPath != NULL)) {
+    if (!synthesize(pr, pOutPath)) {
+      status = 0;
+      *per = ERR_OUTFILE;
+      *pln = snparser_count(pp);
+    }
+  }
+  
+  /* Free parser if allocated */
+  snparser_free(pp);
+  pp = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Synthesize a compiled score file written by compile_score().
+ * 
+ * This takes the place of retro() when the score has been compiled, so
+ * it may not be called for the same library context as retro().  The
+ * header and the registers are read from the file, and then the note
+ * table is loaded out of a memory mapping of the file.  The mapping
+ * remains until the process exits.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pScorePath - the compiled score file path
+ * 
+ *   pOutPath - the output WAV file path
+ * 
+ *   per - pointer to the error status variable
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+static int play_score(
+          RETROLIB * pr,
+    const char     * pScorePath,
+    const char     * pOutPath,
+          int      * per) {
+  
+  int status = 1;
+  long pos = 0;
+  size_t len = 0;
+  FILE *pf = NULL;
+  const unsigned char *pm = NULL;
+  SCORE_HEAD sh;
+  
+  /* Initialize structures */
+  memset(&sh, 0, sizeof(SCORE_HEAD));
+  
+  /* Check parameters */
+  if ((pScorePath == NULL) || (pOutPath == NULL) || (per == NULL)) {
+    abort();
+  }
+  
+  /* Open the compiled score and read the header */
+  pf = fopen(pScorePath, "rb");
+  if (pf == NULL) {
+    status = 0;
+  }
+  if (status) {
+    if (fread(&sh, sizeof(SCORE_HEAD), 1, pf) != 1) {
+      status = 0;
+    }
+  }
+  
+  /* Check the header */
+  if (status) {
+    if ((memcmp(sh.magic, SCORE_MAGIC, strlen(SCORE_MAGIC) + 1) != 0) ||
+        (sh.version != SCORE_VERSION) ||
+        (sh.order != SCORE_ORDER)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (((sh.rate != RATE_DVD) && (sh.rate != RATE_CD)) ||
+        (sh.sqamp < 1) || (sh.sqamp > INT16_MAX) ||
+        (sh.frame_before < 0) || (sh.frame_after < 0) ||
+        (sh.cutoff < 0) || (sh.cutoff > SEQ_CUTOFF_MAX) ||
+        (sh.note_offset < (int64_t) sizeof(SCORE_HEAD))) {
+      status = 0;
+    }
+  }
+  
+  /* Configure the header and restore the registers, which must end
+   * before the note table */
+  if (status) {
+    header_config(pr, sh.rate, sh.sqamp, sh.nostereo,
+                    sh.frame_before, sh.frame_after, sh.cutoff, 0);
+    if (sh.use_sqwave) {
+      pr->use_sqwave = 1;
+    }
+    if ((!instr_restore(pr->pRender->pInstr, pf)) ||
+        (!layer_restore(pr->pRender->pLayer, pf))) {
+      status = 0;
+    }
+  }
+  if (status) {
+    pos = ftell(pf);
+    if ((pos < 0) || ((int64_t) pos > sh.note_offset)) {
+      status = 0;
+    }
+  }
+  
+  /* Close the file */
+  if (pf != NULL) {
+    fclose(pf);
+    pf = NULL;
+  }
+  
+  /* Map the file and load the note table */
+  if (status) {
+    pm = (const unsigned char *) os_mapfile(pScorePath, &len);
+    if ((pm == NULL) || (sh.note_offset > (int64_t) len)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!seq_load(pr->pRender->pSeq, pm + ((size_t) sh.note_offset),
+                    len - ((size_t) sh.note_offset))) {
+      status = 0;
+    }
+  }
+  
+  /* The sequencer has its own copy of the notes, so unmap the file */
+  if (pm != NULL) {
+    os_unmapfile(pm, len);
+    pm = NULL;
+  }
+  
+  /* Report a compiled score error */
+  if (!status) {
+    *per = ERR_SCORE;
+  }
+  
+  /* Synthesize */
+  if (status) {
+    if (!synthesize(pr, pOutPath)) {
+      status = 0;
+      *per = ERR_OUTFILE;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write a silent sample to a caller buffer.
+ * 
+ * Parameters:
+ * 
+ *   pBuf - the caller buffer
+ * 
+ *   format - SEQ_PULL_S16 or SEQ_PULL_FLOAT
+ * 
+ *   i - the index of the sample in the buffer
+ */
+static void pull_zero(void *pBuf, int format, int32_t i) {
+  
+  if (format == SEQ_PULL_S16) {
+    ((int16_t *) pBuf)[i] = 0;
+    
+  } else if (format == SEQ_PULL_FLOAT) {
+    ((float *) pBuf)[i] = 0.0f;
+    
+  } else {
+    abort();  /* unrecognized format */
+  }
+}
+
+/*
+ * Pull the next frames of output into a caller buffer.
+ * 
+ * A script must have been loaded with retrolib_load().  The output is
+ * the silence before the music, the music, and then the silence after
+ * the music, as it would be written to a WAV file, except that the
+ * samples are scaled with the level of the context rather than
+ * normalized.  See retrolib_pull16() for details.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pBuf - the caller buffer
+ * 
+ *   format - SEQ_PULL_S16 or SEQ_PULL_FLOAT
+ * 
+ *   frames - the maximum number of frames to pull
+ * 
+ * Return:
+ * 
+ *   the number of frames written to the buffer, which is less than
+ *   frames only when the output has ended
+ */
+static int32_t pull_frames(
+    RETROLIB * pr,
+    void     * pBuf,
+    int        format,
+    int32_t    frames) {
+  
+  int32_t result = 0;
+  int32_t got = 0;
+  int32_t channels = 2;
+  int32_t c = 0;
+  void *pDest = NULL;
+  
+  /* Check parameters and state */
+  if ((pr == NULL) || (pBuf == NULL) || (frames < 0)) {
+    abort();
+  }
+  if (pr->pull == PULL_NONE) {
+    abort();
+  }
+  
+  /* Determine the number of samples in a frame */
+  if (pr->nostereo) {
+    channels = 1;
+  }
+  if (frames > INT32_MAX / channels) {
+    abort();
+  }
+  
+  /* On the first pull, prepare the render context, remove notes that
+   * can only produce silence, and start with the silence before */
+  if (pr->pull == PULL_READY) {
+    synth_prepare(pr);
+    synth_cull(pr);
+    pr->before = pr->frame_before;
+    pr->after = pr->frame_after;
+    pr->pull = PULL_MUSIC;
+  }
+  
+  /* Pull any silence before the music */
+  while ((pr->before > 0) && (result < frames)) {
+    for(c = 0; c < channels; c++) {
+      pull_zero(pBuf, format, (result * channels) + c);
+    }
+    (pr->before)--;
+    result++;
+  }
+  
+  /* Pull the music straight from the sequencer into the rest of the
+   * buffer; the music is finished once the sequencer returns fewer
+   * frames than requested */
+  if ((pr->pull == PULL_MUSIC) && (result < frames)) {
+    if (format == SEQ_PULL_S16) {
+      pDest = (void *) (((int16_t *) pBuf) + (result * channels));
+    } else {
+      pDest = (void *) (((float *) pBuf) + (result * channels));
+    }
+    
+    got = seq_pull(pr->pRender->pSeq, pDest, format,
+                    frames - result, pr->sqamp, pr->level);
+    if (got < frames - result) {
+      pr->pull = PULL_DONE;
+    }
+    result = result + got;
+  }
+  
+  /* Pull any silence after the music */
+  if (pr->pull == PULL_DONE) {
+    while ((pr->after > 0) && (result < frames)) {
+      for(c = 0; c < channels; c++) {
+        pull_zero(pBuf, format, (result * channels) + c);
+      }
+      (pr->after)--;
+      result++;
+    }
+  }
+  
+  /* Return the number of frames pulled */
+  return result;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * retrolib_errstr function.
+ */
+const char *retrolib_errstr(int code) {
+
+  
+  const char *pResult = NULL;
+  
+  if ((code >= ERR_SN_MIN) && (code <= ERR_SN_MAX)) {
+    pResult = snerror_str(code - ERR_SN_MAX);
+    
+  } else if ((code >= ERR_GENMAP_MIN) && (code <= ERR_GENMAP_MAX)) {
+    pResult = genmap_errstr(code - ERR_GENMAP_MIN);
+  
+  } else if ((code >= ERR_INSTR_MIN) && (code <= ERR_INSTR_MAX)) {
+    pResult = instr_errstr(code - ERR_INSTR_MIN);
+  
+  } else {
+  
+    switch (code) {
+      
+      case ERR_OK:
+        pResult = "No error";
+        break;
+      
+      case ERR_ENTITY:
+        pResult = "Unsupported Shastina entity type";
+        break;
+      
+      case ERR_METAMID:
+        pResult = "Metacommand after header";
+        break;
+      
+      case ERR_NORATE:
+        pResult = "Sampling rate not defined in header";
+        break;
+      
+      case ERR_NOAMP:
+        pResult = "Output amplitude not defined in header";
+        break;
+        
+      case ERR_NOSIG:
+        pResult = "Missing file type signature on input";
+        break;
+      
+      case ERR_BADMETA:
+        pResult = "Metacommand not recognized";
+        break;
+      
+      case ERR_MPARAMC:
+        pResult = "Too many metacommand parameters";
+        break;
+      
+      case ERR_METAINT:
+        pResult = "Can't parse metacommand parameter as integer";
+        break;
+      
+      case ERR_METAPRM:
+        pResult = "Wrong number of parameters for metacommand";
+        break;
+      
+      case ERR_EMPTYMT:
+        pResult = "Empty metacommand";
+        break;
+      
+      case ERR_METAMUL:
+        pResult = "Metacommand used multiple times";
+        break;
+      
+      case ERR_BADRATE:
+        pResult = "Invalid sampling rate";
+        break;
+        
+      case ERR_BADAMP:
+        pResult = "Invalid output amplitude";
+        break;
+      
+      case ERR_BADFRM:
+        pResult = "Invalid frame definition";
+        break;
+      
+      case ERR_EMPTY:
+        pResult = "Nothing in file after header";
+        break;
+      
+      case ERR_NUM:
+        pResult = "Can't parse numeric entity";
+        break;
+      
+      case ERR_OVERFLW:
+        pResult = "Stack overflow";
+        break;
+      
+      case ERR_GROUP:
+        pResult = "Group closed improperly";
+        break;
+        
+      case ERR_BADOP:
+        pResult = "Unrecognized operation";
+        break;
+      
+      case ERR_OPPARAM:
+        pResult = "Operation doesn't have enough parameters";
+        break;
+      
+      case ERR_PARAMT:
+        pResult = "Wrong parameter type for operation";
+        break;
+      
+      case ERR_LAYERC:
+        pResult = "Invalid parameter count for layer op";
+        break;
+      
+      case ERR_BADT:
+        pResult = "t parameter value is negative or too large";
+        break;
+      
+      case ERR_BADFRAC:
+        pResult = "Fraction parameter value out of range";
+        break;
+      
+      case ERR_REMAIN:
+        pResult = "Elements remaining on stack at end";
+        break;
+      
+      case ERR_BADDUR:
+        pResult = "Duration is less than one";
+        break;
+      
+      case ERR_LONGDUR:
+        pResult = "Duration is too long";
+        break;
+      
+      case ERR_PITCH:
+        pResult = "Pitch out of range";
+        break;
+      
+      case ERR_INSTR:
+        pResult = "Instrument index out of range";
+        break;
+      
+      case ERR_LAYER:
+        pResult = "Layer index out of range";
+        break;
+      
+      case ERR_NOTES:
+        pResult = "Too many notes";
+        break;
+      
+      case ERR_PITCHR:
+        pResult = "Invalid pitch range";
+        break;
+      
+      case ERR_IRANGE:
+        pResult = "Invalid intensity range";
+        break;
+      
+      case ERR_GRAPH:
+        pResult = "Invalid graph";
+        break;
+      
+      case ERR_OUTFILE:
+        pResult = "Can't open output file";
+        break;
+      
+      case ERR_STRPFXN:
+        pResult = "Can't parse numeric string prefix";
+        break;
+      
+      case ERR_BADCUT:
+        pResult = "Invalid cutoff threshold";
+        break;
+      
+      case ERR_COMPILE:
+        pResult = "Can't write compiled score";
+        break;
+      
+      case ERR_SCORE:
+        pResult = "Can't read compiled score";
+        break;
+      
+      case ERR_ORDER:
+        pResult = "Note out of time order in streaming mode";
+        break;
+      
+      case ERR_STREAMR:
+        pResult =
+          "Instrument or layer changed after notes in streaming mode";
+        break;
+      
+      case ERR_STREAMC:
+        pResult = "Can't compile a streaming score";
+        break;
+      
+      case ERR_BIGINT:
+        pResult = "Integer parameter out of range";
+        break;
+      
+      default:
+        pResult = "Unknown error";
+    }
+  }
+  
+  return pResult;
+}
+
+
+/*
+ * retrolib_alloc function.
+ */
+RETROLIB *retrolib_alloc(void) {
+  
+  RETROLIB *pr = NULL;
+  
+  /* Allocate the library context */
+  pr = (RETROLIB *) malloc(sizeof(RETROLIB));
+  if (pr == NULL) {
+    abort();
+  }
+  memset(pr, 0, sizeof(RETROLIB));
+  
+  /* Initialize the context with a new render context */
+  pr->pRender = render_alloc();
+  pr->pModule = NULL;
+  pr->used = 0;
+  pr->pWav = NULL;
+  pr->pBuf = NULL;
+  pr->init = 0;
+  pr->pull = PULL_NONE;
+  pr->level = RETROLIB_LEVEL_DEFAULT;
+  
+  /* Return the new context */
+  return pr;
+}
+
+/*
+ * retrolib_free function.
+ */
+void retrolib_free(RETROLIB *pr) {
+  
+  /* Only proceed if not NULL */
+  if (pr != NULL) {
+    
+    /* Release the render context */
+    render_free(pr->pRender);
+    pr->pRender = NULL;
+    
+    /* Release the library context */
+    free(pr);
+  }
+}
+
+/*
+ * retrolib_render function.
+ */
+RENDER *retrolib_render(RETROLIB *pr) {
+  
+  /* Check parameter */
+  if (pr == NULL) {
+    abort();
+  }
+  
+  /* Return the render context */
+  return pr->pRender;
+}
+
+/*
+ * retrolib_report function.
+ */
+void retrolib_report(RETROLIB *pr, const char *pModule) {
+  
+  /* Check parameter */
+  if (pr == NULL) {
+    abort();
+  }
+  
+  /* Set the diagnostic prefix */
+  pr->pModule = pModule;
+}
+
+/*
+ * retrolib_warm function.
+ */
+void retrolib_warm(RETROLIB *pr, const char *pCache) {
+  
+  /* Check parameter */
+  if (pr == NULL) {
+    abort();
+  }
+  
+  /* Build the square wave tables for each rate */
+  sqwave_warm(pCache, SQWAVE_AMP_INIT, RATE_DVD);
+  sqwave_warm(pCache, SQWAVE_AMP_INIT, RATE_CD);
+  
+  /* Load the external instruments for each rate */
+  instr_preload(pr->pRender->pInstr, RATE_DVD);
+  instr_preload(pr->pRender->pInstr, RATE_CD);
+}
+
+/*
+ * retrolib_run function.
+ */
+int retrolib_run(
+          RETROLIB *  pr,
+          SNSOURCE *  pIn,
+    const char     *  pOutPath,
+          int         compile,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal) {
+  
+  /* Check parameters and state */
+  if ((pr == NULL) || (pIn == NULL) || (pOutPath == NULL)) {
+    abort();
+  }
+  if (pr->used) {
+    abort();
+  }
+  pr->used = 1;
+  
+  /* Call through */
+  return retro(pr, pIn, pOutPath, compile, per, pln, ppExternal);
+}
+
+/*
+ * retrolib_play function.
+ */
+int retrolib_play(
+          RETROLIB * pr,
+    const char     * pScorePath,
+    const char     * pOutPath,
+          int      * per) {
+  
+  int dummy = 0;
+  
+  /* Check parameters and state */
+  if ((pr == NULL) || (pScorePath == NULL) || (pOutPath == NULL)) {
+    abort();
+  }
+  if (pr->used) {
+    abort();
+  }
+  pr->used = 1;
+  
+  /* Redirect error to dummy if not defined */
+  if (per == NULL) {
+    per = &dummy;
+  }
+  *per = ERR_OK;
+  
+  /* Call through */
+  return play_score(pr, pScorePath, pOutPath, per);
+}
+
+/*
+ * retrolib_load function.
+ */
+int retrolib_load(
+          RETROLIB *  pr,
+    const char     *  pText,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal) {
+  
+  int status = 1;
+  SNSOURCE *pIn = NULL;
+  
+  /* Check parameters and state */
+  if ((pr == NULL) || (pText == NULL)) {
+    abort();
+  }
+  if (pr->used) {
+    abort();
+  }
+  pr->used = 1;
+  
+  /* Wrap the script in Shastina source */
+  pIn = snsource_string(pText);
+  
+  /* Interpret the script into the render context without any output */
+  if (!retro(pr, pIn, NULL, 0, per, pln, ppExternal)) {
+    status = 0;
+  }
+  
+  /* Release source */
+  snsource_free(pIn);
+  pIn = NULL;
+  
+  /* Samples may now be pulled if successful */
+  if (status) {
+    pr->pull = PULL_READY;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * retrolib_rate function.
+ */
+int32_t retrolib_rate(RETROLIB *pr) {
+  
+  /* Check parameter and state */
+  if (pr == NULL) {
+    abort();
+  }
+  if (pr->pull == PULL_NONE) {
+    abort();
+  }
+  
+  /* Return the sampling rate */
+  return pr->rate;
+}
+
+/*
+ * retrolib_channels function.
+ */
+int retrolib_channels(RETROLIB *pr) {
+  
+  int result = 2;
+  
+  /* Check parameter and state */
+  if (pr == NULL) {
+    abort();
+  }
+  if (pr->pull == PULL_NONE) {
+    abort();
+  }
+  
+  /* Only one channel if stereo is disabled */
+  if (pr->nostereo) {
+    result = 1;
+  }
+  
+  /* Return the number of channels */
+  return result;
+}
+
+/*
+ * retrolib_level function.
+ */
+void retrolib_level(RETROLIB *pr, int32_t level) {
+  
+  /* Check parameters */
+  if ((pr == NULL) || (level < 1)) {
+    abort();
+  }
+  
+  /* Set the level */
+  pr->level = level;
+}
+
+/*
+ * retrolib_pull16 function.
+ */
+int32_t retrolib_pull16(RETROLIB *pr, int16_t *pBuf, int32_t frames) {
+  return pull_frames(pr, (void *) pBuf, SEQ_PULL_S16, frames);
+}
+
+/*
+ * retrolib_pullf function.
+ */
+int32_t retrolib_pullf(RETROLIB *pr, float *pBuf, int32_t frames) {
+  return pull_frames(pr, (void *) pBuf, SEQ_PULL_FLOAT, frames);
+}
@@ -0,0 +1,406 @@
+#ifndef RETROLIB_H_INCLUDED
+#define RETROLIB_H_INCLUDED
+
+/*
+ * retrolib.h
+ * 
+ * Library module of the Retro synthesizer.
+ * 
+ * This module holds the interpreter for Shastina scripts in the
+ * %retro-synth; format, so that the synthesizer can be embedded in
+ * other programs.  The retro program is a thin front end to it.
+ * 
+ * Library contexts
+ * ================
+ * 
+ * A RETROLIB object is a library context, which interprets one script
+ * into a render context of its own.  See render.h for render contexts.
+ * Each library context may only be used once, in one of these ways:
+ * 
+ *   (1) retrolib_run() synthesizes a script to a WAV file, or compiles
+ *       it to a compiled score
+ * 
+ *   (2) retrolib_play() synthesizes a compiled score to a WAV file
+ * 
+ *   (3) retrolib_load() interprets a script held in memory, and then
+ *       retrolib_pull16() or retrolib_pullf() pull the audio a block
+ *       of frames at a time into caller-provided buffers
+ * 
+ * A library context must only be used by one thread at a time.
+ * Different library contexts share no mutable state, so they may run
+ * at the same time in different threads, as render contexts may.
+ * 
+ * Pulling audio
+ * =============
+ * 
+ * Pulled audio is sequenced straight into the caller buffer, without
+ * going through a sample buffer or a WAV file.  The frames are the
+ * same as the frames of the WAV file that retrolib_run() would write,
+ * including the silence of the %frame; header command, except for the
+ * scaling of the samples.  Pulled audio is not limited by the maximum
+ * size of a WAV file, and the 64-bit timeline of the sequencer allows
+ * music of practically any length.  See seq.h.
+ * 
+ * A WAV file is normalized so that its loudest sample has the
+ * amplitude of the %sqamp; header command, which requires the whole
+ * music to be synthesized before the first sample is written.  Pulled
+ * audio is instead scaled by a fixed gain, so that a mixed sample
+ * value equal to the level of the library context is output at the
+ * %sqamp; amplitude.  See retrolib_level().  The %stream; header
+ * command is ignored when pulling.
+ */
+
+#include "retrodef.h"
+#include "render.h"
+#include "shastina.h"
+
+/*
+ * The default level of a library context.
+ * 
+ * This is the amplitude that square wave instruments are synthesized
+ * at, so that a single square wave note at full intensity is output at
+ * about the %sqamp; amplitude.  See retrolib_level().
+ */
+#define RETROLIB_LEVEL_DEFAULT (INT32_C(20000))
+
+/*
+ * Structure prototype for RETROLIB.
+ * 
+ * See the top of this header for further information.
+ */
+struct RETROLIB_TAG;
+typedef struct RETROLIB_TAG RETROLIB;
+
+/*
+ * Allocate a new library context.
+ * 
+ * A new render context is allocated for it.  The context doesn't
+ * report diagnostics until retrolib_report() is called.  Release the
+ * context with retrolib_free().
+ * 
+ * Return:
+ * 
+ *   the new library context
+ */
+RETROLIB *retrolib_alloc(void);
+
+/*
+ * Release a library context.
+ * 
+ * The render context of the library context is released too.  If NULL
+ * is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context, or NULL
+ */
+void retrolib_free(RETROLIB *pr);
+
+/*
+ * Get the render context of a library context.
+ * 
+ * This may be used to configure the instrument, layer, and square wave
+ * contexts before the library context is used, for example to set the
+ * search path with instr_addsearch().  The render context remains
+ * owned by the library context.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   the render context
+ */
+RENDER *retrolib_render(RETROLIB *pr);
+
+/*
+ * Set the name to prefix to diagnostic reports.
+ * 
+ * Diagnostics such as the number of silent notes that were culled are
+ * reported on standard error with this prefix.  If pModule is NULL,
+ * which is the default, nothing is reported.  The string must remain
+ * valid while the library context is used.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pModule - the name to prefix, or NULL
+ */
+void retrolib_report(RETROLIB *pr, const char *pModule);
+
+/*
+ * Build ahead of time what scripts would otherwise build for
+ * themselves.
+ * 
+ * For each sampling rate a script header can choose, the square wave
+ * tables are built with sqwave_warm(), and every external instrument on
+ * the search path is loaded with instr_preload().  Scripts that are
+ * then synthesized with this library context, or with a copy of the
+ * process made after this call, start with all of these.
+ * 
+ * The render context should be fully configured with retrolib_render()
+ * before this call.  pCache is the cache directory that was given to
+ * the square wave context, or NULL if there is none.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pCache - the cache directory, or NULL
+ */
+void retrolib_warm(RETROLIB *pr, const char *pCache);
+
+/*
+ * Interpret a Shastina script and synthesize it to a WAV file.
+ * 
+ * pIn is the Shastina source to read to program the synthesizer.  The
+ * source does not need to support multipass.
+ * 
+ * pOutPath is the path to the output WAV file to create.  If a WAV file
+ * already exists at that location, it will be overwritten.  If compile
+ * is non-zero, the interpreted state is written to a compiled score
+ * file at pOutPath instead of being synthesized.
+ * 
+ * per points to the variable to receive the error status.  If the
+ * status is not required, it may be NULL.  Use retrolib_errstr() to get
+ * an error string for the error code.
+ * 
+ * pln points to the variable to receive the line number, if there is a
+ * line number in the input file associated with the error.  It may be
+ * NULL if not required.  -1 or LONG_MAX is returned if there is no line
+ * number associated with the error.
+ * 
+ * ppExternal points to a string pointer that will by default be cleared
+ * to NULL.  If a parsing error occurs in an external instrument script,
+ * a dynamic copy of the instrument name will be made and a pointer to
+ * it placed in this variable.  Caller has responsibility for freeing
+ * this if it is allocated.  If this parameter is NULL, it will not be
+ * used.
+ * 
+ * A fault occurs if the library context has already been used.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pIn - the input Shastina source to program the synthesizer
+ * 
+ *   pOutPath - the output WAV file path
+ * 
+ *   compile - non-zero to write a compiled score instead
+ * 
+ *   per - pointer to the error status variable, or NULL
+ * 
+ *   pln - pointer to line number status variable, or NULL
+ * 
+ *   ppExternal - pointer to variable to receive external script name,
+ *   or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+int retrolib_run(
+          RETROLIB *  pr,
+          SNSOURCE *  pIn,
+    const char     *  pOutPath,
+          int         compile,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal);
+
+/*
+ * Synthesize a compiled score to a WAV file.
+ * 
+ * pScorePath is a compiled score written by retrolib_run().  The
+ * compiled score is mapped into memory while its notes are loaded.
+ * 
+ * per points to the variable to receive the error status, or it may be
+ * NULL if not required.  Use retrolib_errstr() to get an error string
+ * for the error code.
+ * 
+ * A fault occurs if the library context has already been used.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pScorePath - the compiled score file path
+ * 
+ *   pOutPath - the output WAV file path
+ * 
+ *   per - pointer to the error status variable, or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+int retrolib_play(
+          RETROLIB * pr,
+    const char     * pScorePath,
+    const char     * pOutPath,
+          int      * per);
+
+/*
+ * Interpret a Shastina script held in memory, so that its audio can be
+ * pulled with retrolib_pull16() or retrolib_pullf().
+ * 
+ * pText is the nul-terminated script.  It is only read during this
+ * call.  External instruments are loaded during this call too.  The
+ * %stream; header command is ignored.
+ * 
+ * per, pln, and ppExternal work the same way as for retrolib_run().
+ * 
+ * A fault occurs if the library context has already been used.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pText - the script
+ * 
+ *   per - pointer to the error status variable, or NULL
+ * 
+ *   pln - pointer to line number status variable, or NULL
+ * 
+ *   ppExternal - pointer to variable to receive external script name,
+ *   or NULL
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if error
+ */
+int retrolib_load(
+          RETROLIB *  pr,
+    const char     *  pText,
+          int      *  per,
+          long     *  pln,
+          char     ** ppExternal);
+
+/*
+ * Get the sampling rate of the audio pulled from a library context.
+ * 
+ * A script must have been loaded with retrolib_load(), or a fault
+ * occurs.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   the sampling rate in hertz, RATE_DVD or RATE_CD
+ */
+int32_t retrolib_rate(RETROLIB *pr);
+
+/*
+ * Get the number of channels of the audio pulled from a library
+ * context.
+ * 
+ * A script must have been loaded with retrolib_load(), or a fault
+ * occurs.  There is one channel if the header has the %nostereo;
+ * command, else two.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ * Return:
+ * 
+ *   the number of channels, 1 or 2
+ */
+int retrolib_channels(RETROLIB *pr);
+
+/*
+ * Set the level of a library context.
+ * 
+ * The level is the mixed sample value that is output at the %sqamp;
+ * amplitude when audio is pulled.  Each sample is multiplied by the
+ * amplitude and divided by the level, with 16-bit samples truncated
+ * and clamped as when a WAV file is written.  Lower levels make the
+ * output louder.  The default is RETROLIB_LEVEL_DEFAULT.
+ * 
+ * If the level is the greatest absolute sample value of the music,
+ * the 16-bit samples are exactly the samples of the WAV file.  The
+ * level may be changed between pulls.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   level - the level, greater than zero
+ */
+void retrolib_level(RETROLIB *pr, int32_t level);
+
+/*
+ * Pull the next frames of audio into a buffer of 16-bit samples.
+ * 
+ * A script must have been loaded with retrolib_load(), or a fault
+ * occurs.  Each call continues where the previous one stopped.  The
+ * first call prepares the render context, so the render context must
+ * not be changed after the script has been loaded.
+ * 
+ * pBuf must have room for frames frames, where a frame is one sample
+ * for each channel, see retrolib_channels().  Stereo samples are
+ * interleaved with the left channel first.  Samples are in range
+ * [-32767, 32767], scaled according to retrolib_level().
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pBuf - the buffer to pull samples into
+ * 
+ *   frames - the maximum number of frames to pull
+ * 
+ * Return:
+ * 
+ *   the number of frames written to the buffer, which is less than
+ *   frames only when the audio has ended
+ */
+int32_t retrolib_pull16(RETROLIB *pr, int16_t *pBuf, int32_t frames);
+
+/*
+ * Pull the next frames of audio into a buffer of float samples.
+ * 
+ * This is the same as retrolib_pull16(), except that samples are
+ * floats where 32767 in 16-bit samples is 1.0, and samples are not
+ * clamped.  Both functions may be used on the same library context.
+ * 
+ * Parameters:
+ * 
+ *   pr - the library context
+ * 
+ *   pBuf - the buffer to pull samples into
+ * 
+ *   frames - the maximum number of frames to pull
+ * 
+ * Return:
+ * 
+ *   the number of frames written to the buffer, which is less than
+ *   frames only when the audio has ended
+ */
+int32_t retrolib_pullf(RETROLIB *pr, float *pBuf, int32_t frames);
+
+/*
+ * Convert an error code returned by this module into a string.
+ * 
+ * The string has the first letter capitalized, but no punctuation or
+ * line break at the end.
+ * 
+ * If the code is zero, then "No error" is returned.  If the code is
+ * unrecognized, then "Unknown error" is returned.
+ * 
+ * Parameters:
+ * 
+ *   code - the error code
+ * 
+ * Return:
+ * 
+ *   an error message
+ */
+const char *retrolib_errstr(int code);
+
+#endif
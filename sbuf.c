@@ -5,7 +5,6 @@
  */
 
 #include "sbuf.h"
-#include "wavwrite.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,34 +39,41 @@ typedef struct {
 } SBUF_SAMP;
 
 /*
- * Static data
- * ===========
- */
-
-/*
- * The state of the module.
- * 
- * This is one of the SBUF_STATE constants.
- */
-static int m_sbuf_state = SBUF_STATE_NONE;
-
-/*
- * The temporary buffer file.
+ * SBUF structure.
  * 
- * Only valid if m_sbuf_state is OPEN or STREAM.
- */
-static FILE *m_sbuf_fp = NULL;
-
-/*
- * The total number of samples that have been written to the buffer.
+ * Prototype given in the header.
  */
-static int32_t m_sbuf_count = 0;
-
-/*
- * The maximum absolute sample value that has been written to the
- * buffer.
- */
-static int32_t m_sbuf_maxval = 0;
+struct SBUF_TAG {
+  
+  /*
+   * The state of the object.
+   * 
+   * This is one of the SBUF_STATE constants.
+   */
+  int state;
+  
+  /*
+   * The temporary buffer file.
+   */
+  FILE *fp;
+  
+  /*
+   * The total number of samples that have been written to the buffer.
+   */
+  int32_t count;
+  
+  /*
+   * The maximum absolute sample value that has been written to the
+   * buffer.
+   */
+  int32_t maxval;
+  
+  /*
+   * Non-zero if the buffer is in mono-aural mode, where only a single
+   * value is stored for each sample.
+   */
+  int mono;
+};
 
 /*
  * Public function implementations
@@ -79,43 +85,50 @@ static int32_t m_sbuf_maxval = 0;
 /*
  * sbuf_init function.
  */
-void sbuf_init(void) {
+SBUF *sbuf_init(void) {
   
-  /* Check state */
-  if (m_sbuf_state != SBUF_STATE_NONE) {
+  SBUF *ps = NULL;
+  
+  /* Allocate the object */
+  ps = (SBUF *) malloc(sizeof(SBUF));
+  if (ps == NULL) {
     abort();
   }
+  memset(ps, 0, sizeof(SBUF));
   
   /* Open the temporary file */
-  m_sbuf_fp = tmpfile();
-  if (m_sbuf_fp == NULL) {
+  ps->fp = tmpfile();
+  if (ps->fp == NULL) {
     abort();
   }
   
   /* Set the new state */
-  m_sbuf_state = SBUF_STATE_OPEN;
+  ps->state = SBUF_STATE_OPEN;
+  ps->count = 0;
+  ps->maxval = 0;
+  ps->mono = 0;
+  
+  /* Return the new object */
+  return ps;
 }
 
 /*
  * sbuf_close function.
  */
-void sbuf_close(void) {
+void sbuf_close(SBUF *ps) {
   
-  /* Close the temporary file if open */
-  if ((m_sbuf_state == SBUF_STATE_OPEN) ||
-      (m_sbuf_state == SBUF_STATE_STREAM)) {
-    fclose(m_sbuf_fp);
-    m_sbuf_fp = NULL;
+  /* Close the temporary file and release the object if not NULL */
+  if (ps != NULL) {
+    fclose(ps->fp);
+    ps->fp = NULL;
+    free(ps);
   }
-  
-  /* Set the new state */
-  m_sbuf_state = SBUF_STATE_CLOSED;
 }
 
 /*
  * sbuf_sample function.
  */
-void sbuf_sample(int32_t l, int32_t r) {
+void sbuf_sample(SBUF *ps, int32_t l, int32_t r) {
   
   int32_t av = 0;
   SBUF_SAMP sbs;
@@ -124,7 +137,10 @@ void sbuf_sample(int32_t l, int32_t r) {
   memset(&sbs, 0, sizeof(SBUF_SAMP));
   
   /* Check state */
-  if (m_sbuf_state != SBUF_STATE_OPEN) {
+  if (ps == NULL) {
+    abort();
+  }
+  if (ps->state != SBUF_STATE_OPEN) {
     abort();
   }
   
@@ -145,29 +161,56 @@ void sbuf_sample(int32_t l, int32_t r) {
   }
   
   /* Update maxval statistic */
-  if (m_sbuf_maxval < av) {
-    m_sbuf_maxval = av;
+  if (ps->maxval < av) {
+    ps->maxval = av;
   }
   
   /* Update count, watching for overflow */
-  if (m_sbuf_count < INT32_MAX) {
-    m_sbuf_count++;
+  if (ps->count < INT32_MAX) {
+    ps->count++;
   } else {
     abort();  /* count overflow */
   }
   
-  /* Write the sample */
-  sbs.l = l;
-  sbs.r = r;
-  if (fwrite(&sbs, sizeof(SBUF_SAMP), 1, m_sbuf_fp) != 1) {
-    abort();  /* I/O error */
+  /* Write the sample, which is just one value in mono-aural mode */
+  if (ps->mono) {
+    if (l != r) {
+      abort();
+    }
+    if (fwrite(&l, sizeof(int32_t), 1, ps->fp) != 1) {
+      abort();  /* I/O error */
+    }
+    
+  } else {
+    sbs.l = l;
+    sbs.r = r;
+    if (fwrite(&sbs, sizeof(SBUF_SAMP), 1, ps->fp) != 1) {
+      abort();  /* I/O error */
+    }
+  }
+}
+
+/*
+ * sbuf_mono function.
+ */
+void sbuf_mono(SBUF *ps) {
+  
+  /* Check state */
+  if (ps == NULL) {
+    abort();
   }
+  if ((ps->state != SBUF_STATE_OPEN) || (ps->count > 0)) {
+    abort();
+  }
+  
+  /* Switch to mono-aural mode */
+  ps->mono = 1;
 }
 
 /*
  * sbuf_stream function.
  */
-void sbuf_stream(int32_t amp) {
+void sbuf_stream(SBUF *ps, int32_t amp, WAVWRITE *pw) {
   
   int32_t x = 0;
   int32_t lq = 0;
@@ -178,42 +221,54 @@ void sbuf_stream(int32_t amp) {
   memset(&sbs, 0, sizeof(SBUF_SAMP));
   
   /* Check state */
-  if (m_sbuf_state != SBUF_STATE_OPEN) {
+  if (ps == NULL) {
+    abort();
+  }
+  if (ps->state != SBUF_STATE_OPEN) {
     abort();
   }
   
-  /* Check parameter */
-  if ((amp < 1) || (amp > INT16_MAX)) {
+  /* Check parameters */
+  if ((amp < 1) || (amp > INT16_MAX) || (pw == NULL)) {
     abort();
   }
   
   /* Only proceed if at least one sample recorded */
-  if (m_sbuf_count > 0) {
+  if (ps->count > 0) {
   
     /* If the maxval value is zero, set it to one to avoid weird
      * cases */
-    if (m_sbuf_maxval < 1) {
-      m_sbuf_maxval = 1;
+    if (ps->maxval < 1) {
+      ps->maxval = 1;
     }
   
     /* Rewind temporary file to the beginning */
-    if (fseek(m_sbuf_fp, 0, SEEK_SET)) {
+    if (fseek(ps->fp, 0, SEEK_SET)) {
       abort();  /* I/O error */
     }
     
     /* Transfer each sample to output, scaling each appropriately */
-    for(x = 0; x < m_sbuf_count; x++) {
+    for(x = 0; x < ps->count; x++) {
     
-      /* Read the next sample from the buffer */
-      if (fread(&sbs, sizeof(SBUF_SAMP), 1, m_sbuf_fp) != 1) {
-        abort();  /* I/O error */
+      /* Read the next sample from the buffer, duplicating the single
+       * value in mono-aural mode */
+      if (ps->mono) {
+        if (fread(&(sbs.l), sizeof(int32_t), 1, ps->fp) != 1) {
+          abort();  /* I/O error */
+        }
+        sbs.r = sbs.l;
+        
+      } else {
+        if (fread(&sbs, sizeof(SBUF_SAMP), 1, ps->fp) != 1) {
+          abort();  /* I/O error */
+        }
       }
     
       /* Scale the left and right channel values */
       lq = (int32_t) ((((int64_t) sbs.l) * ((int64_t) amp)) /
-                      ((int64_t) m_sbuf_maxval));
+                      ((int64_t) ps->maxval));
       rq = (int32_t) ((((int64_t) sbs.r) * ((int64_t) amp)) /
-                      ((int64_t) m_sbuf_maxval));
+                      ((int64_t) ps->maxval));
     
       /* Clamp to range */
       if (lq > INT16_MAX) {
@@ -228,10 +283,10 @@ void sbuf_stream(int32_t amp) {
       }
       
       /* Write scaled samples to output */
-      wavwrite_sample((int) lq, (int) rq);
+      wavwrite_sample(pw, (int) lq, (int) rq);
     }
   }
   
   /* Update state */
-  m_sbuf_state = SBUF_STATE_STREAM;
+  ps->state = SBUF_STATE_STREAM;
 }
@@ -8,67 +8,94 @@
  */
 
 #include "retrodef.h"
+#include "wavwrite.h"
 
 /*
- * Initialize the sample buffer module.
+ * Structure prototype for SBUF.
  * 
- * This must be called before any other function in this module, except
- * for sbuf_close().  The sbuf_close() function should be called before
- * the program ends.
+ * Each sample buffer object has its own temporary file, so any number
+ * of them may be open at the same time.
+ */
+struct SBUF_TAG;
+typedef struct SBUF_TAG SBUF;
+
+/*
+ * Create a sample buffer object.
+ * 
+ * The sbuf_close() function should be called on the returned object
+ * when finished with it.
+ * 
+ * Return:
  * 
- * A fault occurs if this is called a second time, or it is called after
- * the sbuf_close() function has been called.
+ *   the new sample buffer object
  */
-void sbuf_init(void);
+SBUF *sbuf_init(void);
 
 /*
- * Close down the sample buffer module.
+ * Close down a sample buffer object.
  * 
- * This function may be called at any time.  If it is called when the
- * module has already been closed down, it is ignored.  If it is called
- * before the module has been initialized, the module is immediately
- * closed.
+ * The object is released by this call, so it may not be used again.
+ * If NULL is passed, the call is ignored.
  * 
- * This should be called before the program finishes to make sure
- * everything is cleaned up.
+ * Parameters:
+ * 
+ *   ps - the sample buffer object, or NULL
  */
-void sbuf_close(void);
+void sbuf_close(SBUF *ps);
 
 /*
- * Record a 32-bit sample in the sample buffer.
+ * Record a 32-bit sample in a sample buffer.
  * 
- * The module must be initialized before calling this function, but the
- * module may not be closed down yet.  This function also may not be
- * called after sbuf_stream() has been called.
+ * This function may not be called after sbuf_stream() has been called
+ * on the object.
  * 
  * Parameters:
  * 
+ *   ps - the sample buffer object
+ * 
  *   l - the left channel value
  * 
  *   r - the right channel value
  */
-void sbuf_sample(int32_t l, int32_t r);
+void sbuf_sample(SBUF *ps, int32_t l, int32_t r);
+
+/*
+ * Switch a sample buffer to mono-aural mode.
+ * 
+ * No samples may have been recorded yet.  In mono-aural mode, only a
+ * single value is buffered for each sample, so the left and right
+ * channel values passed to sbuf_sample() must be equal or a fault
+ * occurs.  sbuf_stream() then outputs that value on both channels,
+ * which is what a WAV writer initialized with WAVWRITE_INIT_MONO
+ * expects.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sample buffer object
+ */
+void sbuf_mono(SBUF *ps);
 
 /*
  * Stream the buffered samples to output.
  * 
- * The module must be initialized before calling this function, and at
- * least one sample must have been recorded with sbuf_sample().  The
- * module may not be closed down yet.  This function may only be called
- * once.
+ * At least one sample must have been recorded with sbuf_sample().  This
+ * function may only be called once for each object.
  * 
  * amp is the target maximum amplitude in the output file.  This is in
  * range [1, INT16_MAX].  All 32-bit samples will be scaled to range
  * [-amp, amp] before being output.
  * 
- * The wavwrite_sample() function of the WAV writer module will be used
- * to record each sample to output.  The WAV writer module must be
- * initialized but not yet closed when sbuf_stream() is called.
+ * pw is the WAV writer object that each sample will be recorded to
+ * with wavwrite_sample().
  * 
  * Parameters:
  * 
+ *   ps - the sample buffer object
+ * 
  *   amp - the output amplitude
+ * 
+ *   pw - the WAV writer to output to
  */
-void sbuf_stream(int32_t amp);
+void sbuf_stream(SBUF *ps, int32_t amp, WAVWRITE *pw);
 
 #endif
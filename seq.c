@@ -7,8 +7,9 @@
  */
 
 #include "seq.h"
+#include "os.h"
 #include "sbuf.h"
-#include "stereo.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -24,9 +25,65 @@
 
 /*
  * The maximum buffer capacity, in notes.
+ * 
+ * Outside of streaming mode, a full buffer is spilled to the spill file
+ * as a sorted run, so this only limits memory use and not the number
+ * of notes.
  */
 #define SEQ_CAP_MAX (INT32_C(1048576))
 
+/*
+ * The number of notes that are read from the spill file at a time for
+ * each run while merging, and while culling the runs.
+ */
+#define SEQ_RUN_BUF (1024)
+
+/*
+ * The number of samples between checks of whether a note has fallen
+ * below the cutoff threshold.
+ * 
+ * Checking is much more expensive than rendering a single sample, so
+ * this should not be too small.
+ */
+#define SEQ_CUTOFF_INTERVAL (INT32_C(1024))
+
+/*
+ * The maximum number of samples that are rendered at a time.
+ * 
+ * Blocks also end early wherever a note starts, ends, or is due for a
+ * cutoff check, so the event list never changes within a block.
+ * 
+ * This must not exceed LAYER_BLOCK_MAX.
+ */
+#define SEQ_BLOCK (256)
+
+/*
+ * The capacity of the queue that passes notes to the worker thread in
+ * pipelined mode, in notes.
+ */
+#define SEQ_QUEUE (4096)
+
+/*
+ * The pull states.
+ * 
+ * INIT is before the first seq_pull(), MUSIC is while music is being
+ * pulled, EMPTY is when the first pull found no notes, and DONE is
+ * when everything has been pulled.
+ */
+#define SEQ_PSTATE_INIT   (0)
+#define SEQ_PSTATE_MUSIC  (1)
+#define SEQ_PSTATE_EMPTY  (2)
+#define SEQ_PSTATE_DONE   (3)
+
+/*
+ * The note flags.
+ * 
+ * CULLED marks a note that seq_cull() found can only produce silence.
+ * The note is not performed, but it stays in sequence so that it still
+ * takes its noise seeds when it would have started.
+ */
+#define SEQ_NOTE_CULLED (1)
+
 /*
  * Type declarations
  * =================
@@ -42,14 +99,14 @@ typedef struct {
    * 
    * Must be zero or greater.
    */
-  int32_t t;
+  int64_t t;
   
   /*
    * The duration in samples.
    * 
-   * Must be greater than zero, and (t+dur) must not exceed INT32_MAX.
+   * Must be greater than zero, and (t+dur) must not exceed MAX_TIME.
    */
-  int32_t dur;
+  int64_t dur;
   
   /*
    * The pitch in semitones from middle C.
@@ -70,10 +127,50 @@ typedef struct {
    * 
    * Must be in range [0, LAYER_MAXCOUNT - 1].
    */
-  int32_t layer;
+  uint16_t layer;
+  
+  /*
+   * The note flags.
+   * 
+   * Either zero or SEQ_NOTE_CULLED.
+   */
+  uint16_t flags;
   
 } SEQ_NOTE;
 
+/*
+ * A sorted run of notes in the spill file.
+ */
+typedef struct {
+  
+  /*
+   * The index of the first note of the run in the spill file.
+   */
+  int64_t base;
+  
+  /*
+   * The number of notes in the run.
+   */
+  int64_t len;
+  
+  /*
+   * The number of notes of the run that have been read into the merge
+   * buffer so far.
+   */
+  int64_t pos;
+  
+  /*
+   * The merge buffer, which is NULL until the first merge.
+   * 
+   * head is the index of the next note in the buffer, and fill is the
+   * number of notes that were read into the buffer.
+   */
+  SEQ_NOTE *pBuf;
+  int32_t head;
+  int32_t fill;
+  
+} SEQ_RUN;
+
 /*
  * The event structure.
  */
@@ -82,14 +179,26 @@ typedef struct SEQ_EVENT_TAG SEQ_EVENT;
 struct SEQ_EVENT_TAG {
   
   /*
-   * The index of the note that is being played.
+   * A copy of the note that is being played.
    */
-  int32_t note_i;
+  SEQ_NOTE note;
   
   /*
    * The greatest t offset of the envelope for this event.
    */
-  int32_t max_t;
+  int64_t max_t;
+  
+  /*
+   * The t value at which to next check whether this event has fallen
+   * below the cutoff threshold.
+   */
+  int64_t check_t;
+  
+  /*
+   * The left and right stereo gains of the note, from instr_pan().
+   */
+  int32_t gain_l;
+  int32_t gain_r;
   
   /*
    * Dynamically allocated instance data for the note being rendered, or
@@ -111,32 +220,189 @@ struct SEQ_EVENT_TAG {
 };
 
 /*
- * Static data
- * ===========
- */
-
-/*
- * The current capacity of the note buffer in notes.
- * 
- * If this is zero, the note buffer hasn't been allocated yet.
- */
-static int32_t m_seq_cap = 0;
-
-/*
- * The total number of notes in the note buffer.
- */
-static int32_t m_seq_count = 0;
-
-/*
- * The note buffer.
- * 
- * m_seq_cap is the total size of the buffer in notes.
- * 
- * m_seq_count is the total number of notes actually used.
+ * SEQ_CTX structure.
  * 
- * If m_seq_cap is zero, the buffer isn't allocated yet.
+ * Prototype given in the header.
  */
-static SEQ_NOTE *m_seq_buf = NULL;
+struct SEQ_CTX_TAG {
+  
+  /*
+   * The instrument and layer contexts that notes are performed with.
+   * 
+   * Not owned by the sequencer context.
+   */
+  INSTR_CTX *pInstr;
+  LAYER_CTX *pLayer;
+  
+  /*
+   * The sample buffer that the music is sequenced to, or NULL if not
+   * set yet.
+   * 
+   * Set with seq_output().  Not owned by the sequencer context.
+   */
+  SBUF *pOut;
+  
+  /*
+   * The caller buffer that samples are written to during seq_pull(),
+   * or NULL when samples go to the sample buffer.
+   * 
+   * dest_format is SEQ_PULL_S16 or SEQ_PULL_FLOAT, dest_amp and
+   * dest_level are the gain that samples are scaled by, and dest_i is
+   * the index of the next sample to write in the buffer.
+   */
+  void *pDest;
+  int dest_format;
+  int32_t dest_amp;
+  int32_t dest_level;
+  int32_t dest_i;
+  
+  /*
+   * The pull state, one of the SEQ_PSTATE constants.
+   */
+  int pull;
+  
+  /*
+   * The note buffer.
+   * 
+   * cap is the total size of the buffer in notes.
+   * 
+   * count is the total number of notes actually used.
+   * 
+   * If cap is zero, the buffer isn't allocated yet.
+   */
+  SEQ_NOTE *buf;
+  int32_t cap;
+  int32_t count;
+  
+  /*
+   * The cutoff threshold for early voice termination, or zero if early
+   * voice termination is disabled.
+   * 
+   * Set with seq_cutoff().
+   */
+  int32_t cutoff;
+  
+  /*
+   * Non-zero if only a single channel is mixed.
+   * 
+   * Set with seq_mono().
+   */
+  int mono;
+  
+  /*
+   * Non-zero if the sequencer is in streaming mode.
+   * 
+   * Set with seq_stream().
+   */
+  int stream;
+  
+  /*
+   * The sequencing state.
+   * 
+   * t is the time offset of the next sample to output, read is the
+   * number of notes in the note buffer that have been started, and
+   * pPlay is the event list of the notes that are playing.
+   */
+  int64_t t;
+  int32_t read;
+  SEQ_EVENT *pPlay;
+  
+  /*
+   * The time offset of the silent sample that ends the music, as far as
+   * notes that were retired early or culled are concerned.
+   * 
+   * Retiring or culling a note doesn't change the length of the output,
+   * so once the event list is empty, silence is output up to this time
+   * offset.  Zero if no notes have been retired or culled.
+   */
+  int64_t end_t;
+  
+  /*
+   * The number of notes that were marked as culled in streaming mode
+   * because they can only produce silence.
+   */
+  int32_t culled;
+  
+  /*
+   * The spill file, which holds the notes that didn't fit in the note
+   * buffer outside of streaming mode, or NULL if no notes have been
+   * spilled.
+   * 
+   * spilled is the total number of notes in the spill file.
+   */
+  FILE *pSpill;
+  int64_t spilled;
+  
+  /*
+   * The sorted runs in the spill file.
+   * 
+   * run_cap is the allocated capacity of the array, and run_count is
+   * the number of runs.  The notes of earlier runs were added before
+   * the notes of later runs.
+   */
+  SEQ_RUN *pRuns;
+  int32_t run_cap;
+  int32_t run_count;
+  
+  /*
+   * The merge heap, which holds the indices of the runs that still have
+   * notes to merge, ordered by their next note.
+   * 
+   * The array has room for run_count indices, and heap_count is the
+   * number of indices in the heap.  A non-zero count means that a merge
+   * is in progress, and the note buffer is refilled from the merge
+   * whenever all of its notes have been read.
+   */
+  int32_t *pHeap;
+  int32_t heap_count;
+  
+  /*
+   * Non-zero if the sequencer is in pipelined mode.
+   * 
+   * Set with seq_pipeline().
+   */
+  int pipe;
+  
+  /*
+   * The worker thread in pipelined mode, or NULL while no worker is
+   * running.
+   * 
+   * Only accessed by the thread that adds notes.
+   */
+  OS_WORKER *pWorker;
+  
+  /*
+   * The time offset of the last note that was queued in pipelined mode.
+   * 
+   * Only accessed by the thread that adds notes.
+   */
+  int64_t last;
+  
+  /*
+   * The queue of notes waiting for the worker thread.
+   * 
+   * The queue is a circular buffer.  qhead is the index of the oldest
+   * note, and qcount is the number of notes in the queue.
+   * 
+   * qdone is set when no more notes will be queued, so the worker
+   * should return once the queue is empty.  qfail is set when the
+   * worker failed to add a note.
+   * 
+   * All of these are protected by the os_lock() lock of the worker.
+   */
+  SEQ_NOTE queue[SEQ_QUEUE];
+  int32_t qhead;
+  int32_t qcount;
+  int qdone;
+  int qfail;
+  
+  /*
+   * The notes the worker has taken out of the queue.
+   * 
+   * Only accessed by the worker thread.
+   */
+  SEQ_NOTE batch[SEQ_QUEUE];
+};
 
 /*
  * Local functions
@@ -144,12 +410,36 @@ static SEQ_NOTE *m_seq_buf = NULL;
  */
 
 /* Prototypes */
-static void seq_shift(int32_t i);
+static void seq_shift(SEQ_CTX *ps, int32_t i);
+static int seq_keep(SEQ_CTX *ps, const SEQ_NOTE *pn);
+static void seq_emit(SEQ_CTX *ps, int32_t l, int32_t r);
+static void seq_advance(SEQ_CTX *ps, int64_t t_end, int finish);
+static int seq_insert(
+    SEQ_CTX * ps,
+    int64_t   t,
+    int64_t   dur,
+    int32_t   pitch,
+    int32_t   instr,
+    int32_t   layer);
+static void seq_work(OS_WORKER *pw, void *pCustom);
+static void seq_stop(SEQ_CTX *ps);
+
+static int seq_seek(SEQ_CTX *ps, int64_t i);
+static int seq_spill(SEQ_CTX *ps);
+static void seq_unspill(SEQ_CTX *ps);
+static void seq_run_read(SEQ_CTX *ps, SEQ_RUN *pr);
+static int seq_run_less(SEQ_CTX *ps, int32_t a, int32_t b);
+static void seq_heap_down(SEQ_CTX *ps, int32_t i);
+static int seq_merge_begin(SEQ_CTX *ps);
+static int32_t seq_merge(SEQ_CTX *ps, SEQ_NOTE *pOut, int32_t max);
+static int32_t seq_refill(SEQ_CTX *ps, int32_t notes_read);
+static int64_t seq_cull_runs(SEQ_CTX *ps);
 
 /*
  * Shift all note entries right starting at index i.
  * 
- * i must be in range [0, m_seq_count - 1].
+ * i must be in range [0, count - 1], where count is the number of
+ * notes in the note buffer.
  * 
  * The shift sequence is all elements starting at i and proceeding to
  * the end of the buffer.
@@ -163,223 +453,258 @@ static void seq_shift(int32_t i);
  * 
  * Parameters:
  * 
+ *   ps - the sequencer context
+ * 
  *   i - the index to begin the shift at
  */
-static void seq_shift(int32_t i) {
+static void seq_shift(SEQ_CTX *ps, int32_t i) {
   
   int32_t x = 0;
   
   /* Check parameter */
-  if ((i < 0) || (i >= m_seq_count)) {
+  if ((i < 0) || (i >= ps->count)) {
     abort();
   }
   
   /* Starting from second-to-last element (if any), shift elements
    * right */
-  for(x = m_seq_count - 2; x >= i; x--) {
-    memcpy(&(m_seq_buf[x + 1]), &(m_seq_buf[x]), sizeof(SEQ_NOTE));
+  for(x = ps->count - 2; x >= i; x--) {
+    memcpy(&((ps->buf)[x + 1]), &((ps->buf)[x]), sizeof(SEQ_NOTE));
   }
   
   /* Clear the element at the given index */
-  memset(&(m_seq_buf[i]), 0, sizeof(SEQ_NOTE));
+  memset(&((ps->buf)[i]), 0, sizeof(SEQ_NOTE));
 }
 
 /*
- * Public function implementations
- * ===============================
+ * Check whether a note can produce anything but silence.
  * 
- * See the header for specifications.
+ * The note is checked against the current state of the instrument and
+ * layer modules.  See seq_cull() for the rule.  If the note can only
+ * produce silence, the end of the music is extended to where the note
+ * would have ended, since the caller culls it.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pn - the note to check
+ * 
+ * Return:
+ * 
+ *   non-zero if the note should be kept, zero if it can only produce
+ *   silence
  */
+static int seq_keep(SEQ_CTX *ps, const SEQ_NOTE *pn) {
+  
+  int keep = 0;
+  int64_t mt = 0;
+  int16_t amp = 0;
+  
+  /* Check parameter */
+  if (pn == NULL) {
+    abort();
+  }
+  
+  /* Get the length of the envelope without preparing the note, so
+   * that checking a note never freezes it; the note ends by MAX_TIME
+   * and the envelope only adds a bounded release, so this can't
+   * overflow */
+  mt = pn->t - 1 + instr_length(ps->pInstr, pn->instr, pn->dur, NULL);
+  
+  /* Instruments that are silent at full amplitude don't need to have
+   * their layers checked */
+  keep = 1;
+  if (instr_silent(ps->pInstr, pn->instr, MAX_FRAC)) {
+    keep = 0;
+  }
+  
+  /* Get the greatest layer amplitude during the envelope, and drop the
+   * note if the instrument is silent at that amplitude */
+  if (keep) {
+    amp = layer_peak(ps->pLayer, pn->layer, pn->t, mt);
+    if (instr_silent(ps->pInstr, pn->instr, amp)) {
+      keep = 0;
+    }
+  }
+  
+  /* If the note is culled, the music still runs to the silent sample
+   * after the end of the note */
+  if (!keep) {
+    if (mt + 1 > ps->end_t) {
+      ps->end_t = mt + 1;
+    }
+  }
+  
+  /* Return result */
+  return keep;
+}
 
 /*
- * seq_note function.
+ * Output a mixed stereo sample.
+ * 
+ * During seq_pull(), the sample is scaled and written to the caller
+ * buffer, which must have room for it.  In mono-aural mode, only the
+ * left channel is written.  Otherwise, the sample is sent to the bound
+ * sample buffer.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   l - the left channel sample
+ * 
+ *   r - the right channel sample
  */
-int seq_note(
-    int32_t t,
-    int32_t dur,
-    int32_t pitch,
-    int32_t instr,
-    int32_t layer) {
+static void seq_emit(SEQ_CTX *ps, int32_t l, int32_t r) {
+  
+  int c = 0;
+  int channels = 2;
+  int32_t v = 0;
+  int64_t q = 0;
+  
+  /* If not pulling, send the sample to the sample buffer */
+  if (ps->pDest == NULL) {
+    sbuf_sample(ps->pOut, l, r);
+  
+  } else {
+    /* Only the left channel is written in mono-aural mode */
+    if (ps->mono) {
+      channels = 1;
+    }
+    
+    /* Write each channel of the sample to the caller buffer */
+    for(c = 0; c < channels; c++) {
+      
+      /* Get the channel */
+      if (c == 0) {
+        v = l;
+      } else {
+        v = r;
+      }
+      
+      /* Scale and store the sample in the requested format */
+      if (ps->dest_format == SEQ_PULL_S16) {
+        q = (((int64_t) v) * ((int64_t) ps->dest_amp)) /
+              ((int64_t) ps->dest_level);
+        if (q > INT16_MAX) {
+          q = INT16_MAX;
+        } else if (q < -(INT16_MAX)) {
+          q = -(INT16_MAX);
+        }
+        ((int16_t *) ps->pDest)[ps->dest_i] = (int16_t) q;
+        
+      } else if (ps->dest_format == SEQ_PULL_FLOAT) {
+        ((float *) ps->pDest)[ps->dest_i] = (float)
+          ((((double) v) * ((double) ps->dest_amp)) /
+            (((double) ps->dest_level) * ((double) INT16_MAX)));
+        
+      } else {
+        abort();  /* unrecognized format */
+      }
+      (ps->dest_i)++;
+    }
+  }
+}
 
-  int status = 1;
-  int32_t newcap = 0;
-  int32_t lo = 0;
-  int32_t hi = 0;
-  int32_t mid = 0;
-  int32_t mt = 0;
+/*
+ * Sequence the notes in the note buffer to the output, starting from
+ * the current sequencing state of the context.
+ * 
+ * If t_end is zero or greater, samples are output up to but excluding
+ * t_end, which must not be less than the time offset of the next
+ * sample to output.  Unless the music finishes first, sequencing stops
+ * there without starting notes at t_end, so that more notes that start
+ * at t_end or later can be added before the next call.
+ * 
+ * If t_end is less than zero, there is no end time.
+ * 
+ * If finish is non-zero, sequencing also stops once all the notes have
+ * been read and the event list is empty, which outputs the rest of the
+ * music.  The music always ends with a single silent sample.  finish
+ * must be non-zero if t_end is less than zero.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   t_end - the time offset to stop at, or -1 for no end time
+ * 
+ *   finish - non-zero to stop when the music is finished
+ */
+static void seq_advance(SEQ_CTX *ps, int64_t t_end, int finish) {
+  
+  int32_t n = 0;
+  int32_t k = 0;
+  int32_t notes_read = 0;
+  int64_t t = 0;
+  int16_t amp = 0;
+  SEQ_EVENT *pl = NULL;
+  SEQ_EVENT *pse = NULL;
+  SEQ_EVENT *psr = NULL;
   SEQ_NOTE *pn = NULL;
-
+  
+  int64_t mix_left[SEQ_BLOCK];
+  int64_t mix_right[SEQ_BLOCK];
+  
+  /* Initialize arrays */
+  memset(mix_left, 0, sizeof(mix_left));
+  memset(mix_right, 0, sizeof(mix_right));
+  
   /* Check parameters */
-  if ((t < 0) || (dur < 1)) {
-    abort();
-  }
-  if (dur > INT32_MAX - t) {
-    abort();
-  }
-  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+  if ((t_end >= 0) && (t_end < ps->t)) {
     abort();
   }
-  if ((instr < 0) || (instr >= INSTR_MAXCOUNT)) {
-    abort();
-  }
-  if ((layer < 0) || (layer >= LAYER_MAXCOUNT)) {
+  if ((t_end < 0) && (!finish)) {
     abort();
   }
   
-  /* Only proceed if we aren't at maximum capacity; else, fail */
-  if (m_seq_count < SEQ_CAP_MAX) {
-    
-    /* Not at maximum capacity yet, check first if we need to make
-     * initial allocation */
-    if (m_seq_cap < 1) {
-      /* We need to make initial allocation */
-      m_seq_buf = (SEQ_NOTE *) malloc(SEQ_CAP_INIT * sizeof(SEQ_NOTE));
-      if (m_seq_buf == NULL) {
-        abort();
-      }
-      memset(m_seq_buf, 0, SEQ_CAP_INIT * sizeof(SEQ_NOTE));
-      m_seq_cap = SEQ_CAP_INIT;
-    }
+  /* Load the sequencing state, refilling the note buffer if a merge
+   * is in progress */
+  t = ps->t;
+  notes_read = seq_refill(ps, ps->read);
+  pl = ps->pPlay;
+  
+  /* Keep sequencing until the end time, or when finishing until we've
+   * read all the notes, the event list is empty, and any silence left
+   * by retired notes has been output */
+  while (((t_end < 0) || (t < t_end)) &&
+          ((!finish) || (notes_read < ps->count) || (pl != NULL) ||
+            (t <= ps->end_t))) {
     
-    /* Next, check whether we need to expand capacity */
-    if (m_seq_count >= m_seq_cap) {
-      /* Expansion needed -- expanded capacity is double current
-       * capacity or maximum capacity, whichever is lesser */
-      newcap = m_seq_cap * 2;
-      if (newcap > SEQ_CAP_MAX) {
-        newcap = SEQ_CAP_MAX;
+    /* Remove finished notes from the event list */
+    pse = pl;
+    while (pse != NULL) {
+      /* If early termination is enabled and the event is due for a
+       * check, retire it when everything it can still produce is below
+       * the cutoff */
+      if ((ps->cutoff > 0) &&
+            (pse->max_t >= t) && (t >= pse->check_t)) {
+        
+        /* Get a pointer to the note */
+        pn = &(pse->note);
+        
+        /* Get the greatest layer amplitude for the rest of the event */
+        amp = layer_peak(ps->pLayer, pn->layer, t, pse->max_t);
+        
+        /* Retire the event if it stays below the cutoff; else, schedule
+         * the next check */
+        if (instr_peak(ps->pInstr, pn->instr,
+                t - pn->t, pn->dur, amp, pse->pod) <
+              ((double) ps->cutoff)) {
+          /* The output still runs to where the event would have
+           * ended, so the cutoff doesn't change the length of the
+           * music */
+          if (pse->max_t + 1 > ps->end_t) {
+            ps->end_t = pse->max_t + 1;
+          }
+          pse->max_t = t - 1;
+          
+        } else {
+          pse->check_t = t + SEQ_CUTOFF_INTERVAL;
+        }
       }
       
-      /* Expand buffer */
-      m_seq_buf = (SEQ_NOTE *) realloc(
-                    m_seq_buf, newcap * sizeof(SEQ_NOTE));
-      if (m_seq_buf == NULL) {
-        abort();
-      }
-      memset(
-        &(m_seq_buf[m_seq_cap]),
-        0,
-        (newcap - m_seq_cap) * sizeof(SEQ_NOTE));
-      m_seq_cap = newcap;
-    }
-    
-    /* First special case to filter out is the first note being added */
-    if (m_seq_count > 0) {
-      /* Not first note, next special case to filter out is that the
-       * note should go first in the buffer */
-      if ((m_seq_buf[0]).t <= t) {
-        
-        /* General case -- find a note that has greatest t value that is
-         * less than or equal to t value of new note */
-        lo = 0;
-        hi = m_seq_count - 1;
-        while(lo < hi) {
-          
-          /* Find the midpoint, at least one greater than low bound */
-          mid = lo + ((hi - lo) / 2);
-          if (mid <= lo) {
-            mid = lo + 1;
-          }
-          
-          /* Get midpoint t value */
-          mt = (m_seq_buf[mid]).t;
-          
-          /* Compare new t to midpoint t */
-          if (t > mt) {
-            /* t greater than midpoint, so midpoint becomes new low
-             * boundary */
-            lo = mid;
-            
-          } else if (t < mt) {
-            /* t less than midpoint, so new high boundary is one less
-             * than midpoint */
-            hi = mid - 1;
-            
-          } else if (t == mt) {
-            /* t equals midpoint t, so we can just zero in on that
-             * record */
-            lo = mid;
-            hi = mid;
-            
-          } else {
-            /* Shouldn't happen */
-            abort();
-          }
-        }
-      
-        /* Low bound is the index we insert the new note after */
-        m_seq_count++;
-        seq_shift(lo + 1);
-        pn = &(m_seq_buf[lo + 1]);
-      
-      } else {
-        /* Note added at very beginning */
-        m_seq_count++;
-        seq_shift(0);
-        pn = &(m_seq_buf[0]);
-      }
-      
-    } else {
-      /* This is the first note, so just add it */
-      m_seq_count++;
-      pn = &(m_seq_buf[0]);
-    }
-  
-    /* Fill in note structure */
-    pn->t = t;
-    pn->dur = dur;
-    pn->pitch = (int16_t) pitch;
-    pn->instr = (uint16_t) instr;
-    pn->layer = layer;
-  
-  } else {
-    /* Already at maximum capacity */
-    status = 0;
-  }
-
-  /* Return status */
-  return status;
-}
-
-/*
- * seq_play function.
- */
-void seq_play(void) {
-  
-  int32_t t = 0;
-  int32_t x = 0;
-  int32_t notes_read = 0;
-  int64_t mt = 0;
-  int16_t amp = 0;
-  SEQ_EVENT *pl = NULL;
-  SEQ_EVENT *pse = NULL;
-  SEQ_EVENT *psr = NULL;
-  SEQ_NOTE *pn = NULL;
-  
-  int32_t samp_left = 0;
-  int32_t samp_right = 0;
-  
-  STEREO_SAMP ssp;
-  
-  /* Initialize structures */
-  memset(&ssp, 0, sizeof(STEREO_SAMP));
-  
-  /* If no notes, then output silent sample */
-  if (m_seq_count < 1) {
-    sbuf_sample(0, 0);
-  }
-  
-  /* Keep sequencing until we've read all the notes and the event list
-   * is empty */
-  while ((notes_read < m_seq_count) || (pl != NULL)) {
-    
-    /* Reset the current sample */
-    samp_left = 0;
-    samp_right = 0;
-    
-    /* Remove finished notes from the event list */
-    pse = pl;
-    while (pse != NULL) {
       /* Check if current event is finished */
       if (pse->max_t < t) {
         /* Current event finished, remove it */
@@ -410,8 +735,16 @@ void seq_play(void) {
     }
     
     /* Add any new notes to the event list */
-    for(x = notes_read; x < m_seq_count; x++) {
-      if ((m_seq_buf[x]).t <= t) {
+    while (notes_read < ps->count) {
+      if ((((ps->buf)[notes_read]).t <= t) &&
+            (((ps->buf)[notes_read]).flags & SEQ_NOTE_CULLED)) {
+        
+        /* Culled notes are not performed, but still take the noise
+         * seeds they would have taken */
+        instr_skip(ps->pInstr, ((ps->buf)[notes_read]).instr);
+        notes_read = seq_refill(ps, notes_read + 1);
+      
+      } else if (((ps->buf)[notes_read]).t <= t) {
         
         /* Add another note to the list */
         pse = (SEQ_EVENT *) malloc(sizeof(SEQ_EVENT));
@@ -430,25 +763,43 @@ void seq_play(void) {
         
         /* Get instance data for the note, if required */
         pse->pod = instr_prepare(
-                            (m_seq_buf[x]).instr,
-                            (m_seq_buf[x]).dur,
-                            (m_seq_buf[x]).pitch);
+                            ps->pInstr,
+                            ((ps->buf)[notes_read]).instr,
+                            ((ps->buf)[notes_read]).dur,
+                            ((ps->buf)[notes_read]).pitch);
         
-        /* Compute the max_t */
-        mt = ((int64_t) (m_seq_buf[x]).t) - 1 +
-              ((int64_t) instr_length(
-                            (m_seq_buf[x]).instr,
-                            (m_seq_buf[x]).dur,
-                            pse->pod
-              ));
-        if (mt > INT32_MAX) {
-          mt = INT32_MAX;
+        /* Get the stereo gains, which stay the same for the note; in
+         * mono-aural mode, the single channel is at full gain */
+        if (ps->mono) {
+          pse->gain_l = MAX_FRAC;
+          pse->gain_r = MAX_FRAC;
+        } else {
+          instr_pan(
+            ps->pInstr,
+            ((ps->buf)[notes_read]).instr,
+            ((ps->buf)[notes_read]).pitch,
+            &(pse->gain_l),
+            &(pse->gain_r));
         }
-        pse->max_t = (int32_t) mt;
         
-        /* Copy the note index and update the notes_read count */
-        pse->note_i = x;
-        notes_read++;
+        /* Compute the max_t */
+        pse->max_t = ((ps->buf)[notes_read]).t - 1 +
+                      instr_length(
+                            ps->pInstr,
+                            ((ps->buf)[notes_read]).instr,
+                            ((ps->buf)[notes_read]).dur,
+                            pse->pod);
+        
+        /* Schedule the first check against the cutoff threshold */
+        pse->check_t = t + SEQ_CUTOFF_INTERVAL;
+        
+        /* Copy the note and update the notes_read count, refilling the
+         * note buffer if a merge is in progress */
+        memcpy(
+          &(pse->note),
+          &((ps->buf)[notes_read]),
+          sizeof(SEQ_NOTE));
+        notes_read = seq_refill(ps, notes_read + 1);
       
       } else {
         /* No more notes to add */
@@ -456,46 +807,1547 @@ void seq_play(void) {
       }
     }
     
-    /* Compute the current sample by going through all notes in the
+    /* Determine how many samples can be rendered before the event list
+     * next needs attention: the next note start, the end of any event,
+     * any event that is due for a cutoff check, or the end time */
+    n = SEQ_BLOCK;
+    if (notes_read < ps->count) {
+      if (((ps->buf)[notes_read]).t - t < n) {
+        n = (int32_t) (((ps->buf)[notes_read]).t - t);
+      }
+    } else if ((pl == NULL) && finish && (t < ps->end_t)) {
+      /* Only silence is left until where retired notes would have
+       * ended */
+      if (ps->end_t - t < n) {
+        n = (int32_t) (ps->end_t - t);
+      }
+      
+    } else if ((pl == NULL) && finish) {
+      /* Everything is finished, so just the single silent sample that
+       * always ends the output */
+      n = 1;
+    }
+    for(pse = pl; pse != NULL; pse = pse->pNext) {
+      if (pse->max_t - t < n - 1) {
+        n = (int32_t) (pse->max_t - t + 1);
+      }
+      if ((ps->cutoff > 0) && (pse->check_t - t < n)) {
+        n = (int32_t) (pse->check_t - t);
+      }
+    }
+    if ((t_end >= 0) && (t_end - t < n)) {
+      n = (int32_t) (t_end - t);
+    }
+    
+    /* Clear the mix bus */
+    for(k = 0; k < n; k++) {
+      mix_left[k] = 0;
+      mix_right[k] = 0;
+    }
+    
+    /* Begin the block of layer intensities that all notes share */
+    layer_block(ps->pLayer, t, n);
+    
+    /* Compute the current samples by going through all notes in the
      * event list */
     for(pse = pl; pse != NULL; pse = pse->pNext) {
       
       /* Get a pointer to the note */
-      pn = &(m_seq_buf[pse->note_i]);
+      pn = &(pse->note);
       
-      /* Get the amplitude of the layer at t */
-      amp = layer_get(pn->layer, t);
-      
-      /* Compute the stereo sample */
-      instr_get(
-        pn->instr, t - pn->t, pn->dur, pn->pitch, amp, &ssp, pse->pod);
-      
-      /* Mix the stereo sample in */
-      mt = ((int64_t) samp_left) + ((int64_t) ssp.left);
-      if (mt > INT32_MAX) {
-        mt = INT32_MAX;
-      } else if (mt < -(INT32_MAX)) {
-        mt = -(INT32_MAX);
-      }
-      samp_left = (int32_t) mt;
-      
-      mt = ((int64_t) samp_right) + ((int64_t) ssp.right);
-      if (mt > INT32_MAX) {
-        mt = INT32_MAX;
-      } else if (mt < -(INT32_MAX)) {
-        mt = -(INT32_MAX);
-      }
-      samp_right = (int32_t) mt;
+      /* Compute the stereo samples and add them to the mix bus */
+      instr_render(
+        ps->pInstr, pn->instr, t - pn->t, pn->dur, pn->pitch,
+        layer_blockget(ps->pLayer, pn->layer), n,
+        pse->gain_l, pse->gain_r,
+        mix_left, (ps->mono ? NULL : mix_right), pse->pod);
     }
     
-    /* Output the current sample */
-    sbuf_sample(samp_left, samp_right);
+    /* Output the current samples, clamping the mix bus once at the
+     * end instead of after each voice */
+    for(k = 0; k < n; k++) {
+      if (mix_left[k] > INT32_MAX) {
+        mix_left[k] = INT32_MAX;
+      } else if (mix_left[k] < -(INT32_MAX)) {
+        mix_left[k] = -(INT32_MAX);
+      }
+      if (ps->mono) {
+        seq_emit(ps, (int32_t) mix_left[k], (int32_t) mix_left[k]);
+        
+      } else {
+        if (mix_right[k] > INT32_MAX) {
+          mix_right[k] = INT32_MAX;
+        } else if (mix_right[k] < -(INT32_MAX)) {
+          mix_right[k] = -(INT32_MAX);
+        }
+        seq_emit(ps, (int32_t) mix_left[k], (int32_t) mix_right[k]);
+      }
+    }
     
     /* Proceed to next t value */
-    if (t < INT32_MAX) {
-      t++;
+    if (t <= INT64_MAX - n) {
+      t += n;
     } else {
       abort();
     }
   }
+  
+  /* Store the sequencing state */
+  ps->t = t;
+  ps->read = notes_read;
+  ps->pPlay = pl;
+}
+
+/*
+ * Seek the spill file to the note with the given index.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   i - the index of the note in the spill file
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the offset is out of range or the
+ *   seek failed
+ */
+static int seq_seek(SEQ_CTX *ps, int64_t i) {
+  
+  int status = 1;
+  
+  /* Check parameter and state */
+  if ((i < 0) || (ps->pSpill == NULL)) {
+    abort();
+  }
+  
+  /* Make sure the byte offset fits in a long */
+  if (i > ((int64_t) (LONG_MAX / ((long) sizeof(SEQ_NOTE))))) {
+    status = 0;
+  }
+  
+  /* Seek to the offset */
+  if (status) {
+    if (fseek(
+          ps->pSpill,
+          ((long) i) * ((long) sizeof(SEQ_NOTE)),
+          SEEK_SET)) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Write all the notes in the note buffer to the end of the spill file
+ * as a new sorted run, and then empty the note buffer.
+ * 
+ * The spill file is created on first use.  The note buffer must not be
+ * empty, and there must be no merge in progress.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the spill file couldn't be written
+ */
+static int seq_spill(SEQ_CTX *ps) {
+  
+  int status = 1;
+  int32_t newcap = 0;
+  SEQ_RUN *pr = NULL;
+  
+  /* Check state */
+  if ((ps->count < 1) || (ps->heap_count > 0)) {
+    abort();
+  }
+  
+  /* Create the spill file if necessary */
+  if (ps->pSpill == NULL) {
+    ps->pSpill = tmpfile();
+    if (ps->pSpill == NULL) {
+      status = 0;
+    }
+  }
+  
+  /* Make room for another run */
+  if (status && (ps->run_count >= ps->run_cap)) {
+    if (ps->run_cap < 1) {
+      newcap = 16;
+    } else if (ps->run_cap <= INT32_MAX / 2) {
+      newcap = ps->run_cap * 2;
+    } else {
+      status = 0;
+    }
+    
+    if (status) {
+      ps->pRuns = (SEQ_RUN *) realloc(
+                      ps->pRuns, ((size_t) newcap) * sizeof(SEQ_RUN));
+      if (ps->pRuns == NULL) {
+        abort();
+      }
+      memset(
+        &((ps->pRuns)[ps->run_cap]),
+        0,
+        ((size_t) (newcap - ps->run_cap)) * sizeof(SEQ_RUN));
+      ps->run_cap = newcap;
+    }
+  }
+  
+  /* Append the notes to the spill file */
+  if (status) {
+    status = seq_seek(ps, ps->spilled);
+  }
+  if (status) {
+    if (fwrite(ps->buf, sizeof(SEQ_NOTE), (size_t) ps->count,
+                ps->pSpill) != (size_t) ps->count) {
+      status = 0;
+    }
+  }
+  
+  /* Record the run and empty the note buffer */
+  if (status) {
+    pr = &((ps->pRuns)[ps->run_count]);
+    pr->base = ps->spilled;
+    pr->len = ps->count;
+    pr->pos = 0;
+    pr->head = 0;
+    pr->fill = 0;
+    (ps->run_count)++;
+    
+    ps->spilled += ps->count;
+    memset(ps->buf, 0, ((size_t) ps->count) * sizeof(SEQ_NOTE));
+    ps->count = 0;
+    ps->read = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Close the spill file and release all the runs.
+ * 
+ * If nothing has been spilled, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+static void seq_unspill(SEQ_CTX *ps) {
+  
+  int32_t x = 0;
+  
+  /* Close the spill file */
+  if (ps->pSpill != NULL) {
+    fclose(ps->pSpill);
+    ps->pSpill = NULL;
+  }
+  ps->spilled = 0;
+  
+  /* Release the runs */
+  for(x = 0; x < ps->run_cap; x++) {
+    if (((ps->pRuns)[x]).pBuf != NULL) {
+      free(((ps->pRuns)[x]).pBuf);
+      ((ps->pRuns)[x]).pBuf = NULL;
+    }
+  }
+  if (ps->pRuns != NULL) {
+    free(ps->pRuns);
+    ps->pRuns = NULL;
+  }
+  ps->run_cap = 0;
+  ps->run_count = 0;
+  
+  /* Release the merge heap */
+  if (ps->pHeap != NULL) {
+    free(ps->pHeap);
+    ps->pHeap = NULL;
+  }
+  ps->heap_count = 0;
+}
+
+/*
+ * Read the next notes of a run from the spill file into its merge
+ * buffer.
+ * 
+ * The merge buffer must already be allocated.  If there are no notes
+ * left in the run, the buffer is left empty.  A fault occurs on I/O
+ * error.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pr - the run
+ */
+static void seq_run_read(SEQ_CTX *ps, SEQ_RUN *pr) {
+  
+  int64_t n = 0;
+  
+  /* Check parameter */
+  if ((pr == NULL) || (pr->pBuf == NULL)) {
+    abort();
+  }
+  
+  /* Determine how many notes to read */
+  n = pr->len - pr->pos;
+  if (n > SEQ_RUN_BUF) {
+    n = SEQ_RUN_BUF;
+  }
+  
+  /* Read the notes */
+  if (n > 0) {
+    if (!seq_seek(ps, pr->base + pr->pos)) {
+      abort();  /* I/O error */
+    }
+    if (fread(pr->pBuf, sizeof(SEQ_NOTE), (size_t) n, ps->pSpill)
+          != (size_t) n) {
+      abort();  /* I/O error */
+    }
+  }
+  
+  /* Update the run */
+  pr->pos += n;
+  pr->head = 0;
+  pr->fill = (int32_t) n;
+}
+
+/*
+ * Check whether the next note of one run comes before the next note of
+ * another run in the merge.
+ * 
+ * Notes are ordered by time offset.  Notes with the same time offset
+ * are ordered by run, so that notes keep the order they were added in.
+ * Both runs must have a note in their merge buffer.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   a - the index of the first run
+ * 
+ *   b - the index of the second run
+ * 
+ * Return:
+ * 
+ *   non-zero if the next note of run a comes first, zero if not
+ */
+static int seq_run_less(SEQ_CTX *ps, int32_t a, int32_t b) {
+  
+  int result = 0;
+  int64_t ta = 0;
+  int64_t tb = 0;
+  
+  /* Get the time offsets */
+  ta = (((ps->pRuns)[a]).pBuf[((ps->pRuns)[a]).head]).t;
+  tb = (((ps->pRuns)[b]).pBuf[((ps->pRuns)[b]).head]).t;
+  
+  /* Compare */
+  if (ta < tb) {
+    result = 1;
+  } else if ((ta == tb) && (a < b)) {
+    result = 1;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Move an entry of the merge heap down until both of its children come
+ * after it.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   i - the index of the entry in the heap
+ */
+static void seq_heap_down(SEQ_CTX *ps, int32_t i) {
+  
+  int32_t c = 0;
+  int32_t v = 0;
+  
+  /* Check parameter */
+  if ((i < 0) || (i >= ps->heap_count)) {
+    abort();
+  }
+  
+  /* Keep swapping with the earliest child */
+  while (i < ps->heap_count / 2) {
+    c = (2 * i) + 1;
+    if (c + 1 < ps->heap_count) {
+      if (seq_run_less(ps, (ps->pHeap)[c + 1], (ps->pHeap)[c])) {
+        c++;
+      }
+    }
+    
+    if (seq_run_less(ps, (ps->pHeap)[c], (ps->pHeap)[i])) {
+      v = (ps->pHeap)[i];
+      (ps->pHeap)[i] = (ps->pHeap)[c];
+      (ps->pHeap)[c] = v;
+      i = c;
+    } else {
+      break;
+    }
+  }
+}
+
+/*
+ * Begin merging the runs in the spill file.
+ * 
+ * If nothing has been spilled, this call is ignored.  Otherwise, any
+ * notes in the note buffer are spilled as a final run so that every
+ * note is in the spill file, and then the merge starts over from the
+ * beginning of every run.  The note buffer is empty afterwards, and
+ * seq_refill() fills it from the merge.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the spill file couldn't be written
+ */
+static int seq_merge_begin(SEQ_CTX *ps) {
+  
+  int status = 1;
+  int32_t x = 0;
+  SEQ_RUN *pr = NULL;
+  
+  /* Only merge if something has been spilled */
+  if (ps->run_count > 0) {
+    
+    /* Abandon any earlier merge, and spill the rest of the notes */
+    ps->heap_count = 0;
+    if (ps->count > 0) {
+      status = seq_spill(ps);
+    }
+    
+    /* Allocate the heap */
+    if (status) {
+      if (ps->pHeap != NULL) {
+        free(ps->pHeap);
+        ps->pHeap = NULL;
+      }
+      ps->pHeap = (int32_t *) malloc(
+                      ((size_t) ps->run_count) * sizeof(int32_t));
+      if (ps->pHeap == NULL) {
+        abort();
+      }
+    }
+    
+    /* Read the beginning of each run, and add each run that isn't
+     * empty to the heap */
+    for(x = 0; status && (x < ps->run_count); x++) {
+      pr = &((ps->pRuns)[x]);
+      if (pr->pBuf == NULL) {
+        pr->pBuf = (SEQ_NOTE *) malloc(SEQ_RUN_BUF * sizeof(SEQ_NOTE));
+        if (pr->pBuf == NULL) {
+          abort();
+        }
+      }
+      
+      pr->pos = 0;
+      seq_run_read(ps, pr);
+      if (pr->fill > 0) {
+        (ps->pHeap)[ps->heap_count] = x;
+        (ps->heap_count)++;
+      }
+    }
+    
+    /* Arrange the heap */
+    if (status) {
+      for(x = (ps->heap_count / 2) - 1; x >= 0; x--) {
+        seq_heap_down(ps, x);
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Take the next notes from the merge in time order.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pOut - the array to receive the notes
+ * 
+ *   max - the maximum number of notes to take
+ * 
+ * Return:
+ * 
+ *   the number of notes taken, which is less than max only if the merge
+ *   has finished
+ */
+static int32_t seq_merge(SEQ_CTX *ps, SEQ_NOTE *pOut, int32_t max) {
+  
+  int32_t n = 0;
+  SEQ_RUN *pr = NULL;
+  
+  /* Check parameters */
+  if ((pOut == NULL) || (max < 0)) {
+    abort();
+  }
+  
+  /* Take notes from the run at the top of the heap */
+  while ((n < max) && (ps->heap_count > 0)) {
+    
+    /* Take the next note of the run */
+    pr = &((ps->pRuns)[(ps->pHeap)[0]]);
+    memcpy(&(pOut[n]), &((pr->pBuf)[pr->head]), sizeof(SEQ_NOTE));
+    n++;
+    
+    /* Advance the run, removing it from the heap once it is empty */
+    pr->head++;
+    if (pr->head >= pr->fill) {
+      seq_run_read(ps, pr);
+      if (pr->fill < 1) {
+        (ps->heap_count)--;
+        (ps->pHeap)[0] = (ps->pHeap)[ps->heap_count];
+      }
+    }
+    
+    /* Restore the heap order */
+    if (ps->heap_count > 0) {
+      seq_heap_down(ps, 0);
+    }
+  }
+  
+  /* Return the count */
+  return n;
+}
+
+/*
+ * Refill the note buffer from the merge once all its notes have been
+ * read.
+ * 
+ * If a merge is in progress and notes_read shows that every note in the
+ * note buffer has been read, the buffer is filled with the next notes
+ * of the merge and zero is returned.  Otherwise, notes_read is returned
+ * as it is.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   notes_read - the number of notes in the buffer that have been read
+ * 
+ * Return:
+ * 
+ *   the updated number of notes in the buffer that have been read
+ */
+static int32_t seq_refill(SEQ_CTX *ps, int32_t notes_read) {
+  
+  /* Refill if necessary */
+  if ((notes_read >= ps->count) && (ps->heap_count > 0)) {
+    ps->count = seq_merge(ps, ps->buf, ps->cap);
+    notes_read = 0;
+  }
+  
+  /* Return the updated count */
+  return notes_read;
+}
+
+/*
+ * Mark the notes in the runs of the spill file that can only produce
+ * silence.
+ * 
+ * See seq_cull() for the rule.  Each block of notes is written back to
+ * where it was read from, so the runs keep their places and order.  A
+ * fault occurs on I/O error.  There must be no merge in progress.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ * Return:
+ * 
+ *   the number of notes newly marked
+ */
+static int64_t seq_cull_runs(SEQ_CTX *ps) {
+  
+  int64_t marked = 0;
+  int64_t rpos = 0;
+  int64_t rend = 0;
+  int32_t r = 0;
+  int32_t n = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  SEQ_RUN *pr = NULL;
+  SEQ_NOTE *pBuf = NULL;
+  
+  /* Check state */
+  if (ps->heap_count > 0) {
+    abort();
+  }
+  
+  /* Only proceed if something has been spilled */
+  if (ps->run_count > 0) {
+    
+    /* Allocate a buffer */
+    pBuf = (SEQ_NOTE *) malloc(SEQ_RUN_BUF * sizeof(SEQ_NOTE));
+    if (pBuf == NULL) {
+      abort();
+    }
+    
+    /* Mark each run in place */
+    for(r = 0; r < ps->run_count; r++) {
+      pr = &((ps->pRuns)[r]);
+      rpos = pr->base;
+      rend = pr->base + pr->len;
+      
+      while (rpos < rend) {
+        /* Read the next notes */
+        n = SEQ_RUN_BUF;
+        if (rend - rpos < n) {
+          n = (int32_t) (rend - rpos);
+        }
+        if (!seq_seek(ps, rpos)) {
+          abort();  /* I/O error */
+        }
+        if (fread(pBuf, sizeof(SEQ_NOTE), (size_t) n, ps->pSpill)
+              != (size_t) n) {
+          abort();  /* I/O error */
+        }
+        
+        /* Mark the notes that are silent */
+        y = 0;
+        for(x = 0; x < n; x++) {
+          if (!(pBuf[x].flags & SEQ_NOTE_CULLED)) {
+            if (!seq_keep(ps, &(pBuf[x]))) {
+              pBuf[x].flags |= SEQ_NOTE_CULLED;
+              y++;
+            }
+          }
+        }
+        
+        /* Write the notes back if any were marked */
+        if (y > 0) {
+          if (!seq_seek(ps, rpos)) {
+            abort();  /* I/O error */
+          }
+          if (fwrite(pBuf, sizeof(SEQ_NOTE), (size_t) n, ps->pSpill)
+                != (size_t) n) {
+            abort();  /* I/O error */
+          }
+          marked += y;
+        }
+        rpos += n;
+      }
+    }
+    
+    /* Release the buffer */
+    free(pBuf);
+    pBuf = NULL;
+  }
+  
+  /* Return the number of notes marked */
+  return marked;
+}
+
+/*
+ * The function run by the worker thread in pipelined mode.
+ * 
+ * Notes are taken out of the queue in batches and added with
+ * seq_insert(), which sequences the music before them.  Once a note
+ * fails, the rest are discarded.  The function returns when the queue
+ * is empty and the qdone flag is set.
+ * 
+ * Interface matches os_fp_worker.
+ * 
+ * Parameters:
+ * 
+ *   pw - the worker
+ * 
+ *   pCustom - the sequencer context
+ */
+static void seq_work(OS_WORKER *pw, void *pCustom) {
+  
+  SEQ_CTX *ps = NULL;
+  int done = 0;
+  int fail = 0;
+  int32_t n = 0;
+  int32_t x = 0;
+  int32_t i = 0;
+  SEQ_NOTE *pn = NULL;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pCustom == NULL)) {
+    abort();
+  }
+  ps = (SEQ_CTX *) pCustom;
+  
+  os_lock(pw);
+  while (!done) {
+    
+    /* Wait for notes or for the end of the notes */
+    while ((ps->qcount < 1) && (!ps->qdone)) {
+      os_wait(pw);
+    }
+    
+    /* Take all the queued notes, or stop if there are none left */
+    if (ps->qcount > 0) {
+      n = ps->qcount;
+      for(x = 0; x < n; x++) {
+        i = (ps->qhead + x) % SEQ_QUEUE;
+        memcpy(&((ps->batch)[x]), &((ps->queue)[i]), sizeof(SEQ_NOTE));
+      }
+      ps->qhead = (ps->qhead + n) % SEQ_QUEUE;
+      ps->qcount = 0;
+      fail = ps->qfail;
+      os_wake(pw);
+      
+    } else {
+      n = 0;
+      done = 1;
+    }
+    
+    /* Sequence the notes without holding the lock */
+    if (n > 0) {
+      os_unlock(pw);
+      for(x = 0; x < n; x++) {
+        pn = &((ps->batch)[x]);
+        if (!fail) {
+          if (!seq_insert(ps, pn->t, pn->dur, pn->pitch,
+                            pn->instr, pn->layer)) {
+            fail = 1;
+          }
+        }
+      }
+      os_lock(pw);
+      
+      if (fail) {
+        ps->qfail = 1;
+        os_wake(pw);
+      }
+    }
+  }
+  os_unlock(pw);
+}
+
+/*
+ * Wait for the worker thread to sequence all the queued notes and then
+ * stop it.
+ * 
+ * If there is no worker thread, this call is ignored.  The failure
+ * flag qfail is left as it is.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+static void seq_stop(SEQ_CTX *ps) {
+  
+  if (ps->pWorker != NULL) {
+    os_lock(ps->pWorker);
+    ps->qdone = 1;
+    os_wake(ps->pWorker);
+    os_unlock(ps->pWorker);
+    
+    os_join(ps->pWorker);
+    ps->pWorker = NULL;
+    ps->qdone = 0;
+  }
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * seq_alloc function.
+ */
+SEQ_CTX *seq_alloc(INSTR_CTX *pi, LAYER_CTX *pl) {
+  
+  SEQ_CTX *ps = NULL;
+  
+  /* Check parameters */
+  if ((pi == NULL) || (pl == NULL)) {
+    abort();
+  }
+  
+  /* Allocate the context */
+  ps = (SEQ_CTX *) malloc(sizeof(SEQ_CTX));
+  if (ps == NULL) {
+    abort();
+  }
+  memset(ps, 0, sizeof(SEQ_CTX));
+  
+  /* Initialize the context */
+  ps->pInstr = pi;
+  ps->pLayer = pl;
+  ps->pOut = NULL;
+  ps->pDest = NULL;
+  ps->pull = SEQ_PSTATE_INIT;
+  ps->buf = NULL;
+  ps->cap = 0;
+  ps->count = 0;
+  ps->cutoff = SEQ_CUTOFF_DEFAULT;
+  ps->pPlay = NULL;
+  ps->end_t = 0;
+  ps->pSpill = NULL;
+  ps->pRuns = NULL;
+  ps->pHeap = NULL;
+  ps->pWorker = NULL;
+  
+  /* Return the new context */
+  return ps;
+}
+
+/*
+ * seq_free function.
+ */
+void seq_free(SEQ_CTX *ps) {
+  
+  SEQ_EVENT *pse = NULL;
+  
+  /* Only proceed if not NULL */
+  if (ps != NULL) {
+    
+    /* Stop any worker thread */
+    seq_stop(ps);
+    
+    /* Release the events that are still playing */
+    while (ps->pPlay != NULL) {
+      pse = ps->pPlay;
+      ps->pPlay = pse->pNext;
+      if (pse->pod != NULL) {
+        free(pse->pod);
+        pse->pod = NULL;
+      }
+      free(pse);
+      pse = NULL;
+    }
+    
+    /* Release the note buffer and any spill file */
+    if (ps->buf != NULL) {
+      free(ps->buf);
+      ps->buf = NULL;
+    }
+    seq_unspill(ps);
+    
+    /* Release the context */
+    free(ps);
+  }
+}
+
+/*
+ * seq_output function.
+ */
+void seq_output(SEQ_CTX *ps, SBUF *pb) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (pb == NULL)) {
+    abort();
+  }
+  
+  /* Bind the sample buffer */
+  ps->pOut = pb;
+}
+
+/*
+ * seq_cutoff function.
+ */
+void seq_cutoff(SEQ_CTX *ps, int32_t cutoff) {
+  
+  /* Check parameters */
+  if ((ps == NULL) || (cutoff < 0) || (cutoff > SEQ_CUTOFF_MAX)) {
+    abort();
+  }
+  
+  /* Store cutoff */
+  ps->cutoff = cutoff;
+}
+
+/*
+ * seq_mono function.
+ */
+void seq_mono(SEQ_CTX *ps) {
+  
+  /* Check parameter */
+  if (ps == NULL) {
+    abort();
+  }
+  
+  /* Switch to mono-aural mode */
+  ps->mono = 1;
+}
+
+/*
+ * Add a note to the note buffer.
+ * 
+ * This is the implementation of seq_note(), except that parameters
+ * have already been checked, and that it is called on the worker
+ * thread in pipelined mode.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   t - the time offset in samples
+ * 
+ *   dur - the duration in samples
+ * 
+ *   pitch - the pitch
+ * 
+ *   instr - the instrument index
+ * 
+ *   layer - the layer index
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if too many notes
+ */
+static int seq_insert(
+    SEQ_CTX * ps,
+    int64_t   t,
+    int64_t   dur,
+    int32_t   pitch,
+    int32_t   instr,
+    int32_t   layer) {
+
+  int status = 1;
+  int add = 1;
+  int32_t newcap = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  int64_t mt = 0;
+  uint16_t flags = 0;
+  SEQ_NOTE *pn = NULL;
+  SEQ_NOTE sn;
+  
+  /* Initialize structures */
+  memset(&sn, 0, sizeof(SEQ_NOTE));
+  
+  /* In streaming mode, mark the note as culled if it can only produce
+   * silence, then sequence everything before it and remove the notes
+   * that have started from the buffer */
+  if (ps->stream) {
+    if (t < ps->t) {
+      abort();
+    }
+    if (ps->count > 0) {
+      if (t < ((ps->buf)[ps->count - 1]).t) {
+        abort();
+      }
+    }
+    
+    sn.t = t;
+    sn.dur = dur;
+    sn.pitch = (int16_t) pitch;
+    sn.instr = (uint16_t) instr;
+    sn.layer = (uint16_t) layer;
+    
+    if (!seq_keep(ps, &sn)) {
+      flags = SEQ_NOTE_CULLED;
+      if (ps->culled < INT32_MAX) {
+        (ps->culled)++;
+      }
+    }
+    
+    if (t > ps->t) {
+      seq_advance(ps, t, 0);
+      if (ps->read > 0) {
+        memmove(
+          ps->buf,
+          &((ps->buf)[ps->read]),
+          ((size_t) (ps->count - ps->read)) * sizeof(SEQ_NOTE));
+        memset(
+          &((ps->buf)[ps->count - ps->read]),
+          0,
+          ((size_t) ps->read) * sizeof(SEQ_NOTE));
+        ps->count -= ps->read;
+        ps->read = 0;
+      }
+    }
+  }
+  
+  /* Outside of streaming mode, spill a full note buffer to the spill
+   * file as a sorted run */
+  if (add && (!ps->stream) && (ps->count >= SEQ_CAP_MAX)) {
+    if (!seq_spill(ps)) {
+      add = 0;
+      status = 0;
+    }
+  }
+  
+  /* Only proceed if we aren't at maximum capacity; else, fail */
+  if (add && (ps->count < SEQ_CAP_MAX)) {
+    
+    /* Not at maximum capacity yet, check first if we need to make
+     * initial allocation */
+    if (ps->cap < 1) {
+      /* We need to make initial allocation */
+      ps->buf = (SEQ_NOTE *) malloc(SEQ_CAP_INIT * sizeof(SEQ_NOTE));
+      if (ps->buf == NULL) {
+        abort();
+      }
+      memset(ps->buf, 0, SEQ_CAP_INIT * sizeof(SEQ_NOTE));
+      ps->cap = SEQ_CAP_INIT;
+    }
+    
+    /* Next, check whether we need to expand capacity */
+    if (ps->count >= ps->cap) {
+      /* Expansion needed -- expanded capacity is double current
+       * capacity or maximum capacity, whichever is lesser */
+      newcap = ps->cap * 2;
+      if (newcap > SEQ_CAP_MAX) {
+        newcap = SEQ_CAP_MAX;
+      }
+      
+      /* Expand buffer */
+      ps->buf = (SEQ_NOTE *) realloc(
+                    ps->buf, newcap * sizeof(SEQ_NOTE));
+      if (ps->buf == NULL) {
+        abort();
+      }
+      memset(
+        &((ps->buf)[ps->cap]),
+        0,
+        (newcap - ps->cap) * sizeof(SEQ_NOTE));
+      ps->cap = newcap;
+    }
+    
+    /* First special case to filter out is the first note being added */
+    if (ps->count > 0) {
+      /* Not first note, next special case to filter out is that the
+       * note should go first in the buffer */
+      if (((ps->buf)[0]).t <= t) {
+        
+        /* General case -- find a note that has greatest t value that is
+         * less than or equal to t value of new note */
+        lo = 0;
+        hi = ps->count - 1;
+        while(lo < hi) {
+          
+          /* Find the midpoint, at least one greater than low bound */
+          mid = lo + ((hi - lo) / 2);
+          if (mid <= lo) {
+            mid = lo + 1;
+          }
+          
+          /* Get midpoint t value */
+          mt = ((ps->buf)[mid]).t;
+          
+          /* Compare new t to midpoint t */
+          if (t > mt) {
+            /* t greater than midpoint, so midpoint becomes new low
+             * boundary */
+            lo = mid;
+            
+          } else if (t < mt) {
+            /* t less than midpoint, so new high boundary is one less
+             * than midpoint */
+            hi = mid - 1;
+            
+          } else if (t == mt) {
+            /* t equals midpoint t, so we can just zero in on that
+             * record */
+            lo = mid;
+            hi = mid;
+            
+          } else {
+            /* Shouldn't happen */
+            abort();
+          }
+        }
+      
+        /* Low bound is the index we insert the new note after */
+        (ps->count)++;
+        seq_shift(ps, lo + 1);
+        pn = &((ps->buf)[lo + 1]);
+      
+      } else {
+        /* Note added at very beginning */
+        (ps->count)++;
+        seq_shift(ps, 0);
+        pn = &((ps->buf)[0]);
+      }
+      
+    } else {
+      /* This is the first note, so just add it */
+      (ps->count)++;
+      pn = &((ps->buf)[0]);
+    }
+  
+    /* Fill in note structure */
+    pn->t = t;
+    pn->dur = dur;
+    pn->pitch = (int16_t) pitch;
+    pn->instr = (uint16_t) instr;
+    pn->layer = (uint16_t) layer;
+    pn->flags = flags;
+  
+  } else if (add) {
+    /* Already at maximum capacity */
+    status = 0;
+  }
+
+  /* Return status */
+  return status;
+}
+
+/*
+ * seq_note function.
+ */
+int seq_note(
+    SEQ_CTX * ps,
+    int64_t   t,
+    int64_t   dur,
+    int32_t   pitch,
+    int32_t   instr,
+    int32_t   layer) {
+  
+  int status = 1;
+  SEQ_NOTE *pn = NULL;
+  
+  /* Check parameters */
+  if (ps == NULL) {
+    abort();
+  }
+  if ((t < 0) || (t > MAX_TIME) || (dur < 1)) {
+    abort();
+  }
+  if (dur > MAX_TIME - t) {
+    abort();
+  }
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  if ((instr < 0) || (instr >= INSTR_MAXCOUNT)) {
+    abort();
+  }
+  if ((layer < 0) || (layer >= LAYER_MAXCOUNT)) {
+    abort();
+  }
+  
+  /* In pipelined mode, start the worker thread with the first note;
+   * if the platform can't start it, add notes directly instead */
+  if (ps->pipe && (ps->pWorker == NULL)) {
+    ps->pWorker = os_worker(&seq_work, ps);
+    if (ps->pWorker == NULL) {
+      ps->pipe = 0;
+    }
+  }
+  
+  /* Queue the note for the worker thread, or add it directly */
+  if (ps->pWorker != NULL) {
+    if (t < ps->last) {
+      abort();
+    }
+    ps->last = t;
+    
+    os_lock(ps->pWorker);
+    while ((ps->qcount >= SEQ_QUEUE) && (!ps->qfail)) {
+      os_wait(ps->pWorker);
+    }
+    
+    if (ps->qfail) {
+      status = 0;
+    
+    } else {
+      pn = &((ps->queue)[(ps->qhead + ps->qcount) % SEQ_QUEUE]);
+      pn->t = t;
+      pn->dur = dur;
+      pn->pitch = (int16_t) pitch;
+      pn->instr = (uint16_t) instr;
+      pn->layer = (uint16_t) layer;
+      pn->flags = 0;
+      
+      (ps->qcount)++;
+      if (ps->qcount == 1) {
+        os_wake(ps->pWorker);
+      }
+    }
+    os_unlock(ps->pWorker);
+    
+  } else {
+    status = seq_insert(ps, t, dur, pitch, instr, layer);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * seq_cull function.
+ */
+int32_t seq_cull(SEQ_CTX *ps) {
+  
+  int32_t x = 0;
+  int32_t y = 0;
+  int64_t marked = 0;
+  
+  /* Check parameter */
+  if (ps == NULL) {
+    abort();
+  }
+  
+  /* Let the worker thread finish first in pipelined mode */
+  seq_stop(ps);
+  
+  /* In streaming mode, silent notes were already marked as they were
+   * added */
+  if (ps->stream) {
+    x = ps->culled;
+    ps->culled = 0;
+    
+  } else {
+    /* Go through all notes, marking the ones that can only produce
+     * silence and counting how many were newly marked */
+    for(x = 0; x < ps->count; x++) {
+      if (!(((ps->buf)[x]).flags & SEQ_NOTE_CULLED)) {
+        if (!seq_keep(ps, &((ps->buf)[x]))) {
+          ((ps->buf)[x]).flags |= SEQ_NOTE_CULLED;
+          y++;
+        }
+      }
+    }
+    
+    /* Get number of notes culled, adding the notes culled in the spill
+     * file */
+    x = y;
+    
+    marked = seq_cull_runs(ps);
+    if (marked > INT32_MAX - x) {
+      x = INT32_MAX;
+    } else {
+      x = x + ((int32_t) marked);
+    }
+  }
+  
+  /* Return number of notes culled */
+  return x;
+}
+
+/*
+ * seq_play function.
+ */
+void seq_play(SEQ_CTX *ps) {
+  
+  /* Check parameter and state */
+  if ((ps == NULL) || (ps->pOut == NULL)) {
+    abort();
+  }
+  if (ps->pull != SEQ_PSTATE_INIT) {
+    abort();
+  }
+  
+  /* Let the worker thread finish first in pipelined mode */
+  seq_stop(ps);
+  
+  /* If notes were spilled, merge them into the note buffer as they are
+   * sequenced */
+  if (!seq_merge_begin(ps)) {
+    abort();  /* I/O error */
+  }
+  
+  /* If no notes, then output silent sample; else, sequence the rest of
+   * the music */
+  if ((ps->count < 1) && (ps->heap_count < 1) &&
+        (ps->pPlay == NULL)) {
+    sbuf_sample(ps->pOut, 0, 0);
+  } else {
+    seq_advance(ps, -1, 1);
+  }
+}
+
+/*
+ * seq_pull function.
+ */
+int32_t seq_pull(
+    SEQ_CTX * ps,
+    void    * pBuf,
+    int       format,
+    int32_t   frames,
+    int32_t   amp,
+    int32_t   level) {
+  
+  int64_t t_start = 0;
+  int32_t result = 0;
+  
+  /* Check parameters and state */
+  if ((ps == NULL) || (pBuf == NULL) || (frames < 0)) {
+    abort();
+  }
+  if ((format != SEQ_PULL_S16) && (format != SEQ_PULL_FLOAT)) {
+    abort();
+  }
+  if ((amp < 1) || (amp > INT16_MAX) || (level < 1)) {
+    abort();
+  }
+  if (ps->stream) {
+    abort();
+  }
+  
+  /* On the first pull, let the worker thread finish, start merging
+   * any spilled notes, and check whether there is any music at all */
+  if ((ps->pull == SEQ_PSTATE_INIT) && (frames > 0)) {
+    seq_stop(ps);
+    if (!seq_merge_begin(ps)) {
+      abort();  /* I/O error */
+    }
+    
+    if ((ps->count < 1) && (ps->heap_count < 1) &&
+          (ps->pPlay == NULL)) {
+      ps->pull = SEQ_PSTATE_EMPTY;
+    } else {
+      ps->pull = SEQ_PSTATE_MUSIC;
+    }
+  }
+  
+  /* Direct the output to the caller buffer */
+  ps->pDest = pBuf;
+  ps->dest_format = format;
+  ps->dest_amp = amp;
+  ps->dest_level = level;
+  ps->dest_i = 0;
+  
+  /* If there are no notes, pull the single silent sample; else,
+   * sequence up to the requested number of frames */
+  if ((ps->pull == SEQ_PSTATE_EMPTY) && (frames > 0)) {
+    seq_emit(ps, 0, 0);
+    result = 1;
+    ps->pull = SEQ_PSTATE_DONE;
+    
+  } else if ((ps->pull == SEQ_PSTATE_MUSIC) && (frames > 0)) {
+    t_start = ps->t;
+    seq_advance(ps, t_start + frames, 1);
+    
+    result = (int32_t) (ps->t - t_start);
+    if (result < frames) {
+      ps->pull = SEQ_PSTATE_DONE;
+    }
+  }
+  
+  /* Direct the output back to the sample buffer */
+  ps->pDest = NULL;
+  
+  /* Return the number of frames pulled */
+  return result;
+}
+
+/*
+ * seq_stream function.
+ */
+void seq_stream(SEQ_CTX *ps) {
+  
+  /* Check parameter and state */
+  if (ps == NULL) {
+    abort();
+  }
+  if ((ps->count > 0) || (ps->run_count > 0)) {
+    abort();
+  }
+  
+  /* Switch to streaming mode */
+  ps->stream = 1;
+}
+
+/*
+ * seq_pipeline function.
+ */
+void seq_pipeline(SEQ_CTX *ps) {
+  
+  /* Check parameter and state */
+  if (ps == NULL) {
+    abort();
+  }
+  if ((!ps->stream) || (ps->count > 0) || (ps->pWorker != NULL)) {
+    abort();
+  }
+  
+  /* Switch to pipelined mode */
+  ps->pipe = 1;
+}
+
+/*
+ * seq_join function.
+ */
+int seq_join(SEQ_CTX *ps) {
+  
+  int status = 1;
+  
+  /* Check parameter */
+  if (ps == NULL) {
+    abort();
+  }
+  
+  /* Wait for the worker thread */
+  seq_stop(ps);
+  
+  /* Report and clear any failure */
+  if (ps->qfail) {
+    status = 0;
+    ps->qfail = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * seq_save function.
+ */
+int seq_save(SEQ_CTX *ps, FILE *pOut) {
+  
+  int status = 1;
+  int32_t n = 0;
+  
+  /* Check parameter and state */
+  if ((ps == NULL) || (pOut == NULL)) {
+    abort();
+  }
+  if (ps->stream) {
+    abort();
+  }
+  
+  /* If notes were spilled, write the whole merge and leave every note
+   * in the spill file; otherwise, write the whole note table */
+  if (ps->run_count > 0) {
+    status = seq_merge_begin(ps);
+    while (status && (ps->heap_count > 0)) {
+      n = seq_merge(ps, ps->buf, ps->cap);
+      if (fwrite(ps->buf, sizeof(SEQ_NOTE), (size_t) n, pOut)
+            != (size_t) n) {
+        status = 0;
+      }
+    }
+    ps->heap_count = 0;
+    memset(ps->buf, 0, ((size_t) ps->cap) * sizeof(SEQ_NOTE));
+    ps->count = 0;
+    
+  } else if (ps->count > 0) {
+    if (fwrite(ps->buf, sizeof(SEQ_NOTE), (size_t) ps->count, pOut)
+          != (size_t) ps->count) {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * seq_load function.
+ */
+int seq_load(SEQ_CTX *ps, const void *pData, size_t len) {
+  
+  int status = 1;
+  int64_t count = 0;
+  int64_t done = 0;
+  int32_t cap = 0;
+  int32_t n = 0;
+  int32_t x = 0;
+  int64_t last_t = 0;
+  const SEQ_NOTE *pn = NULL;
+  
+  /* Check parameters and state */
+  if ((ps == NULL) || ((pData == NULL) && (len > 0))) {
+    abort();
+  }
+  if ((ps->count > 0) || (ps->run_count > 0) || ps->stream) {
+    abort();
+  }
+  
+  /* Get the note count */
+  if ((len % sizeof(SEQ_NOTE)) != 0) {
+    status = 0;
+  }
+  if (status && (len / sizeof(SEQ_NOTE) > (size_t) INT64_MAX)) {
+    status = 0;
+  }
+  if (status) {
+    count = (int64_t) (len / sizeof(SEQ_NOTE));
+  }
+  
+  /* Replace the buffer with one that has room for all the notes, or
+   * for as many as the buffer can hold */
+  if (status && (count > 0)) {
+    cap = SEQ_CAP_MAX;
+    if (count < cap) {
+      cap = (int32_t) count;
+    }
+    if (cap < SEQ_CAP_INIT) {
+      cap = SEQ_CAP_INIT;
+    }
+    if (ps->buf != NULL) {
+      free(ps->buf);
+      ps->buf = NULL;
+    }
+    ps->buf = (SEQ_NOTE *) malloc(((size_t) cap) * sizeof(SEQ_NOTE));
+    if (ps->buf == NULL) {
+      abort();
+    }
+    memset(ps->buf, 0, ((size_t) cap) * sizeof(SEQ_NOTE));
+    ps->cap = cap;
+  }
+  
+  /* Copy the notes in pieces that fit in the buffer, spilling each full
+   * buffer to the spill file before the next */
+  while (status && (done < count)) {
+    if (ps->count > 0) {
+      status = seq_spill(ps);
+    }
+    
+    if (status) {
+      n = ps->cap;
+      if (count - done < n) {
+        n = (int32_t) (count - done);
+      }
+      memcpy(
+        ps->buf,
+        ((const unsigned char *) pData) +
+          (((size_t) done) * sizeof(SEQ_NOTE)),
+        ((size_t) n) * sizeof(SEQ_NOTE));
+      ps->count = n;
+      done += n;
+    }
+    
+    /* Check every note, including that the notes are sorted */
+    for(x = 0; status && (x < n); x++) {
+      pn = &((ps->buf)[x]);
+      if ((pn->t < 0) || (pn->t > MAX_TIME) || (pn->dur < 1) ||
+          (pn->dur > MAX_TIME - pn->t) ||
+          (pn->pitch < PITCH_MIN) || (pn->pitch > PITCH_MAX) ||
+          (pn->instr >= INSTR_MAXCOUNT) ||
+          (pn->layer >= LAYER_MAXCOUNT) ||
+          ((pn->flags & ~SEQ_NOTE_CULLED) != 0)) {
+        status = 0;
+      }
+      if (status && (pn->t < last_t)) {
+        status = 0;
+      }
+      if (status) {
+        last_t = pn->t;
+      }
+    }
+  }
+  
+  /* If not valid, blank the buffer and discard anything spilled */
+  if (!status) {
+    if (ps->cap > 0) {
+      memset(ps->buf, 0, ((size_t) ps->cap) * sizeof(SEQ_NOTE));
+    }
+    ps->count = 0;
+    seq_unspill(ps);
+  }
+  
+  /* Return status */
+  return status;
 }
@@ -5,27 +5,174 @@
  * seq.h
  * 
  * Sequencer module of Retro synthesizer.
+ * 
+ * The timeline is measured in samples with 64-bit signed integers, and
+ * no note may end after sample MAX_TIME, which is centuries into the
+ * music.  The number of notes is only limited by disk space, since
+ * notes are spilled to disk when they don't fit in memory.  See
+ * seq_note().
  */
 
 #include "retrodef.h"
 #include "instr.h"
 #include "layer.h"
+#include "sbuf.h"
 #include "sqwave.h"
 #include "ttone.h"
 
+/*
+ * The default cutoff threshold for early voice termination, which
+ * disables it.
+ * 
+ * See seq_cutoff() for further information.
+ */
+#define SEQ_CUTOFF_DEFAULT (0)
+
+/*
+ * The maximum cutoff threshold for early voice termination.
+ */
+#define SEQ_CUTOFF_MAX (INT16_MAX)
+
+/*
+ * The sample formats of seq_pull().
+ * 
+ * S16 is signed 16-bit integer samples in range [-32767, 32767], and
+ * FLOAT is float samples where 32767 in the 16-bit format is 1.0.
+ */
+#define SEQ_PULL_S16    (1)
+#define SEQ_PULL_FLOAT  (2)
+
+/*
+ * Structure prototype for SEQ_CTX.
+ * 
+ * A sequencer context holds the notes, options, and sequencing state of
+ * one render context.  See render.h for further information.
+ */
+struct SEQ_CTX_TAG;
+typedef struct SEQ_CTX_TAG SEQ_CTX;
+
+/*
+ * Allocate a new sequencer context.
+ * 
+ * pi and pl are the instrument and layer contexts that notes are
+ * performed with.  They are not owned by the sequencer context, and
+ * they must remain valid until the sequencer context is released.
+ * 
+ * The new context holds no notes and is not in streaming mode.  The
+ * cutoff threshold starts out as SEQ_CUTOFF_DEFAULT.  A sample buffer
+ * must be bound with seq_output() before the music is sequenced.
+ * Release the context with seq_free().
+ * 
+ * Parameters:
+ * 
+ *   pi - the instrument context
+ * 
+ *   pl - the layer context
+ * 
+ * Return:
+ * 
+ *   the new sequencer context
+ */
+SEQ_CTX *seq_alloc(INSTR_CTX *pi, LAYER_CTX *pl);
+
+/*
+ * Release a sequencer context.
+ * 
+ * Any worker thread is stopped first, and any spill file is closed and
+ * deleted.  The bound instrument, layer, and sample buffer objects are
+ * not released.  If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context, or NULL
+ */
+void seq_free(SEQ_CTX *ps);
+
+/*
+ * Bind the sample buffer that the music is sequenced to.
+ * 
+ * This must be called before seq_play(), and in streaming mode before
+ * the first note is added, since notes are then sequenced as they are
+ * added.  The sample buffer is not owned by the sequencer context, and
+ * it must remain valid while music is sequenced to it.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pb - the sample buffer
+ */
+void seq_output(SEQ_CTX *ps, SBUF *pb);
+
+/*
+ * Set the cutoff threshold for early voice termination.
+ * 
+ * Normally, a note stays in the sequencer until the end of the envelope
+ * reported by instr_length().  With a cutoff, the sequencer
+ * periodically asks the instrument and layer modules for an upper bound
+ * on everything the note can still produce, and retires the note early
+ * once that bound falls below the cutoff.  This saves the work of
+ * rendering long release tails, notes whose operators have all been
+ * disabled, and notes on layers that stay silent.  Retired notes still
+ * count towards the length of the music, so silence is output up to
+ * where they would have ended.
+ * 
+ * cutoff is measured in instrument sample units, the same units as the
+ * samples produced by instr_get().  It must be in range
+ * [0, SEQ_CUTOFF_MAX].  Zero disables early voice termination, so that
+ * every note is rendered for its full envelope.  The default is
+ * SEQ_CUTOFF_DEFAULT, which is zero.  Since FM samples are rounded
+ * down, a note whose bound is below one may still produce samples of
+ * -1, so even a cutoff of one can change the output slightly.
+ * 
+ * This must be called before seq_play() to have any effect.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   cutoff - the cutoff threshold, or zero to disable
+ */
+void seq_cutoff(SEQ_CTX *ps, int32_t cutoff);
+
+/*
+ * Switch the sequencer to mono-aural output.
+ * 
+ * In mono-aural mode, the sequencer skips stereo imaging and mixes
+ * only a single channel.  Each sample is sent to the sample buffer
+ * with that channel on both the left and right, so the sample buffer
+ * can be switched to mono-aural mode with sbuf_mono().
+ * 
+ * The output is the same as stereo output after instr_flatten(), which
+ * should also be called on the instrument context so that any
+ * remaining stereo computations agree.
+ * 
+ * This must be called before seq_play() to have any effect.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+void seq_mono(SEQ_CTX *ps);
+
 /*
  * Add a note to the sequencer.
  * 
  * Notes can be added in any order, but the sequencer is optimized for
  * notes to be added in roughly sequential order.
  * 
- * The function fails if there are too many notes.
+ * Outside of streaming mode, once the note buffer in memory is full,
+ * its notes are written to a temporary spill file as a sorted run, and
+ * the buffer starts over.  seq_play() merges the runs back in time
+ * order as it sequences, so the number of notes is limited by disk
+ * space rather than memory.  The function then only fails if the spill
+ * file can't be written.
  * 
  * t is the time offset in samples from the beginning of the music.  It
- * must be zero or greater.
+ * must be in range [0, MAX_TIME].
  * 
  * dur is the duration of the note in samples.  It must be greater than
- * zero.  Furthermore, (t+dur) must not exceed INT32_MAX.
+ * zero.  Furthermore, (t+dur) must not exceed MAX_TIME.
  * 
  * pitch is the pitch of the note, in semitones from middle C.  That is,
  * a pitch of zero is middle C, -1 is one semitone below middle C, 2 is
@@ -42,8 +189,22 @@
  * sequencing, not during this call.  The layer index must be in range
  * [0, LAYER_MAXCOUNT - 1].
  * 
+ * In streaming mode, see seq_stream(), notes must be added in order of
+ * their time offsets or a fault occurs.  A note that can only produce
+ * silence is culled right away, as seq_cull() would.  All the music
+ * before the note is sequenced to the sample buffer before the note is
+ * added, so the buffer only ever holds notes that start at the same
+ * time.  The failure for too many notes then only occurs if too many
+ * notes start at the same time.
+ * 
+ * In pipelined mode, see seq_pipeline(), the note is only queued for
+ * the worker thread.  If the worker fails to add a note, the failure is
+ * returned by a later call to this function, or by seq_join().
+ * 
  * Parameters:
  * 
+ *   ps - the sequencer context
+ * 
  *   t - the time offset of the note in samples
  * 
  *   dur - the duration of the note in samples
@@ -56,32 +217,247 @@
  * 
  * Return:
  * 
- *   non-zero if successful, zero if too many notes
+ *   non-zero if successful, zero if too many notes or the spill file
+ *   couldn't be written
  */
 int seq_note(
-    int32_t t,
-    int32_t dur,
-    int32_t pitch,
-    int32_t instr,
-    int32_t layer);
+    SEQ_CTX * ps,
+    int64_t   t,
+    int64_t   dur,
+    int32_t   pitch,
+    int32_t   instr,
+    int32_t   layer);
+
+/*
+ * Cull notes that can only produce silence from the sequencer.
+ * 
+ * This is an analysis pass that should be run after all instruments,
+ * layers, and notes have been defined and before seq_play().  Each note
+ * is checked against the current state of the instrument and layer
+ * contexts.  A note is culled if its instrument register is cleared,
+ * or if its layer is undefined or stays low enough during the whole
+ * envelope of the note that the instrument intensity is zero.  See
+ * instr_silent() for the exact rule.
+ * 
+ * Culled notes are marked rather than removed.  They are not performed,
+ * but they still take the noise seeds they would have taken when they
+ * start, see instr_skip(), so the output is exactly the same as without
+ * the cull.  They also still count towards the length of the music, so
+ * silence is output up to where a culled note at the very end would
+ * have ended.
+ * 
+ * In streaming mode, notes are culled as they are added instead, and
+ * this call just returns the number of notes that were culled since
+ * the last call.
+ * 
+ * Notes that were spilled to disk are marked in the spill file.  The
+ * count is clamped to INT32_MAX.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ * Return:
+ * 
+ *   the number of notes that were culled
+ */
+int32_t seq_cull(SEQ_CTX *ps);
+
+/*
+ * Switch the sequencer to streaming mode.
+ * 
+ * This must be called before any notes have been added, or a fault
+ * occurs.  In streaming mode, seq_note() sequences the music as notes
+ * are added, so memory use depends on how many notes are playing at
+ * the same time rather than on the length of the music.  See
+ * seq_note() for details.
+ * 
+ * Since notes are sequenced as they are added, everything seq_play()
+ * requires must be ready before the first note is added, and the
+ * instrument and layer registers used by notes must not change after
+ * the first note is added.  Notes that start at the same time may be
+ * mixed in a different order than outside of streaming mode, which
+ * only matters for instruments that use noise.  seq_save() and
+ * seq_load() may not be used in streaming mode.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+void seq_stream(SEQ_CTX *ps);
+
+/*
+ * Switch the sequencer to pipelined mode.
+ * 
+ * The sequencer must already be in streaming mode, and no notes may
+ * have been added yet, or a fault occurs.
+ * 
+ * In pipelined mode, the first call to seq_note() starts a worker
+ * thread with os_worker().  seq_note() then only queues each note, and
+ * the worker adds the notes as streaming mode would, sequencing the
+ * music up to each note while the caller goes on reading more notes.
+ * The output is exactly the same.  If the platform can't start a
+ * thread, notes are added directly as in plain streaming mode.
+ * 
+ * Since the worker reads the bound instrument and layer contexts, and
+ * writes to the bound sample buffer, the caller must not use any of
+ * these objects from the first note until seq_join() returns.
+ * seq_cull() and seq_play() wait for the worker automatically.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+void seq_pipeline(SEQ_CTX *ps);
+
+/*
+ * Wait for the worker thread in pipelined mode to sequence all the
+ * queued notes, and then stop it.
+ * 
+ * If there is no worker thread, nothing is waited for.  Any later note
+ * starts a new worker.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the worker failed to add a note
+ *   because there were too many notes
+ */
+int seq_join(SEQ_CTX *ps);
 
 /*
  * Perform the music according to the notes currently programmed in the
  * sequencer, using the current instrument and layer settings.
  * 
- * The square wave module must be initialized before using this
- * function.  The sbuf module must be initialized and open before using
- * this function.
+ * The square wave context of the instrument context must be
+ * initialized before using this function.  A sample buffer must have
+ * been bound with seq_output(), or a fault occurs.
  * 
  * The instrument and layer indices of each note select instruments and
- * layers according to the state of the instrument and layer modules
+ * layers according to the state of the instrument and layer contexts
  * when this function is called, NOT when the note was defined with a
  * call to seq_note().
  * 
  * If no notes have been programmed yet, this call only outputs a single
  * silent sample.  Otherwise, it generates the appropriate samples and
- * sends them to the sbuf module.
+ * sends them to the sample buffer.  In streaming mode, this only
+ * sequences the rest of the music after the last note was added.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ */
+void seq_play(SEQ_CTX *ps);
+
+/*
+ * Perform the music into a caller-provided buffer, a block of frames at
+ * a time.
+ * 
+ * This is an alternative to seq_play() that doesn't use the sample
+ * buffer, so no sample buffer needs to be bound.  The same context may
+ * not use both seq_play() and seq_pull(), and seq_pull() may not be
+ * used in streaming mode, or a fault occurs.  The requirements of
+ * seq_play() on the square wave, instrument, and layer contexts also
+ * apply here, and the contexts must not change between pulls.
+ * 
+ * Each call sequences up to frames frames into pBuf, continuing from
+ * where the previous call stopped.  A frame is one sample in mono-aural
+ * mode, see seq_mono(), or else a left sample followed by a right
+ * sample.  pBuf must have room for that many frames, in the format
+ * selected by format, which is one of the SEQ_PULL constants.  pBuf
+ * points to int16_t samples for SEQ_PULL_S16 and float samples for
+ * SEQ_PULL_FLOAT.
+ * 
+ * The output is the same as seq_play() would send to the sample
+ * buffer, including the single silent sample at the end, except that
+ * each sample is scaled by amp divided by level.  For SEQ_PULL_S16,
+ * scaled samples are clamped to 16-bit range as sbuf_stream() does.
+ * If level is the greatest absolute sample value of the music, this
+ * gives exactly the samples that sbuf_stream() would write with the
+ * same amp.  Since the samples are pulled before the rest of the music
+ * is sequenced, that value isn't known in advance, so level must be
+ * chosen by the caller.  amp must be in range [1, INT16_MAX] and level
+ * must be greater than zero.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pBuf - the buffer to pull samples into
+ * 
+ *   format - the sample format
+ * 
+ *   frames - the maximum number of frames to pull
+ * 
+ *   amp - the amplitude that level is scaled to
+ * 
+ *   level - the sample value that is scaled to amp
+ * 
+ * Return:
+ * 
+ *   the number of frames written to the buffer, which is less than
+ *   frames only when the music has ended
+ */
+int32_t seq_pull(
+    SEQ_CTX * ps,
+    void    * pBuf,
+    int       format,
+    int32_t   frames,
+    int32_t   amp,
+    int32_t   level);
+
+/*
+ * Write the note table to a file in a binary format.
+ * 
+ * The notes are written in sorted order exactly as they are stored in
+ * memory, with no header, so the data is in the native byte order and
+ * layout, with the time offset and duration of each note as 64-bit
+ * integers.  If notes were spilled to disk, see seq_note(), the runs
+ * are merged as they are written.  It can be loaded back on the same
+ * machine with seq_load(), for example straight out of a memory-mapped
+ * file.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pOut - the file to write to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there was an I/O error
+ */
+int seq_save(SEQ_CTX *ps, FILE *pOut);
+
+/*
+ * Load a note table written by seq_save().
+ * 
+ * pData points to the note table and len is its length in bytes.  The
+ * data does not need to be aligned.  No notes may have been added to
+ * the sequencer yet, or a fault occurs.
+ * 
+ * Every note is checked against the rules of seq_note(), and the notes
+ * must be in sorted order.  Notes that don't fit in the note buffer
+ * are spilled to disk as seq_note() would.  If the data is not valid or
+ * the spill file can't be written, the sequencer is left empty and the
+ * call fails.
+ * 
+ * Parameters:
+ * 
+ *   ps - the sequencer context
+ * 
+ *   pData - the note table
+ * 
+ *   len - the length of the note table in bytes
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the data is not valid or the spill
+ *   file couldn't be written
  */
-void seq_play(void);
+int seq_load(SEQ_CTX *ps, const void *pData, size_t len);
 
 #endif
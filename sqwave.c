@@ -9,9 +9,12 @@
 #include "sqwave.h"
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "os.h"
+
 /*
  * Constants
  * =========
@@ -47,6 +50,32 @@
 #define SQWAVE_FLIMIT_CD  (21000.0)
 #define SQWAVE_FLIMIT_DVD (23000.0)
 
+/*
+ * The signature and version at the start of wave table cache files.
+ * 
+ * The version must be incremented whenever the way the tables are
+ * computed changes, so that stale cache files are ignored.
+ */
+#define SQWAVE_CACHE_MAGIC "RSQWAVE"
+#define SQWAVE_CACHE_VERSION (1)
+
+/*
+ * The byte order marker stored in wave table cache files, so that
+ * files written on a platform with a different byte order are ignored.
+ */
+#define SQWAVE_CACHE_ORDER (0x01020304L)
+
+/*
+ * The file extension of wave table cache files.
+ */
+#define SQWAVE_CACHE_EXT ".sretro"
+
+/*
+ * The maximum number of shared wave tables that sqwave_warm() keeps,
+ * which is enough for one at each sampling rate.
+ */
+#define SQWAVE_BANK_MAX (2)
+
 /*
  * Type declarations
  * =================
@@ -64,8 +93,12 @@ typedef struct {
   
   /*
    * Pointer to the samples for this record.
+   * 
+   * This either points to dynamically allocated memory that is owned
+   * by the square wave object, or into a mapped cache file that the
+   * object unmaps when it is released.
    */
-  int16_t *psamp;
+  const int16_t *psamp;
   
 } SQWAVE_WAVREC;
 
@@ -95,21 +128,126 @@ typedef struct {
 } SQWAVE_WAVPARAM;
 
 /*
- * Static data
- * ===========
+ * Structure definition of the header of a wave table cache file.
+ * 
+ * The header is followed by the sample count of each key, as int32_t
+ * values in key order, and then by the samples of each key, as int16_t
+ * values in key order.  All values are in platform byte order.
+ */
+typedef struct {
+  
+  /*
+   * SQWAVE_CACHE_MAGIC, padded with zero bytes.
+   */
+  char magic[8];
+  
+  /*
+   * SQWAVE_CACHE_VERSION.
+   */
+  int32_t version;
+  
+  /*
+   * SQWAVE_CACHE_ORDER.
+   */
+  int32_t order;
+  
+  /*
+   * The sampling rate.
+   */
+  int32_t rate;
+  
+  /*
+   * SQWAVE_KEY_COUNT.
+   */
+  int32_t keys;
+  
+  /*
+   * SQWAVE_MAX_HARMONICS.
+   */
+  int32_t harmonics;
+  
+  /*
+   * SQWAVE_MIN_SAMPLES.
+   */
+  int32_t minsamp;
+  
+  /*
+   * The quantization amplitude.
+   */
+  double amp;
+  
+} SQWAVE_CACHEHEAD;
+
+/*
+ * SQWAVE_CTX structure.
+ * 
+ * Prototype given in the header.
  */
+struct SQWAVE_CTX_TAG {
+  
+  /*
+   * The initialization flag.
+   */
+  int init;
+  
+  /*
+   * The quantization amplitude and sampling rate.
+   * 
+   * Only valid if init is non-zero.
+   */
+  double amp;
+  int32_t rate;
+  
+  /*
+   * The mapped cache file that the records point into, or NULL if the
+   * records point into memory that the object owns.
+   * 
+   * maplen is the length of the mapping in bytes.
+   */
+  const void *pMap;
+  size_t maplen;
+  
+  /*
+   * The shared wave table that the records point into, or NULL if the
+   * records are not shared.
+   * 
+   * Shared wave tables are built by sqwave_warm() and never released,
+   * so the object doesn't own anything the records point to.
+   */
+  const SQWAVE_CTX *pBank;
+  
+  /*
+   * The wave table.
+   * 
+   * Only valid if init is non-zero.  Each record is only built the
+   * first time its key is used; until then, its psamp pointer is NULL.
+   * Use sqwave_build() to get a record.
+   */
+  SQWAVE_WAVREC table[SQWAVE_KEY_COUNT];
+  
+  /*
+   * The wave table cache directory, or NULL if there is no cache.
+   * 
+   * Dynamically allocated copy of the path.
+   */
+  char *pCache;
+};
 
 /*
- * The initialization flag.
+ * Static data
+ * ===========
  */
-static int m_sqwave_init = 0;
 
 /*
- * The wave table.
+ * The shared wave tables built by sqwave_warm().
  * 
- * Only valid if m_sqwave_init is non-zero.
+ * NULL entries are unused.  Each shared wave table is a fully built
+ * square wave object that is never released.  This table is only
+ * accessed while holding os_global_lock().  The objects in it never
+ * change once they are added, so their records are read without the
+ * lock.
  */
-static SQWAVE_WAVREC m_sqwave_table[SQWAVE_KEY_COUNT];
+static SQWAVE_CTX *m_sqwave_bank[SQWAVE_BANK_MAX];
 
 /*
  * Local functions
@@ -118,10 +256,11 @@ static SQWAVE_WAVREC m_sqwave_table[SQWAVE_KEY_COUNT];
 
 /* Function prototypes */
 static void sqwave_sinewave(
-    int16_t * ps,
-    int32_t   samp_count,
-    int32_t   wave_count,
-    double    amp);
+          int16_t * ps,
+          int32_t   samp_count,
+          int32_t   wave_count,
+          double    amp,
+    const double  * pSin);
 static void sqwave_squarewave(
     int16_t * ps,
     int32_t   samp_count,
@@ -137,6 +276,17 @@ static void sqwave_param(
     int32_t           max_hcount,
     int32_t           min_scount);
 
+static void sqwave_keyparam(
+    SQWAVE_CTX      * psw,
+    SQWAVE_WAVPARAM * pwp,
+    int32_t           pitch);
+static SQWAVE_WAVREC *sqwave_build(SQWAVE_CTX *psw, int32_t pitch);
+
+static void sqwave_cachehead(SQWAVE_CTX *psw, SQWAVE_CACHEHEAD *ph);
+static char *sqwave_cachepath(SQWAVE_CTX *psw);
+static int sqwave_cacheload(SQWAVE_CTX *psw);
+static void sqwave_cachesave(SQWAVE_CTX *psw);
+
 /*
  * Add a sine wave to the given sample array.
  * 
@@ -150,6 +300,12 @@ static void sqwave_param(
  * amp is what to multiply each normalized sine wave by to get the
  * integer value.  It must be finite.
  * 
+ * pSin points to a table of samp_count values holding a single period
+ * of the sine wave, so that element j is sin(2 * pi * j / samp_count).
+ * Since the wave_count periods fit exactly into the sample array, each
+ * sample of the wave is one of the table elements, so no sine needs to
+ * be computed here.
+ * 
  * The generated samples are added to the samples that are already 
  * the array.
  * 
@@ -162,20 +318,23 @@ static void sqwave_param(
  *   wave_count - the number of wave periods to write
  * 
  *   amp - the amplitude of the sine wave
+ * 
+ *   pSin - the table of a single sine period
  */
 static void sqwave_sinewave(
-    int16_t * ps,
-    int32_t   samp_count,
-    int32_t   wave_count,
-    double    amp) {
+          int16_t * ps,
+          int32_t   samp_count,
+          int32_t   wave_count,
+          double    amp,
+    const double  * pSin) {
   
   int32_t x = 0;
   int32_t i = 0;
-  double sv = 0.0;
-  double mult = 0.0;
+  int32_t j = 0;
+  int32_t step = 0;
   
   /* Check parameters */
-  if (ps == NULL) {
+  if ((ps == NULL) || (pSin == NULL)) {
     abort();
   }
   if ((samp_count < 2) || (wave_count < 1)) {
@@ -185,18 +344,14 @@ static void sqwave_sinewave(
     abort();
   }
   
-  /* Precompute the multiplier */
-  mult = (2.0 * M_PI * ((double) wave_count)) /
-            ((double) samp_count);
+  /* Each sample advances the table position by the wave count */
+  step = wave_count % samp_count;
   
   /* Generate the sine wave */
   for(x = 0; x < samp_count; x++) {
     
-    /* Get the sine wave value */
-    sv = sin(((double) x) * mult);
-    
-    /* Quantize */
-    i = (int32_t) (sv * amp);
+    /* Quantize the sine wave value */
+    i = (int32_t) (pSin[j] * amp);
     
     /* Add in existing sample */
     i = i + ((int32_t) ps[x]);
@@ -210,6 +365,12 @@ static void sqwave_sinewave(
     
     /* Update sample */
     ps[x] = (int16_t) i;
+    
+    /* Advance table position */
+    j = j + step;
+    if (j >= samp_count) {
+      j = j - samp_count;
+    }
   }
 }
 
@@ -221,7 +382,9 @@ static void sqwave_sinewave(
  * 
  * The square wave is constructed as multiple calls to sinewave, each
  * adding a different harmonic of the square wave.  Square waves only
- * include odd-numbered harmonics.
+ * include odd-numbered harmonics.  The sine table that all the calls
+ * share is computed once here, so the whole wave only takes samp_count
+ * sine computations regardless of the number of harmonics.
  * 
  * harmonics indicates how many harmonics to add.  It must be greater
  * than zero.  If it is one, the result is the same as a sine wave.
@@ -252,6 +415,9 @@ static void sqwave_squarewave(
   
   int32_t h = 0;
   int32_t m = 0;
+  int32_t x = 0;
+  double mult = 0.0;
+  double *pSin = NULL;
   
   /* Check harmonics, wave_count, and amp parameters */
   if ((harmonics < 1) || (wave_count < 1)) {
@@ -260,6 +426,19 @@ static void sqwave_squarewave(
   if (!isfinite(amp)) {
     abort();
   }
+  if (samp_count < 2) {
+    abort();
+  }
+  
+  /* Compute the table of a single sine period */
+  pSin = (double *) malloc(samp_count * sizeof(double));
+  if (pSin == NULL) {
+    abort();
+  }
+  mult = (2.0 * M_PI) / ((double) samp_count);
+  for(x = 0; x < samp_count; x++) {
+    pSin[x] = sin(((double) x) * mult);
+  }
   
   /* Add harmonics */
   for(h = 0; h < harmonics; h++) {
@@ -272,8 +451,13 @@ static void sqwave_squarewave(
         ps,
         samp_count,
         wave_count * m,
-        (4.0 / (M_PI * ((double) m))) * amp);
+        (4.0 / (M_PI * ((double) m))) * amp,
+        pSin);
   }
+  
+  /* Release the sine table */
+  free(pSin);
+  pSin = NULL;
 }
 
 /*
@@ -407,26 +591,488 @@ static void sqwave_param(
 }
 
 /*
- * Public function implementations
- * ===============================
+ * Fill in a square wave parameter structure for one of the keys.
  * 
- * See the header for specifications.
+ * The square wave object must be initialized.  pitch must be in range
+ * [PITCH_MIN, PITCH_MAX].
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ *   pwp - the parameter structure to fill in
+ * 
+ *   pitch - the pitch of the square wave
  */
+static void sqwave_keyparam(
+    SQWAVE_CTX      * psw,
+    SQWAVE_WAVPARAM * pwp,
+    int32_t           pitch) {
+  
+  double flim = 0.0;
+  
+  /* Check state */
+  if (!(psw->init)) {
+    abort();
+  }
+  
+  /* Check parameters */
+  if (pwp == NULL) {
+    abort();
+  }
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  
+  /* Determine frequency limit depending on sample rate */
+  if (psw->rate == RATE_CD) {
+    flim = SQWAVE_FLIMIT_CD;
+  } else if (psw->rate == RATE_DVD) {
+    flim = SQWAVE_FLIMIT_DVD;
+  } else {
+    /* Unrecognized sample rate */
+    abort();
+  }
+  
+  /* Determine wave parameters */
+  sqwave_param(
+      pwp,
+      pitchfreq(pitch),
+      psw->rate,
+      flim,
+      SQWAVE_MAX_HARMONICS,
+      SQWAVE_MIN_SAMPLES);
+}
 
 /*
- * sqwave_init function.
+ * Get the wave table record for a pitch, building it if this is the
+ * first time the pitch is used.
+ * 
+ * The square wave object must be initialized.  pitch must be in range
+ * [PITCH_MIN, PITCH_MAX].
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ *   pitch - the pitch of the square wave
+ * 
+ * Return:
+ * 
+ *   the wave table record
  */
-void sqwave_init(double amp, int32_t samprate) {
+static SQWAVE_WAVREC *sqwave_build(SQWAVE_CTX *psw, int32_t pitch) {
   
-  int32_t i = 0;
+  SQWAVE_WAVREC *pr = NULL;
   SQWAVE_WAVPARAM wp;
-  double flim = 0.0;
+  int16_t *ps = NULL;
   
   /* Initialize structures */
   memset(&wp, 0, sizeof(SQWAVE_WAVPARAM));
   
   /* Check state */
-  if (m_sqwave_init) {
+  if (!(psw->init)) {
+    abort();
+  }
+  
+  /* Check parameters */
+  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
+    abort();
+  }
+  
+  /* Get the record */
+  pr = &((psw->table)[pitch + SQWAVE_KEY_BIAS]);
+  
+  /* Only build if not built yet */
+  if (pr->psamp == NULL) {
+    
+    /* Determine wave parameters for this entry */
+    sqwave_keyparam(psw, &wp, pitch);
+    
+    /* Allocate memory for the wave and clear the samples */
+    ps = (int16_t *) malloc(wp.samp_count * sizeof(int16_t));
+    if (ps == NULL) {
+      abort();
+    }
+    memset(ps, 0, wp.samp_count * sizeof(int16_t));
+    
+    /* Write the square wave */
+    sqwave_squarewave(
+      ps,
+      wp.samp_count,
+      wp.wave_count,
+      psw->amp,
+      wp.harmonics);
+    
+    /* Store in the wave table */
+    pr->sampcount = wp.samp_count;
+    pr->psamp = ps;
+  }
+  
+  /* Return the record */
+  return pr;
+}
+
+/*
+ * Fill in the header that a wave table cache file for the current
+ * amplitude and sampling rate must have.
+ * 
+ * The square wave object must be initialized.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ *   ph - the header to fill in
+ */
+static void sqwave_cachehead(SQWAVE_CTX *psw, SQWAVE_CACHEHEAD *ph) {
+  
+  /* Check state and parameters */
+  if ((!(psw->init)) || (ph == NULL)) {
+    abort();
+  }
+  
+  /* Fill in the header, clearing any padding */
+  memset(ph, 0, sizeof(SQWAVE_CACHEHEAD));
+  strcpy(ph->magic, SQWAVE_CACHE_MAGIC);
+  ph->version = SQWAVE_CACHE_VERSION;
+  ph->order = (int32_t) SQWAVE_CACHE_ORDER;
+  ph->rate = psw->rate;
+  ph->keys = SQWAVE_KEY_COUNT;
+  ph->harmonics = SQWAVE_MAX_HARMONICS;
+  ph->minsamp = SQWAVE_MIN_SAMPLES;
+  ph->amp = psw->amp;
+}
+
+/*
+ * Get the path to the wave table cache file for the current amplitude
+ * and sampling rate.
+ * 
+ * The square wave object must be initialized and have a cache
+ * directory.  The file name only includes the integer part of the
+ * amplitude, since the header of the file records the exact value.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ * Return:
+ * 
+ *   the dynamically allocated path
+ */
+static char *sqwave_cachepath(SQWAVE_CTX *psw) {
+  
+  char *pc = NULL;
+  
+  /* Check state */
+  if ((!(psw->init)) || (psw->pCache == NULL)) {
+    abort();
+  }
+  
+  /* Allocate the path with room for separator, name, and extension */
+  pc = (char *) malloc(
+        strlen(psw->pCache) + strlen(SQWAVE_CACHE_EXT) + 32);
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Format the path */
+  sprintf(pc, "%s%csqwave-%ld-%ld%s",
+          psw->pCache,
+          (char) os_getsep(),
+          (long) psw->rate,
+          (long) psw->amp,
+          SQWAVE_CACHE_EXT);
+  
+  /* Return path */
+  return pc;
+}
+
+/*
+ * Load the whole wave table from the cache file.
+ * 
+ * The square wave object must be initialized and have a cache
+ * directory, and no records may have been built yet.  The file is
+ * mapped into memory and the records point directly into it.
+ * 
+ * The file is only used if its header matches, and the sample count of
+ * each key and the total length of the file are what they should be.
+ * Otherwise, the wave table is left empty.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ * Return:
+ * 
+ *   non-zero if the wave table was loaded, zero if the cache file is
+ *   missing, out of date, or invalid
+ */
+static int sqwave_cacheload(SQWAVE_CTX *psw) {
+  
+  int status = 1;
+  int32_t k = 0;
+  char *pPath = NULL;
+  const unsigned char *pm = NULL;
+  const int32_t *pCount = NULL;
+  const int16_t *ps = NULL;
+  size_t flen = 0;
+  size_t total = 0;
+  SQWAVE_CACHEHEAD head;
+  SQWAVE_WAVPARAM wp;
+  
+  /* Initialize structures */
+  memset(&head, 0, sizeof(SQWAVE_CACHEHEAD));
+  memset(&wp, 0, sizeof(SQWAVE_WAVPARAM));
+  
+  /* Check state */
+  if ((!(psw->init)) || (psw->pCache == NULL)) {
+    abort();
+  }
+  
+  /* Map the cache file, if it exists */
+  pPath = sqwave_cachepath(psw);
+  pm = (const unsigned char *) os_mapfile(pPath, &flen);
+  if (pm == NULL) {
+    status = 0;
+  }
+  
+  /* Check the header */
+  total = sizeof(SQWAVE_CACHEHEAD)
+            + (SQWAVE_KEY_COUNT * sizeof(int32_t));
+  if (status && (flen < total)) {
+    status = 0;
+  }
+  if (status) {
+    sqwave_cachehead(psw, &head);
+    if (memcmp(pm, &head, sizeof(SQWAVE_CACHEHEAD)) != 0) {
+      status = 0;
+    }
+  }
+  
+  /* Check each sample count and compute the total length */
+  if (status) {
+    pCount = (const int32_t *) (pm + sizeof(SQWAVE_CACHEHEAD));
+    for(k = 0; k < SQWAVE_KEY_COUNT; k++) {
+      sqwave_keyparam(psw, &wp, k - SQWAVE_KEY_BIAS);
+      if (pCount[k] != wp.samp_count) {
+        status = 0;
+        break;
+      }
+      total = total + (((size_t) pCount[k]) * sizeof(int16_t));
+    }
+  }
+  if (status && (flen != total)) {
+    status = 0;
+  }
+  
+  /* Point each record into the file */
+  if (status) {
+    ps = (const int16_t *) (pm + sizeof(SQWAVE_CACHEHEAD)
+            + (SQWAVE_KEY_COUNT * sizeof(int32_t)));
+    for(k = 0; k < SQWAVE_KEY_COUNT; k++) {
+      ((psw->table)[k]).sampcount = pCount[k];
+      ((psw->table)[k]).psamp = ps;
+      ps = ps + pCount[k];
+    }
+    psw->pMap = pm;
+    psw->maplen = flen;
+  }
+  
+  /* Unmap the file if it wasn't used */
+  if ((!status) && (pm != NULL)) {
+    os_unmapfile(pm, flen);
+    pm = NULL;
+  }
+  
+  /* Release path */
+  free(pPath);
+  pPath = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Build the whole wave table and save it to the cache file.
+ * 
+ * The square wave object must be initialized and have a cache
+ * directory.  The file is first written to a temporary file and then
+ * renamed, so that an interrupted write never leaves a partial file
+ * behind.  The temporary file has a unique name, so that parallel jobs
+ * saving the same file don't write into each other's files.  Any
+ * failure just leaves the cache without the file.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ */
+static void sqwave_cachesave(SQWAVE_CTX *psw) {
+  
+  int status = 1;
+  int32_t k = 0;
+  char *pPath = NULL;
+  char *pTemp = NULL;
+  FILE *pf = NULL;
+  SQWAVE_CACHEHEAD head;
+  
+  /* Initialize structures */
+  memset(&head, 0, sizeof(SQWAVE_CACHEHEAD));
+  
+  /* Check state */
+  if ((!(psw->init)) || (psw->pCache == NULL)) {
+    abort();
+  }
+  
+  /* Build every record */
+  for(k = PITCH_MIN; k <= PITCH_MAX; k++) {
+    sqwave_build(psw, k);
+  }
+  
+  /* Build the path and create the temporary file */
+  pPath = sqwave_cachepath(psw);
+  pf = os_tempfile(pPath, &pTemp);
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Write the temporary file */
+  if (status) {
+    sqwave_cachehead(psw, &head);
+    if (fwrite(&head, sizeof(SQWAVE_CACHEHEAD), 1, pf) != 1) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    for(k = 0; k < SQWAVE_KEY_COUNT; k++) {
+      if (fwrite(&(((psw->table)[k]).sampcount),
+                  sizeof(int32_t), 1, pf) != 1) {
+        status = 0;
+        break;
+      }
+    }
+  }
+  
+  if (status) {
+    for(k = 0; k < SQWAVE_KEY_COUNT; k++) {
+      if (fwrite(((psw->table)[k]).psamp,
+                  sizeof(int16_t),
+                  (size_t) ((psw->table)[k]).sampcount,
+                  pf) != (size_t) ((psw->table)[k]).sampcount) {
+        status = 0;
+        break;
+      }
+    }
+  }
+  
+  if (pf != NULL) {
+    if (fclose(pf) != 0) {
+      status = 0;
+    }
+    pf = NULL;
+  }
+  
+  /* Move the temporary file into place, or remove it on failure */
+  if (status) {
+    remove(pPath);
+    if (rename(pTemp, pPath) != 0) {
+      status = 0;
+    }
+  }
+  if ((!status) && (pTemp != NULL)) {
+    remove(pTemp);
+  }
+  
+  /* Release paths */
+  free(pTemp);
+  pTemp = NULL;
+  free(pPath);
+  pPath = NULL;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * sqwave_alloc function.
+ */
+SQWAVE_CTX *sqwave_alloc(void) {
+  
+  SQWAVE_CTX *psw = NULL;
+  
+  /* Allocate the object */
+  psw = (SQWAVE_CTX *) malloc(sizeof(SQWAVE_CTX));
+  if (psw == NULL) {
+    abort();
+  }
+  memset(psw, 0, sizeof(SQWAVE_CTX));
+  
+  /* Initialize the object */
+  psw->init = 0;
+  psw->amp = 0.0;
+  psw->rate = 0;
+  psw->pMap = NULL;
+  psw->maplen = 0;
+  psw->pBank = NULL;
+  psw->pCache = NULL;
+  
+  /* Return the new object */
+  return psw;
+}
+
+/*
+ * sqwave_free function.
+ */
+void sqwave_free(SQWAVE_CTX *psw) {
+  
+  int32_t k = 0;
+  
+  /* Only proceed if not NULL */
+  if (psw != NULL) {
+    
+    /* Release the records, or unmap the file they point into; records
+     * that point into a shared wave table are left alone */
+    if (psw->pMap != NULL) {
+      os_unmapfile(psw->pMap, psw->maplen);
+      psw->pMap = NULL;
+      psw->maplen = 0;
+      
+    } else if (psw->pBank == NULL) {
+      for(k = 0; k < SQWAVE_KEY_COUNT; k++) {
+        if (((psw->table)[k]).psamp != NULL) {
+          free((void *) ((psw->table)[k]).psamp);
+          ((psw->table)[k]).psamp = NULL;
+        }
+      }
+    }
+    psw->pBank = NULL;
+    
+    /* Release the cache directory and the object */
+    if (psw->pCache != NULL) {
+      free(psw->pCache);
+      psw->pCache = NULL;
+    }
+    free(psw);
+  }
+}
+
+/*
+ * sqwave_init function.
+ */
+void sqwave_init(SQWAVE_CTX *psw, double amp, int32_t samprate) {
+  
+  int32_t k = 0;
+  
+  /* Check state */
+  if (psw == NULL) {
+    abort();
+  }
+  if (psw->init) {
     abort();
   }
   
@@ -449,81 +1095,150 @@ void sqwave_init(double amp, int32_t samprate) {
   }
   
   /* Set initialization flag */
-  m_sqwave_init = 1;
+  psw->init = 1;
   
-  /* Clear wave table */
-  memset(m_sqwave_table, 0, SQWAVE_KEY_COUNT * sizeof(SQWAVE_WAVREC));
+  /* Store the parameters for building the wave table */
+  psw->amp = amp;
+  psw->rate = samprate;
   
-  /* Determine frequency limit depending on sample rate */
-  if (samprate == RATE_CD) {
-    flim = SQWAVE_FLIMIT_CD;
-  } else if (samprate == RATE_DVD) {
-    flim = SQWAVE_FLIMIT_DVD;
-  } else {
-    /* Unrecognized sample rate */
-    abort();
+  /* Clear wave table, since records are only built when first used */
+  memset(psw->table, 0, SQWAVE_KEY_COUNT * sizeof(SQWAVE_WAVREC));
+  
+  /* If sqwave_warm() built a shared wave table with the same
+   * parameters, point the records into it */
+  os_global_lock();
+  for(k = 0; k < SQWAVE_BANK_MAX; k++) {
+    if (m_sqwave_bank[k] != NULL) {
+      if ((m_sqwave_bank[k]->amp == amp) &&
+          (m_sqwave_bank[k]->rate == samprate)) {
+        memcpy(psw->table, m_sqwave_bank[k]->table,
+                SQWAVE_KEY_COUNT * sizeof(SQWAVE_WAVREC));
+        psw->pBank = m_sqwave_bank[k];
+        break;
+      }
+    }
   }
+  os_global_unlock();
   
-  /* Initialize wave table */
-  for(i = 0; i < SQWAVE_KEY_COUNT; i++) {
-    
-    /* Determine wave parameters for this entry */
-    sqwave_param(
-        &wp,
-        pitchfreq(i + PITCH_MIN),
-        samprate,
-        flim,
-        SQWAVE_MAX_HARMONICS,
-        SQWAVE_MIN_SAMPLES);
-    
-    /* Set the sample count in the wave table */
-    (m_sqwave_table[i]).sampcount = wp.samp_count;
+  /* Otherwise, if there is a cache directory, load the whole wave table
+   * from it, or build the whole wave table and save it if that fails */
+  if ((psw->pBank == NULL) && (psw->pCache != NULL)) {
+    if (!sqwave_cacheload(psw)) {
+      sqwave_cachesave(psw);
+    }
+  }
+}
+
+/*
+ * sqwave_warm function.
+ */
+void sqwave_warm(const char *pDir, double amp, int32_t samprate) {
+  
+  int32_t k = 0;
+  SQWAVE_CTX *pb = NULL;
+  
+  /* Initialize a new object in the usual way, which also checks the
+   * parameters and clamps the amplitude */
+  pb = sqwave_alloc();
+  sqwave_cachedir(pb, pDir);
+  sqwave_init(pb, amp, samprate);
+  
+  /* Only proceed if there isn't already a shared wave table with these
+   * parameters */
+  if (pb->pBank == NULL) {
     
-    /* Allocate memory for the wave and clear the samples */
-    (m_sqwave_table[i]).psamp = (int16_t *) malloc(
-                                  wp.samp_count * sizeof(int16_t));
-    if ((m_sqwave_table[i]).psamp == NULL) {
-      abort();
+    /* Build every record */
+    for(k = PITCH_MIN; k <= PITCH_MAX; k++) {
+      sqwave_build(pb, k);
     }
-    memset(
-      (m_sqwave_table[i]).psamp,
-      0,
-      wp.samp_count * sizeof(int16_t));
     
-    /* Write the square wave */
-    sqwave_squarewave(
-      (m_sqwave_table[i]).psamp,
-      wp.samp_count,
-      wp.wave_count,
-      amp,
-      wp.harmonics);
+    /* Add the object to the shared wave tables if there is room */
+    os_global_lock();
+    for(k = 0; k < SQWAVE_BANK_MAX; k++) {
+      if (m_sqwave_bank[k] == NULL) {
+        m_sqwave_bank[k] = pb;
+        pb = NULL;
+        break;
+      }
+    }
+    os_global_unlock();
   }
+  
+  /* Release the object unless it was kept */
+  sqwave_free(pb);
+  pb = NULL;
 }
 
 /*
- * sqwave_get function.
+ * sqwave_cachedir function.
  */
-int16_t sqwave_get(int32_t pitch, int32_t t) {
-  
-  int32_t key = 0;
+void sqwave_cachedir(SQWAVE_CTX *psw, const char *pDir) {
   
   /* Check state */
-  if (!m_sqwave_init) {
+  if (psw == NULL) {
+    abort();
+  }
+  if (psw->init) {
     abort();
   }
   
+  /* Release any current cache directory */
+  if (psw->pCache != NULL) {
+    free(psw->pCache);
+    psw->pCache = NULL;
+  }
+  
+  /* Copy the new cache directory if given */
+  if (pDir != NULL) {
+    psw->pCache = (char *) malloc(strlen(pDir) + 1);
+    if (psw->pCache == NULL) {
+      abort();
+    }
+    strcpy(psw->pCache, pDir);
+  }
+}
+
+/*
+ * sqwave_get function.
+ */
+int16_t sqwave_get(SQWAVE_CTX *psw, int32_t pitch, int64_t t) {
+  
+  SQWAVE_WAVREC *pr = NULL;
+  
   /* Check parameters */
-  if ((pitch < PITCH_MIN) || (pitch > PITCH_MAX) ||
-      (t < 0)) {
+  if ((psw == NULL) || (t < 0)) {
     abort();
   }
   
-  /* Get the key offset from the pitch */
-  key = pitch + SQWAVE_KEY_BIAS;
+  /* Get the record for the pitch, building it if necessary */
+  pr = sqwave_build(psw, pitch);
 
   /* Adjust t with modulus so the sample loops if necessary */
-  t = t % (m_sqwave_table[key]).sampcount;
+  t = t % ((int64_t) pr->sampcount);
   
   /* Get the requested sample */
-  return ((m_sqwave_table[key]).psamp)[t];
+  return (pr->psamp)[(int32_t) t];
+}
+
+/*
+ * sqwave_table function.
+ */
+const int16_t *sqwave_table(
+    SQWAVE_CTX * psw,
+    int32_t      pitch,
+    int32_t    * pcount) {
+  
+  SQWAVE_WAVREC *pr = NULL;
+  
+  /* Check parameters */
+  if ((psw == NULL) || (pcount == NULL)) {
+    abort();
+  }
+  
+  /* Get the record for the pitch, building it if necessary */
+  pr = sqwave_build(psw, pitch);
+  
+  /* Return the table and its size */
+  *pcount = pr->sampcount;
+  return pr->psamp;
 }
@@ -9,7 +9,7 @@
  * Compilation
  * ===========
  * 
- * Requires ttone.
+ * Requires ttone and an os_ module.
  * 
  * May require the math library to be included (-lm).
  */
@@ -24,10 +24,43 @@
 #define SQWAVE_AMP_MAX (32000.0)
 
 /*
- * Initialize the square wave module.
+ * Structure prototype for SQWAVE_CTX.
  * 
- * This must be called before all other functions in this module.  It
- * may only be called once.
+ * A square wave object holds the square wave tables for one render
+ * context.  See render.h for further information.
+ */
+struct SQWAVE_CTX_TAG;
+typedef struct SQWAVE_CTX_TAG SQWAVE_CTX;
+
+/*
+ * Allocate a new square wave object.
+ * 
+ * The object must be initialized with sqwave_init() before any square
+ * waves can be read from it.  Release it with sqwave_free().
+ * 
+ * Return:
+ * 
+ *   the new square wave object
+ */
+SQWAVE_CTX *sqwave_alloc(void);
+
+/*
+ * Release a square wave object.
+ * 
+ * If NULL is passed, the call is ignored.  If the wave table records
+ * were mapped from a cache file, the file is unmapped.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object, or NULL
+ */
+void sqwave_free(SQWAVE_CTX *psw);
+
+/*
+ * Initialize a square wave object.
+ * 
+ * This must be called before reading any square waves from the object.
+ * It may only be called once for each object.
  * 
  * amp is what to multiply the normalized results by to quantize into
  * integer samples.  It must be finite and greater than zero.  It will
@@ -39,18 +72,78 @@
  * samprate is the sampling rate for the computed square waves.  It must
  * be either the RATE_CD or RATE_DVD constant.
  * 
+ * The wave table for each pitch is not computed here.  Instead, it is
+ * computed the first time that pitch is requested from sqwave_get() or
+ * sqwave_table(), so only the pitches that are actually used are ever
+ * computed.  The exceptions are when a cache directory has been set
+ * with sqwave_cachedir(), and when sqwave_warm() has built a shared
+ * wave table with the same amplitude and sampling rate.
+ * 
  * Parameters:
  * 
+ *   psw - the square wave object
+ * 
  *   amp - the quantization amplitude
  * 
  *   samprate - the sampling rate
  */
-void sqwave_init(double amp, int32_t samprate);
+void sqwave_init(SQWAVE_CTX *psw, double amp, int32_t samprate);
+
+/*
+ * Build a shared wave table ahead of time.
+ * 
+ * The wave table for every pitch is built for the quantization
+ * amplitude amp and sampling rate samprate, which have the same
+ * meaning as for sqwave_init().  Every square wave object that is
+ * initialized afterwards with the same amplitude and sampling rate
+ * then shares this wave table instead of building its own.  A shared
+ * wave table is never released.
+ * 
+ * pDir is the cache directory to build the wave table through, or
+ * NULL.  See sqwave_cachedir().
+ * 
+ * This is meant for a process that is copied for each job it runs, so
+ * that the wave table is built once and every copy starts with it.  At
+ * most two shared wave tables are kept, which is enough for one at each
+ * sampling rate.  If there is no room left, the wave table is built but
+ * not kept.  Calling this again with the same parameters does nothing.
+ * 
+ * Parameters:
+ * 
+ *   pDir - the cache directory, or NULL
+ * 
+ *   amp - the quantization amplitude
+ * 
+ *   samprate - the sampling rate
+ */
+void sqwave_warm(const char *pDir, double amp, int32_t samprate);
+
+/*
+ * Set the directory in which to cache wave tables.
+ * 
+ * This may only be called before sqwave_init().  pDir is the path to an
+ * existing directory, or NULL to turn off caching, which is the
+ * default.  A copy of the string is made.
+ * 
+ * When there is a cache directory, sqwave_init() builds the wave table
+ * for every pitch at once and saves them all in a cache file in that
+ * directory, named after the sampling rate and amplitude.  Later runs
+ * with the same sampling rate and amplitude map the cache file into
+ * memory instead of computing anything.  If the cache file can't be
+ * written, the wave tables are still used but not cached.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ *   pDir - the cache directory, or NULL
+ */
+void sqwave_cachedir(SQWAVE_CTX *psw, const char *pDir);
 
 /*
  * Get the square wave sample at a given time point for a given pitch.
  * 
- * The square wave module must be initialized with sqwave_init() before
+ * The square wave object must be initialized with sqwave_init() before
  * using this function.  The amplitude passed to the initialization
  * function determines the amplitude of the returned wave samples.  The
  * sampling rate passed to the initialization function determines the
@@ -70,6 +163,8 @@ void sqwave_init(double amp, int32_t samprate);
  * 
  * Parameters:
  * 
+ *   psw - the square wave object
+ * 
  *   pitch - the pitch of the square wave
  * 
  *   t - the sample offset to request
@@ -78,6 +173,41 @@ void sqwave_init(double amp, int32_t samprate);
  * 
  *   the sample value
  */
-int16_t sqwave_get(int32_t pitch, int32_t t);
+int16_t sqwave_get(SQWAVE_CTX *psw, int32_t pitch, int64_t t);
+
+/*
+ * Get the looped wave table for a given pitch.
+ * 
+ * The square wave object must be initialized with sqwave_init() before
+ * using this function.
+ * 
+ * This gives direct access to the samples that sqwave_get() reads, so
+ * that callers generating many consecutive samples can walk the table
+ * with a running index instead of computing a modulus for each sample.
+ * Sample t of the square wave is element (t % count) of the table.
+ * 
+ * pitch is the pitch of the square wave, in the same range as for
+ * sqwave_get().  pcount points to a variable to receive the number of
+ * samples in the table, which is always at least one.
+ * 
+ * The returned table is owned by the square wave object and must not
+ * be modified.
+ * 
+ * Parameters:
+ * 
+ *   psw - the square wave object
+ * 
+ *   pitch - the pitch of the square wave
+ * 
+ *   pcount - pointer to variable to receive the sample count
+ * 
+ * Return:
+ * 
+ *   the samples of the table
+ */
+const int16_t *sqwave_table(
+    SQWAVE_CTX * psw,
+    int32_t      pitch,
+    int32_t    * pcount);
 
 #endif
@@ -10,61 +10,42 @@
 #include <stdlib.h>
 #include <string.h>
 
-/*
- * Static data
- * ===========
- */
-
-/*
- * The flatten flag.
- * 
- * If non-zero, it means that single-channel flattening has been
- * requested with stereo_flatten().
- */
-static int m_stereo_flat = 0;
-
 /*
  * Local functions
  * ===============
  */
 
 /* Prototypes */
-static void stereo_compute(int16_t s, int32_t pos, STEREO_SAMP *pss);
+static void stereo_compute(int32_t pos, int32_t *pl, int32_t *pr);
 
 /*
- * Compute a stereo sample given an input sample and a stereo position.
- * 
- * s is the input sample.
+ * Compute the channel gains for a stereo position.
  * 
  * pos is the position.  It must be in range [-MAX_FRAC, MAX_FRAC],
  * where the minimum value is full left, the maximum value is full
  * right, and zero value is full center.
  * 
- * pss is the stereo sample structure to compute.
- * 
- * This function ignores m_stereo_flat.
+ * pl and pr receive the left and right channel gains.
  * 
  * Parameters:
  * 
- *   s - the input sample
- * 
  *   pos - the stereo position
  * 
- *   pss - the stereo sample to compute
+ *   pl - pointer to variable to receive the left channel gain
+ * 
+ *   pr - pointer to variable to receive the right channel gain
  */
-static void stereo_compute(int16_t s, int32_t pos, STEREO_SAMP *pss) {
+static void stereo_compute(int32_t pos, int32_t *pl, int32_t *pr) {
   
   int32_t mul_l = 0;
   int32_t mul_r = 0;
   
   /* Check parameters */
-  if ((pos < -MAX_FRAC) || (pos > MAX_FRAC) || (pss == NULL)) {
+  if ((pos < -MAX_FRAC) || (pos > MAX_FRAC) ||
+      (pl == NULL) || (pr == NULL)) {
     abort();
   }
   
-  /* Clear output structure */
-  memset(pss, 0, sizeof(STEREO_SAMP));
-  
   /* Handle different position cases to determine left channel and right
    * channel multipliers */
   if (pos < 0) {
@@ -87,9 +68,9 @@ static void stereo_compute(int16_t s, int32_t pos, STEREO_SAMP *pss) {
     abort();
   }
   
-  /* Compute samples according to multipliers */
-  pss->left = (int16_t) ((mul_l * ((int32_t) s)) / MAX_FRAC);
-  pss->right = (int16_t) ((mul_r * ((int32_t) s)) / MAX_FRAC);
+  /* Return multipliers */
+  *pl = mul_l;
+  *pr = mul_r;
 }
 
 /*
@@ -99,13 +80,6 @@ static void stereo_compute(int16_t s, int32_t pos, STEREO_SAMP *pss) {
  * See the header for specifications.
  */
 
-/*
- * stereo_flatten function.
- */
-void stereo_flatten(void) {
-  m_stereo_flat = 1;
-}
-
 /*
  * stereo_image function.
  */
@@ -115,54 +89,68 @@ void stereo_image(
     const STEREO_POS  * psp,
           STEREO_SAMP * pss) {
   
+  int32_t mul_l = 0;
+  int32_t mul_r = 0;
+  
+  /* Check parameters */
+  if (pss == NULL) {
+    abort();
+  }
+  
+  /* Get the channel gains */
+  stereo_gain(pitch, psp, &mul_l, &mul_r);
+  
+  /* Compute samples according to gains */
+  pss->left = (int16_t) ((mul_l * ((int32_t) s)) / MAX_FRAC);
+  pss->right = (int16_t) ((mul_r * ((int32_t) s)) / MAX_FRAC);
+}
+
+/*
+ * stereo_gain function.
+ */
+void stereo_gain(
+          int32_t      pitch,
+    const STEREO_POS * psp,
+          int32_t    * pl,
+          int32_t    * pr) {
+  
   int32_t pos = 0;
   
   /* Check parameters */
-  if ((pss == NULL) || (psp == NULL) ||
+  if ((psp == NULL) || (pl == NULL) || (pr == NULL) ||
       (pitch < PITCH_MIN) || (pitch > PITCH_MAX)) {
     abort();
   }
   
-  /* Check whether in flat mode */
-  if (m_stereo_flat) {
-    
-    /* Flat mode, so just duplicate sample on both channels regardless
-     * of the position */
-    pss->left = s;
-    pss->right = s;
+  /* Check whether the stereo position is constant or a field */
+  if (psp->low_pitch == psp->high_pitch) {
+    /* Constant stereo position */
+    stereo_compute(psp->low_pos, pl, pr);
     
-  } else {
-    /* Not in flat mode, so we need to compute the stereo image; check
-     * whether the stereo position is constant or a field */
-    if (psp->low_pitch == psp->high_pitch) {
-      /* Constant stereo position */
-      stereo_compute(s, psp->low_pos, pss);
+  } else if (psp->low_pitch < psp->high_pitch) {
+    /* Stereo field -- compute position at current pitch */
+    if (pitch <= psp->low_pitch) {
+      /* Pitch at low end of field, so position is low position */
+      pos = psp->low_pos;
+      
+    } else if (pitch >= psp->high_pitch) {
+      /* Pitch at high end of field, so position is high position */
+      pos = psp->high_pos;
       
-    } else if (psp->low_pitch < psp->high_pitch) {
-      /* Stereo field -- compute position at current pitch */
-      if (pitch <= psp->low_pitch) {
-        /* Pitch at low end of field, so position is low position */
-        pos = psp->low_pos;
-        
-      } else if (pitch >= psp->high_pitch) {
-        /* Pitch at high end of field, so position is high position */
-        pos = psp->high_pos;
-        
-      } else {
-        /* Pitch in middle of field, so we need to interpolate */
-        pos = ((((int32_t) (pitch - psp->low_pitch)) *
-                ((int32_t) (psp->high_pos - psp->low_pos))) /
-              ((int32_t) (psp->high_pitch - psp->low_pitch))) +
-                  ((int32_t) psp->low_pos);
-      }
-    
-      /* Compute at the proper position */
-      stereo_compute(s, pos, pss);
-    
     } else {
-      /* Invalid structure */
-      abort();
+      /* Pitch in middle of field, so we need to interpolate */
+      pos = ((((int32_t) (pitch - psp->low_pitch)) *
+              ((int32_t) (psp->high_pos - psp->low_pos))) /
+            ((int32_t) (psp->high_pitch - psp->low_pitch))) +
+                ((int32_t) psp->low_pos);
     }
+  
+    /* Compute at the proper position */
+    stereo_compute(pos, pl, pr);
+  
+  } else {
+    /* Invalid structure */
+    abort();
   }
 }
 
@@ -84,18 +84,6 @@ typedef struct {
   
 } STEREO_SAMP;
 
-/*
- * Set the stereo module into single-channel mode.
- * 
- * If this function has already been called, further calls have no
- * effect.
- * 
- * After this function has been called, stereo_image() will always
- * ignore stereo positions and just duplicate the input to both stereo
- * output channels.  This allows for single-channel output.
- */
-void stereo_flatten(void);
-
 /*
  * Compute the stereo image of a sample using a given stereo position.
  * 
@@ -108,9 +96,10 @@ void stereo_flatten(void);
  * 
  * pss points to the structure to receive the stereo-imaged result.
  * 
- * If stereo_flatten() has been called, then the stereo position will be
- * ignored and the input sample s will just be duplicated to both the
- * left and right channels.
+ * The stereo module has no state of its own.  Single-channel output is
+ * handled by the instrument module, which skips stereo imaging and
+ * duplicates the input sample to both channels instead.  See
+ * instr_flatten() for further information.
  * 
  * Parameters:
  * 
@@ -128,6 +117,35 @@ void stereo_image(
     const STEREO_POS  * psp,
           STEREO_SAMP * pss);
 
+/*
+ * Compute the channel gains that stereo_image() applies for a given
+ * pitch and stereo position.
+ * 
+ * pitch and psp have the same meaning as for stereo_image().
+ * 
+ * pl and pr point to variables to receive the left and right channel
+ * gains, each in range [0, MAX_FRAC].  stereo_image() produces the
+ * channel value ((gain * s) / MAX_FRAC) for each channel, using 32-bit
+ * integer arithmetic, so callers that image many samples at the same
+ * pitch and position can compute the gains once and apply them
+ * directly with identical results.
+ * 
+ * Parameters:
+ * 
+ *   pitch - the pitch
+ * 
+ *   psp - the stereo position
+ * 
+ *   pl - pointer to variable to receive the left channel gain
+ * 
+ *   pr - pointer to variable to receive the right channel gain
+ */
+void stereo_gain(
+          int32_t      pitch,
+    const STEREO_POS * psp,
+          int32_t    * pl,
+          int32_t    * pr);
+
 /*
  * Initialize a stereo position structure to represent a field.
  * 
@@ -35,6 +35,9 @@
  * 
  * Compile with the wavwrite and sqwave and ttone modules.
  * 
+ * Also compile with the os_ module that is appropriate for the target
+ * platform.
+ * 
  * The sqwave module may require the math library to be included with
  * -lm
  */
@@ -92,6 +95,8 @@ static int soundbeep(
   int status = 1;
   int wavflags = 0;
   int32_t sqrate = 0;
+  SQWAVE_CTX *psw = NULL;
+  WAVWRITE *pw = NULL;
   
   /* Check parameters */
   if (pPath == NULL) {
@@ -124,11 +129,13 @@ static int soundbeep(
     abort();
   }
   
-  /* Initialize square wave module */
-  sqwave_init((double) amp, sqrate);
+  /* Initialize square wave object */
+  psw = sqwave_alloc();
+  sqwave_init(psw, (double) amp, sqrate);
   
   /* Initialize WAV writer */
-  if (!wavwrite_init(pPath, wavflags)) {
+  pw = wavwrite_init(pPath, wavflags);
+  if (pw == NULL) {
     status = 0;
   }
   
@@ -136,17 +143,22 @@ static int soundbeep(
   if (status) {
     sfull = rate * sec;
     for(scount = 0; scount < sfull; scount++) {
-      s = sqwave_get(pitch, scount);
-      wavwrite_sample(s, s);
+      s = sqwave_get(psw, pitch, scount);
+      wavwrite_sample(pw, s, s);
     }
   }
   
   /* Close down */
   if (status) {
-    wavwrite_close(WAVWRITE_CLOSE_NORMAL);
+    wavwrite_close(pw, WAVWRITE_CLOSE_NORMAL);
   } else {
-    wavwrite_close(WAVWRITE_CLOSE_RMFILE);
+    wavwrite_close(pw, WAVWRITE_CLOSE_RMFILE);
   }
+  pw = NULL;
+  
+  /* Release the square wave object */
+  sqwave_free(psw);
+  psw = NULL;
   
   /* Return status */
   return status;
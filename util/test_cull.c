@@ -0,0 +1,322 @@
+/*
+ * test_cull.c
+ * ===========
+ * 
+ * Check that culling silent notes doesn't change the output of the
+ * Retro sequencer.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   test_cull
+ * 
+ * The same score is rendered twice, once without seq_cull() and once
+ * with it, and the two renders are compared sample by sample.  The
+ * score uses an FM instrument with a noise operator, so that the test
+ * also catches culled notes changing the noise seeds of the notes that
+ * are kept.  Some of the notes are on a layer that stays at zero, and
+ * some use a cleared instrument register, so that there is something
+ * to cull.
+ * 
+ * The program reports how many notes were culled and whether the
+ * renders match.  The exit status is zero only if they match.
+ * 
+ * Compilation
+ * -----------
+ * 
+ * Compile with the following Retro modules:
+ * 
+ *   - adsr
+ *   - generator
+ *   - genmap
+ *   - graph
+ *   - instr
+ *   - layer
+ *   - render
+ *   - sbuf
+ *   - seq
+ *   - sqwave
+ *   - stereo
+ *   - ttone
+ *   - wavetbl
+ * 
+ * Compile with libshastina 0.9.2 beta or compatible.
+ * 
+ * Also compile with the os_ module that is appropriate for the target
+ * platform.
+ * 
+ * The math library may need to be included with -lm
+ */
+
+#include "retrodef.h"
+
+#include "graph.h"
+#include "instr.h"
+#include "layer.h"
+#include "render.h"
+#include "seq.h"
+#include "sqwave.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of notes in the score.
+ */
+#define TEST_NOTES (80)
+
+/*
+ * The number of frames to pull from the sequencer at a time.
+ */
+#define TEST_PULL (2048)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The name of the module executing, for error reports.
+ * 
+ * Set at the start of main().
+ */
+static const char *pModule = NULL;
+
+/*
+ * The embedded instrument script for the noise instrument.
+ */
+static const char *pScript =
+  "%fm;\n"
+  "5.0 10.0 0.5 100.0 adsr @A\n"
+  "[\"fop\", \"noise\", \"adsr\", =A] operator 8000.0 scale\n"
+  "|;\n";
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Function prototypes */
+static int render_score(int cull, int16_t **ppBuf, int32_t *pCount);
+
+/*
+ * Render the test score.
+ * 
+ * If cull is non-zero, seq_cull() is run on the score before it is
+ * rendered.  The rendered stereo samples are returned in a dynamically
+ * allocated buffer, which the caller must free, and the number of
+ * frames is written to *pCount.
+ * 
+ * Errors are reported to stderr.
+ * 
+ * Parameters:
+ * 
+ *   cull - non-zero to cull silent notes
+ * 
+ *   ppBuf - pointer to variable to receive the sample buffer
+ * 
+ *   pCount - pointer to variable to receive the frame count
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int render_score(int cull, int16_t **ppBuf, int32_t *pCount) {
+  
+  int status = 1;
+  int er = 0;
+  int er_src = 0;
+  long line = 0;
+  int32_t x = 0;
+  int32_t n = 0;
+  int32_t instr = 0;
+  int32_t layer = 0;
+  int32_t culled = 0;
+  int32_t cap = 0;
+  int16_t *pBuf = NULL;
+  RENDER *pr = NULL;
+  GRAPH_OBJ *pg = NULL;
+  
+  /* Check parameters */
+  if ((ppBuf == NULL) || (pCount == NULL)) {
+    abort();
+  }
+  
+  /* Allocate the render context */
+  pr = render_alloc();
+  instr_setsamp(pr->pInstr, RATE_DVD);
+  sqwave_init(pr->pSqwave, 20000.0, RATE_DVD);
+  
+  /* Define the noise instrument in register one, with a minimum
+   * intensity of zero so that notes on a silent layer are silent */
+  if (!instr_embedded(pr->pInstr, 1, pScript,
+                      &er, &er_src, &line)) {
+    status = 0;
+    fprintf(stderr,
+            "%s: Can't define instrument (error %d, line %ld)!\n",
+            pModule, er, line);
+  }
+  if (status) {
+    instr_setMaxMin(pr->pInstr, 1, MAX_FRAC, 0);
+  }
+  
+  /* Layer zero is at full intensity and layer one is silent */
+  if (status) {
+    pg = graph_alloc(1);
+    graph_set(pg, 0, 0, MAX_FRAC, -1);
+    layer_define(pr->pLayer, 0, 1.0, pg);
+    graph_release(pg);
+    pg = NULL;
+    
+    pg = graph_alloc(1);
+    graph_set(pg, 0, 0, 0, -1);
+    layer_define(pr->pLayer, 1, 1.0, pg);
+    graph_release(pg);
+    pg = NULL;
+  }
+  
+  /* Add overlapping notes; every third note is on the silent layer and
+   * every seventh note uses the cleared register two */
+  if (status) {
+    for(x = 0; x < TEST_NOTES; x++) {
+      instr = 1;
+      if ((x % 7) == 0) {
+        instr = 2;
+      }
+      
+      layer = 0;
+      if ((x % 3) == 0) {
+        layer = 1;
+      }
+      
+      if (!seq_note(pr->pSeq, x * 1500, 3000, (x % 12) - 6,
+                      instr, layer)) {
+        status = 0;
+        fprintf(stderr, "%s: Can't add note!\n", pModule);
+        break;
+      }
+    }
+  }
+  
+  /* Cull if requested */
+  if (status && cull) {
+    culled = seq_cull(pr->pSeq);
+    printf("Culled %ld silent note(s)\n", (long) culled);
+  }
+  
+  /* Pull all the samples */
+  if (status) {
+    *pCount = 0;
+    cap = TEST_PULL;
+    pBuf = (int16_t *) malloc(((size_t) cap) * 2 * sizeof(int16_t));
+    if (pBuf == NULL) {
+      abort();
+    }
+    
+    n = 1;
+    while (n > 0) {
+      if (cap - *pCount < TEST_PULL) {
+        cap = cap * 2;
+        pBuf = (int16_t *) realloc(
+                  pBuf, ((size_t) cap) * 2 * sizeof(int16_t));
+        if (pBuf == NULL) {
+          abort();
+        }
+      }
+      n = seq_pull(
+            pr->pSeq,
+            &(pBuf[2 * (*pCount)]),
+            SEQ_PULL_S16,
+            TEST_PULL,
+            20000,
+            20000);
+      *pCount += n;
+    }
+    *ppBuf = pBuf;
+    pBuf = NULL;
+  }
+  
+  /* Release the render context */
+  render_free(pr);
+  pr = NULL;
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  int status = 1;
+  int32_t count_a = 0;
+  int32_t count_b = 0;
+  int16_t *pA = NULL;
+  int16_t *pB = NULL;
+  
+  /* Get module name */
+  pModule = NULL;
+  if (argc > 0) {
+    if (argv != NULL) {
+      if (argv[0] != NULL) {
+        pModule = argv[0];
+      }
+    }
+  }
+  if (pModule == NULL) {
+    pModule = "test_cull";
+  }
+  
+  /* Verify no parameters in addition to module name */
+  if (argc > 1) {
+    status = 0;
+    fprintf(stderr, "%s: Not expecting parameters!\n", pModule);
+  }
+  
+  /* Render the score without and then with the cull */
+  if (status) {
+    if (!render_score(0, &pA, &count_a)) {
+      status = 0;
+    }
+  }
+  if (status) {
+    if (!render_score(1, &pB, &count_b)) {
+      status = 0;
+    }
+  }
+  
+  /* Compare the renders */
+  if (status) {
+    if ((count_a != count_b) || (memcmp(pA, pB,
+          ((size_t) count_a) * 2 * sizeof(int16_t)) != 0)) {
+      status = 0;
+      fprintf(stderr, "%s: Output changes when notes are culled!\n",
+              pModule);
+    } else {
+      printf("Output matches over %ld frame(s)\n", (long) count_a);
+    }
+  }
+  
+  /* Release buffers */
+  free(pA);
+  pA = NULL;
+  free(pB);
+  pB = NULL;
+  
+  /* Invert status and return */
+  if (status) {
+    status = 0;
+  } else {
+    status = 1;
+  }
+  return status;
+}
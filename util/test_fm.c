@@ -24,7 +24,9 @@
  * [amp] is the target level to normalize result samples to.  This must
  * be in range [16, 32000].
  * 
- * [genmap] is the generator map script file to interpret
+ * [genmap] is the generator map script file to interpret.  Any
+ * table"name" wave table literals in the script are interpreted as
+ * paths to wave table files, relative to the current directory.
  * 
  * All numeric values are given as signed integers, with a "-" sign used
  * in front of negative values.  "+" may optionally precede positive
@@ -38,11 +40,15 @@
  *   - adsr
  *   - generator
  *   - genmap
+ *   - wavetbl
  *   - sbuf
  *   - wavwrite
  * 
  * Compile with libshastina 0.9.2 beta or compatible.
  * 
+ * Also compile with the os_ module that is appropriate for the target
+ * platform.
+ * 
  * The math library may need to be included with -lm
  */
 
@@ -51,6 +57,7 @@
 #include "generator.h"
 #include "genmap.h"
 #include "sbuf.h"
+#include "wavetbl.h"
 #include "wavwrite.h"
 
 #include "shastina.h"
@@ -78,6 +85,7 @@ static const char *pModule = NULL;
  */
 
 /* Function prototypes */
+static WAVETBL *fm_table(void *pCustom, const char *pName);
 static int soundbeep(
     const char    * pPath,
           int32_t   freq,
@@ -87,6 +95,32 @@ static int soundbeep(
     const char    * pScript);
 static int parseInt(const char *pstr, int32_t *pv);
 
+/*
+ * Load a wave table named in the generator map script.
+ * 
+ * This is the wave table callback passed to genmap_run().  The name is
+ * the path to the wave table file.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - ignored
+ * 
+ *   pName - the wave table file path
+ * 
+ * Return:
+ * 
+ *   a new reference to the wave table object, or NULL if the file
+ *   could not be loaded
+ */
+static WAVETBL *fm_table(void *pCustom, const char *pName) {
+  
+  /* No custom data is needed */
+  (void) pCustom;
+  
+  /* Load the wave table */
+  return wavetbl_file(pName);
+}
+
 /*
  * Perform the program action -- see the top of the file for a further
  * description.
@@ -121,12 +155,14 @@ static int soundbeep(
   int wavflags = 0;
   int32_t x = 0;
   int32_t s = 0;
-  int32_t edur = 0;
+  int64_t edur = 0;
   double gv = 0.0;
   
   FILE *fScript = NULL;
   SNSOURCE *psScript = NULL;
   GENERATOR_OPDATA *pInstance = NULL;
+  WAVWRITE *pw = NULL;
+  SBUF *pb = NULL;
   
   GENMAP_RESULT gmr;
 
@@ -174,7 +210,7 @@ static int soundbeep(
 
   /* Interpret script */
   if (status) {
-    genmap_run(psScript, &gmr, rate);
+    genmap_run(psScript, &gmr, rate, 0, &fm_table, NULL);
 
     if (gmr.errcode != GENMAP_OK) {
       status = 0;
@@ -202,7 +238,7 @@ static int soundbeep(
     }
     for(x = 0; x < gmr.icount; x++) {
       generator_opdata_init(
-        &(pInstance[x]), freq, (msec * rate) / 1000);
+        &(pInstance[x]), freq, (msec * rate) / 1000, 1, (uint32_t) x);
     }
   }
 
@@ -227,7 +263,8 @@ static int soundbeep(
 
   /* Initialize WAV writer */
   if (status) {
-    if (!wavwrite_init(pPath, wavflags)) {
+    pw = wavwrite_init(pPath, wavflags);
+    if (pw == NULL) {
       status = 0;
       fprintf(stderr, "%s: Can't open output file!\n", pModule);
     }
@@ -235,13 +272,13 @@ static int soundbeep(
   
   /* Initialize sample buffer */
   if (status) {
-    sbuf_init();
+    pb = sbuf_init();
   }
   
   /* Write one second of silence */
   if (status) {
     for(x = 0; x < rate; x++) {
-      sbuf_sample(0, 0);
+      sbuf_sample(pb, 0, 0);
     }
   }
 
@@ -267,28 +304,32 @@ static int soundbeep(
       }
       
       /* Write the sample */
-      sbuf_sample(s, s);
+      sbuf_sample(pb, s, s);
     }
   }
 
   /* Write one second of silence */
   if (status) {
     for(x = 0; x < rate; x++) {
-      sbuf_sample(0, 0);
+      sbuf_sample(pb, 0, 0);
     }
   }
   
   /* Stream normalized samples to wave file */
   if (status) {
-    sbuf_stream(amp);
+    sbuf_stream(pb, amp, pw);
   }
   
   /* Close down */
+  sbuf_close(pb);
+  pb = NULL;
+  
   if (status) {
-    wavwrite_close(WAVWRITE_CLOSE_NORMAL);
+    wavwrite_close(pw, WAVWRITE_CLOSE_NORMAL);
   } else {
-    wavwrite_close(WAVWRITE_CLOSE_RMFILE);
+    wavwrite_close(pw, WAVWRITE_CLOSE_RMFILE);
   }
+  pw = NULL;
 
   /* Free objects */
   if (pInstance != NULL) {
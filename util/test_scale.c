@@ -31,6 +31,9 @@
  * 
  * Compile with the wavwrite and sqwave and ttone modules.
  * 
+ * Also compile with the os_ module that is appropriate for the target
+ * platform.
+ * 
  * The sqwave module may require the math library to be included with
  * -lm
  */
@@ -76,6 +79,8 @@ static int fullscale(const char *pPath, int32_t rate, int32_t amp) {
   int status = 1;
   int wavflags = 0;
   int32_t sqrate = 0;
+  SQWAVE_CTX *psw = NULL;
+  WAVWRITE *pw = NULL;
   
   /* Check parameters */
   if (pPath == NULL) {
@@ -102,11 +107,13 @@ static int fullscale(const char *pPath, int32_t rate, int32_t amp) {
     abort();
   }
   
-  /* Initialize square wave module */
-  sqwave_init((double) amp, sqrate);
+  /* Initialize square wave object */
+  psw = sqwave_alloc();
+  sqwave_init(psw, (double) amp, sqrate);
   
   /* Initialize WAV writer */
-  if (!wavwrite_init(pPath, wavflags)) {
+  pw = wavwrite_init(pPath, wavflags);
+  if (pw == NULL) {
     status = 0;
   }
   
@@ -115,7 +122,7 @@ static int fullscale(const char *pPath, int32_t rate, int32_t amp) {
     
     /* Write one second of silence beforehand */
     for(i = 0; i < rate; i++) {
-      wavwrite_sample(0, 0);
+      wavwrite_sample(pw, 0, 0);
     }
     
     /* Compute the length in samples of each pitch */
@@ -128,23 +135,28 @@ static int fullscale(const char *pPath, int32_t rate, int32_t amp) {
       for(i = 0; i < plen; i++) {
         
         /* Get the current sample and write it */
-        s = sqwave_get(p, i);
-        wavwrite_sample(s, s);
+        s = sqwave_get(psw, p, i);
+        wavwrite_sample(pw, s, s);
       }
     }
     
     /* Write one second of silence afterwards */
     for(i = 0; i < rate; i++) {
-      wavwrite_sample(0, 0);
+      wavwrite_sample(pw, 0, 0);
     }
   }
   
   /* Close down */
   if (status) {
-    wavwrite_close(WAVWRITE_CLOSE_NORMAL);
+    wavwrite_close(pw, WAVWRITE_CLOSE_NORMAL);
   } else {
-    wavwrite_close(WAVWRITE_CLOSE_RMFILE);
+    wavwrite_close(pw, WAVWRITE_CLOSE_RMFILE);
   }
+  pw = NULL;
+  
+  /* Release the square wave object */
+  sqwave_free(psw);
+  psw = NULL;
   
   /* Return status */
   return status;
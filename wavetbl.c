@@ -0,0 +1,970 @@
+/*
+ * wavetbl.c
+ * 
+ * Implementation of wavetbl.h
+ * 
+ * See the header for further information.
+ */
+
+#include "wavetbl.h"
+#include "os.h"
+
+#include "shastina.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of samples in each band table.
+ * 
+ * This must be a power of two, and it must be more than twice the
+ * number of harmonics in the top band.
+ */
+#define WAVETBL_SAMPLES (4096)
+
+/*
+ * The number of bands in each wave table object.
+ * 
+ * Band k holds the first 2^k harmonics, so the top band holds
+ * 2^(WAVETBL_BANDS - 1) harmonics.
+ */
+#define WAVETBL_BANDS (11)
+
+/*
+ * The maximum number of harmonics in a wave table object.
+ * 
+ * This is the harmonic count of the top band.
+ */
+#define WAVETBL_HARMONICS (1024)
+
+/*
+ * The amplitude of the peak sample in a wave table object.
+ * 
+ * This must be greater than zero and within signed 16-bit range.
+ */
+#define WAVETBL_AMP (16384)
+
+/*
+ * The duty cycle of the built-in pulse wave.
+ */
+#define WAVETBL_DUTY (0.25)
+
+/*
+ * The minimum and maximum number of samples in a wave table file.
+ * 
+ * At least three samples are needed to represent the fundamental.  A
+ * file with more than (2 * WAVETBL_HARMONICS + 1) samples is allowed,
+ * but the harmonics above WAVETBL_HARMONICS are dropped.
+ */
+#define WAVETBL_LOAD_MIN (3)
+#define WAVETBL_LOAD_MAX (16384)
+
+/*
+ * The initial capacity of the sample buffer used while loading a wave
+ * table file.
+ */
+#define WAVETBL_LOAD_INIT (256)
+
+/*
+ * FNV-1a 64-bit hash parameters, used to tell whether a cached wave
+ * table file has changed.
+ */
+#define WAVETBL_FNV_BASIS (UINT64_C(0xcbf29ce484222325))
+#define WAVETBL_FNV_PRIME (UINT64_C(0x100000001b3))
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * WAVETBL structure.
+ * 
+ * Prototype given in the header.
+ */
+struct WAVETBL_TAG {
+  
+  /*
+   * The reference count of the object.
+   */
+  int32_t refcount;
+  
+  /*
+   * The band tables.
+   * 
+   * Each table has (WAVETBL_SAMPLES + 1) samples, where the last sample
+   * is a copy of the first so that interpolation can wrap around.
+   * 
+   * Band k holds the first 2^k harmonics of the waveform.
+   */
+  int16_t *pBand[WAVETBL_BANDS];
+};
+
+/*
+ * WAVETBL_FILE structure for entries in the wave table file cache.
+ * 
+ * Preceded by a structure prototype so the structure can
+ * self-reference.
+ */
+struct WAVETBL_FILE_TAG;
+typedef struct WAVETBL_FILE_TAG WAVETBL_FILE;
+struct WAVETBL_FILE_TAG {
+  
+  /*
+   * Pointer to next entry in the cache, or NULL if last entry.
+   */
+  WAVETBL_FILE *pNext;
+  
+  /*
+   * The path the wave table was loaded from.
+   * 
+   * Dynamically allocated and owned by the entry.
+   */
+  char *pPath;
+  
+  /*
+   * The FNV-1a hash of the file contents when the wave table was
+   * loaded.
+   */
+  uint64_t hash;
+  
+  /*
+   * The loaded wave table object.
+   * 
+   * The entry holds a reference to this object.
+   */
+  WAVETBL *pw;
+};
+
+/*
+ * Static data
+ * ===========
+ */
+
+/*
+ * The shared wave table objects for each built-in shape.
+ * 
+ * The index is the shape minus WAVETBL_SHAPE_MINVAL.  NULL entries have
+ * not been generated yet.  This table holds a reference to each object
+ * it contains.
+ * 
+ * Wave table objects are shared between all renders in the process, so
+ * this table, m_wavetbl_file, and the reference counts of all objects
+ * are only accessed while holding os_global_lock().  The samples of an
+ * object never change after it is built, so wavetbl_get() needs no
+ * lock.
+ */
+static WAVETBL *m_wavetbl_shape[
+                  WAVETBL_SHAPE_MAXVAL - WAVETBL_SHAPE_MINVAL + 1];
+
+/*
+ * The cache of wave tables loaded from files.
+ * 
+ * There is at most one entry for each path.  When the contents of a
+ * file change, its entry is updated with the new wave table.
+ */
+static WAVETBL_FILE *m_wavetbl_file = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static WAVETBL *wavetbl_build(
+    const double  * pSin,
+    const double  * pCos,
+          int32_t   hcount);
+static int wavetbl_hashfile(const char *pPath, uint64_t *ph);
+static WAVETBL *wavetbl_read(const char *pPath);
+static void wavetbl_inc(WAVETBL *pw);
+
+/*
+ * Construct a new wave table object from a harmonic spectrum.
+ * 
+ * pSin and pCos point to arrays of hcount coefficients each.  Element
+ * zero is the fundamental, element one is the second harmonic, and so
+ * forth.  Harmonic n contributes (pSin[n-1] * sin(2*pi*n*w)) and
+ * (pCos[n-1] * cos(2*pi*n*w)) to the waveform.  hcount must be in range
+ * [1, WAVETBL_HARMONICS].  All coefficients must be finite, and at
+ * least one must be non-zero.
+ * 
+ * The whole object is normalized so that its largest sample in any
+ * band is WAVETBL_AMP.  The same normalization applies to every band,
+ * so that the loudness doesn't change when switching bands.
+ * 
+ * The returned object has a reference count of one.
+ * 
+ * Parameters:
+ * 
+ *   pSin - the sine coefficients
+ * 
+ *   pCos - the cosine coefficients
+ * 
+ *   hcount - the number of harmonics
+ * 
+ * Return:
+ * 
+ *   the new wave table object
+ */
+static WAVETBL *wavetbl_build(
+    const double  * pSin,
+    const double  * pCos,
+          int32_t   hcount) {
+  
+  WAVETBL *pw = NULL;
+  double *pSine = NULL;
+  double *pAcc = NULL;
+  int32_t b = 0;
+  int32_t n = 0;
+  int32_t h_top = 0;
+  int32_t x = 0;
+  int32_t iv = 0;
+  double peak = 0.0;
+  double v = 0.0;
+  
+  /* Check parameters */
+  if ((pSin == NULL) || (pCos == NULL) ||
+      (hcount < 1) || (hcount > WAVETBL_HARMONICS)) {
+    abort();
+  }
+  
+  /* Allocate the object */
+  pw = (WAVETBL *) malloc(sizeof(WAVETBL));
+  if (pw == NULL) {
+    abort();
+  }
+  memset(pw, 0, sizeof(WAVETBL));
+  pw->refcount = 1;
+  
+  /* Allocate a full cycle of the sine function, so that harmonic n at
+   * sample x can be read exactly at index (n * x) modulo the count */
+  pSine = (double *) calloc((size_t) WAVETBL_SAMPLES, sizeof(double));
+  if (pSine == NULL) {
+    abort();
+  }
+  for(x = 0; x < WAVETBL_SAMPLES; x++) {
+    pSine[x] = sin(
+            (((double) x) / ((double) WAVETBL_SAMPLES)) * 2.0 * M_PI);
+  }
+  
+  /* Allocate floating-point accumulators for all bands */
+  pAcc = (double *) calloc(
+                      ((size_t) WAVETBL_BANDS) * WAVETBL_SAMPLES,
+                      sizeof(double));
+  if (pAcc == NULL) {
+    abort();
+  }
+  
+  /* Build each band by adding the new harmonics to a copy of the
+   * previous band */
+  n = 1;
+  for(b = 0; b < WAVETBL_BANDS; b++) {
+    
+    /* Start with a copy of the previous band, if there is one */
+    if (b > 0) {
+      memcpy(
+        &(pAcc[b * WAVETBL_SAMPLES]),
+        &(pAcc[(b - 1) * WAVETBL_SAMPLES]),
+        ((size_t) WAVETBL_SAMPLES) * sizeof(double));
+    }
+    
+    /* Determine the highest harmonic in this band */
+    h_top = ((int32_t) 1) << b;
+    if (h_top > hcount) {
+      h_top = hcount;
+    }
+    
+    /* Add each new harmonic */
+    for( ; n <= h_top; n++) {
+      if ((pSin[n - 1] != 0.0) || (pCos[n - 1] != 0.0)) {
+        for(x = 0; x < WAVETBL_SAMPLES; x++) {
+          pAcc[(b * WAVETBL_SAMPLES) + x] +=
+            (pSin[n - 1] * pSine[(n * x) % WAVETBL_SAMPLES]) +
+            (pCos[n - 1] * pSine[
+                ((n * x) + (WAVETBL_SAMPLES / 4)) % WAVETBL_SAMPLES]);
+        }
+      }
+    }
+  }
+  
+  /* Find the peak across all bands */
+  peak = 0.0;
+  for(x = 0; x < WAVETBL_BANDS * WAVETBL_SAMPLES; x++) {
+    if (fabs(pAcc[x]) > peak) {
+      peak = fabs(pAcc[x]);
+    }
+  }
+  if ((!isfinite(peak)) || (!(peak > 0.0))) {
+    abort();
+  }
+  
+  /* Quantize each band into its integer table */
+  for(b = 0; b < WAVETBL_BANDS; b++) {
+    
+    /* Allocate the band table, with one extra sample for wrapping */
+    (pw->pBand)[b] = (int16_t *) calloc(
+                                  (size_t) (WAVETBL_SAMPLES + 1),
+                                  sizeof(int16_t));
+    if ((pw->pBand)[b] == NULL) {
+      abort();
+    }
+    
+    /* Normalize and quantize each sample */
+    for(x = 0; x < WAVETBL_SAMPLES; x++) {
+      v = (pAcc[(b * WAVETBL_SAMPLES) + x] / peak) *
+            ((double) WAVETBL_AMP);
+      iv = (int32_t) floor(v + 0.5);
+      if (iv > WAVETBL_AMP) {
+        iv = WAVETBL_AMP;
+      } else if (iv < -(WAVETBL_AMP)) {
+        iv = -(WAVETBL_AMP);
+      }
+      ((pw->pBand)[b])[x] = (int16_t) iv;
+    }
+    
+    /* Copy the first sample to the end */
+    ((pw->pBand)[b])[WAVETBL_SAMPLES] = ((pw->pBand)[b])[0];
+  }
+  
+  /* Release the work buffers */
+  free(pSine);
+  pSine = NULL;
+  
+  free(pAcc);
+  pAcc = NULL;
+  
+  /* Return the new object */
+  return pw;
+}
+
+/*
+ * Compute the FNV-1a hash of the contents of a file.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ *   ph - pointer to the variable to receive the hash
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file couldn't be read
+ */
+static int wavetbl_hashfile(const char *pPath, uint64_t *ph) {
+  
+  int status = 1;
+  size_t n = 0;
+  size_t i = 0;
+  uint64_t h = WAVETBL_FNV_BASIS;
+  FILE *pf = NULL;
+  unsigned char buf[4096];
+  
+  /* Check parameters */
+  if ((pPath == NULL) || (ph == NULL)) {
+    abort();
+  }
+  
+  /* Open the file */
+  pf = fopen(pPath, "rb");
+  if (pf == NULL) {
+    status = 0;
+  }
+  
+  /* Hash the whole file */
+  if (status) {
+    for(n = fread(buf, 1, sizeof(buf), pf);
+        n > 0;
+        n = fread(buf, 1, sizeof(buf), pf)) {
+      for(i = 0; i < n; i++) {
+        h ^= (uint64_t) buf[i];
+        h *= WAVETBL_FNV_PRIME;
+      }
+    }
+    if (ferror(pf)) {
+      status = 0;
+    }
+  }
+  
+  /* Close the file */
+  if (pf != NULL) {
+    fclose(pf);
+    pf = NULL;
+  }
+  
+  /* Write the hash */
+  if (status) {
+    *ph = h;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Load a wave table object from a wave table file.
+ * 
+ * See wavetbl_file() for the file format.  This function does not use
+ * the cache.
+ * 
+ * The harmonic spectrum of the single cycle in the file is determined
+ * with a discrete Fourier transform.  The DC offset is dropped, as is
+ * the Nyquist component for even sample counts, since neither has a
+ * sine or cosine phase that can be resampled at other frequencies.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ * Return:
+ * 
+ *   the new wave table object, or NULL if the file could not be loaded
+ */
+static WAVETBL *wavetbl_read(const char *pPath) {
+  
+  int status = 1;
+  int32_t cap = 0;
+  int32_t count = 0;
+  int32_t hcount = 0;
+  int32_t n = 0;
+  int32_t x = 0;
+  int any = 0;
+  double v = 0.0;
+  double a = 0.0;
+  char *endptr = NULL;
+  double *pSamp = NULL;
+  double *pSin = NULL;
+  double *pCos = NULL;
+  WAVETBL *pw = NULL;
+  FILE *pHIn = NULL;
+  SNSOURCE *pIn = NULL;
+  SNPARSER *pp = NULL;
+  SNENTITY ent;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SNENTITY));
+  
+  /* Check parameter */
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  /* Open the file and wrap it in a Shastina source */
+  pHIn = fopen(pPath, "rb");
+  if (pHIn == NULL) {
+    status = 0;
+  }
+  
+  if (status) {
+    pIn = snsource_stream(pHIn, SNSTREAM_OWNER);
+    pHIn = NULL;
+    pp = snparser_alloc();
+  }
+  
+  /* Read the signature, which must be "%wavetable;" */
+  if (status) {
+    snparser_read(pp, &ent, pIn);
+    if (ent.status != SNENTITY_BEGIN_META) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    snparser_read(pp, &ent, pIn);
+    if ((ent.status != SNENTITY_META_TOKEN) ||
+        (strcmp(ent.pKey, "wavetable") != 0)) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    snparser_read(pp, &ent, pIn);
+    if (ent.status != SNENTITY_END_META) {
+      status = 0;
+    }
+  }
+  
+  /* Read all the samples, which must be finite numeric literals */
+  if (status) {
+    for(snparser_read(pp, &ent, pIn);
+        ent.status > 0;
+        snparser_read(pp, &ent, pIn)) {
+      
+      /* Only numeric literals are allowed */
+      if (ent.status != SNENTITY_NUMERIC) {
+        status = 0;
+      }
+      
+      /* Parse the value */
+      if (status) {
+        v = strtod(ent.pKey, &endptr);
+        if ((*endptr != 0) || (!isfinite(v))) {
+          status = 0;
+        }
+      }
+      
+      /* Check the sample count */
+      if (status && (count >= WAVETBL_LOAD_MAX)) {
+        status = 0;
+      }
+      
+      /* Grow the sample buffer if necessary */
+      if (status && (count >= cap)) {
+        if (cap < 1) {
+          cap = WAVETBL_LOAD_INIT;
+        } else {
+          cap *= 2;
+        }
+        pSamp = (double *) realloc(
+                            pSamp, ((size_t) cap) * sizeof(double));
+        if (pSamp == NULL) {
+          abort();
+        }
+      }
+      
+      /* Store the sample */
+      if (status) {
+        pSamp[count] = v;
+        count++;
+      }
+      
+      /* Leave loop if error */
+      if (!status) {
+        break;
+      }
+    }
+    
+    /* Check for parsing error and sample count */
+    if (status && (ent.status < 0)) {
+      status = 0;
+    }
+    if (status && (count < WAVETBL_LOAD_MIN)) {
+      status = 0;
+    }
+  }
+  
+  /* Determine the number of harmonics to analyze */
+  if (status) {
+    hcount = (count - 1) / 2;
+    if (hcount > WAVETBL_HARMONICS) {
+      hcount = WAVETBL_HARMONICS;
+    }
+  }
+  
+  /* Compute the discrete Fourier transform of the cycle */
+  if (status) {
+    pSin = (double *) calloc((size_t) hcount, sizeof(double));
+    pCos = (double *) calloc((size_t) hcount, sizeof(double));
+    if ((pSin == NULL) || (pCos == NULL)) {
+      abort();
+    }
+    
+    for(n = 1; n <= hcount; n++) {
+      for(x = 0; x < count; x++) {
+        a = (2.0 * M_PI * ((double) ((n * x) % count))) /
+              ((double) count);
+        pSin[n - 1] += pSamp[x] * sin(a);
+        pCos[n - 1] += pSamp[x] * cos(a);
+      }
+      pSin[n - 1] = (2.0 * pSin[n - 1]) / ((double) count);
+      pCos[n - 1] = (2.0 * pCos[n - 1]) / ((double) count);
+      
+      if ((pSin[n - 1] != 0.0) || (pCos[n - 1] != 0.0)) {
+        any = 1;
+      }
+    }
+    
+    /* Fail if the cycle has no harmonic content */
+    if (!any) {
+      status = 0;
+    }
+  }
+  
+  /* Build the object */
+  if (status) {
+    pw = wavetbl_build(pSin, pCos, hcount);
+  }
+  
+  /* Release resources */
+  if (pp != NULL) {
+    snparser_free(pp);
+    pp = NULL;
+  }
+  
+  snsource_free(pIn);
+  pIn = NULL;
+  
+  if (pHIn != NULL) {
+    fclose(pHIn);
+    pHIn = NULL;
+  }
+  
+  if (pSamp != NULL) {
+    free(pSamp);
+    pSamp = NULL;
+  }
+  if (pSin != NULL) {
+    free(pSin);
+    pSin = NULL;
+  }
+  if (pCos != NULL) {
+    free(pCos);
+    pCos = NULL;
+  }
+  
+  /* Return the new object or NULL */
+  return pw;
+}
+
+/*
+ * Increment the reference count of a wave table object.
+ * 
+ * The caller must hold os_global_lock().  A fault occurs if the
+ * reference count overflows.
+ * 
+ * Parameters:
+ * 
+ *   pw - the wave table object
+ */
+static void wavetbl_inc(WAVETBL *pw) {
+  
+  /* Check parameter */
+  if (pw == NULL) {
+    abort();
+  }
+  
+  /* Increment reference count, watching for overflow */
+  if (pw->refcount < INT32_MAX) {
+    (pw->refcount)++;
+  } else {
+    abort();
+  }
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * wavetbl_shape function.
+ */
+WAVETBL *wavetbl_shape(int shape) {
+  
+  double *pSin = NULL;
+  double *pCos = NULL;
+  double *pSlot = NULL;
+  WAVETBL *pw = NULL;
+  int32_t n = 0;
+  int i = 0;
+  
+  /* Check parameter */
+  if ((shape < WAVETBL_SHAPE_MINVAL) ||
+      (shape > WAVETBL_SHAPE_MAXVAL)) {
+    abort();
+  }
+  i = shape - WAVETBL_SHAPE_MINVAL;
+  
+  os_global_lock();
+  
+  /* Generate the shared object if not already generated */
+  if (m_wavetbl_shape[i] == NULL) {
+    
+    /* Allocate the coefficient arrays */
+    pSin = (double *) calloc(
+              (size_t) WAVETBL_HARMONICS, sizeof(double));
+    pCos = (double *) calloc(
+              (size_t) WAVETBL_HARMONICS, sizeof(double));
+    if ((pSin == NULL) || (pCos == NULL)) {
+      abort();
+    }
+    
+    /* Compute the Fourier series of the shape */
+    for(n = 1; n <= WAVETBL_HARMONICS; n++) {
+      pSlot = &(pSin[n - 1]);
+      
+      if (shape == WAVETBL_SHAPE_SQUARE) {
+        /* Odd harmonics, falling off with 1/n */
+        if ((n % 2) != 0) {
+          *pSlot = 4.0 / (M_PI * ((double) n));
+        }
+        
+      } else if (shape == WAVETBL_SHAPE_TRIANGLE) {
+        /* Odd harmonics, falling off with 1/n^2, alternating sign */
+        if ((n % 2) != 0) {
+          *pSlot = 8.0 / (M_PI * M_PI * ((double) n) * ((double) n));
+          if (((n - 1) / 2) % 2 != 0) {
+            *pSlot = -(*pSlot);
+          }
+        }
+        
+      } else if (shape == WAVETBL_SHAPE_SAWTOOTH) {
+        /* All harmonics, falling off with 1/n, alternating sign */
+        *pSlot = 2.0 / (M_PI * ((double) n));
+        if ((n % 2) == 0) {
+          *pSlot = -(*pSlot);
+        }
+        
+      } else if (shape == WAVETBL_SHAPE_PULSE) {
+        /* All harmonics, with the spectrum shaped by the duty cycle */
+        *pSlot = (2.0 / (M_PI * ((double) n))) *
+                  (1.0 - cos(2.0 * M_PI * ((double) n) * WAVETBL_DUTY));
+        pCos[n - 1] = (2.0 / (M_PI * ((double) n))) *
+                  sin(2.0 * M_PI * ((double) n) * WAVETBL_DUTY);
+        
+      } else {
+        /* Unrecognized shape */
+        abort();
+      }
+    }
+    
+    /* Build the object */
+    m_wavetbl_shape[i] = wavetbl_build(pSin, pCos, WAVETBL_HARMONICS);
+    
+    /* Release the coefficient arrays */
+    free(pSin);
+    pSin = NULL;
+    
+    free(pCos);
+    pCos = NULL;
+  }
+  
+  /* Get a new reference to the shared object */
+  wavetbl_inc(m_wavetbl_shape[i]);
+  pw = m_wavetbl_shape[i];
+  
+  os_global_unlock();
+  
+  /* Return the new reference */
+  return pw;
+}
+
+/*
+ * wavetbl_file function.
+ */
+WAVETBL *wavetbl_file(const char *pPath) {
+  
+  int status = 1;
+  uint64_t h = 0;
+  WAVETBL_FILE *pf = NULL;
+  WAVETBL *pw = NULL;
+  WAVETBL *pOld = NULL;
+  
+  /* Check parameter */
+  if (pPath == NULL) {
+    abort();
+  }
+  
+  /* Hash the current contents of the file, outside of the lock */
+  if (!wavetbl_hashfile(pPath, &h)) {
+    status = 0;
+  }
+  
+  /* Look for an up-to-date entry in the cache */
+  if (status) {
+    os_global_lock();
+    
+    for(pf = m_wavetbl_file; pf != NULL; pf = pf->pNext) {
+      if (strcmp(pf->pPath, pPath) == 0) {
+        break;
+      }
+    }
+    
+    if (pf != NULL) {
+      if (pf->hash == h) {
+        wavetbl_inc(pf->pw);
+        pw = pf->pw;
+      }
+    }
+    
+    os_global_unlock();
+  }
+  
+  /* If there was no up-to-date entry, load the file outside of the
+   * lock, and then update the cache */
+  if (status && (pw == NULL)) {
+    pw = wavetbl_read(pPath);
+    if (pw == NULL) {
+      status = 0;
+    }
+    
+    if (status) {
+      os_global_lock();
+      
+      /* Look for the path again, since another thread may have
+       * updated the cache while the file was being loaded */
+      for(pf = m_wavetbl_file; pf != NULL; pf = pf->pNext) {
+        if (strcmp(pf->pPath, pPath) == 0) {
+          break;
+        }
+      }
+      
+      if (pf == NULL) {
+        /* Add a new entry, which takes the initial reference */
+        pf = (WAVETBL_FILE *) malloc(sizeof(WAVETBL_FILE));
+        if (pf == NULL) {
+          abort();
+        }
+        memset(pf, 0, sizeof(WAVETBL_FILE));
+        
+        pf->pPath = (char *) malloc(strlen(pPath) + 1);
+        if (pf->pPath == NULL) {
+          abort();
+        }
+        strcpy(pf->pPath, pPath);
+        
+        pf->hash = h;
+        pf->pw = pw;
+        
+        pf->pNext = m_wavetbl_file;
+        m_wavetbl_file = pf;
+        
+      } else if (pf->hash == h) {
+        /* Another thread loaded the same contents, so use its object
+         * and drop the one just loaded */
+        pOld = pw;
+        pw = pf->pw;
+        
+      } else {
+        /* Replace the stale object of the entry */
+        pOld = pf->pw;
+        pf->hash = h;
+        pf->pw = pw;
+      }
+      
+      /* Get a new reference for the caller */
+      wavetbl_inc(pw);
+      
+      os_global_unlock();
+    }
+  }
+  
+  /* Drop the reference to any replaced object, outside of the lock
+   * since wavetbl_release() takes it */
+  wavetbl_release(pOld);
+  pOld = NULL;
+  
+  /* Return the new reference or NULL */
+  return pw;
+}
+
+/*
+ * wavetbl_addref function.
+ */
+void wavetbl_addref(WAVETBL *pw) {
+  os_global_lock();
+  wavetbl_inc(pw);
+  os_global_unlock();
+}
+
+/*
+ * wavetbl_release function.
+ */
+void wavetbl_release(WAVETBL *pw) {
+  
+  int32_t b = 0;
+  int32_t rc = 0;
+  
+  /* Only proceed if parameter is not NULL */
+  if (pw != NULL) {
+    
+    /* Decrement reference count */
+    os_global_lock();
+    (pw->refcount)--;
+    rc = pw->refcount;
+    os_global_unlock();
+    
+    /* If reference count is now zero, free the object */
+    if (rc < 1) {
+      for(b = 0; b < WAVETBL_BANDS; b++) {
+        if ((pw->pBand)[b] != NULL) {
+          free((pw->pBand)[b]);
+          (pw->pBand)[b] = NULL;
+        }
+      }
+      free(pw);
+    }
+  }
+}
+
+/*
+ * wavetbl_get function.
+ */
+double wavetbl_get(WAVETBL *pw, double w, double hlim) {
+  
+  int32_t x = 0;
+  int b = 0;
+  int e = 0;
+  double m = 0.0;
+  double base = 0.0;
+  double r = 0.0;
+  double sv = 0.0;
+  const int16_t *pt = NULL;
+  
+  /* Check parameter */
+  if (pw == NULL) {
+    abort();
+  }
+  
+  /* Select the band -- we want the greatest k where 2^k is less than
+   * the harmonic limit, so split the limit into mantissa and
+   * exponent */
+  if (isfinite(hlim) && (!(hlim > 1.0))) {
+    /* Even the fundamental is beyond the limit, so the best we can do
+     * is the band with the fewest harmonics */
+    b = 0;
+    
+  } else if (isfinite(hlim)) {
+    m = frexp(hlim, &e);
+    
+    /* hlim is in [2^(e-1), 2^e), so 2^(e-1) is below the limit unless
+     * hlim is exactly a power of two */
+    if (m > 0.5) {
+      b = e - 1;
+    } else {
+      b = e - 2;
+    }
+    
+    /* Clamp to the available bands */
+    if (b < 0) {
+      b = 0;
+    } else if (b > WAVETBL_BANDS - 1) {
+      b = WAVETBL_BANDS - 1;
+    }
+    
+  } else {
+    /* Unlimited, so use the top band */
+    b = WAVETBL_BANDS - 1;
+  }
+  pt = (pw->pBand)[b];
+  
+  /* Handle cases */
+  if ((!isfinite(w)) || (!(w >= 0.0)) || (!(w < 1.0))) {
+    /* Out of range, so result is zero */
+    sv = 0.0;
+    
+  } else {
+    /* Get the sample position and split into integer and fractional
+     * parts */
+    r = modf(w * ((double) WAVETBL_SAMPLES), &base);
+    x = (int32_t) base;
+    if (x > WAVETBL_SAMPLES - 1) {
+      x = WAVETBL_SAMPLES - 1;
+    }
+    
+    /* Perform linear interpolation and scale by amplitude */
+    sv = (((double) pt[x]) * (1.0 - r)) + (((double) pt[x + 1]) * r);
+    sv = sv / ((double) WAVETBL_AMP);
+  }
+  
+  /* Return result */
+  return sv;
+}
@@ -0,0 +1,169 @@
+#ifndef WAVETBL_H_INCLUDED
+#define WAVETBL_H_INCLUDED
+
+/*
+ * wavetbl.h
+ * 
+ * Band-limited wave table module of the Retro synthesizer.
+ * 
+ * A wave table object stores a single cycle of a periodic waveform,
+ * defined by its harmonic spectrum.  To avoid aliasing distortion, the
+ * object is "mip-mapped" with one table per octave of harmonic count:
+ * band k contains only the first 2^k harmonics.  When the waveform is
+ * read at a given frequency, the band with the most harmonics that all
+ * stay below the Nyquist limit is selected.
+ * 
+ * Wave tables can also be loaded from wave table files, which store a
+ * single cycle of the waveform as a list of samples.  See
+ * wavetbl_file() for further information.
+ * 
+ * Wave table objects are shared between all renders in the process.
+ * All functions of this module may be called from any thread.  The
+ * caches and reference counts are guarded by os_global_lock(), and the
+ * samples of an object never change once it has been built.
+ * 
+ * Compilation
+ * ===========
+ * 
+ * Requires libshastina beta 0.9.3 or compatible.
+ * 
+ * May require the math library -lm
+ */
+
+#include "retrodef.h"
+
+/*
+ * The built-in waveform shapes.
+ * 
+ * WAVETBL_SHAPE_MINVAL and WAVETBL_SHAPE_MAXVAL are the minimum and
+ * maximum valid values.  They should be kept updated appropriately.
+ * 
+ * The pulse wave has a duty cycle of 25%.
+ */
+#define WAVETBL_SHAPE_SQUARE    (1)   /* Square wave    */
+#define WAVETBL_SHAPE_TRIANGLE  (2)   /* Triangle wave  */
+#define WAVETBL_SHAPE_SAWTOOTH  (3)   /* Sawtooth wave  */
+#define WAVETBL_SHAPE_PULSE     (4)   /* Pulse wave     */
+
+#define WAVETBL_SHAPE_MINVAL (1)
+#define WAVETBL_SHAPE_MAXVAL (4)
+
+/*
+ * WAVETBL structure prototype.
+ * 
+ * Definition given in the implementation.
+ */
+struct WAVETBL_TAG;
+typedef struct WAVETBL_TAG WAVETBL;
+
+/*
+ * Get a wave table object for one of the built-in waveform shapes.
+ * 
+ * shape is one of the WAVETBL_SHAPE constants.
+ * 
+ * The wave table for each shape is only generated the first time it is
+ * requested.  After that, the same object is shared by all callers.
+ * The returned object has had its reference count incremented, so the
+ * caller must eventually release it with wavetbl_release().
+ * 
+ * Parameters:
+ * 
+ *   shape - the waveform shape
+ * 
+ * Return:
+ * 
+ *   a new reference to the wave table object
+ */
+WAVETBL *wavetbl_shape(int shape);
+
+/*
+ * Get a wave table object loaded from a wave table file.
+ * 
+ * pPath is the path to the file.  Loaded wave tables are cached by
+ * path, along with a hash of the file contents.  Each call hashes the
+ * file, and the cached object is shared when the contents have not
+ * changed since it was loaded.  Otherwise, the file is loaded again
+ * and replaces the cached object, while callers that still hold
+ * references to the old object may keep using it.  The file is read
+ * and parsed without holding os_global_lock().  The returned object has
+ * had its reference count incremented, so the caller must eventually
+ * release it with wavetbl_release().
+ * 
+ * Wave table files are Shastina files that begin with the following
+ * signature:
+ * 
+ *   %wavetable;
+ * 
+ * After the signature is a sequence of numeric literals, which are the
+ * samples of a single cycle of the waveform.  There must be at least
+ * three samples, and no more than 16384.  The scale of the samples
+ * does not matter, since the table is normalized after loading.  Any DC
+ * offset is removed.  With N samples, the table holds harmonics up to
+ * (N - 1) / 2, limited to 1024.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the wave table file
+ * 
+ * Return:
+ * 
+ *   a new reference to the wave table object, or NULL if the file
+ *   could not be loaded
+ */
+WAVETBL *wavetbl_file(const char *pPath);
+
+/*
+ * Increment the reference count of a wave table object.
+ * 
+ * A fault occurs if the reference count overflows.
+ * 
+ * Parameters:
+ * 
+ *   pw - the wave table object
+ */
+void wavetbl_addref(WAVETBL *pw);
+
+/*
+ * Decrement the reference count of a wave table object.
+ * 
+ * If NULL is passed, this call is ignored.  If the reference count
+ * drops to zero, the object is released.
+ * 
+ * Parameters:
+ * 
+ *   pw - the wave table object
+ */
+void wavetbl_release(WAVETBL *pw);
+
+/*
+ * Read a sample from a wave table object.
+ * 
+ * pw is the wave table object.
+ * 
+ * w is the normalized location within the wave, where 0.0 is the start
+ * of the cycle and 1.0 is the end of the cycle.  Values outside of the
+ * range [0.0, 1.0) and non-finite values result in zero.
+ * 
+ * hlim is the harmonic limit, which is the Nyquist frequency divided by
+ * the frequency of the wave.  Only harmonics below this limit will be
+ * present in the returned sample.  If the limit is one or less, then
+ * even the fundamental is beyond Nyquist, and the band with the fewest
+ * harmonics is used.  Non-finite values are treated as unlimited.
+ * 
+ * Adjacent samples in the table are linearly interpolated.
+ * 
+ * Parameters:
+ * 
+ *   pw - the wave table object
+ * 
+ *   w - the normalized location within the wave
+ * 
+ *   hlim - the harmonic limit
+ * 
+ * Return:
+ * 
+ *   the sample value, in range [-1.0, 1.0]
+ */
+double wavetbl_get(WAVETBL *pw, double w, double hlim);
+
+#endif
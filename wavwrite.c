@@ -35,62 +35,47 @@
 #define WAVWRITE_U8MAX  (255)     /* Maximum unsigned 8-bit value */
 
 /*
- * Static data
- * ===========
+ * Type declarations
+ * =================
  */
 
 /*
- * Non-zero when module has been closed.
+ * WAVWRITE structure.
  * 
- * Once the module is closed, all other static data is invalid.
+ * Prototype given in the header.
  */
-static int m_wavwrite_closed = 0;
-
-/*
- * Initialization flags.
- * 
- * This is only valid if m_wavwrite_closed is zero.
- * 
- * If this value is valid and zero, it means the module has not been
- * initialized yet.
- * 
- * If this value is valid and non-zero, it means the module has been
- * initialized and these are the flags that were passed to the
- * initialization function.
- */
-static int m_wavwrite_flags = 0;
-
-/*
- * Output file path copy.
- * 
- * This is only valid if m_wavwrite_closed is zero and m_wavwrite_flags
- * is non-zero.
- * 
- * This stores a dynamically-allocated copy of the path that was passed
- * to the initialization function.  This allows the output file to be
- * erased if necessary.
- */
-static char *m_wavwrite_pPath = NULL;
-
-/*
- * Output file handle.
- * 
- * This is only valid if m_wavwrite_closed is zero and m_wavwrite_flags
- * is non-zero.
- * 
- * This stores the handle to the output file.
- */
-static FILE *m_wavwrite_pf = NULL;
-
-/*
- * The total number of bytes that have been written to the output file.
- * 
- * This is only valid if m_wavwrite_closed is zero and m_wavwrite_flags
- * is non-zero.
- * 
- * This may not exceed WAVWRITE_MAXFILE.
- */
-static unsigned long m_wavwrite_bytes = 0;
+struct WAVWRITE_TAG {
+  
+  /*
+   * Initialization flags.
+   * 
+   * These are the flags that were passed to the initialization
+   * function.
+   */
+  int flags;
+  
+  /*
+   * Output file path copy.
+   * 
+   * This stores a dynamically-allocated copy of the path that was
+   * passed to the initialization function.  This allows the output
+   * file to be erased if necessary.
+   */
+  char *pPath;
+  
+  /*
+   * Output file handle.
+   */
+  FILE *pf;
+  
+  /*
+   * The total number of bytes that have been written to the output
+   * file.
+   * 
+   * This may not exceed WAVWRITE_MAXFILE.
+   */
+  unsigned long bytes;
+};
 
 /*
  * Local functions
@@ -98,46 +83,45 @@ static unsigned long m_wavwrite_bytes = 0;
  */
 
 /* Prototypes */
-static void wavwrite_byte(int v);
-static void wavwrite_uword(unsigned int v);
-static void wavwrite_word(int v);
-static void wavwrite_dword(unsigned long v);
+static void wavwrite_byte(WAVWRITE *pw, int v);
+static void wavwrite_uword(WAVWRITE *pw, unsigned int v);
+static void wavwrite_word(WAVWRITE *pw, int v);
+static void wavwrite_dword(WAVWRITE *pw, unsigned long v);
 
 /*
  * Write an unsigned 8-bit integer value to output.
  * 
- * The wavwrite module must be initialized but not yet closed.  This
- * function will update the m_wavwrite_bytes count of bytes written,
- * with a fault occuring if it would overflow WAVWRITE_MAXFILE.  The
- * data is written to the current file pointer.
+ * pw is the WAV writer object.  This function will update the count
+ * of bytes written, with a fault occuring if it would overflow
+ * WAVWRITE_MAXFILE.  The data is written to the current file pointer.
  * 
  * The provided value may not exceed WAVWRITE_U8MAX.
  * 
  * Parameters:
  * 
+ *   pw - the WAV writer object
+ * 
  *   v - the unsigned byte value to write
  */
-static void wavwrite_byte(int v) {
+static void wavwrite_byte(WAVWRITE *pw, int v) {
   
-  /* Check state */
-  if (m_wavwrite_closed || (m_wavwrite_flags == 0)) {
+  /* Check parameters */
+  if (pw == NULL) {
     abort();
   }
-  
-  /* Check parameter */
   if ((v < 0) || (v > WAVWRITE_U8MAX)) {
     abort();
   }
   
   /* Increment byte count, watching for overflow */
-  if (m_wavwrite_bytes < WAVWRITE_MAXFILE) {
-    m_wavwrite_bytes++;
+  if (pw->bytes < WAVWRITE_MAXFILE) {
+    (pw->bytes)++;
   } else {
     abort();  /* File length overflow */
   }
   
   /* Write the byte */
-  if (putc(v, m_wavwrite_pf) != v) {
+  if (putc(v, pw->pf) != v) {
     abort();  /* I/O error */
   }
 }
@@ -145,10 +129,9 @@ static void wavwrite_byte(int v) {
 /*
  * Write an unsigned 16-bit integer value to output.
  * 
- * The wavwrite module must be initialized but not yet closed.  This
- * function will update the m_wavwrite_bytes count of bytes written,
- * with a fault occuring if it would overflow WAVWRITE_MAXFILE.  The
- * data is written to the current file pointer.
+ * pw is the WAV writer object.  This function will update the count
+ * of bytes written, with a fault occuring if it would overflow
+ * WAVWRITE_MAXFILE.  The data is written to the current file pointer.
  * 
  * The integer is written as two bytes in little endian order regardless
  * of what platform the program is compiled on.
@@ -160,9 +143,11 @@ static void wavwrite_byte(int v) {
  * 
  * Parameters:
  * 
+ *   pw - the WAV writer object
+ * 
  *   v - the unsigned word value to write
  */
-static void wavwrite_uword(unsigned int v) {
+static void wavwrite_uword(WAVWRITE *pw, unsigned int v) {
   
   /* Check range */
   if (v > WAVWRITE_U16MAX) {
@@ -170,19 +155,18 @@ static void wavwrite_uword(unsigned int v) {
   }
   
   /* Write bytes in little endian order */
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
   v >>= 8;
   
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
 }
 
 /*
  * Write a signed 16-bit integer value to output.
  * 
- * The wavwrite module must be initialized but not yet closed.  This
- * function will update the m_wavwrite_bytes count of bytes written,
- * with a fault occuring if it would overflow WAVWRITE_MAXFILE.  The
- * data is written to the current file pointer.
+ * pw is the WAV writer object.  This function will update the count
+ * of bytes written, with a fault occuring if it would overflow
+ * WAVWRITE_MAXFILE.  The data is written to the current file pointer.
  * 
  * The integer is written as two bytes in little endian order with
  * negative values represented in two's complement, regardless of what
@@ -198,9 +182,11 @@ static void wavwrite_uword(unsigned int v) {
  * 
  * Parameters:
  * 
+ *   pw - the WAV writer object
+ * 
  *   v - the signed word value to write
  */
-static void wavwrite_word(int v) {
+static void wavwrite_word(WAVWRITE *pw, int v) {
   
   long lv = 0;
   
@@ -218,16 +204,15 @@ static void wavwrite_word(int v) {
   }
   
   /* Pass through */
-  wavwrite_uword((unsigned int) lv);
+  wavwrite_uword(pw, (unsigned int) lv);
 }
 
 /*
  * Write an unsigned 32-bit integer value to output.
  * 
- * The wavwrite module must be initialized but not yet closed.  This
- * function will update the m_wavwrite_bytes count of bytes written,
- * with a fault occuring if it would overflow WAVWRITE_MAXFILE.  The
- * data is written to the current file pointer.
+ * pw is the WAV writer object.  This function will update the count
+ * of bytes written, with a fault occuring if it would overflow
+ * WAVWRITE_MAXFILE.  The data is written to the current file pointer.
  * 
  * The integer is written as four bytes in little endian order
  * regardless of what platform the program is compiled on.
@@ -239,9 +224,11 @@ static void wavwrite_word(int v) {
  * 
  * Parameters:
  * 
+ *   pw - the WAV writer object
+ * 
  *   v - the doubleword value to write
  */
-static void wavwrite_dword(unsigned long v) {
+static void wavwrite_dword(WAVWRITE *pw, unsigned long v) {
   
   /* Check range */
   if (v > WAVWRITE_U32MAX) {
@@ -249,16 +236,16 @@ static void wavwrite_dword(unsigned long v) {
   }
   
   /* Write bytes in little endian order */
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
   v >>= 8;
   
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
   v >>= 8;
   
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
   v >>= 8;
   
-  wavwrite_byte((int) (v & 0xff));
+  wavwrite_byte(pw, (int) (v & 0xff));
 }
 
 /*
@@ -271,21 +258,15 @@ static void wavwrite_dword(unsigned long v) {
 /*
  * wavwrite_init function.
  */
-int wavwrite_init(const char *pPath, int flags) {
+WAVWRITE *wavwrite_init(const char *pPath, int flags) {
   
-  int status = 1;
   FILE *pf = NULL;
-  size_t psz = 0;
+  WAVWRITE *pw = NULL;
   unsigned int chcount = 0;
   unsigned int blockalign = 0;
   unsigned long samprate = 0;
   unsigned long bpsec = 0;
   
-  /* Check state */
-  if ((m_wavwrite_closed) || (m_wavwrite_flags != 0)) {
-    abort();
-  }
-  
   /* Check parameters */
   if (pPath == NULL) {
     abort();
@@ -328,127 +309,113 @@ int wavwrite_init(const char *pPath, int flags) {
   
   /* Create the output file */
   pf = fopen(pPath, "wb");
-  if (pf == NULL) {
-    status = 0;
-  }
   
-  /* Proceed with initialization if file open successful; else, move
-   * directly to closed state */
-  if (status) {
+  /* Proceed with initialization if file open successful */
+  if (pf != NULL) {
   
-    /* Initialize the variables */
-    m_wavwrite_flags = flags;
-    m_wavwrite_pf = pf;
-    m_wavwrite_bytes = 0;
+    /* Allocate and initialize the object */
+    pw = (WAVWRITE *) malloc(sizeof(WAVWRITE));
+    if (pw == NULL) {
+      abort();
+    }
+    memset(pw, 0, sizeof(WAVWRITE));
+    
+    pw->flags = flags;
+    pw->pf = pf;
+    pw->bytes = 0;
     
     /* Make a copy of the path */
-    psz = strlen(pPath);
-    m_wavwrite_pPath = (char *) malloc(psz + 1);
-    if (m_wavwrite_pPath == NULL) {
+    pw->pPath = (char *) malloc(strlen(pPath) + 1);
+    if (pw->pPath == NULL) {
       abort();
     }
-    strcpy(m_wavwrite_pPath, pPath);
+    strcpy(pw->pPath, pPath);
   
     /* Write the WAV header, setting the file length and data length
-     * fields to zero for now (they will be filled in when the module is
+     * fields to zero for now (they will be filled in when the object is
      * closed) */
-    wavwrite_dword(0x46464952UL);   /* "RIFF" in little endian */
-    wavwrite_dword(0);              /* (File length field) */
-    wavwrite_dword(0x45564157UL);   /* "WAVE" in little endian */
+    wavwrite_dword(pw, 0x46464952UL);   /* "RIFF" in little endian */
+    wavwrite_dword(pw, 0);              /* (File length field) */
+    wavwrite_dword(pw, 0x45564157UL);   /* "WAVE" in little endian */
     
-    wavwrite_dword(0x20746d66UL);   /* "fmt " in little endian */
-    wavwrite_dword(16);             /* Size of fmt chunk */
-    wavwrite_uword(1);              /* PCM/uncompressed */
-    wavwrite_uword(chcount);        /* Channel count */
-    wavwrite_dword(samprate);       /* Sample rate */
-    wavwrite_dword(bpsec);          /* Average bytes per second */
-    wavwrite_uword(blockalign);     /* Block alignment */
-    wavwrite_uword(16);             /* Bits per channel sample */
+    wavwrite_dword(pw, 0x20746d66UL);   /* "fmt " in little endian */
+    wavwrite_dword(pw, 16);             /* Size of fmt chunk */
+    wavwrite_uword(pw, 1);              /* PCM/uncompressed */
+    wavwrite_uword(pw, chcount);        /* Channel count */
+    wavwrite_dword(pw, samprate);       /* Sample rate */
+    wavwrite_dword(pw, bpsec);          /* Average bytes per second */
+    wavwrite_uword(pw, blockalign);     /* Block alignment */
+    wavwrite_uword(pw, 16);             /* Bits per channel sample */
     
-    wavwrite_dword(0x61746164UL);   /* "data" in little endian */
-    wavwrite_dword(0);              /* (Data length field) */
-  
-  } else {
-    /* Open failed, so move to closed state */
-    m_wavwrite_closed = 1;
+    wavwrite_dword(pw, 0x61746164UL);   /* "data" in little endian */
+    wavwrite_dword(pw, 0);              /* (Data length field) */
   }
   
-  /* Return status */
-  return status;
+  /* Return the new object or NULL */
+  return pw;
 }
 
 /*
  * wavwrite_close function.
  */
-void wavwrite_close(int flags) {
+void wavwrite_close(WAVWRITE *pw, int flags) {
   
   unsigned long total_len = 0;
   
-  /* Determine what to do from the state (do nothing if already
-   * closed) */
-  if ((!m_wavwrite_closed) && (m_wavwrite_flags != 0) &&
-      (flags & WAVWRITE_CLOSE_RMFILE)) {
+  /* Determine what to do from the flags (do nothing if NULL) */
+  if ((pw != NULL) && (flags & WAVWRITE_CLOSE_RMFILE)) {
     /* Close down, removing output file -- first, close output file */
-    fclose(m_wavwrite_pf);
-    m_wavwrite_pf = NULL;
+    fclose(pw->pf);
+    pw->pf = NULL;
     
     /* Remove the file */
-    remove(m_wavwrite_pPath);
+    remove(pw->pPath);
     
-    /* Free the path and set the closed flag */
-    free(m_wavwrite_pPath);
-    m_wavwrite_pPath = NULL;
-    
-    m_wavwrite_closed = 1;
-    
-  } else if ((!m_wavwrite_closed) && (m_wavwrite_flags != 0)) {
+  } else if (pw != NULL) {
     /* Close down normally -- first, get the total file length */
-    total_len = m_wavwrite_bytes;
+    total_len = pw->bytes;
     
     /* Clear byte count to zero since we will now be performing random
      * access and we don't have to worry about overflow anymore */
-    m_wavwrite_bytes = 0;
+    pw->bytes = 0;
     
     /* Seek to the file length field */
-    if (fseek(m_wavwrite_pf, 4, SEEK_SET)) {
+    if (fseek(pw->pf, 4, SEEK_SET)) {
       abort();  /* I/O error */
     }
     
     /* Write total file length minus eight to the file length field */
-    wavwrite_dword(total_len - 8);
+    wavwrite_dword(pw, total_len - 8);
     
     /* Seek to the data length field */
-    if (fseek(m_wavwrite_pf, 40, SEEK_SET)) {
+    if (fseek(pw->pf, 40, SEEK_SET)) {
       abort();  /* I/O error */
     }
     
     /* Write total file length minus the 44-byte header to the data
      * length field */
-    wavwrite_dword(total_len - 44);
+    wavwrite_dword(pw, total_len - 44);
     
     /* WAV file is now complete, so close it */
-    fclose(m_wavwrite_pf);
-    m_wavwrite_pf = NULL;
-    
-    /* Free the path and set the closed flag */
-    free(m_wavwrite_pPath);
-    m_wavwrite_pPath = NULL;
-    
-    m_wavwrite_closed = 1;
-    
-  } else if (!m_wavwrite_closed) {
-    /* Never was initialized, so just set closed flag */
-    m_wavwrite_closed = 1;
+    fclose(pw->pf);
+    pw->pf = NULL;
+  }
+  
+  /* Free the path and the object */
+  if (pw != NULL) {
+    free(pw->pPath);
+    pw->pPath = NULL;
+    free(pw);
   }
 }
 
 /*
  * wavwrite_sample function.
  */
-void wavwrite_sample(int left, int right) {
+void wavwrite_sample(WAVWRITE *pw, int left, int right) {
   
-  /* Check state */
-  if (m_wavwrite_closed || (m_wavwrite_flags == 0)) {
+  /* Check parameter */
+  if (pw == NULL) {
     abort();
   }
   
@@ -466,21 +433,21 @@ void wavwrite_sample(int left, int right) {
   }
   
   /* If in mono-aural mode, make sure left and right are equal */
-  if (m_wavwrite_flags & WAVWRITE_INIT_MONO) {
+  if (pw->flags & WAVWRITE_INIT_MONO) {
     if (left != right) {
       abort();
     }
   }
   
   /* Write samples depending on mode */
-  if (m_wavwrite_flags & WAVWRITE_INIT_STEREO) {
+  if (pw->flags & WAVWRITE_INIT_STEREO) {
     /* Stereo mode, so write left then right channel */
-    wavwrite_word(left);
-    wavwrite_word(right);
+    wavwrite_word(pw, left);
+    wavwrite_word(pw, right);
     
-  } else if (m_wavwrite_flags & WAVWRITE_INIT_MONO) {
+  } else if (pw->flags & WAVWRITE_INIT_MONO) {
     /* Mono-aural mode, so write the sample */
-    wavwrite_word(left);
+    wavwrite_word(pw, left);
     
   } else {
     /* Invalid flag state */
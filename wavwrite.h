@@ -24,14 +24,20 @@
 #define WAVWRITE_CLOSE_RMFILE   (0x1)
 
 /*
- * Initialize the WAV writer module.
+ * Structure prototype for WAVWRITE.
  * 
- * This must be called before any of the other WAV writer functions,
- * except for wavwrite_close().  This function may only be called once.
+ * Each WAV writer object writes one output file, so any number of them
+ * may be open at the same time.
+ */
+struct WAVWRITE_TAG;
+typedef struct WAVWRITE_TAG WAVWRITE;
+
+/*
+ * Create a WAV writer object.
  * 
- * Call wavwrite_close() before the program finishes.  If this function
- * is not explicitly called, an incomplete or invalid WAV file may be
- * left on disk.
+ * Call wavwrite_close() on the returned object when finished with it.
+ * If it is not called, an incomplete or invalid WAV file may be left on
+ * disk.
  * 
  * pPath is the path to the WAV output file.  If a file already exists
  * at this path, it will be overwritten.
@@ -50,8 +56,7 @@
  *     WAVWRITE_INIT_MONO   -> one channel
  *     WAVWRITE_INIT_STEREO -> two channels
  * 
- * The function fails if the output file can't be created.  In this
- * case, the WAV writer module will transition to closed state.
+ * The function fails if the output file can't be created.
  * 
  * Parameters:
  * 
@@ -61,43 +66,38 @@
  * 
  * Return:
  * 
- *   non-zero if successful, zero if output file could not be created
+ *   the new WAV writer object, or NULL if output file could not be
+ *   created
  */
-int wavwrite_init(const char *pPath, int flags);
+WAVWRITE *wavwrite_init(const char *pPath, int flags);
 
 /*
- * Close down the WAV writer module.
+ * Close down a WAV writer object.
  * 
- * This function may be called at any time, even before wavwrite_init().
- * The WAV writer module always transitions to closed state after this
- * function.  If this function is called when the WAV writer is already
- * closed, the function has no effect.
+ * The object is released by this call, so it may not be used again.
+ * If NULL is passed, the call is ignored.
  * 
  * flags is a combination of WAVWRITE_CLOSE flags.  Use zero or
  * WAVWRITE_CLOSE_NORMAL if no special flags are required.
  * 
- * If the WAVWRITE_CLOSE_RMFILE flag is specified, then if the WAV
- * writer module is currently initialized, the output WAV file will be
- * erased during closure.  Otherwise, the normal operation is to flush
- * the write buffer and complete the WAV file.  The RMFILE flag is
- * ignored if the WAV writer module is not currently initialized.
+ * If the WAVWRITE_CLOSE_RMFILE flag is specified, then the output WAV
+ * file will be erased during closure.  Otherwise, the normal operation
+ * is to flush the write buffer and complete the WAV file.
  * 
  * Unrecognized flags are ignored.
  * 
- * If this function is not called before the end of the program, an
- * incomplete or invalid WAV file may be left on disk.
- * 
  * Parameters:
  * 
+ *   pw - the WAV writer object, or NULL
+ * 
  *   flags - closure flags
  */
-void wavwrite_close(int flags);
+void wavwrite_close(WAVWRITE *pw, int flags);
 
 /*
  * Write a sample to output.
  * 
- * The WAV writer module must be initialized with wavwrite_init() before
- * calling this function, and it may not be closed.
+ * pw is the WAV writer object, which may not be closed.
  * 
  * left is the left channel value and right is the right channel value.
  * Both are clamped to the range [-32,767, +32,767] by this function.
@@ -107,10 +107,12 @@ void wavwrite_close(int flags);
  * 
  * Parameters:
  * 
+ *   pw - the WAV writer object
+ * 
  *   left - the left channel value
  * 
  *   right - the right channel value
  */
-void wavwrite_sample(int left, int right);
+void wavwrite_sample(WAVWRITE *pw, int left, int right);
 
 #endif